@@ -1,6 +1,6 @@
-#ifndef ASTAPI_H_INCLUDED
-#define ASTAPI_H_INCLUDED
-
+#ifndef ASTAPI_H_INCLUDED
+#define ASTAPI_H_INCLUDED
+
 /*******************************************************************************
  * astapi - library for using Asterisk Manager API.
  * Copyright (C) 2010 Baligh GUESMI
@@ -24,7 +24,7 @@
  *  @brief
  *  @author Baligh.GUESMI
  *  @date
- ******************************************************************************/
+ ******************************************************************************/
 /*******************************************************************************
  *  @def    MAX_LEN
  *  @brief  One Header Max Len supported
@@ -52,5 +52,10 @@
  *  @brief
  ******************************************************************************/
 #define MAX_EVENTS 16
-
-#endif // ASTAPI_H_INCLUDED
+/*******************************************************************************
+ *  @def    MAX_PENDING_ACTIONS
+ *  @brief  Actions sent and not yet answered that are timed by the metrics
+ ******************************************************************************/
+#define MAX_PENDING_ACTIONS 32
+
+#endif // ASTAPI_H_INCLUDED
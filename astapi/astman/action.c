@@ -30,6 +30,11 @@
 #include "astevent.h"
 #include "astlog.h"
 #include "action.h"
+#include "astconfig.h"
+#include "astmetrics.h"
+#include "astnames.h"
+#include "astcache.h"
+#include "astmem.h"
 /*******************************************************************************
  *
  ******************************************************************************/
@@ -38,26 +43,87 @@ struct msgbuf {
   struct message *msg;
   int count;
   int len;
+  size_t charged;   /* bytes accounted to ASTMAN_MEM_LISTS */
+  int full;         /* policy of the exceeded budget, ASTMAN_MEM_OK if none */
+  int dropped;      /* entries shed */
 };
+/*******************************************************************************
+ * @fn static int msgbuf_grow(struct mansession *s, struct msgbuf *b)
+ * @brief Double the array, within the memory budget of the session
+ * @return ASTMAN_MEM_OK, else the overflow policy to apply
+ ******************************************************************************/
+static int msgbuf_grow(struct mansession *s, struct msgbuf *b) {
+  struct message *msg;
+  size_t bytes = b->len * sizeof(struct message);
+  int res;
+
+  if ((res = astman_mem_charge(s, ASTMAN_MEM_LISTS, bytes)) != ASTMAN_MEM_OK)
+    return res;
+  msg = (struct message *)realloc(b->msg, 2 * bytes);
+  if (!msg) {
+    astman_mem_release(s, ASTMAN_MEM_LISTS, bytes);
+    return ASTMAN_MEM_REJECT;
+  }
+  memset(msg + b->len, 0, bytes);
+  b->msg = msg;
+  b->charged += bytes;
+  b->len *= 2;
+  return ASTMAN_MEM_OK;
+}
+/*******************************************************************************
+ * @fn static int msgbuf_end(struct mansession *s, struct msgbuf *b)
+ * @brief The list is complete, the caller owns the array from now on
+ * @return ASTMAN_FAILURE if the list was rejected for lack of memory
+ ******************************************************************************/
+static int msgbuf_end(struct mansession *s, struct msgbuf *b) {
+  astman_mem_release(s, ASTMAN_MEM_LISTS, b->charged);
+  b->charged = 0;
+  if (b->full == ASTMAN_MEM_SHED) {
+    astlog(ASTLOG_WARNING, "List truncated to %d entries, %d dropped (memory budget)",
+           b->count, b->dropped);
+  } else if (b->full != ASTMAN_MEM_OK) {
+    astlog(ASTLOG_ERROR, "List rejected after %d entries (memory budget)", b->count);
+    return ASTMAN_FAILURE;
+  }
+  return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static void msgbuf_free(struct mansession *s, struct msgbuf *b)
+ ******************************************************************************/
+static void msgbuf_free(struct mansession *s, struct msgbuf *b) {
+  astman_mem_release(s, ASTMAN_MEM_LISTS, b->charged);
+  b->charged = 0;
+  free(b->msg);
+  b->msg = NULL;
+}
 /*******************************************************************************
  *
  ******************************************************************************/
 #define MSGBUF_INIT(L)	\
   struct msgbuf _buf; \
+  if (astman_mem_charge(s, ASTMAN_MEM_LISTS, L * sizeof(struct message)) != ASTMAN_MEM_OK) \
+    return ASTMAN_FAILURE; \
   _buf.msg = (struct message *)calloc(L, sizeof(struct message)); \
   _buf.count = 0; \
   _buf.len = L; \
-  if (!_buf.msg) return ASTMAN_FAILURE;
+  _buf.charged = L * sizeof(struct message); \
+  _buf.full = ASTMAN_MEM_OK; \
+  _buf.dropped = 0; \
+  if (!_buf.msg) { \
+    astman_mem_release(s, ASTMAN_MEM_LISTS, _buf.charged); \
+    return ASTMAN_FAILURE; \
+  }
 /*******************************************************************************
- *
+ * The last entry stays empty: it ends the list
  ******************************************************************************/
 #define MSGBUF_ADD(M)	\
-  memcpy(_buf.msg+_buf.count, M, sizeof(struct message)); \
-  _buf.count++; \
-  if (_buf.count >= _buf.len) { \
-    _buf.msg = (struct message *)realloc(_buf.msg, _buf.len * 2 * sizeof(struct message)); \
-    memset(_buf.msg+_buf.len, 0, _buf.len * sizeof(struct message)); \
-    _buf.len *= 2; \
+  if (_buf.full == ASTMAN_MEM_OK && _buf.count + 1 >= _buf.len) \
+    _buf.full = msgbuf_grow(s, &_buf); \
+  if (_buf.full == ASTMAN_MEM_OK) { \
+    memcpy(_buf.msg+_buf.count, M, sizeof(struct message)); \
+    _buf.count++; \
+  } else { \
+    _buf.dropped++; \
   }
 /*******************************************************************************
  *
@@ -67,6 +133,14 @@ struct msgbuf {
  *
  ******************************************************************************/
 #define MSGBUF_NB _buf.count;
+/*******************************************************************************
+ * List complete: ASTMAN_FAILURE if it was rejected
+ ******************************************************************************/
+#define MSGBUF_END msgbuf_end(s, &_buf)
+/*******************************************************************************
+ * List abandoned
+ ******************************************************************************/
+#define MSGBUF_FREE msgbuf_free(s, &_buf)
 /*******************************************************************************
  * @fn astman_originate(struct mansession *s, struct message *m,
  *		     char *channel,
@@ -193,7 +267,7 @@ int astman_queuestatus(struct mansession *s, struct message **m,
 		       char *actionid) {
   int res;
   char params[MAX_LEN] = "";
-  char event[80];
+  int event;
   struct message msg;
 
   MSGBUF_INIT(1);
@@ -207,12 +281,15 @@ int astman_queuestatus(struct mansession *s, struct message **m,
     for(;;) {
       res = astman_wait_for_response(s, &msg, 0);
       if ( res > 0 ) {
-	strncpy(event, astman_get_header(&msg, "Event"), sizeof(event));
-	if (!strcasecmp(event, "QueueParams") ||
-	    !strcasecmp(event, "QueueMember") ||
-	    !strcasecmp(event, "QueueEnter")) {
+	event = astman_message_event(&msg);
+	if (event == ASTMAN_EVT_QUEUEPARAMS ||
+	    event == ASTMAN_EVT_QUEUEMEMBER ||
+	    event == ASTMAN_EVT_QUEUEENTER) {
 	  MSGBUF_ADD(&msg);
-	} else if (!strcasecmp(event, "QueueStatusComplete")) {
+	} else if (event == ASTMAN_EVT_QUEUESTATUSCOMPLETE) {
+	  astman_metrics_list_complete(s);
+	  if (MSGBUF_END != ASTMAN_SUCCESS)
+	    goto out;
 	  *m = MSGBUF_MSG;
 	  astman_add_event_handler_system(s, NULL);
 	  return ASTMAN_SUCCESS;
@@ -223,6 +300,7 @@ int astman_queuestatus(struct mansession *s, struct message **m,
     } /* infinity loop */
   }
   out:
+    MSGBUF_FREE;
     astman_add_event_handler_system(s, NULL);
     return ASTMAN_FAILURE;
 }
@@ -272,7 +350,7 @@ int astman_status(struct mansession *s, struct message **m,
                   char *actionid) {
   int res;
   char params[MAX_LEN] = "";
-  char event[80];
+  int event;
   struct message msg;
 
   MSGBUF_INIT(1);
@@ -288,11 +366,14 @@ int astman_status(struct mansession *s, struct message **m,
     for(;;) {
       res = astman_wait_for_response(s, &msg, 0);
       if ( res > 0 ) {
-	strncpy(event, astman_get_header(&msg, "Event"), sizeof(event));
+	event = astman_message_event(&msg);
 
-	if (!strcasecmp(event, "Status")) {
+	if (event == ASTMAN_EVT_STATUS) {
 	  MSGBUF_ADD(&msg);
-	} else if (!strcasecmp(event, "StatusComplete")) {
+	} else if (event == ASTMAN_EVT_STATUSCOMPLETE) {
+	  astman_metrics_list_complete(s);
+	  if (MSGBUF_END != ASTMAN_SUCCESS)
+	    goto out;
 	  *m = MSGBUF_MSG;
 	  astman_add_event_handler_system(s, NULL);
 	  return ASTMAN_SUCCESS;
@@ -304,6 +385,7 @@ int astman_status(struct mansession *s, struct message **m,
   }
 
   out:
+    MSGBUF_FREE;
     astman_add_event_handler_system(s, NULL);
     return ASTMAN_FAILURE;
 }
@@ -360,10 +442,15 @@ int astman_getvar(struct mansession *s, struct message *m,
 
   astman_add_param(params, sizeof(params), "Channel", channel);
   astman_add_param(params, sizeof(params), "Variable", variable);
-  astman_add_param(params, sizeof(params), "ActionId", actionid);
 
-  astman_manager_action_params(s, "GetVar", params);
-  res = astman_wait_for_response(s, m, 0);
+  /* Global variables may be cached, channel ones change with the call */
+  if (astman_strlen_zero(channel)) {
+    res = astman_cache_query(s, m, "GetVar", params, actionid);
+  } else {
+    astman_add_param(params, sizeof(params), "ActionId", actionid);
+    astman_manager_action_params(s, "GetVar", params);
+    res = astman_wait_for_response(s, m, 0);
+  }
   if ( res > 0 && response_is(m, "Success")) {
     return res;
   }
@@ -395,10 +482,108 @@ int astman_setvar(struct mansession *s, struct message *m,
   astman_manager_action_params(s, "SetVar", params);
   res = astman_wait_for_response(s, m, 0);
   if ( res > 0 && response_is(m, "Success")) {
+    if (astman_strlen_zero(channel))
+      astman_cache_invalidate(s, "GetVar");
     return res;
   }
   return ASTMAN_FAILURE;
 }
+/*******************************************************************************
+ * @struct  vars_request
+ * @brief   A variable of a batch in flight
+ ******************************************************************************/
+struct vars_request {
+    struct astman_var *var;
+    int *left;
+};
+/*******************************************************************************
+ * @fn static void vars_done(struct mansession *s,
+ *                           struct astman_action_result *r, void *data)
+ ******************************************************************************/
+static void vars_done(struct mansession *s, struct astman_action_result *r,
+                      void *data) {
+    struct vars_request *req = data;
+    const char *value;
+
+    (void)s;
+    req->var->status = r->status;
+    if (r->status == ASTMAN_SUCCESS && r->response) {
+        value = astman_get_header_id(r->response, ASTMAN_HDR_VALUE);
+        strncpy(req->var->result, value, sizeof(req->var->result) - 1);
+    }
+    (*req->left)--;
+}
+/*******************************************************************************
+ * @fn static int astman_vars(struct mansession *s, struct astman_var *vars,
+ *                            int count, int set, int timeout_ms)
+ * @brief Send every GetVar / SetVar in one write, then read until each one
+ *        is answered
+ ******************************************************************************/
+static int astman_vars(struct mansession *s, struct astman_var *vars,
+                       int count, int set, int timeout_ms) {
+    struct vars_request *reqs;
+    char params[MAX_LEN];
+    int i, left = 0, ok = 0, global = 0;
+
+    if (count <= 0)
+        return 0;
+    reqs = calloc(count, sizeof(*reqs));
+    if (!reqs)
+        return -1;
+
+    astman_cork(s);
+    for (i = 0; i < count; i++) {
+        vars[i].status = ASTMAN_FAILURE;
+        vars[i].result[0] = '\0';
+        if (astman_strlen_zero(vars[i].variable))
+            continue;
+        params[0] = '\0';
+        astman_add_param(params, sizeof(params), "Channel", vars[i].channel);
+        astman_add_param(params, sizeof(params), "Variable", vars[i].variable);
+        if (set)
+            astman_add_param(params, sizeof(params), "Value", vars[i].value);
+        reqs[i].var = &vars[i];
+        reqs[i].left = &left;
+        if (astman_action_async(s, set ? "SetVar" : "GetVar", params, NULL, 0,
+                                timeout_ms, vars_done, &reqs[i]) == ASTMAN_SUCCESS)
+            left++;
+    }
+    if (astman_uncork(s) != ASTMAN_SUCCESS) {
+        astman_async_abort(s);
+        free(reqs);
+        return -1;
+    }
+
+    while (left > 0)
+        if (astman_poll(s, -1) < 0)
+            break;
+    free(reqs);
+
+    for (i = 0; i < count; i++) {
+        if (vars[i].status != ASTMAN_SUCCESS)
+            continue;
+        ok++;
+        if (astman_strlen_zero(vars[i].channel))
+            global = 1;
+    }
+    if (set && global)
+        astman_cache_invalidate(s, "GetVar");
+    return ok;
+}
+/*******************************************************************************
+ * @brief astman_getvars
+ ******************************************************************************/
+int astman_getvars(struct mansession *s, struct astman_var *vars, int count,
+                   int timeout_ms) {
+    return astman_vars(s, vars, count, 0, timeout_ms);
+}
+/*******************************************************************************
+ * @brief astman_setvars
+ ******************************************************************************/
+int astman_setvars(struct mansession *s, struct astman_var *vars, int count,
+                   int timeout_ms) {
+    return astman_vars(s, vars, count, 1, timeout_ms);
+}
 /*******************************************************************************
  * @brief ListCommands
  *         List available manager commands
@@ -410,10 +595,8 @@ int astman_list_commands(struct mansession *s, struct message *m,
     char params[MAX_LEN] = "";
 
     astman_add_param(params, sizeof(params), "Parameters", "ActionId");
-    astman_add_param(params, sizeof(params), "ActionId", actionid);
 
-    astman_manager_action_params(s, "ListCommands", params);
-    res = astman_wait_for_response(s, m, 0);
+    res = astman_cache_query(s, m, "ListCommands", params, actionid);
     if ( res > 0 && response_is(m, "Success")) {
         return res;
     }
@@ -432,12 +615,19 @@ int astman_list_categories(struct mansession *s, struct message *m,
 {
     char params[MAX_LEN] = "";
     int res = 0;
+    struct astman_config *cfg;
+
+    /* Served from the parsed GetConfig cache when the file is known */
+    cfg = astman_config_lookup(s, filename);
+    if (cfg) {
+        res = astman_config_to_message(cfg, NULL, 1, actionid, m);
+        astman_config_release(cfg);
+        return res;
+    }
 
     astman_add_param(params, sizeof(params), "Filename", filename);
-    astman_add_param(params, sizeof(params), "ActionId", actionid);
 
-    astman_manager_action(s, "ListCategories", params);
-    res = astman_wait_for_response(s, m, 0);
+    res = astman_cache_query(s, m, "ListCategories", params, actionid);
     if ( res > 0 && response_is(m, "Success")) {
         return res;
     }
@@ -459,16 +649,33 @@ int astman_get_config(struct mansession *s, struct message *m,
 {
     int rv = 0;
     char params[MAX_LEN] = "";
+    struct astman_config *cfg;
+
+    /* Hot reads are answered from the cache, no AMI round trip */
+    cfg = astman_config_lookup(s, filename);
+    if (cfg) {
+        rv = astman_config_to_message(cfg, category, 0, actionid, m);
+        astman_config_release(cfg);
+        return rv;
+    }
 
     astman_add_param(params, sizeof(params), "Filename", filename);
     astman_add_param(params, sizeof(params), "Category", category);
     astman_add_param(params, sizeof(params), "ActionId", actionid);
 
+    /* Only a full dump describes the whole file. It is built as it is
+       read: a file has more lines than a message has headers. */
+    cfg = astman_strlen_zero(category) && !s->config_build ? astman_config_begin(s, filename) : NULL;
+    s->config_build = cfg;
     astman_manager_action_params(s, "GetConfig", params);
     rv = astman_wait_for_response(s, m, 3);
+    if (cfg)
+        s->config_build = NULL;
     if ( rv > 0 && response_is(m, "Success")) {
+        astman_config_release(astman_config_commit(cfg));
         return ASTMAN_SUCCESS;
     }
+    astman_config_release(cfg);
     return ASTMAN_FAILURE;
 }
 /*******************************************************************************
@@ -500,12 +707,13 @@ int astman_sip_peers(struct mansession *s, struct message **m,
     if ( res > 0 && response_is(&msg, "Success")) {
         if(strlen(astman_get_header(&msg, "Eventlist"))) {
             while(astman_wait_for_response(s, &msg, 0)==ASTMAN_SUCCESS) {
-                if(strncasecmp(astman_get_header(&msg, ASTMAN_HEADER_EVENT),
-                                ASTMAN_EVENT_PEER_LIST_COMPLETE,
-                                strlen(ASTMAN_EVENT_PEER_LIST_COMPLETE)))
+                if(astman_message_event(&msg) != ASTMAN_EVT_PEERLISTCOMPLETE)
                 {
                     MSGBUF_ADD(&msg);
                 } else {
+                    astman_metrics_list_complete(s);
+                    if (MSGBUF_END != ASTMAN_SUCCESS)
+                        break;
                     *m = MSGBUF_MSG;
                     astman_add_event_handler_system(s, NULL);
                     return MSGBUF_NB;
@@ -513,6 +721,7 @@ int astman_sip_peers(struct mansession *s, struct message **m,
             }
         }
     }
+    MSGBUF_FREE;
     astman_add_event_handler_system(s, NULL);
     return ASTMAN_FAILURE;
 }
@@ -536,10 +745,8 @@ int astman_sip_show_peer(struct mansession *s, struct message *m,
     }
 
     astman_add_param(params, sizeof(params), "Peer", peer);
-    astman_add_param(params, sizeof(params), "ActionId", actionid);
 
-    astman_manager_action(s, "SIPShowpeer", params);
-    res = astman_wait_for_response(s, m, 0);
+    res = astman_cache_query(s, m, "SIPshowpeer", params, actionid);
 
     if ( res > 0 && response_is(m, "Success")) {
             return ASTMAN_SUCCESS;
@@ -606,12 +813,13 @@ int astman_sip_show_registry(struct mansession *s, struct message **m,
     if ( res > 0 && response_is(&msg, "Success")) {
         if(strlen(astman_get_header(&msg, "Eventlist"))) {
             while(astman_wait_for_response(s, &msg, 0)==ASTMAN_SUCCESS) {
-                if(strncasecmp(astman_get_header(&msg, ASTMAN_HEADER_EVENT),
-                                ASTMAN_EVENT_REGISTRATIONS_COMPLETE,
-                                strlen(ASTMAN_EVENT_REGISTRATIONS_COMPLETE)))
+                if(astman_message_event(&msg) != ASTMAN_EVT_REGISTRATIONSCOMPLETE)
                 {
                     MSGBUF_ADD(&msg);
                 } else {
+                    astman_metrics_list_complete(s);
+                    if (MSGBUF_END != ASTMAN_SUCCESS)
+                        break;
                     *m = MSGBUF_MSG;
                     astman_add_event_handler_system(s, NULL);
                     return MSGBUF_NB;
@@ -619,6 +827,7 @@ int astman_sip_show_registry(struct mansession *s, struct message **m,
             }
         }
     }
+    MSGBUF_FREE;
     astman_add_event_handler_system(s, NULL);
     return ASTMAN_FAILURE;
 }
@@ -0,0 +1,671 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astasync.c
+ *  @brief Asynchronous actions completed by ActionID
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astnames.h"
+#include "astmetrics.h"
+#include "astbatch.h"
+#include "astasync.h"
+#include "astmem.h"
+#include "astflow.h"
+/*******************************************************************************
+ *  \def ASYNC_ACTIONID_PREFIX
+ *  \brief  Prefix of the generated ActionIDs. Late answers carrying it (the
+ *          action timed out) are swallowed instead of reaching a blocking
+ *          caller.
+ ******************************************************************************/
+#define ASYNC_ACTIONID_PREFIX   "astapi-"
+/*******************************************************************************
+ * @struct  async_pending
+ * @brief   One action in flight
+ ******************************************************************************/
+struct async_pending {
+    char actionid[ASTMAN_MAX_ACTIONID_LEN];
+    int flags;
+    int listing;                        /**!< response received, list follows */
+    int status;                         /**!< status of the response */
+    ASTMAN_ACTION_CALLBACK func;
+    void *data;
+    unsigned long long deadline;        /**!< ns, 0 = none */
+    struct message *response;           /**!< copy of the response */
+    struct message *events;             /**!< collected list events */
+    int count;
+    int len;
+    int bulk;                           /**!< counts in the bulk window */
+    char *queued;                       /**!< "action\0params": not sent yet */
+    struct async_pending *hnext;        /**!< hash chain */
+    struct async_pending *prev;         /**!< send order list */
+    struct async_pending *next;
+};
+/*******************************************************************************
+ * @struct  astman_async
+ * @brief   Asynchronous state of a session
+ ******************************************************************************/
+struct astman_async {
+    struct async_pending **buckets;
+    unsigned int nbuckets;              /**!< power of two */
+    int count;                          /**!< actions in flight */
+    struct async_pending *head;         /**!< oldest */
+    struct async_pending *tail;         /**!< newest */
+    unsigned long long next_expiry;     /**!< earliest deadline, 0 = none */
+    unsigned int seq;                   /**!< generated ActionIDs */
+    int completed;                      /**!< completions, for astman_poll */
+    int bulk_window;                    /**!< 0 = no limit */
+    int bulk_inflight;                  /**!< bulk actions sent, not complete */
+    int queued;                         /**!< bulk actions waiting */
+    int aborting;                       /**!< nothing is sent any more */
+    int busy;                           /**!< callers walking it, free later */
+    struct message rx;                  /**!< message being received */
+};
+/*******************************************************************************
+ * @fn static unsigned int async_hash(const char *str)
+ ******************************************************************************/
+static unsigned int async_hash(const char *str) {
+    unsigned int h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+/*******************************************************************************
+ * @fn static struct astman_async *async_get(struct mansession *s)
+ ******************************************************************************/
+static struct astman_async *async_get(struct mansession *s) {
+    struct astman_async *a = s->async;
+    if (a)
+        return a;
+    a = calloc(1, sizeof(*a));
+    if (!a)
+        return NULL;
+    a->nbuckets = 64;
+    a->bulk_window = ASTMAN_BULK_WINDOW;
+    a->buckets = calloc(a->nbuckets, sizeof(*a->buckets));
+    if (!a->buckets) {
+        free(a);
+        return NULL;
+    }
+    s->async = a;
+    return a;
+}
+/*******************************************************************************
+ * @fn static int async_grow(struct astman_async *a)
+ ******************************************************************************/
+static int async_grow(struct astman_async *a) {
+    struct async_pending **buckets, *p;
+    unsigned int n = a->nbuckets * 2, b;
+
+    buckets = calloc(n, sizeof(*buckets));
+    if (!buckets)
+        return ASTMAN_FAILURE;
+    for (p = a->head; p; p = p->next) {
+        b = async_hash(p->actionid) & (n - 1);
+        p->hnext = buckets[b];
+        buckets[b] = p;
+    }
+    free(a->buckets);
+    a->buckets = buckets;
+    a->nbuckets = n;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static struct async_pending *async_lookup(struct astman_async *a,
+ *                                               const char *actionid)
+ ******************************************************************************/
+static struct async_pending *async_lookup(struct astman_async *a,
+                                          const char *actionid) {
+    struct async_pending *p;
+    for (p = a->buckets[async_hash(actionid) & (a->nbuckets - 1)]; p; p = p->hnext)
+        if (!strcmp(p->actionid, actionid))
+            return p;
+    return NULL;
+}
+/*******************************************************************************
+ * @fn static void async_unlink(struct astman_async *a, struct async_pending *p)
+ ******************************************************************************/
+static void async_unlink(struct astman_async *a, struct async_pending *p) {
+    struct async_pending **pp;
+    for (pp = &a->buckets[async_hash(p->actionid) & (a->nbuckets - 1)]; *pp; pp = &(*pp)->hnext) {
+        if (*pp == p) {
+            *pp = p->hnext;
+            break;
+        }
+    }
+    if (p->prev)
+        p->prev->next = p->next;
+    else
+        a->head = p->next;
+    if (p->next)
+        p->next->prev = p->prev;
+    else
+        a->tail = p->prev;
+    a->count--;
+}
+/*******************************************************************************
+ * Lanes of the well known actions, by name
+ ******************************************************************************/
+static const char *_control_actions[] = {
+    "Hangup", "Redirect", "AbsoluteTimeout", "Atxfer", "BlindTransfer",
+    "Bridge", "Park", "PlayDTMF", "SendText", "Originate", NULL
+};
+static const char *_bulk_actions[] = {
+    "SIPpeers", "SIPshowregistry", "IAXpeers", "IAXpeerlist", "Status",
+    "CoreShowChannels", "QueueStatus", "QueueSummary", "ShowDialPlan",
+    "GetConfig", "GetConfigJSON", "ListCategories", "ListCommands",
+    "PJSIPShowEndpoints", "PJSIPShowContacts", "DeviceStateList",
+    "ExtensionStateList", "Agents", "ParkedCalls", "MeetmeList",
+    "ConfbridgeList", "VoicemailUsersList", "DBGetTree", "Command", NULL
+};
+/*******************************************************************************
+ * @fn int astman_action_class(const char *action, int flags)
+ ******************************************************************************/
+int astman_action_class(const char *action, int flags) {
+    int x;
+
+    if (flags & ASTMAN_ACTION_CONTROL)
+        return ASTMAN_CLASS_CONTROL;
+    if (flags & (ASTMAN_ACTION_BULK | ASTMAN_ACTION_LIST))
+        return ASTMAN_CLASS_BULK;
+    for (x = 0; _control_actions[x]; x++)
+        if (!strcasecmp(action, _control_actions[x]))
+            return ASTMAN_CLASS_CONTROL;
+    for (x = 0; _bulk_actions[x]; x++)
+        if (!strcasecmp(action, _bulk_actions[x]))
+            return ASTMAN_CLASS_BULK;
+    return ASTMAN_CLASS_NORMAL;
+}
+/*******************************************************************************
+ * @fn static int async_send(struct mansession *s, struct async_pending *p,
+ *                           const char *action, const char *params)
+ ******************************************************************************/
+static int async_send(struct mansession *s, struct async_pending *p,
+                      const char *action, const char *params) {
+    if (astman_manager_action(s, (char *)action, "ActionID: %s\r\n%s", p->actionid,
+                              params ? params : "") < 0)
+        return ASTMAN_FAILURE;
+    if (p->bulk)
+        s->async->bulk_inflight++;
+    return ASTMAN_SUCCESS;
+}
+static void async_finish(struct mansession *s, struct async_pending *p, int status);
+/*******************************************************************************
+ * @fn static int async_leave(struct mansession *s, struct astman_async *a)
+ * @brief End of a walk of a started by a->busy++. A callback may have
+ *        aborted it (astman_disconnect()): the last walker frees it.
+ * @return ASTMAN_SUCCESS if a is still the state of s
+ ******************************************************************************/
+static int async_leave(struct mansession *s, struct astman_async *a) {
+    if (s->async == a) {
+        a->busy--;
+        return ASTMAN_SUCCESS;
+    }
+    if (!--a->busy) {
+        free(a->buckets);
+        free(a);
+    }
+    return ASTMAN_FAILURE;
+}
+/*******************************************************************************
+ * @fn static void async_pump(struct mansession *s)
+ * @brief Send the waiting bulk actions the window has room for, oldest
+ *        first
+ ******************************************************************************/
+static void async_pump(struct mansession *s) {
+    struct astman_async *a = s->async;
+    struct async_pending *p, *next;
+    char *queued;
+
+    for (p = a->head; p && a->queued && !a->aborting; p = next) {
+        next = p->next;
+        if (!p->queued)
+            continue;
+        if (a->bulk_window && a->bulk_inflight >= a->bulk_window)
+            return;
+        queued = p->queued;
+        p->queued = NULL;
+        a->queued--;
+        if (async_send(s, p, queued, queued + strlen(queued) + 1) != ASTMAN_SUCCESS) {
+            free(queued);
+            async_finish(s, p, ASTMAN_ACTION_ABORTED);
+            return;
+        }
+        free(queued);
+    }
+}
+/*******************************************************************************
+ * @fn static void async_finish(struct mansession *s, struct async_pending *p,
+ *                              int status)
+ * @brief Remove p and run its callback a last time
+ ******************************************************************************/
+static void async_finish(struct mansession *s, struct async_pending *p, int status) {
+    struct astman_action_result r;
+    struct astman_async *a = s->async;
+
+    async_unlink(a, p);
+    a->completed++;
+    if (p->queued)
+        a->queued--;
+    else if (p->bulk)
+        a->bulk_inflight--;
+
+    r.actionid = p->actionid;
+    r.status = status;
+    r.response = p->response;
+    r.events = p->events;
+    r.count = p->count;
+    r.complete = 1;
+    a->busy++;
+    if (p->func)
+        p->func(s, &r, p->data);
+
+    astman_mem_release(s, ASTMAN_MEM_PENDING,
+                       sizeof(*p) + (p->response ? sizeof(struct message) : 0));
+    astman_mem_release(s, ASTMAN_MEM_LISTS, p->len * sizeof(struct message));
+    free(p->response);
+    free(p->events);
+    free(p->queued);
+    free(p);
+    if (async_leave(s, a) != ASTMAN_SUCCESS)
+        return;
+    /* room in the bulk window */
+    if (a->queued)
+        async_pump(s);
+}
+/*******************************************************************************
+ * @fn static int async_add_event(struct mansession *s, struct async_pending *p,
+ *                                struct message *m)
+ ******************************************************************************/
+static int async_add_event(struct mansession *s, struct async_pending *p,
+                           struct message *m) {
+    struct message *events;
+    int len, res;
+    if (p->count >= p->len) {
+        len = p->len ? p->len * 2 : 8;
+        res = astman_mem_charge(s, ASTMAN_MEM_LISTS, (len - p->len) * sizeof(struct message));
+        if (res != ASTMAN_MEM_OK) {
+            /* shed: the list goes on without it */
+            if (res != ASTMAN_MEM_SHED)
+                p->status = ASTMAN_FAILURE;
+            return ASTMAN_FAILURE;
+        }
+        events = realloc(p->events, len * sizeof(struct message));
+        if (!events) {
+            astman_mem_release(s, ASTMAN_MEM_LISTS, (len - p->len) * sizeof(struct message));
+            return ASTMAN_FAILURE;
+        }
+        p->events = events;
+        p->len = len;
+    }
+    astman_message_copy(&p->events[p->count], m);
+    p->count++;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static int async_is_complete(struct message *m)
+ * @brief Last event of a list: "EventList: Complete" or a "...Complete" name
+ ******************************************************************************/
+static int async_is_complete(struct message *m) {
+    const char *event;
+    size_t len;
+    if (!strcasecmp(astman_get_header(m, "EventList"), "Complete"))
+        return 1;
+    event = astman_get_header(m, "Event");
+    len = strlen(event);
+    return len > 8 && !strcasecmp(event + len - 8, "Complete");
+}
+/*******************************************************************************
+ * @fn int astman_async_dispatch(struct mansession *s, struct message *m)
+ ******************************************************************************/
+int astman_async_dispatch(struct mansession *s, struct message *m) {
+    struct astman_async *a = s->async;
+    struct async_pending *p;
+    struct astman_action_result r;
+    const char *actionid, *response;
+    int res;
+
+    if (!a)
+        return 0;
+    actionid = astman_get_header(m, "ActionID");
+    if (astman_strlen_zero(actionid))
+        return 0;
+    response = astman_get_header(m, "Response");
+
+    p = async_lookup(a, actionid);
+    if (!p) {
+        if (strncmp(actionid, ASYNC_ACTIONID_PREFIX, strlen(ASYNC_ACTIONID_PREFIX)))
+            return 0;
+        /* late answer of a timed out action */
+        if (strlen(response))
+            astman_metrics_response(s, m, 0);
+        else
+            astman_metrics_event(s, m);
+        return 1;
+    }
+
+    if (strlen(response)) {
+        astman_metrics_response(s, m, !strcasecmp(response, "Success"));
+        if (p->response)
+            return 1;
+        res = astman_mem_charge(s, ASTMAN_MEM_PENDING, sizeof(struct message));
+        if (res == ASTMAN_MEM_OK && !(p->response = malloc(sizeof(struct message))))
+            astman_mem_release(s, ASTMAN_MEM_PENDING, sizeof(struct message));
+        if (p->response)
+            astman_message_copy(p->response, m);
+        p->status = strcasecmp(response, "Error") ? ASTMAN_SUCCESS : ASTMAN_FAILURE;
+        /* shed: answered without the response */
+        if (res != ASTMAN_MEM_OK && res != ASTMAN_MEM_SHED)
+            p->status = ASTMAN_FAILURE;
+        if (p->status == ASTMAN_SUCCESS &&
+            ((p->flags & ASTMAN_ACTION_LIST) ||
+             !strcasecmp(astman_get_header(m, "EventList"), "start"))) {
+            p->listing = 1;
+        } else {
+            async_finish(s, p, p->status);
+        }
+        return 1;
+    }
+
+    /* Event carrying our ActionID */
+    astman_metrics_event(s, m);
+    if (async_is_complete(m)) {
+        astman_metrics_list_complete(s);
+        async_finish(s, p, p->response ? p->status : ASTMAN_SUCCESS);
+    } else if (p->flags & ASTMAN_ACTION_STREAM) {
+        r.actionid = p->actionid;
+        r.status = p->status;
+        r.response = p->response;
+        r.events = m;
+        r.count = 1;
+        r.complete = 0;
+        a->busy++;
+        if (p->func)
+            p->func(s, &r, p->data);
+        async_leave(s, a);
+    } else if (async_add_event(s, p, m) != ASTMAN_SUCCESS) {
+        astlog(ASTLOG_ERROR, "%s: list event dropped, out of memory", p->actionid);
+    }
+    return 1;
+}
+/*******************************************************************************
+ * @fn int astman_action_async(struct mansession *s, char *action,
+ *                             char *params, char *actionid, int flags,
+ *                             int timeout_ms, ASTMAN_ACTION_CALLBACK callback,
+ *                             void *data)
+ ******************************************************************************/
+int astman_action_async(struct mansession *s, char *action, char *params,
+                        char *actionid, int flags, int timeout_ms,
+                        ASTMAN_ACTION_CALLBACK callback, void *data) {
+    struct astman_async *a;
+    struct async_pending *p;
+    unsigned int b;
+
+    if (astman_strlen_zero(action))
+        return ASTMAN_FAILURE;
+    a = async_get(s);
+    if (!a)
+        return ASTMAN_FAILURE;
+    if ((unsigned int)a->count >= a->nbuckets && async_grow(a) != ASTMAN_SUCCESS)
+        return ASTMAN_FAILURE;
+
+    if (astman_mem_charge(s, ASTMAN_MEM_PENDING, sizeof(*p)) != ASTMAN_MEM_OK) {
+        astlog(ASTLOG_ERROR, "%s not sent, pending actions over the memory budget", action);
+        return ASTMAN_FAILURE;
+    }
+    p = calloc(1, sizeof(*p));
+    if (!p) {
+        astman_mem_release(s, ASTMAN_MEM_PENDING, sizeof(*p));
+        return ASTMAN_FAILURE;
+    }
+    if (astman_strlen_zero(actionid))
+        snprintf(p->actionid, sizeof(p->actionid), ASYNC_ACTIONID_PREFIX "%u", ++a->seq);
+    else
+        strncpy(p->actionid, actionid, sizeof(p->actionid) - 1);
+    if (async_lookup(a, p->actionid)) {
+        astlog(ASTLOG_ERROR, "ActionID %s already in flight", p->actionid);
+        astman_mem_release(s, ASTMAN_MEM_PENDING, sizeof(*p));
+        free(p);
+        return ASTMAN_FAILURE;
+    }
+    p->flags = flags;
+    p->func = callback;
+    p->data = data;
+    p->bulk = astman_action_class(action, flags) == ASTMAN_CLASS_BULK;
+    if (timeout_ms > 0) {
+        p->deadline = astman_metrics_now() + (unsigned long long)timeout_ms * 1000000ULL;
+        if (!a->next_expiry || p->deadline < a->next_expiry)
+            a->next_expiry = p->deadline;
+    }
+
+    b = async_hash(p->actionid) & (a->nbuckets - 1);
+    p->hnext = a->buckets[b];
+    a->buckets[b] = p;
+    p->prev = a->tail;
+    if (a->tail)
+        a->tail->next = p;
+    else
+        a->head = p;
+    a->tail = p;
+    a->count++;
+
+    /* A full bulk window keeps the action here, control and normal ones
+       (and ASTMAN_ACTION_NOWINDOW) pass it */
+    if (p->bulk && !(flags & ASTMAN_ACTION_NOWINDOW) &&
+        (a->queued || (a->bulk_window && a->bulk_inflight >= a->bulk_window))) {
+        p->queued = malloc(strlen(action) + (params ? strlen(params) : 0) + 2);
+        if (!p->queued) {
+            async_unlink(a, p);
+            astman_mem_release(s, ASTMAN_MEM_PENDING, sizeof(*p));
+            free(p);
+            return ASTMAN_FAILURE;
+        }
+        strcpy(p->queued, action);
+        strcpy(p->queued + strlen(action) + 1, params ? params : "");
+        a->queued++;
+        return ASTMAN_SUCCESS;
+    }
+    if (async_send(s, p, action, params) != ASTMAN_SUCCESS) {
+        async_unlink(a, p);
+        astman_mem_release(s, ASTMAN_MEM_PENDING, sizeof(*p));
+        free(p);
+        return ASTMAN_FAILURE;
+    }
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_set_bulk_window(struct mansession *s, int window)
+ ******************************************************************************/
+int astman_set_bulk_window(struct mansession *s, int window) {
+    struct astman_async *a = async_get(s);
+
+    if (!a || window < 0)
+        return ASTMAN_FAILURE;
+    a->bulk_window = window;
+    async_pump(s);
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_async_expire(struct mansession *s)
+ ******************************************************************************/
+int astman_async_expire(struct mansession *s) {
+    struct astman_async *a = s->async;
+    struct async_pending *p, *next;
+    unsigned long long now;
+    int before, res;
+
+    if (!a || !a->next_expiry)
+        return 0;
+    now = astman_metrics_now();
+    if (now < a->next_expiry)
+        return 0;
+    before = a->completed;
+    a->next_expiry = 0;
+    a->busy++;
+    for (p = a->head; p; p = next) {
+        next = p->next;
+        if (!p->deadline)
+            continue;
+        if (p->deadline <= now) {
+            astman_metrics_timeout(s);
+            async_finish(s, p, ASTMAN_ACTION_TIMEOUT);
+            /* the callback may have aborted all, queued or completed others */
+            if (s->async != a)
+                break;
+            next = a->head;
+            now = astman_metrics_now();
+            a->next_expiry = 0;
+        } else if (!a->next_expiry || p->deadline < a->next_expiry) {
+            a->next_expiry = p->deadline;
+        }
+    }
+    res = a->completed - before;
+    if (async_leave(s, a) != ASTMAN_SUCCESS)
+        return -1;
+    return res;
+}
+/*******************************************************************************
+ * @fn int astman_poll(struct mansession *s, int timeout_ms)
+ ******************************************************************************/
+int astman_poll(struct mansession *s, int timeout_ms) {
+    struct astman_async *a = async_get(s);
+    int res, before, wait;
+
+    if (!a)
+        return -1;
+    before = a->completed;
+
+    /* Do not sleep past the earliest deadline */
+    if (timeout_ms != 0) {
+        wait = astman_async_timeout(s);
+        if (wait >= 0 && (timeout_ms < 0 || wait < timeout_ms))
+            timeout_ms = wait;
+    }
+
+    a->busy++;
+    for (;;) {
+        res = astman_read_message(s, &a->rx, timeout_ms);
+        if (res < 0) {
+            astman_async_abort(s);
+            async_leave(s, a);
+            return -1;
+        }
+        if (res == 0)
+            break;
+        if (!astman_async_dispatch(s, &a->rx))
+            astman_dispatch_message(s, &a->rx);
+        a->rx.hdrcount = 0;
+        a->rx.gettingdata = 0;
+        /* disconnected by a callback */
+        if (s->async != a)
+            break;
+        timeout_ms = 0;
+    }
+    if (s->async == a)
+        astman_async_expire(s);
+    /* The socket is drained, now the slow consumers */
+    if (s->async == a && s->flow)
+        astman_flow_drain(s, 0);
+    res = a->completed - before;
+    if (async_leave(s, a) != ASTMAN_SUCCESS)
+        return -1;
+    return res;
+}
+/*******************************************************************************
+ * @fn int astman_async_input(struct mansession *s, const char *data,
+ *                            size_t len)
+ ******************************************************************************/
+int astman_async_input(struct mansession *s, const char *data, size_t len) {
+    struct astman_async *a = async_get(s);
+    int before, res;
+
+    if (!a)
+        return -1;
+    before = a->completed;
+    astman_metrics_received(len);
+    a->busy++;
+    while (astman_message_input(s, &a->rx, &data, &len) == 1) {
+        if (!astman_async_dispatch(s, &a->rx))
+            astman_dispatch_message(s, &a->rx);
+        a->rx.hdrcount = 0;
+        a->rx.gettingdata = 0;
+        /* disconnected by a callback */
+        if (s->async != a)
+            break;
+    }
+    /* Everything parsed from this buffer is collected */
+    if (s->async == a && s->batch)
+        astman_batch_flush(s);
+    if (s->async == a && s->flow)
+        astman_flow_drain(s, 0);
+    res = a->completed - before;
+    if (async_leave(s, a) != ASTMAN_SUCCESS)
+        return -1;
+    return res;
+}
+/*******************************************************************************
+ * @fn int astman_pending_count(struct mansession *s)
+ ******************************************************************************/
+int astman_pending_count(struct mansession *s) {
+    return s->async ? s->async->count : 0;
+}
+/*******************************************************************************
+ * @fn int astman_session_fd(struct mansession *s)
+ ******************************************************************************/
+int astman_session_fd(struct mansession *s) {
+    return s->fd;
+}
+/*******************************************************************************
+ * @fn int astman_async_timeout(struct mansession *s)
+ ******************************************************************************/
+int astman_async_timeout(struct mansession *s) {
+    struct astman_async *a = s->async;
+    unsigned long long now;
+    if (!a || !a->next_expiry)
+        return -1;
+    now = astman_metrics_now();
+    if (now >= a->next_expiry)
+        return 0;
+    return (int)((a->next_expiry - now + 999999ULL) / 1000000ULL);
+}
+/*******************************************************************************
+ * @fn void astman_async_abort(struct mansession *s)
+ ******************************************************************************/
+void astman_async_abort(struct mansession *s) {
+    struct astman_async *a = s->async;
+    if (!a || a->aborting)
+        return;
+    a->aborting = 1;
+    while (a->head)
+        async_finish(s, a->head, ASTMAN_ACTION_ABORTED);
+    s->async = NULL;
+    /* a callback up the stack still walks it */
+    if (a->busy)
+        return;
+    free(a->buckets);
+    free(a);
+}
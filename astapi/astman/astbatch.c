@@ -0,0 +1,138 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astbatch.c
+ *  @brief Batched event delivery
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astnames.h"
+#include "astmetrics.h"
+#include "astbatch.h"
+#include "astmem.h"
+/*******************************************************************************
+ * @struct  astman_batch
+ * @brief   Pending events of a session
+ ******************************************************************************/
+struct astman_batch {
+    ASTMAN_EVENT_BATCH_CALLBACK func;   /**!< batch callback */
+    struct message *msgs;               /**!< max_events slots */
+    int count;                          /**!< pending events */
+    int max_events;                     /**!< flush threshold */
+    unsigned long long max_age;         /**!< flush threshold (ns), 0 = none */
+    unsigned long long first;           /**!< time of the first pending (ns) */
+    int flushing;                       /**!< callback running */
+};
+/*******************************************************************************
+ * @fn static void batch_free(struct mansession *s, struct astman_batch *b)
+ ******************************************************************************/
+static void batch_free(struct mansession *s, struct astman_batch *b) {
+    if (!b)
+        return;
+    astman_mem_release(s, ASTMAN_MEM_QUEUES, b->max_events * sizeof(struct message));
+    free(b->msgs);
+    free(b);
+}
+/*******************************************************************************
+ * @fn int astman_add_event_batch_handler(struct mansession *s,
+ *                                        ASTMAN_EVENT_BATCH_CALLBACK callback,
+ *                                        int max_events, int max_usec)
+ ******************************************************************************/
+int astman_add_event_batch_handler(struct mansession *s,
+                                   ASTMAN_EVENT_BATCH_CALLBACK callback,
+                                   int max_events, int max_usec) {
+    struct astman_batch *b;
+
+    if (s->batch) {
+        astman_batch_flush(s);
+        batch_free(s, s->batch);
+        s->batch = NULL;
+    }
+    if (!callback)
+        return ASTMAN_SUCCESS;
+    if (max_events <= 0)
+        return ASTMAN_FAILURE;
+
+    b = calloc(1, sizeof(*b));
+    if (!b)
+        return ASTMAN_FAILURE;
+    if (astman_mem_charge(s, ASTMAN_MEM_QUEUES, max_events * sizeof(struct message)) != ASTMAN_MEM_OK) {
+        astlog(ASTLOG_ERROR, "Batch of %d events over the memory budget", max_events);
+        free(b);
+        return ASTMAN_FAILURE;
+    }
+    b->msgs = malloc(max_events * sizeof(struct message));
+    if (!b->msgs) {
+        astman_mem_release(s, ASTMAN_MEM_QUEUES, max_events * sizeof(struct message));
+        free(b);
+        return ASTMAN_FAILURE;
+    }
+    b->func = callback;
+    b->max_events = max_events;
+    b->max_age = max_usec > 0 ? (unsigned long long)max_usec * 1000ULL : 0;
+    s->batch = b;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn void astman_batch_flush(struct mansession *s)
+ ******************************************************************************/
+void astman_batch_flush(struct mansession *s) {
+    struct astman_batch *b = s->batch;
+    int n;
+    if (!b || !b->count || b->flushing)
+        return;
+    b->flushing = 1;
+    n = b->count;
+    b->func(s, b->msgs, n);
+    /* keep what the callback itself queued */
+    if (b->count > n)
+        memmove(b->msgs, b->msgs + n, (b->count - n) * sizeof(struct message));
+    b->count -= n;
+    b->flushing = 0;
+}
+/*******************************************************************************
+ * @fn void astman_batch_add(struct mansession *s, struct message *m)
+ ******************************************************************************/
+void astman_batch_add(struct mansession *s, struct message *m) {
+    struct astman_batch *b = s->batch;
+
+    if (!b)
+        return;
+    if (b->count >= b->max_events) {
+        if (b->flushing) {
+            /* added from the callback itself and no room left */
+            b->func(s, m, 1);
+            return;
+        }
+        astman_batch_flush(s);
+    }
+    astman_message_copy(&b->msgs[b->count], m);
+    if (!b->count)
+        b->first = astman_metrics_now();
+    b->count++;
+
+    if (b->count >= b->max_events ||
+        (b->max_age && astman_metrics_now() - b->first >= b->max_age))
+        astman_batch_flush(s);
+}
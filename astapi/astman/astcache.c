@@ -0,0 +1,474 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astcache.c
+ *  @brief Response cache with coalescing of identical requests
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astnames.h"
+#include "astmetrics.h"
+#include "astcache.h"
+#include "astmem.h"
+/*******************************************************************************
+ *  \def CACHE_BUCKETS
+ *  \brief  Hash buckets (power of two)
+ ******************************************************************************/
+#define CACHE_BUCKETS   256
+/*******************************************************************************
+ *  \def CACHE_ACTIONS
+ *  \brief  Actions with a TTL
+ ******************************************************************************/
+#define CACHE_ACTIONS   32
+/*******************************************************************************
+ *  \def CACHE_MAX_PARAMS
+ ******************************************************************************/
+#define CACHE_MAX_PARAMS 32
+/*******************************************************************************
+ * @struct  cache_entry
+ * @brief   A response, or a request on the wire (fetching)
+ ******************************************************************************/
+struct cache_entry {
+    char *key;
+    unsigned int hash;
+    int fetching;                   /**!< the leader is waiting for it */
+    int waiters;                    /**!< requests waiting for the leader */
+    int epoch;                      /**!< bumped by invalidation */
+    int res;                        /**!< astman_wait_for_response() result */
+    unsigned long long expires;     /**!< ns, astman_metrics_now() */
+    void *m;                        /**!< astman_message_pack() */
+    size_t msize;                   /**!< bytes of m */
+    size_t charged;                 /**!< bytes accounted to ASTMAN_MEM_CACHE */
+    pthread_cond_t done;
+    struct cache_entry *next;       /**!< in the bucket */
+    struct cache_entry *newer;      /**!< LRU list */
+    struct cache_entry *older;
+};
+/*******************************************************************************
+ * @struct  cache_action
+ ******************************************************************************/
+struct cache_action {
+    char name[MAX_NAME_LEN];
+    int ttl_ms;
+};
+static struct cache_entry *_buckets[CACHE_BUCKETS];
+static struct cache_action _actions[CACHE_ACTIONS];
+static int _nactions = 0;
+static int _entries = 0;
+static struct cache_entry *_newest, *_oldest;
+static struct astman_cache_stats _stats;
+/* the workers of every thread share the cache */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+/*******************************************************************************
+ * @fn static unsigned int cache_hash(const char *str)
+ ******************************************************************************/
+static unsigned int cache_hash(const char *str) {
+    unsigned int h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+/*******************************************************************************
+ * @fn static struct cache_action *cache_action(const char *action)
+ * @warning _lock held
+ ******************************************************************************/
+static struct cache_action *cache_action(const char *action) {
+    int x;
+    for (x = 0; x < _nactions; x++)
+        if (!strcasecmp(_actions[x].name, action))
+            return &_actions[x];
+    return NULL;
+}
+/*******************************************************************************
+ * @fn int astman_cache_set_ttl(const char *action, int ttl_ms)
+ ******************************************************************************/
+int astman_cache_set_ttl(const char *action, int ttl_ms) {
+    struct cache_action *a;
+    int ret = ASTMAN_SUCCESS;
+
+    if (astman_strlen_zero(action) || strlen(action) >= MAX_NAME_LEN)
+        return ASTMAN_FAILURE;
+    pthread_mutex_lock(&_lock);
+    a = cache_action(action);
+    if (!a && _nactions < CACHE_ACTIONS) {
+        a = &_actions[_nactions++];
+        strcpy(a->name, action);
+    }
+    if (a)
+        a->ttl_ms = ttl_ms;
+    else
+        ret = ASTMAN_FAILURE;
+    pthread_mutex_unlock(&_lock);
+    /* a shorter TTL applies to what is cached already */
+    astman_cache_invalidate(NULL, action);
+    return ret;
+}
+/*******************************************************************************
+ * @fn static int cache_param_cmp(const void *a, const void *b)
+ ******************************************************************************/
+static int cache_param_cmp(const void *a, const void *b) {
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+/*******************************************************************************
+ * @fn static char *cache_key(struct mansession *s, const char *action,
+ *                            const char *params)
+ * @brief "host:port\naction\nname: value\n..." with the names lower-cased and
+ *        the lines sorted, so that the order of the parameters is not part of
+ *        the key
+ ******************************************************************************/
+static char *cache_key(struct mansession *s, const char *action,
+                       const char *params) {
+    char host[INET_ADDRSTRLEN] = "";
+    struct in_addr addr = s->sin.sin_addr;
+    char *copy, *line, *save, *c, *key;
+    char *lines[CACHE_MAX_PARAMS];
+    size_t len;
+    int n = 0, x;
+
+    copy = strdup(params);
+    if (!copy)
+        return NULL;
+    for (line = strtok_r(copy, "\r\n", &save); line && n < CACHE_MAX_PARAMS;
+         line = strtok_r(NULL, "\r\n", &save)) {
+        for (c = line; *c && *c != ':'; c++)
+            *c = tolower((unsigned char)*c);
+        lines[n++] = line;
+    }
+    qsort(lines, n, sizeof(*lines), cache_param_cmp);
+    inet_ntop(AF_INET, &addr, host, sizeof(host));
+    len = strlen(host) + strlen(action) + strlen(params) + n + 16;
+    key = malloc(len);
+    if (key) {
+        x = snprintf(key, len, "%s:%d\n", host, ntohs(s->sin.sin_port));
+        for (c = key + x; *action; )
+            *c++ = tolower((unsigned char)*action++);
+        *c = '\0';
+        for (x = 0; x < n; x++) {
+            strcat(key, "\n");
+            strcat(key, lines[x]);
+        }
+    }
+    free(copy);
+    return key;
+}
+/*******************************************************************************
+ * @fn static void cache_copy(struct message *dst, const void *src,
+ *                            const char *actionid)
+ * @brief Unpack a cached response with the caller's ActionID
+ ******************************************************************************/
+static void cache_copy(struct message *dst, const void *src,
+                       const char *actionid) {
+    int x, y;
+
+    astman_message_unpack(dst, src);
+    for (x = 0; x < dst->hdrcount && dst->hdrid[x] != ASTMAN_HDR_ACTIONID; x++);
+    if (x < dst->hdrcount) {
+        /* removed, it goes back last when the caller has one */
+        for (y = x; y < dst->hdrcount - 1; y++) {
+            dst->hdrid[y] = dst->hdrid[y + 1];
+            memcpy(dst->headers[y], dst->headers[y + 1], MAX_LEN);
+        }
+        dst->hdrcount--;
+    }
+    if (!astman_strlen_zero(actionid) && dst->hdrcount < MAX_HEADERS - 1) {
+        snprintf(dst->headers[dst->hdrcount], MAX_LEN, "ActionID: %s", actionid);
+        dst->hdrid[dst->hdrcount++] = ASTMAN_HDR_ACTIONID;
+    }
+}
+/*******************************************************************************
+ * @fn static void cache_touch(struct cache_entry *e)
+ * @brief Move e first in the LRU list
+ * @warning _lock held
+ ******************************************************************************/
+static void cache_touch(struct cache_entry *e) {
+    if (_newest == e)
+        return;
+    /* in the list: unlinked, a new entry is not linked yet */
+    if (e->newer) {
+        e->newer->older = e->older;
+        if (e->older)
+            e->older->newer = e->newer;
+        else
+            _oldest = e->newer;
+    }
+    e->older = _newest;
+    e->newer = NULL;
+    if (_newest)
+        _newest->newer = e;
+    _newest = e;
+    if (!_oldest)
+        _oldest = e;
+}
+/*******************************************************************************
+ * @fn static void cache_free(struct cache_entry *e)
+ * @brief Unlink e from its bucket and the LRU list and free it
+ * @warning _lock held, nobody waiting for e
+ ******************************************************************************/
+static void cache_free(struct cache_entry *e) {
+    struct cache_entry **p;
+
+    for (p = &_buckets[e->hash & (CACHE_BUCKETS - 1)]; *p != e; p = &(*p)->next)
+        ;
+    *p = e->next;
+    if (e->older)
+        e->older->newer = e->newer;
+    else
+        _oldest = e->newer;
+    if (e->newer)
+        e->newer->older = e->older;
+    else
+        _newest = e->older;
+    pthread_cond_destroy(&e->done);
+    astman_mem_release(NULL, ASTMAN_MEM_CACHE, e->charged);
+    free(e->key);
+    free(e->m);
+    free(e);
+    _entries--;
+}
+/*******************************************************************************
+ * @fn static void cache_sweep(unsigned long long now)
+ * @brief Free the expired responses nobody is waiting for
+ * @warning _lock held
+ ******************************************************************************/
+static void cache_sweep(unsigned long long now) {
+    struct cache_entry *e, *newer;
+
+    for (e = _oldest; e; e = newer) {
+        newer = e->newer;
+        if (!e->fetching && !e->waiters && e->expires <= now)
+            cache_free(e);
+    }
+}
+/*******************************************************************************
+ * @fn static int cache_evict(void)
+ * @brief Make room for an entry: the expired ones first, then the least
+ *        recently used
+ * @return ASTMAN_FAILURE when every entry is in use
+ * @warning _lock held
+ ******************************************************************************/
+static int cache_evict(void) {
+    struct cache_entry *e, *newer;
+
+    cache_sweep(astman_metrics_now());
+    for (e = _oldest; e && _entries >= ASTMAN_CACHE_MAX_ENTRIES; e = newer) {
+        newer = e->newer;
+        if (e->fetching || e->waiters)
+            continue;
+        cache_free(e);
+        _stats.evicted++;
+    }
+    return _entries < ASTMAN_CACHE_MAX_ENTRIES ? ASTMAN_SUCCESS : ASTMAN_FAILURE;
+}
+/*******************************************************************************
+ * @fn static int cache_send(struct mansession *s, struct message *m,
+ *                           char *action, const char *params,
+ *                           char *actionid)
+ * @brief The request on the wire
+ ******************************************************************************/
+static int cache_send(struct mansession *s, struct message *m, char *action,
+                      const char *params, char *actionid) {
+    char id[MAX_LEN] = "";
+
+    astman_add_param(id, sizeof(id), "ActionId", actionid);
+    if (astman_manager_action(s, action, "%s%s", params, id) < 0)
+        return -1;
+    return astman_wait_for_response(s, m, 0);
+}
+/*******************************************************************************
+ * @fn int astman_cache_query(struct mansession *s, struct message *m,
+ *                            char *action, const char *params,
+ *                            char *actionid)
+ ******************************************************************************/
+int astman_cache_query(struct mansession *s, struct message *m, char *action,
+                       const char *params, char *actionid) {
+    struct cache_action *a;
+    struct cache_entry *e;
+    unsigned long long now;
+    unsigned int hash;
+    int ttl_ms, epoch, res;
+    size_t size;
+    char *key;
+
+    pthread_mutex_lock(&_lock);
+    a = cache_action(action);
+    ttl_ms = a ? a->ttl_ms : -1;
+    pthread_mutex_unlock(&_lock);
+    if (ttl_ms < 0)
+        return cache_send(s, m, action, params, actionid);
+    key = cache_key(s, action, params);
+    if (!key)
+        return cache_send(s, m, action, params, actionid);
+    hash = cache_hash(key);
+
+    pthread_mutex_lock(&_lock);
+    for (e = _buckets[hash & (CACHE_BUCKETS - 1)]; e; e = e->next)
+        if (e->hash == hash && !strcmp(e->key, key))
+            break;
+    if (!e) {
+        /* Full of requests in flight or over the budget: not cached */
+        size = sizeof(*e) + strlen(key) + 1;
+        if ((_entries >= ASTMAN_CACHE_MAX_ENTRIES && cache_evict() != ASTMAN_SUCCESS) ||
+            astman_mem_charge(NULL, ASTMAN_MEM_CACHE, size) != ASTMAN_MEM_OK) {
+            pthread_mutex_unlock(&_lock);
+            free(key);
+            return cache_send(s, m, action, params, actionid);
+        }
+        e = calloc(1, sizeof(*e));
+        if (!e) {
+            astman_mem_release(NULL, ASTMAN_MEM_CACHE, size);
+            pthread_mutex_unlock(&_lock);
+            free(key);
+            return cache_send(s, m, action, params, actionid);
+        }
+        e->key = key;
+        e->hash = hash;
+        e->charged = size;
+        pthread_cond_init(&e->done, NULL);
+        e->next = _buckets[hash & (CACHE_BUCKETS - 1)];
+        _buckets[hash & (CACHE_BUCKETS - 1)] = e;
+        _entries++;
+        key = NULL;
+    }
+    free(key);
+    cache_touch(e);
+    for (;;) {
+        if (e->fetching) {
+            /* Identical request on the wire: share its response */
+            e->waiters++;
+            while (e->fetching)
+                pthread_cond_wait(&e->done, &_lock);
+            e->waiters--;
+            if (e->res > 0) {
+                cache_copy(m, e->m, actionid);
+                res = e->res;
+                _stats.coalesced++;
+                pthread_mutex_unlock(&_lock);
+                return res;
+            }
+            /* The leader's session failed, not the request: try ours */
+            continue;
+        }
+        now = astman_metrics_now();
+        if (e->m && e->res > 0 && now < e->expires) {
+            cache_copy(m, e->m, actionid);
+            res = e->res;
+            _stats.hits++;
+            pthread_mutex_unlock(&_lock);
+            return res;
+        }
+        break;
+    }
+    e->fetching = 1;
+    epoch = e->epoch;
+    _stats.misses++;
+    pthread_mutex_unlock(&_lock);
+
+    res = cache_send(s, m, action, params, actionid);
+
+    pthread_mutex_lock(&_lock);
+    e->res = res;
+    if (e->m) {
+        free(e->m);
+        e->m = NULL;
+        astman_mem_release(NULL, ASTMAN_MEM_CACHE, e->msize);
+        e->charged -= e->msize;
+    }
+    /* Only the used headers. Over the budget the response is not kept,
+       waiters send their own. */
+    if (res > 0) {
+        size = astman_message_packed_size(m);
+        if (astman_mem_charge(NULL, ASTMAN_MEM_CACHE, size) == ASTMAN_MEM_OK) {
+            if ((e->m = malloc(size))) {
+                astman_message_pack(e->m, m);
+                e->msize = size;
+                e->charged += size;
+            } else {
+                astman_mem_release(NULL, ASTMAN_MEM_CACHE, size);
+            }
+        }
+    }
+    if (!e->m)
+        e->res = -1;
+    /* Error responses are shared with the waiters but not kept */
+    now = astman_metrics_now();
+    if (res > 0 && epoch == e->epoch &&
+        !strcasecmp(astman_get_header_id(m, ASTMAN_HDR_RESPONSE), "Success"))
+        e->expires = now + (unsigned long long)ttl_ms * 1000000ULL;
+    else
+        e->expires = now;
+    e->fetching = 0;
+    pthread_cond_broadcast(&e->done);
+    pthread_mutex_unlock(&_lock);
+    return res;
+}
+/*******************************************************************************
+ * @fn void astman_cache_invalidate(struct mansession *s, const char *action)
+ ******************************************************************************/
+void astman_cache_invalidate(struct mansession *s, const char *action) {
+    char host[INET_ADDRSTRLEN] = "", server[INET_ADDRSTRLEN + 8] = "";
+    struct cache_entry *e;
+    const char *name;
+    size_t len = action ? strlen(action) : 0, slen = 0;
+    struct in_addr addr;
+    int x;
+
+    if (s) {
+        /* the key starts with "host:port\n" */
+        addr = s->sin.sin_addr;
+        inet_ntop(AF_INET, &addr, host, sizeof(host));
+        slen = snprintf(server, sizeof(server), "%s:%d\n", host, ntohs(s->sin.sin_port));
+    }
+    pthread_mutex_lock(&_lock);
+    for (x = 0; x < CACHE_BUCKETS; x++) {
+        for (e = _buckets[x]; e; e = e->next) {
+            if (slen && strncmp(e->key, server, slen))
+                continue;
+            name = strchr(e->key, '\n') + 1;
+            if (action && (strncasecmp(name, action, len) || (name[len] && name[len] != '\n')))
+                continue;
+            /* a response on the wire is shared but not kept */
+            e->epoch++;
+            e->expires = 0;
+        }
+    }
+    cache_sweep(0);
+    pthread_mutex_unlock(&_lock);
+}
+/*******************************************************************************
+ * @fn void astman_cache_stats(struct astman_cache_stats *st)
+ ******************************************************************************/
+void astman_cache_stats(struct astman_cache_stats *st) {
+    pthread_mutex_lock(&_lock);
+    *st = _stats;
+    st->entries = _entries;
+    pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,531 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astcluster.c
+ *  @brief Multi-server scatter-gather client
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astmetrics.h"
+#include "astasync.h"
+#include "astcluster.h"
+/*******************************************************************************
+ *  \def CLUSTER_MANAGER_PORT
+ *  \brief  Port used when a node is added with port 0
+ ******************************************************************************/
+#define CLUSTER_MANAGER_PORT    5038
+/*******************************************************************************
+ * @struct  cluster_node
+ * @brief   One server of the cluster
+ ******************************************************************************/
+struct cluster_node {
+    char name[64];
+    char host[80];
+    int port;
+    char username[80];
+    char secret[80];
+    struct mansession *s;
+    int up;                     /**!< connected and logged in */
+};
+/*******************************************************************************
+ * @struct  astman_cluster
+ ******************************************************************************/
+struct astman_cluster {
+    struct cluster_node **nodes;
+    int count;
+    int len;
+    struct pollfd *pfd;         /**!< len entries, for astman_cluster_poll */
+    int *map;                   /**!< pfd index -> node */
+};
+/*******************************************************************************
+ * @struct  cluster_call
+ * @brief   An action fanned out to several nodes
+ ******************************************************************************/
+struct cluster_call {
+    struct astman_cluster *c;
+    ASTMAN_CLUSTER_CALLBACK func;
+    void *data;
+    int refs;                   /**!< nodes still answering + caller */
+    int ok;                     /**!< nodes that answered with success */
+};
+/*******************************************************************************
+ * @struct  cluster_ctx
+ * @brief   The part of a cluster_call running on one node
+ ******************************************************************************/
+struct cluster_ctx {
+    struct cluster_call *call;
+    int node;
+};
+/*******************************************************************************
+ * @fn static void cluster_call_unref(struct cluster_call *call)
+ ******************************************************************************/
+static void cluster_call_unref(struct cluster_call *call) {
+    if (--call->refs == 0)
+        free(call);
+}
+/*******************************************************************************
+ * @fn static void cluster_done(struct mansession *s,
+ *                              struct astman_action_result *r, void *data)
+ * @brief astman_action_async() callback: tag the result with its node
+ ******************************************************************************/
+static void cluster_done(struct mansession *s __attribute__((unused)),
+                         struct astman_action_result *r, void *data) {
+    struct cluster_ctx *ctx = data;
+    struct cluster_call *call = ctx->call;
+
+    if (call->func)
+        call->func(call->c, ctx->node, r, call->data);
+    if (!r->complete)
+        return;
+    if (r->status == ASTMAN_SUCCESS)
+        call->ok++;
+    free(ctx);
+    cluster_call_unref(call);
+}
+/*******************************************************************************
+ * @fn static void cluster_node_lost(struct astman_cluster *c, int i)
+ ******************************************************************************/
+static void cluster_node_lost(struct astman_cluster *c, int i) {
+    struct cluster_node *n = c->nodes[i];
+    astlog(ASTLOG_WARNING, "Cluster node %s lost", n->name);
+    astman_disconnect(n->s);
+    n->up = 0;
+}
+/*******************************************************************************
+ * @fn static int cluster_remaining(unsigned long long deadline)
+ * @return ms left before deadline, -1 if deadline is 0 (none)
+ ******************************************************************************/
+static int cluster_remaining(unsigned long long deadline) {
+    unsigned long long now;
+    if (!deadline)
+        return -1;
+    now = astman_metrics_now();
+    if (now >= deadline)
+        return 0;
+    return (int)((deadline - now + 999999ULL) / 1000000ULL);
+}
+/*******************************************************************************
+ * @fn struct astman_cluster *astman_cluster_new(void)
+ ******************************************************************************/
+struct astman_cluster *astman_cluster_new(void) {
+    return calloc(1, sizeof(struct astman_cluster));
+}
+/*******************************************************************************
+ * @fn void astman_cluster_free(struct astman_cluster *c)
+ ******************************************************************************/
+void astman_cluster_free(struct astman_cluster *c) {
+    int i;
+    if (!c)
+        return;
+    for (i = 0; i < c->count; i++) {
+        if (c->nodes[i]->up)
+            astman_logoff(c->nodes[i]->s);
+        astman_session_free(c->nodes[i]->s);
+        free(c->nodes[i]);
+    }
+    free(c->nodes);
+    free(c->pfd);
+    free(c->map);
+    free(c);
+}
+/*******************************************************************************
+ * @fn int astman_cluster_add_node(struct astman_cluster *c, const char *name,
+ *                                 const char *host, int port,
+ *                                 const char *username, const char *secret)
+ ******************************************************************************/
+int astman_cluster_add_node(struct astman_cluster *c, const char *name,
+                            const char *host, int port,
+                            const char *username, const char *secret) {
+    struct cluster_node *n;
+    void *p;
+    int len;
+
+    if (astman_strlen_zero(host) || astman_strlen_zero(username) ||
+        astman_strlen_zero(secret))
+        return -1;
+    if (c->count >= c->len) {
+        len = c->len ? c->len * 2 : 8;
+        if (!(p = realloc(c->nodes, len * sizeof(*c->nodes))))
+            return -1;
+        c->nodes = p;
+        if (!(p = realloc(c->pfd, len * sizeof(*c->pfd))))
+            return -1;
+        c->pfd = p;
+        if (!(p = realloc(c->map, len * sizeof(*c->map))))
+            return -1;
+        c->map = p;
+        c->len = len;
+    }
+    n = calloc(1, sizeof(*n));
+    if (!n)
+        return -1;
+    n->s = astman_session_new();
+    if (!n->s) {
+        free(n);
+        return -1;
+    }
+    strncpy(n->name, name ? name : host, sizeof(n->name) - 1);
+    strncpy(n->host, host, sizeof(n->host) - 1);
+    n->port = port > 0 ? port : CLUSTER_MANAGER_PORT;
+    strncpy(n->username, username, sizeof(n->username) - 1);
+    strncpy(n->secret, secret, sizeof(n->secret) - 1);
+    c->nodes[c->count] = n;
+    return c->count++;
+}
+/*******************************************************************************
+ * @fn static void cluster_login_done(struct mansession *s,
+ *                                    struct astman_action_result *r,
+ *                                    void *data)
+ ******************************************************************************/
+static void cluster_login_done(struct mansession *s __attribute__((unused)),
+                               struct astman_action_result *r, void *data) {
+    struct cluster_node *n = data;
+    n->up = r->status == ASTMAN_SUCCESS;
+    if (!n->up)
+        astlog(ASTLOG_ERROR, "Cluster node %s: login failed", n->name);
+}
+/*******************************************************************************
+ * @fn static int cluster_start_connect(struct cluster_node *n)
+ * @brief Start a non blocking connect
+ * @return the socket, -1 on error
+ ******************************************************************************/
+static int cluster_start_connect(struct cluster_node *n) {
+    struct addrinfo hints, *ai;
+    struct sockaddr_in addr;
+    int fd;
+
+    /* reentrant, unlike gethostbyname(): as astshard.c does */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(n->host, NULL, &hints, &ai) || !ai) {
+        astlog(ASTLOG_ERROR, "No such address: %s", n->host);
+        return -1;
+    }
+    /* aligned copy, the session is packed */
+    memcpy(&addr, ai->ai_addr, sizeof(addr));
+    addr.sin_port = htons(n->port);
+    freeaddrinfo(ai);
+    memcpy(&n->s->sin, &addr, sizeof(addr));
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 &&
+        errno != EINPROGRESS) {
+        astlog(ASTLOG_ERROR, "Cluster node %s: connect: %s", n->name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+/*******************************************************************************
+ * @fn int astman_cluster_connect(struct astman_cluster *c, int timeout_ms)
+ ******************************************************************************/
+int astman_cluster_connect(struct astman_cluster *c, int timeout_ms) {
+    struct cluster_node *n;
+    unsigned long long deadline = 0;
+    char params[256];
+    int i, k, npfd = 0, waiting = 0, err, up = 0;
+    socklen_t len;
+
+    if (timeout_ms > 0)
+        deadline = astman_metrics_now() + (unsigned long long)timeout_ms * 1000000ULL;
+
+    /* All the connects at once */
+    for (i = 0; i < c->count; i++) {
+        n = c->nodes[i];
+        if (n->up)
+            continue;
+        astman_disconnect(n->s);
+        c->pfd[npfd].fd = cluster_start_connect(n);
+        c->pfd[npfd].events = POLLOUT;
+        c->pfd[npfd].revents = 0;
+        c->map[npfd] = i;
+        if (c->pfd[npfd].fd >= 0)
+            waiting++;
+        npfd++;
+    }
+    while (waiting && cluster_remaining(deadline)) {
+        if (poll(c->pfd, npfd, cluster_remaining(deadline)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (k = 0; k < npfd; k++) {
+            if (c->pfd[k].fd < 0 || !c->pfd[k].revents)
+                continue;
+            n = c->nodes[c->map[k]];
+            err = 0;
+            len = sizeof(err);
+            getsockopt(c->pfd[k].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err) {
+                astlog(ASTLOG_ERROR, "Cluster node %s: connect: %s", n->name, strerror(err));
+                close(c->pfd[k].fd);
+            } else {
+                fcntl(c->pfd[k].fd, F_SETFL, fcntl(c->pfd[k].fd, F_GETFL) & ~O_NONBLOCK);
+                n->s->fd = c->pfd[k].fd;
+            }
+            c->pfd[k].fd = -1;
+            waiting--;
+        }
+    }
+    for (k = 0; k < npfd; k++) {
+        if (c->pfd[k].fd >= 0) {
+            astlog(ASTLOG_ERROR, "Cluster node %s: connect timed out",
+                   c->nodes[c->map[k]]->name);
+            close(c->pfd[k].fd);
+        }
+    }
+
+    /* Then all the logins at once */
+    for (k = 0; k < npfd; k++) {
+        n = c->nodes[c->map[k]];
+        if (n->s->fd <= 0)
+            continue;
+        snprintf(params, sizeof(params),
+                 "Username: %s" CRLF "Secret: %s" CRLF "Events: off" CRLF,
+                 n->username, n->secret);
+        if (astman_action_async(n->s, "Login", params, NULL, 0,
+                                deadline ? cluster_remaining(deadline) + 1 : 10000,
+                                cluster_login_done, n) != ASTMAN_SUCCESS)
+            astman_disconnect(n->s);
+    }
+    for (k = 0; k < npfd; k++) {
+        n = c->nodes[c->map[k]];
+        while (n->s->fd > 0 && astman_pending_count(n->s)) {
+            if (astman_poll(n->s, -1) < 0)
+                break;
+        }
+        if (!n->up)
+            astman_disconnect(n->s);
+    }
+
+    for (i = 0; i < c->count; i++)
+        up += c->nodes[i]->up;
+    return up;
+}
+/*******************************************************************************
+ * @fn int astman_cluster_node_count(struct astman_cluster *c)
+ ******************************************************************************/
+int astman_cluster_node_count(struct astman_cluster *c) {
+    return c->count;
+}
+/*******************************************************************************
+ * @fn const char *astman_cluster_node_name(struct astman_cluster *c, int node)
+ ******************************************************************************/
+const char *astman_cluster_node_name(struct astman_cluster *c, int node) {
+    if (node < 0 || node >= c->count)
+        return NULL;
+    return c->nodes[node]->name;
+}
+/*******************************************************************************
+ * @fn int astman_cluster_node_up(struct astman_cluster *c, int node)
+ ******************************************************************************/
+int astman_cluster_node_up(struct astman_cluster *c, int node) {
+    if (node < 0 || node >= c->count)
+        return 0;
+    return c->nodes[node]->up;
+}
+/*******************************************************************************
+ * @fn struct mansession *astman_cluster_session(struct astman_cluster *c,
+ *                                               int node)
+ ******************************************************************************/
+struct mansession *astman_cluster_session(struct astman_cluster *c, int node) {
+    if (node < 0 || node >= c->count)
+        return NULL;
+    return c->nodes[node]->s;
+}
+/*******************************************************************************
+ * @fn static struct cluster_call *cluster_send(struct astman_cluster *c,
+ *                                              const int *nodes, int nnodes,
+ *                                              char *action, char *params,
+ *                                              int flags, int timeout_ms,
+ *                                              ASTMAN_CLUSTER_CALLBACK callback,
+ *                                              void *data, int *sent)
+ * @brief Fan an action out. The returned call holds a reference for the
+ *        caller.
+ ******************************************************************************/
+static struct cluster_call *cluster_send(struct astman_cluster *c,
+                                         const int *nodes, int nnodes,
+                                         char *action, char *params,
+                                         int flags, int timeout_ms,
+                                         ASTMAN_CLUSTER_CALLBACK callback,
+                                         void *data, int *sent) {
+    struct astman_action_result r;
+    struct cluster_call *call;
+    struct cluster_ctx *ctx;
+    int k, i, total;
+
+    *sent = 0;
+    call = calloc(1, sizeof(*call));
+    if (!call)
+        return NULL;
+    call->c = c;
+    call->func = callback;
+    call->data = data;
+    call->refs = 1;
+
+    total = nodes ? nnodes : c->count;
+    for (k = 0; k < total; k++) {
+        i = nodes ? nodes[k] : k;
+        if (i < 0 || i >= c->count)
+            continue;
+        if (c->nodes[i]->up && (ctx = malloc(sizeof(*ctx)))) {
+            ctx->call = call;
+            ctx->node = i;
+            call->refs++;
+            if (astman_action_async(c->nodes[i]->s, action, params, NULL, flags,
+                                    timeout_ms, cluster_done, ctx) == ASTMAN_SUCCESS) {
+                (*sent)++;
+                continue;
+            }
+            call->refs--;
+            free(ctx);
+        }
+        /* Down or unreachable: the node still gets its answer */
+        memset(&r, 0, sizeof(r));
+        r.actionid = "";
+        r.status = ASTMAN_ACTION_ABORTED;
+        r.complete = 1;
+        if (callback)
+            callback(c, i, &r, data);
+    }
+    return call;
+}
+/*******************************************************************************
+ * @fn int astman_cluster_action(struct astman_cluster *c, const int *nodes,
+ *                               int nnodes, char *action, char *params,
+ *                               int flags, int timeout_ms,
+ *                               ASTMAN_CLUSTER_CALLBACK callback, void *data)
+ ******************************************************************************/
+int astman_cluster_action(struct astman_cluster *c, const int *nodes,
+                          int nnodes, char *action, char *params, int flags,
+                          int timeout_ms, ASTMAN_CLUSTER_CALLBACK callback,
+                          void *data) {
+    struct cluster_call *call;
+    int sent;
+
+    call = cluster_send(c, nodes, nnodes, action, params, flags, timeout_ms,
+                        callback, data, &sent);
+    if (call)
+        cluster_call_unref(call);
+    return sent;
+}
+/*******************************************************************************
+ * @fn int astman_cluster_poll(struct astman_cluster *c, int timeout_ms)
+ ******************************************************************************/
+int astman_cluster_poll(struct astman_cluster *c, int timeout_ms) {
+    struct mansession *s;
+    int i, k, n = 0, t, res, completed = 0;
+
+    for (i = 0; i < c->count; i++) {
+        if (!c->nodes[i]->up)
+            continue;
+        s = c->nodes[i]->s;
+        t = astman_async_timeout(s);
+        if (t >= 0 && (timeout_ms < 0 || t < timeout_ms))
+            timeout_ms = t;
+        c->pfd[n].fd = s->fd;
+        c->pfd[n].events = POLLIN;
+        c->pfd[n].revents = 0;
+        c->map[n++] = i;
+    }
+    if (!n)
+        return 0;
+    if (poll(c->pfd, n, timeout_ms) < 0 && errno != EINTR)
+        return 0;
+
+    for (k = 0; k < n; k++) {
+        s = c->nodes[c->map[k]]->s;
+        if (!c->pfd[k].revents && astman_async_timeout(s) != 0)
+            continue;
+        res = astman_poll(s, 0);
+        if (res < 0)
+            cluster_node_lost(c, c->map[k]);
+        else
+            completed += res;
+    }
+    return completed;
+}
+/*******************************************************************************
+ * @fn static int cluster_pending(struct astman_cluster *c)
+ ******************************************************************************/
+static int cluster_pending(struct astman_cluster *c) {
+    int i, pending = 0;
+    for (i = 0; i < c->count; i++)
+        if (c->nodes[i]->up)
+            pending += astman_pending_count(c->nodes[i]->s);
+    return pending;
+}
+/*******************************************************************************
+ * @fn int astman_cluster_wait(struct astman_cluster *c, int timeout_ms)
+ ******************************************************************************/
+int astman_cluster_wait(struct astman_cluster *c, int timeout_ms) {
+    unsigned long long deadline = 0;
+    int pending, left;
+
+    if (timeout_ms >= 0)
+        deadline = astman_metrics_now() + (unsigned long long)timeout_ms * 1000000ULL;
+    while ((pending = cluster_pending(c)) > 0) {
+        left = timeout_ms >= 0 ? cluster_remaining(deadline) : -1;
+        if (timeout_ms >= 0 && !left)
+            break;
+        astman_cluster_poll(c, left);
+    }
+    return pending;
+}
+/*******************************************************************************
+ * @fn int astman_cluster_gather(struct astman_cluster *c, const int *nodes,
+ *                               int nnodes, char *action, char *params,
+ *                               int flags, int timeout_ms,
+ *                               ASTMAN_CLUSTER_CALLBACK callback, void *data)
+ ******************************************************************************/
+int astman_cluster_gather(struct astman_cluster *c, const int *nodes,
+                          int nnodes, char *action, char *params, int flags,
+                          int timeout_ms, ASTMAN_CLUSTER_CALLBACK callback,
+                          void *data) {
+    struct cluster_call *call;
+    int sent, ok;
+
+    call = cluster_send(c, nodes, nnodes, action, params, flags, timeout_ms,
+                        callback, data, &sent);
+    if (!call)
+        return 0;
+    /* Every node completes by its own deadline, or by being lost */
+    while (call->refs > 1 && cluster_pending(c))
+        astman_cluster_poll(c, -1);
+    ok = call->ok;
+    cluster_call_unref(call);
+    return ok;
+}
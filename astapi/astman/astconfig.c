@@ -0,0 +1,615 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astconfig.c
+ *  @brief Parsed and cached view of the GetConfig responses
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "astman.h"
+#include "astlog.h"
+#include "action.h"
+#include "astconfig.h"
+#include "astnames.h"
+/*******************************************************************************
+ * @struct  cfg_var
+ * @brief   One "Line-XXXXXX-YYYYYY: name=value" of a category
+ ******************************************************************************/
+struct cfg_var {
+    char *name;     /**!< variable name */
+    char *value;    /**!< variable value */
+    int hnext;      /**!< next variable in the same hash bucket, -1 = end */
+};
+/*******************************************************************************
+ * @struct  cfg_category
+ * @brief   One "Category-XXXXXX: name" and its lines
+ ******************************************************************************/
+struct cfg_category {
+    char *name;             /**!< category name */
+    int number;             /**!< XXXXXX of Category-XXXXXX */
+    int hnext;              /**!< next category in the same hash bucket */
+    struct cfg_var *vars;   /**!< lines, in file order */
+    int nvars;              /**!< used lines */
+    int lenvars;            /**!< allocated lines */
+    int *buckets;           /**!< variable hash table (indexes into vars) */
+    int nbuckets;           /**!< power of two */
+};
+/*******************************************************************************
+ * @struct  astman_config
+ * @brief   A parsed configuration file
+ ******************************************************************************/
+struct astman_config {
+    char server[INET_ADDRSTRLEN + 8];   /**!< "host:port", key of the cache */
+    char *filename;                 /**!< key of the cache */
+    int refcount;                   /**!< cache + users references */
+    struct cfg_category *cats;      /**!< categories, in file order */
+    int ncats;                      /**!< used categories */
+    int lencats;                    /**!< allocated categories */
+    int *buckets;                   /**!< category hash table */
+    int nbuckets;                   /**!< power of two */
+    int feeding;                    /**!< astman_config_feed(): in a response */
+    int broken;                     /**!< a line could not be stored */
+    struct astman_config *next;     /**!< next cached file */
+};
+/*******************************************************************************
+ * Cached configurations, one per server and filename
+ ******************************************************************************/
+static struct astman_config *_cache = NULL;
+/* sessions of several threads (astshard.c) share the cache */
+static pthread_mutex_t _cache_lock = PTHREAD_MUTEX_INITIALIZER;
+/*******************************************************************************
+ * @fn static unsigned int cfg_hash(const char *str)
+ * @brief Case-insensitive FNV-1a, Asterisk compares names with strcasecmp
+ ******************************************************************************/
+static unsigned int cfg_hash(const char *str) {
+    unsigned int h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char)tolower((unsigned char)*str++);
+        h *= 16777619u;
+    }
+    return h;
+}
+/*******************************************************************************
+ * @fn static int cfg_nbuckets(int n)
+ * @brief Smallest power of two keeping the load factor under 0.5
+ ******************************************************************************/
+static int cfg_nbuckets(int n) {
+    int b = 8;
+    while (b < 2 * n)
+        b <<= 1;
+    return b;
+}
+/*******************************************************************************
+ * @fn static void cfg_server(struct mansession *s, char *buf, size_t len)
+ * @brief "host:port" of the session, sessions to several Asterisk servers
+ *        share the cache
+ ******************************************************************************/
+static void cfg_server(struct mansession *s, char *buf, size_t len) {
+    char host[INET_ADDRSTRLEN] = "";
+    struct in_addr addr = s->sin.sin_addr;
+    inet_ntop(AF_INET, &addr, host, sizeof(host));
+    snprintf(buf, len, "%s:%d", host, ntohs(s->sin.sin_port));
+}
+/*******************************************************************************
+ * @fn static int cfg_match(struct astman_config *cfg, const char *server,
+ *                          const char *filename)
+ * @brief NULL server or filename matches any
+ ******************************************************************************/
+static int cfg_match(struct astman_config *cfg, const char *server,
+                     const char *filename) {
+    return (!server || !strcmp(cfg->server, server)) &&
+           (!filename || !strcmp(cfg->filename, filename));
+}
+/*******************************************************************************
+ * @fn static void cfg_clear(struct astman_config *cfg)
+ * @brief Drop the categories, keep the key
+ ******************************************************************************/
+static void cfg_clear(struct astman_config *cfg) {
+    int x, y;
+    for (x = 0; x < cfg->ncats; x++) {
+        for (y = 0; y < cfg->cats[x].nvars; y++) {
+            free(cfg->cats[x].vars[y].name);
+            free(cfg->cats[x].vars[y].value);
+        }
+        free(cfg->cats[x].vars);
+        free(cfg->cats[x].buckets);
+        free(cfg->cats[x].name);
+    }
+    free(cfg->cats);
+    free(cfg->buckets);
+    cfg->cats = NULL;
+    cfg->ncats = cfg->lencats = 0;
+    cfg->buckets = NULL;
+    cfg->nbuckets = 0;
+    cfg->broken = 0;
+}
+/*******************************************************************************
+ * @fn static void cfg_free(struct astman_config *cfg)
+ ******************************************************************************/
+static void cfg_free(struct astman_config *cfg) {
+    cfg_clear(cfg);
+    free(cfg->filename);
+    free(cfg);
+}
+/*******************************************************************************
+ * @fn static struct cfg_category *cfg_find_category(struct astman_config *cfg,
+ *                                                   const char *name)
+ ******************************************************************************/
+static struct cfg_category *cfg_find_category(struct astman_config *cfg,
+                                              const char *name) {
+    int x;
+    if (!cfg || !name || !cfg->nbuckets)
+        return NULL;
+    for (x = cfg->buckets[cfg_hash(name) & (cfg->nbuckets - 1)];
+         x >= 0; x = cfg->cats[x].hnext) {
+        if (!strcasecmp(cfg->cats[x].name, name))
+            return &cfg->cats[x];
+    }
+    return NULL;
+}
+/*******************************************************************************
+ * @fn static struct cfg_category *cfg_number_category(struct astman_config *cfg,
+ *                                                     int number)
+ * @brief Lines refer to their category by number, which is almost always
+ *        the position of the category (Asterisk numbers them from 0).
+ ******************************************************************************/
+static struct cfg_category *cfg_number_category(struct astman_config *cfg,
+                                                int number) {
+    int x;
+    if (number >= 0 && number < cfg->ncats && cfg->cats[number].number == number)
+        return &cfg->cats[number];
+    for (x = 0; x < cfg->ncats; x++)
+        if (cfg->cats[x].number == number)
+            return &cfg->cats[x];
+    return NULL;
+}
+/*******************************************************************************
+ * @fn static int cfg_add_category(struct astman_config *cfg, int number,
+ *                                 const char *name)
+ ******************************************************************************/
+static int cfg_add_category(struct astman_config *cfg, int number,
+                            const char *name) {
+    struct cfg_category *c;
+    if (cfg->ncats >= cfg->lencats) {
+        c = realloc(cfg->cats, (cfg->lencats * 2 + 8) * sizeof(*c));
+        if (!c)
+            return ASTMAN_FAILURE;
+        cfg->cats = c;
+        cfg->lencats = cfg->lencats * 2 + 8;
+    }
+    c = &cfg->cats[cfg->ncats];
+    memset(c, 0, sizeof(*c));
+    c->name = strdup(name);
+    if (!c->name)
+        return ASTMAN_FAILURE;
+    c->number = number;
+    c->hnext = -1;
+    cfg->ncats++;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static int cfg_add_var(struct cfg_category *c, const char *line)
+ * @brief Split "name=value" and append it to the category
+ ******************************************************************************/
+static int cfg_add_var(struct cfg_category *c, const char *line) {
+    struct cfg_var *v;
+    const char *eq;
+    size_t nlen;
+
+    if (c->nvars >= c->lenvars) {
+        v = realloc(c->vars, (c->lenvars * 2 + 8) * sizeof(*v));
+        if (!v)
+            return ASTMAN_FAILURE;
+        c->vars = v;
+        c->lenvars = c->lenvars * 2 + 8;
+    }
+    v = &c->vars[c->nvars];
+    eq = strchr(line, '=');
+    nlen = eq ? (size_t)(eq - line) : strlen(line);
+    v->name = strndup(line, nlen);
+    v->value = strdup(eq ? eq + 1 : "");
+    v->hnext = -1;
+    if (!v->name || !v->value) {
+        free(v->name);
+        free(v->value);
+        return ASTMAN_FAILURE;
+    }
+    c->nvars++;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static int cfg_build_index(struct astman_config *cfg)
+ * @brief Hash categories and their variables once the parsing is over.
+ *        Repeated variables (allow=, disallow=...) are chained in file order
+ *        so the lookup returns the first one.
+ ******************************************************************************/
+static int cfg_build_index(struct astman_config *cfg) {
+    int x, y, b;
+    struct cfg_category *c;
+
+    cfg->nbuckets = cfg_nbuckets(cfg->ncats);
+    cfg->buckets = malloc(cfg->nbuckets * sizeof(int));
+    if (!cfg->buckets)
+        return ASTMAN_FAILURE;
+    memset(cfg->buckets, 0xff, cfg->nbuckets * sizeof(int));
+    for (x = cfg->ncats - 1; x >= 0; x--) {
+        b = cfg_hash(cfg->cats[x].name) & (cfg->nbuckets - 1);
+        cfg->cats[x].hnext = cfg->buckets[b];
+        cfg->buckets[b] = x;
+    }
+
+    for (x = 0; x < cfg->ncats; x++) {
+        c = &cfg->cats[x];
+        c->nbuckets = cfg_nbuckets(c->nvars);
+        c->buckets = malloc(c->nbuckets * sizeof(int));
+        if (!c->buckets)
+            return ASTMAN_FAILURE;
+        memset(c->buckets, 0xff, c->nbuckets * sizeof(int));
+        for (y = c->nvars - 1; y >= 0; y--) {
+            b = cfg_hash(c->vars[y].name) & (c->nbuckets - 1);
+            c->vars[y].hnext = c->buckets[b];
+            c->buckets[b] = y;
+        }
+    }
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static void cfg_unlink(struct astman_config *cfg)
+ * @brief Remove cfg from the cache and drop the cache reference
+ ******************************************************************************/
+static void cfg_unlink(struct astman_config *cfg) {
+    struct astman_config **p;
+    for (p = &_cache; *p; p = &(*p)->next) {
+        if (*p == cfg) {
+            *p = cfg->next;
+            cfg->next = NULL;
+            astman_config_release(cfg);
+            return;
+        }
+    }
+}
+/*******************************************************************************
+ * @fn static int cfg_line(struct astman_config *cfg, const char *h)
+ * @brief Store a Category-XXXXXX or Line-XXXXXX-YYYYYY header, the others
+ *        are ignored
+ ******************************************************************************/
+static int cfg_line(struct astman_config *cfg, const char *h) {
+    struct cfg_category *c;
+    char *end;
+    long cat;
+
+    if (!strncasecmp(h, "Category-", 9)) {
+        cat = strtol(h + 9, &end, 10);
+        if (end == h + 9 || strncmp(end, ": ", 2))
+            return ASTMAN_SUCCESS;
+        return cfg_add_category(cfg, (int)cat, end + 2);
+    } else if (!strncasecmp(h, "Line-", 5)) {
+        cat = strtol(h + 5, &end, 10);
+        if (end == h + 5 || *end != '-')
+            return ASTMAN_SUCCESS;
+        end = strstr(end, ": ");
+        if (!end)
+            return ASTMAN_SUCCESS;
+        c = cfg_number_category(cfg, (int)cat);
+        if (!c) {
+            astlog(ASTLOG_WARNING, "%s: line for unknown category %ld", cfg->filename, cat);
+            return ASTMAN_SUCCESS;
+        }
+        return cfg_add_var(c, end + 2);
+    }
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn struct astman_config *astman_config_begin(struct mansession *s,
+ *                                               const char *filename)
+ ******************************************************************************/
+struct astman_config *astman_config_begin(struct mansession *s,
+                                          const char *filename) {
+    struct astman_config *cfg;
+
+    if (!s || astman_strlen_zero(filename))
+        return NULL;
+    cfg = calloc(1, sizeof(*cfg));
+    if (!cfg)
+        return NULL;
+    cfg_server(s, cfg->server, sizeof(cfg->server));
+    cfg->filename = strdup(filename);
+    if (!cfg->filename) {
+        free(cfg);
+        return NULL;
+    }
+    /* the builder's reference */
+    cfg->refcount = 1;
+    return cfg;
+}
+/*******************************************************************************
+ * @fn void astman_config_feed(struct astman_config *cfg, struct message *m,
+ *                             const char *line)
+ ******************************************************************************/
+void astman_config_feed(struct astman_config *cfg, struct message *m,
+                        const char *line) {
+    if (!m->hdrcount) {
+        /* a new response starts over, events are skipped */
+        cfg->feeding = !strncasecmp(line, "Response:", 9);
+        if (cfg->feeding)
+            cfg_clear(cfg);
+        return;
+    }
+    if (cfg->feeding && !cfg->broken && cfg_line(cfg, line) != ASTMAN_SUCCESS)
+        cfg->broken = 1;
+}
+/*******************************************************************************
+ * @fn struct astman_config *astman_config_commit(struct astman_config *cfg)
+ ******************************************************************************/
+struct astman_config *astman_config_commit(struct astman_config *cfg) {
+    struct astman_config *old;
+
+    if (!cfg)
+        return NULL;
+    if (cfg->broken || cfg_build_index(cfg) != ASTMAN_SUCCESS) {
+        astlog(ASTLOG_ERROR, "Unable to parse configuration %s", cfg->filename);
+        cfg_free(cfg);
+        return NULL;
+    }
+    /* cache reference + caller reference */
+    cfg->refcount = 2;
+    pthread_mutex_lock(&_cache_lock);
+    for (old = _cache; old; old = old->next) {
+        if (cfg_match(old, cfg->server, cfg->filename)) {
+            cfg_unlink(old);
+            break;
+        }
+    }
+    cfg->next = _cache;
+    _cache = cfg;
+    pthread_mutex_unlock(&_cache_lock);
+    return cfg;
+}
+/*******************************************************************************
+ * @fn struct astman_config *astman_config_parse(struct mansession *s,
+ *                                               const char *filename,
+ *                                               struct message *m)
+ ******************************************************************************/
+struct astman_config *astman_config_parse(struct mansession *s,
+                                          const char *filename,
+                                          struct message *m) {
+    struct astman_config *cfg;
+    int x;
+
+    if (!s || astman_strlen_zero(filename) || !m)
+        return NULL;
+    /* A partial file would answer its missing variables as absent */
+    if (m->hdrcount >= MAX_HEADERS - 1) {
+        astlog(ASTLOG_WARNING, "%s: GetConfig response truncated to %d headers, not cached",
+               filename, MAX_HEADERS);
+        return NULL;
+    }
+    cfg = astman_config_begin(s, filename);
+    if (!cfg)
+        return NULL;
+    for (x = 0; x < m->hdrcount && !cfg->broken; x++)
+        if (cfg_line(cfg, m->headers[x]) != ASTMAN_SUCCESS)
+            cfg->broken = 1;
+    return astman_config_commit(cfg);
+}
+/*******************************************************************************
+ * @fn struct astman_config *astman_config_lookup(struct mansession *s,
+ *                                                const char *filename)
+ ******************************************************************************/
+struct astman_config *astman_config_lookup(struct mansession *s,
+                                           const char *filename) {
+    struct astman_config *cfg;
+    char server[INET_ADDRSTRLEN + 8];
+    if (!s || astman_strlen_zero(filename))
+        return NULL;
+    cfg_server(s, server, sizeof(server));
+    pthread_mutex_lock(&_cache_lock);
+    for (cfg = _cache; cfg; cfg = cfg->next) {
+        if (cfg_match(cfg, server, filename)) {
+            __atomic_add_fetch(&cfg->refcount, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_cache_lock);
+    return cfg;
+}
+/*******************************************************************************
+ * @fn int astman_config_load(struct mansession *s, char *filename,
+ *                            struct astman_config **cfg)
+ ******************************************************************************/
+int astman_config_load(struct mansession *s, char *filename,
+                       struct astman_config **cfg) {
+    struct message m;
+
+    if (!cfg || astman_strlen_zero(filename))
+        return ASTMAN_FAILURE;
+
+    *cfg = astman_config_lookup(s, filename);
+    if (*cfg)
+        return ASTMAN_SUCCESS;
+
+    /* astman_get_config() stores the parsed response in the cache */
+    if (astman_get_config(s, &m, filename, NULL, NULL) != ASTMAN_SUCCESS)
+        return ASTMAN_FAILURE;
+
+    *cfg = astman_config_lookup(s, filename);
+    return *cfg ? ASTMAN_SUCCESS : ASTMAN_FAILURE;
+}
+/*******************************************************************************
+ * @fn void astman_config_release(struct astman_config *cfg)
+ ******************************************************************************/
+void astman_config_release(struct astman_config *cfg) {
+    if (cfg && __atomic_sub_fetch(&cfg->refcount, 1, __ATOMIC_ACQ_REL) <= 0)
+        cfg_free(cfg);
+}
+/*******************************************************************************
+ * @fn void astman_config_invalidate(struct mansession *s,
+ *                                   const char *filename)
+ ******************************************************************************/
+void astman_config_invalidate(struct mansession *s, const char *filename) {
+    struct astman_config *cfg, *next;
+    char server[INET_ADDRSTRLEN + 8];
+    if (s)
+        cfg_server(s, server, sizeof(server));
+    pthread_mutex_lock(&_cache_lock);
+    for (cfg = _cache; cfg; cfg = next) {
+        next = cfg->next;
+        if (cfg_match(cfg, s ? server : NULL, filename)) {
+            astlog(ASTLOG_DEBUG, "Invalidate cached configuration %s of %s",
+                   cfg->filename, cfg->server);
+            cfg_unlink(cfg);
+        }
+    }
+    pthread_mutex_unlock(&_cache_lock);
+}
+/*******************************************************************************
+ * @fn const char *astman_config_get_value(struct astman_config *cfg,
+ *                                         const char *category,
+ *                                         const char *variable)
+ ******************************************************************************/
+const char *astman_config_get_value(struct astman_config *cfg,
+                                    const char *category,
+                                    const char *variable) {
+    struct cfg_category *c;
+    int x;
+
+    c = cfg_find_category(cfg, category);
+    if (!c || !variable)
+        return NULL;
+    for (x = c->buckets[cfg_hash(variable) & (c->nbuckets - 1)];
+         x >= 0; x = c->vars[x].hnext) {
+        if (!strcasecmp(c->vars[x].name, variable))
+            return c->vars[x].value;
+    }
+    return NULL;
+}
+/*******************************************************************************
+ * @fn int astman_config_has_category(struct astman_config *cfg,
+ *                                    const char *category)
+ ******************************************************************************/
+int astman_config_has_category(struct astman_config *cfg, const char *category) {
+    return cfg_find_category(cfg, category) != NULL;
+}
+/*******************************************************************************
+ * @fn int astman_config_category_count(struct astman_config *cfg)
+ ******************************************************************************/
+int astman_config_category_count(struct astman_config *cfg) {
+    return cfg ? cfg->ncats : 0;
+}
+/*******************************************************************************
+ * @fn const char *astman_config_category_name(struct astman_config *cfg, int idx)
+ ******************************************************************************/
+const char *astman_config_category_name(struct astman_config *cfg, int idx) {
+    if (!cfg || idx < 0 || idx >= cfg->ncats)
+        return NULL;
+    return cfg->cats[idx].name;
+}
+/*******************************************************************************
+ * @fn int astman_config_variable_count(struct astman_config *cfg,
+ *                                      const char *category)
+ ******************************************************************************/
+int astman_config_variable_count(struct astman_config *cfg, const char *category) {
+    struct cfg_category *c = cfg_find_category(cfg, category);
+    return c ? c->nvars : 0;
+}
+/*******************************************************************************
+ * @fn int astman_config_variable(struct astman_config *cfg,
+ *                                const char *category, int idx,
+ *                                const char **name, const char **value)
+ ******************************************************************************/
+int astman_config_variable(struct astman_config *cfg, const char *category,
+                           int idx, const char **name, const char **value) {
+    struct cfg_category *c = cfg_find_category(cfg, category);
+    if (!c || idx < 0 || idx >= c->nvars)
+        return ASTMAN_FAILURE;
+    if (name)
+        *name = c->vars[idx].name;
+    if (value)
+        *value = c->vars[idx].value;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static int cfg_add_header(struct message *m, const char *fmt, ...)
+ ******************************************************************************/
+static int cfg_add_header(struct message *m, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+static int cfg_add_header(struct message *m, const char *fmt, ...) {
+    va_list ap;
+    if (m->hdrcount >= MAX_HEADERS - 1)
+        return ASTMAN_FAILURE;
+    va_start(ap, fmt);
+    vsnprintf(m->headers[m->hdrcount], MAX_LEN, fmt, ap);
+    va_end(ap);
+    astman_message_intern(m, m->hdrcount);
+    m->hdrcount++;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_config_to_message(struct astman_config *cfg,
+ *                                  const char *category,
+ *                                  int categories_only,
+ *                                  char *actionid,
+ *                                  struct message *m)
+ ******************************************************************************/
+int astman_config_to_message(struct astman_config *cfg, const char *category,
+                             int categories_only, char *actionid,
+                             struct message *m) {
+    struct cfg_category *c;
+    int x, y, n = 0;
+
+    if (!cfg || !m)
+        return ASTMAN_FAILURE;
+
+    memset(m, 0, sizeof(*m));
+    if (!astman_strlen_zero(category) && !cfg_find_category(cfg, category)) {
+        cfg_add_header(m, "Response: Error");
+        cfg_add_header(m, "Message: Category not found");
+        return ASTMAN_FAILURE;
+    }
+    cfg_add_header(m, "Response: Success");
+    if (!astman_strlen_zero(actionid))
+        cfg_add_header(m, "ActionID: %s", actionid);
+
+    for (x = 0; x < cfg->ncats; x++) {
+        c = &cfg->cats[x];
+        if (!astman_strlen_zero(category) && strcasecmp(c->name, category))
+            continue;
+        if (cfg_add_header(m, "Category-%06d: %s", n, c->name) != ASTMAN_SUCCESS)
+            break;
+        if (!categories_only) {
+            for (y = 0; y < c->nvars; y++) {
+                if (cfg_add_header(m, "Line-%06d-%06d: %s=%s", n, y,
+                                   c->vars[y].name, c->vars[y].value) != ASTMAN_SUCCESS)
+                    break;
+            }
+        }
+        n++;
+    }
+    return ASTMAN_SUCCESS;
+}
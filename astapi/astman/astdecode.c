@@ -0,0 +1,361 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astdecode.c
+ *  @brief Typed event decoding
+ *
+ *  Each event type has a field table built from the FIELD() and
+ *  CHANNEL_FIELDS() macros below: interned header ID, value kind and where
+ *  it lands in struct astman_event. Decoding an event is one pass over its
+ *  headers, each one looked up in its table by ID and converted in place.
+ *  Adding an event or a header only takes a table line (and the name in
+ *  astnames.h).
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <limits.h>
+#include "astman.h"
+#include "astdecode.h"
+#include "astnames.h"
+/*******************************************************************************
+ * @enum    field_kind
+ ******************************************************************************/
+enum field_kind {
+    F_STR,                          /**!< struct astman_slice */
+    F_INT,                          /**!< int */
+    F_LLONG,                        /**!< long long */
+    F_TIME,                         /**!< "sec.usec" into long long (us) */
+    F_STATE,                        /**!< ChannelState number */
+    F_STATEDESC,                    /**!< State name (Asterisk 1.4 - 11) */
+    F_PEERSTATUS,                   /**!< PeerStatus name */
+    F_SUBEVENT                      /**!< Dial SubEvent: Begin / End */
+};
+/*******************************************************************************
+ * @struct  field
+ ******************************************************************************/
+struct field {
+    unsigned short id;              /**!< enum astman_header_id */
+    unsigned char kind;
+    unsigned short off;             /**!< in struct astman_event */
+};
+#define FIELD(id, kind, member) \
+    { ASTMAN_HDR_##id, kind, offsetof(struct astman_event, member) }
+#define CHANNEL_FIELDS(prefix, snap) \
+    FIELD(prefix##CHANNEL,      F_STR,       snap.channel), \
+    FIELD(prefix##UNIQUEID,     F_STR,       snap.uniqueid), \
+    FIELD(prefix##LINKEDID,     F_STR,       snap.linkedid), \
+    FIELD(prefix##CALLERIDNUM,  F_STR,       snap.calleridnum), \
+    FIELD(prefix##CALLERID,     F_STR,       snap.calleridnum), \
+    FIELD(prefix##CALLERIDNAME, F_STR,       snap.calleridname), \
+    FIELD(prefix##CONTEXT,      F_STR,       snap.context), \
+    FIELD(prefix##EXTEN,        F_STR,       snap.exten), \
+    FIELD(prefix##PRIORITY,     F_INT,       snap.priority), \
+    FIELD(prefix##CHANNELSTATE, F_STATE,     snap.state), \
+    FIELD(prefix##STATE,        F_STATEDESC, snap.state)
+#define COMMON_FIELDS \
+    FIELD(TIMESTAMP, F_TIME, timestamp)
+
+static const struct field f_channel[] = {
+    COMMON_FIELDS,
+    CHANNEL_FIELDS(, chan),
+};
+static const struct field f_hangup[] = {
+    COMMON_FIELDS,
+    CHANNEL_FIELDS(, chan),
+    FIELD(CAUSE,                F_INT,  u.hangup.cause),
+    FIELD(CAUSE_TXT,            F_STR,  u.hangup.cause_txt),
+};
+static const struct field f_peerstatus[] = {
+    COMMON_FIELDS,
+    FIELD(CHANNELTYPE,          F_STR,  u.peerstatus.channeltype),
+    FIELD(PEER,                 F_STR,  u.peerstatus.peer),
+    FIELD(PEERSTATUS,           F_PEERSTATUS, u.peerstatus.status),
+    FIELD(CAUSE,                F_STR,  u.peerstatus.cause),
+    FIELD(ADDRESS,              F_STR,  u.peerstatus.address),
+    FIELD(TIME,                 F_INT,  u.peerstatus.time),
+};
+static const struct field f_queuemember[] = {
+    COMMON_FIELDS,
+    FIELD(QUEUE,                F_STR,  u.queuemember.queue),
+    FIELD(INTERFACE,            F_STR,  u.queuemember.interface),
+    FIELD(LOCATION,             F_STR,  u.queuemember.interface),
+    FIELD(MEMBERNAME,           F_STR,  u.queuemember.membername),
+    FIELD(STATEINTERFACE,       F_STR,  u.queuemember.stateinterface),
+    FIELD(STATUS,               F_INT,  u.queuemember.status),
+    FIELD(PENALTY,              F_INT,  u.queuemember.penalty),
+    FIELD(CALLSTAKEN,           F_INT,  u.queuemember.callstaken),
+    FIELD(LASTCALL,             F_LLONG, u.queuemember.lastcall),
+    FIELD(PAUSED,               F_INT,  u.queuemember.paused),
+    FIELD(INCALL,               F_INT,  u.queuemember.incall),
+};
+static const struct field f_varset[] = {
+    COMMON_FIELDS,
+    CHANNEL_FIELDS(, chan),
+    FIELD(VARIABLE,             F_STR,  u.varset.variable),
+    FIELD(VALUE,                F_STR,  u.varset.value),
+};
+static const struct field f_dial[] = {
+    COMMON_FIELDS,
+    CHANNEL_FIELDS(, chan),
+    CHANNEL_FIELDS(DEST, u.dial.dest),
+    FIELD(DESTINATION,          F_STR,  u.dial.dest.channel),
+    FIELD(DIALSTRING,           F_STR,  u.dial.dialstring),
+    FIELD(DIALSTATUS,           F_STR,  u.dial.dialstatus),
+    FIELD(SUBEVENT,             F_SUBEVENT, type),
+};
+static const struct field f_bridge[] = {
+    COMMON_FIELDS,
+    CHANNEL_FIELDS(, chan),
+    FIELD(BRIDGEUNIQUEID,       F_STR,  u.bridge.uniqueid),
+    FIELD(BRIDGETYPE,           F_STR,  u.bridge.type),
+    FIELD(BRIDGETECHNOLOGY,     F_STR,  u.bridge.technology),
+    FIELD(BRIDGENUMCHANNELS,    F_INT,  u.bridge.numchannels),
+};
+#define TABLE(t) { t, sizeof(t) / sizeof(t[0]) }
+/*******************************************************************************
+ * @brief   Field table of each event type
+ ******************************************************************************/
+static const struct {
+    const struct field *f;
+    int count;
+} tables[ASTMAN_EV_COUNT] = {
+    [ASTMAN_EV_NEWCHANNEL]          = TABLE(f_channel),
+    [ASTMAN_EV_NEWSTATE]            = TABLE(f_channel),
+    [ASTMAN_EV_HANGUP]              = TABLE(f_hangup),
+    [ASTMAN_EV_PEERSTATUS]          = TABLE(f_peerstatus),
+    [ASTMAN_EV_QUEUEMEMBERSTATUS]   = TABLE(f_queuemember),
+    [ASTMAN_EV_VARSET]              = TABLE(f_varset),
+    [ASTMAN_EV_DIALBEGIN]           = TABLE(f_dial),
+    [ASTMAN_EV_DIALEND]             = TABLE(f_dial),
+    [ASTMAN_EV_BRIDGEENTER]         = TABLE(f_bridge),
+    [ASTMAN_EV_BRIDGELEAVE]         = TABLE(f_bridge),
+};
+/*******************************************************************************
+ * @brief   Decoded type of each interned Event ("Dial" is the 1.4 - 11 form
+ *          of DialBegin/DialEnd)
+ ******************************************************************************/
+static const unsigned char types[ASTMAN_EVT_IDS] = {
+    [ASTMAN_EVT_NEWCHANNEL]         = ASTMAN_EV_NEWCHANNEL,
+    [ASTMAN_EVT_NEWSTATE]           = ASTMAN_EV_NEWSTATE,
+    [ASTMAN_EVT_HANGUP]             = ASTMAN_EV_HANGUP,
+    [ASTMAN_EVT_PEERSTATUS]         = ASTMAN_EV_PEERSTATUS,
+    [ASTMAN_EVT_QUEUEMEMBERSTATUS]  = ASTMAN_EV_QUEUEMEMBERSTATUS,
+    [ASTMAN_EVT_VARSET]             = ASTMAN_EV_VARSET,
+    [ASTMAN_EVT_DIALBEGIN]          = ASTMAN_EV_DIALBEGIN,
+    [ASTMAN_EVT_DIALEND]            = ASTMAN_EV_DIALEND,
+    [ASTMAN_EVT_DIAL]               = ASTMAN_EV_DIALBEGIN,
+    [ASTMAN_EVT_BRIDGEENTER]        = ASTMAN_EV_BRIDGEENTER,
+    [ASTMAN_EVT_BRIDGELEAVE]        = ASTMAN_EV_BRIDGELEAVE,
+};
+/*******************************************************************************
+ * @brief   State names, in AST_STATE_* order
+ ******************************************************************************/
+static const char *state_names[] = {
+    "Down", "Rsrvd", "OffHook", "Dialing", "Ring", "Ringing", "Up", "Busy",
+    "Dialing Offhook", "Pre-ring"
+};
+/*******************************************************************************
+ * @brief   PeerStatus names, in enum astman_peer_status order
+ ******************************************************************************/
+static const char *peer_status_names[] = {
+    "Unknown", "Registered", "Unregistered", "Reachable", "Unreachable",
+    "Lagged", "Rejected"
+};
+/*******************************************************************************
+ * @fn static int decode_name(const char **names, int count, const char *str)
+ * @return index of str in names, -1 if none
+ ******************************************************************************/
+static int decode_name(const char **names, int count, const char *str) {
+    int x;
+    for (x = 0; x < count; x++) {
+        if (!strcasecmp(names[x], str))
+            return x;
+    }
+    return -1;
+}
+/*******************************************************************************
+ * @fn int astman_parse_int(const char *str, int len, long long *val)
+ ******************************************************************************/
+int astman_parse_int(const char *str, int len, long long *val) {
+    unsigned long long n = 0;
+    int neg = 0, x = 0;
+
+    if (len > 0 && (*str == '-' || *str == '+')) {
+        neg = *str == '-';
+        x++;
+    }
+    if (x >= len)
+        return ASTMAN_FAILURE;
+    for (; x < len; x++) {
+        unsigned int d = (unsigned char)str[x] - '0';
+        if (d > 9 || n > (ULLONG_MAX - d) / 10)
+            return ASTMAN_FAILURE;
+        n = n * 10 + d;
+    }
+    if (n > (unsigned long long)LLONG_MAX + neg)
+        return ASTMAN_FAILURE;
+    *val = neg ? (long long)(0 - n) : (long long)n;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static long long decode_time(const char *str, int len)
+ * @brief "1276161211.123456" into microseconds, -1 if malformed
+ ******************************************************************************/
+static long long decode_time(const char *str, int len) {
+    long long sec, usec = 0;
+    int dot, x;
+
+    for (dot = 0; dot < len && str[dot] != '.'; dot++)
+        ;
+    if (astman_parse_int(str, dot, &sec) != ASTMAN_SUCCESS || sec < 0)
+        return -1;
+    /* Six digits of fraction, pad or truncate */
+    for (x = 1; x <= 6; x++) {
+        unsigned int d = dot + x < len ? (unsigned char)str[dot + x] - '0' : 0;
+        if (d > 9)
+            return -1;
+        usec = usec * 10 + d;
+    }
+    return sec * 1000000 + usec;
+}
+/*******************************************************************************
+ * @fn int astman_event_type(const char *event)
+ ******************************************************************************/
+int astman_event_type(const char *event) {
+    return types[astman_event_id(event, -1)];
+}
+/*******************************************************************************
+ * @fn static void decode_defaults(struct astman_event *ev,
+ *                                 const struct field *f, int count)
+ * @brief Missing strings are "", missing numbers -1
+ ******************************************************************************/
+static void decode_defaults(struct astman_event *ev, const struct field *f,
+                            int count) {
+    char *base = (char *)ev;
+    struct astman_slice *sl;
+    int x;
+
+    for (x = 0; x < count; x++) {
+        switch (f[x].kind) {
+        case F_STR:
+            sl = (struct astman_slice *)(base + f[x].off);
+            sl->ptr = "";
+            sl->len = 0;
+            break;
+        case F_INT:
+            *(int *)(base + f[x].off) = -1;
+            break;
+        case F_LLONG:
+            *(long long *)(base + f[x].off) = -1;
+            break;
+        case F_STATE:
+        case F_STATEDESC:
+            *(int *)(base + f[x].off) = ASTMAN_STATE_UNKNOWN;
+            break;
+        default:
+            break;
+        }
+    }
+}
+/*******************************************************************************
+ * @fn static void decode_field(struct astman_event *ev, const struct field *f,
+ *                              const char *val, int len)
+ ******************************************************************************/
+static void decode_field(struct astman_event *ev, const struct field *f,
+                         const char *val, int len) {
+    char *p = (char *)ev + f->off;
+    struct astman_slice *sl;
+    long long n;
+    int x;
+
+    switch (f->kind) {
+    case F_STR:
+        sl = (struct astman_slice *)p;
+        sl->ptr = val;
+        sl->len = len;
+        break;
+    case F_INT:
+    case F_STATE:
+        if (astman_parse_int(val, len, &n) == ASTMAN_SUCCESS &&
+            n >= INT_MIN && n <= INT_MAX)
+            *(int *)p = (int)n;
+        break;
+    case F_LLONG:
+        if (astman_parse_int(val, len, &n) == ASTMAN_SUCCESS)
+            *(long long *)p = n;
+        break;
+    case F_TIME:
+        n = decode_time(val, len);
+        if (n >= 0)
+            *(long long *)p = n;
+        break;
+    case F_STATEDESC:
+        x = decode_name(state_names, sizeof(state_names) / sizeof(state_names[0]), val);
+        if (x >= 0)
+            *(int *)p = x;
+        break;
+    case F_PEERSTATUS:
+        x = decode_name(peer_status_names,
+                        sizeof(peer_status_names) / sizeof(peer_status_names[0]), val);
+        *(int *)p = x > 0 ? x : ASTMAN_PEER_UNKNOWN;
+        break;
+    case F_SUBEVENT:
+        if (!strcasecmp(val, "End"))
+            *(int *)p = ASTMAN_EV_DIALEND;
+        break;
+    }
+}
+/*******************************************************************************
+ * @fn int astman_event_decode(struct message *m, struct astman_event *ev)
+ ******************************************************************************/
+int astman_event_decode(struct message *m, struct astman_event *ev) {
+    const struct field *f;
+    const char *h, *val;
+    int x, y, id, count, nlen;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->type = types[astman_message_event(m)];
+    if (ev->type == ASTMAN_EV_UNKNOWN)
+        return ASTMAN_FAILURE;
+    f = tables[ev->type].f;
+    count = tables[ev->type].count;
+    decode_defaults(ev, f, count);
+    for (x = 0; x < m->hdrcount; x++) {
+        h = m->headers[x];
+        for (nlen = 0; h[nlen] && h[nlen] != ':'; nlen++)
+            ;
+        if (!h[nlen])
+            continue;
+        id = m->hdrid[x];
+        if (id == ASTMAN_HDR_NONE || id >= ASTMAN_HDR_IDS)
+            id = astman_header_id(h, nlen);
+        for (y = 0; y < count; y++) {
+            if (f[y].id == id) {
+                for (val = h + nlen + 1; *val == ' '; val++)
+                    ;
+                decode_field(ev, &f[y], val, strlen(val));
+                break;
+            }
+        }
+    }
+    return ASTMAN_SUCCESS;
+}
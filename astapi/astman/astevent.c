@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include "astman.h"
 #include "astevent.h"
+#include "astnames.h"
 
 /*******************************************************************************
  *  \fn astman_add_param(char *buf, int buflen, char *header, char *value)
@@ -40,11 +41,10 @@
  ******************************************************************************/
 int astman_sippeers_callback(struct mansession *s __attribute__((unused)),
                              struct message *m) {
-  char event[80];
-  strncpy(event, astman_get_header(m, ASTMAN_HEADER_EVENT), sizeof(event));
+  int event = astman_message_event(m);
 
-  if (!strcasecmp(event, ASTMAN_EVENT_PEER_ENTRY) ||
-      !strcasecmp(event, ASTMAN_EVENT_PEER_LIST_COMPLETE)) {
+  if (event == ASTMAN_EVT_PEERENTRY ||
+      event == ASTMAN_EVT_PEERLISTCOMPLETE) {
     return 1; /* return wait_for_answer() */
   }
   return 0;
@@ -60,11 +60,10 @@ int astman_sippeers_callback(struct mansession *s __attribute__((unused)),
  ******************************************************************************/
 int astman_sipshowregistry_callback(struct mansession *s __attribute__((unused)),
                              struct message *m) {
-  char event[80];
-  strncpy(event, astman_get_header(m, ASTMAN_HEADER_EVENT), sizeof(event));
+  int event = astman_message_event(m);
 
-  if (!strcasecmp(event, ASTMAN_EVENT_REGISTRY_ENTRY) ||
-      !strcasecmp(event, ASTMAN_EVENT_REGISTRATIONS_COMPLETE)) {
+  if (event == ASTMAN_EVT_REGISTRYENTRY ||
+      event == ASTMAN_EVT_REGISTRATIONSCOMPLETE) {
     return 1; /* return wait_for_answer() */
   }
   return 0;
@@ -80,13 +79,12 @@ int astman_sipshowregistry_callback(struct mansession *s __attribute__((unused))
  ******************************************************************************/
 int astman_queues_callback(struct mansession *s __attribute__((unused)),
                            struct message *m) {
-  char event[80];
-  strncpy(event, astman_get_header(m, ASTMAN_HEADER_EVENT), sizeof(event));
+  int event = astman_message_event(m);
 
-  if (!strcasecmp(event, ASTMAN_EVENT_QUEUE_ENTER) ||
-      !strcasecmp(event, ASTMAN_EVENT_QUEUE_MEMBER) ||
-      !strcasecmp(event, ASTMAN_EVENT_QUEUE_PARAMS)  ||
-      !strcasecmp(event, ASTMAN_EVENT_QUEUE_STATUS_COMPLETE)) {
+  if (event == ASTMAN_EVT_QUEUEENTER ||
+      event == ASTMAN_EVT_QUEUEMEMBER ||
+      event == ASTMAN_EVT_QUEUEPARAMS  ||
+      event == ASTMAN_EVT_QUEUESTATUSCOMPLETE) {
     return 1; /* return wait_for_answer() */
   }
   return 0;
@@ -103,11 +101,10 @@ int astman_queues_callback(struct mansession *s __attribute__((unused)),
  ******************************************************************************/
 int astman_status_callback(struct mansession *s __attribute__((unused)),
                            struct message *m) {
-  char event[80];
-  strncpy(event, astman_get_header(m, ASTMAN_HEADER_EVENT), sizeof(event));
+  int event = astman_message_event(m);
 
-  if (!strcasecmp(event, ASTMAN_EVENT_STATUS)  ||
-      !strcasecmp(event, ASTMAN_EVENT_STATUS_COMPLETE)) {
+  if (event == ASTMAN_EVT_STATUS  ||
+      event == ASTMAN_EVT_STATUSCOMPLETE) {
     return 1; /* return wait_for_answer() */
   }
   return 0;
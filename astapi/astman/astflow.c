@@ -0,0 +1,352 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astflow.c
+ *  @brief Flow control of event subscriptions. A queue is a list of
+ *         compact message copies attached to its subscription; shedding
+ *         skips the critical events, they are the ones consumers rebuild
+ *         their state from.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astnames.h"
+#include "astsub.h"
+#include "astmem.h"
+#include "astflow.h"
+/*******************************************************************************
+ * @struct  flow_entry
+ * @brief   A queued event, only its used headers are allocated
+ ******************************************************************************/
+struct flow_entry {
+    struct flow_entry *next;
+    ASTMAN_EVENT_CALLBACK func;
+    size_t size;                /**!< of the entry, accounted */
+    int critical;
+    char m[];                   /**!< astman_message_pack() */
+};
+/*******************************************************************************
+ * @struct  flow_queue
+ ******************************************************************************/
+struct flow_queue {
+    struct flow_queue *next;
+    char *event;                /**!< subscription */
+    struct flow_entry *head;
+    struct flow_entry *tail;
+    int count;
+    int depth;
+    int policy;
+    int sample;
+    unsigned int seen;          /**!< events arrived on a full queue */
+    struct astman_flow_stats stats;
+};
+/*******************************************************************************
+ * @struct  astman_flow
+ ******************************************************************************/
+struct astman_flow {
+    struct flow_queue *queues;
+    struct flow_queue *turn;    /**!< next queue to drain */
+    struct message *scratch;    /**!< full size copy for the callbacks */
+    int draining;
+};
+/*******************************************************************************
+ * @fn int astman_flow_critical(int event)
+ ******************************************************************************/
+int astman_flow_critical(int event) {
+    switch (event) {
+    case ASTMAN_EVT_NEWCHANNEL:
+    case ASTMAN_EVT_HANGUP:
+    case ASTMAN_EVT_HANGUPREQUEST:
+    case ASTMAN_EVT_SOFTHANGUPREQUEST:
+    case ASTMAN_EVT_RENAME:
+    case ASTMAN_EVT_MASQUERADE:
+    case ASTMAN_EVT_DIAL:
+    case ASTMAN_EVT_DIALBEGIN:
+    case ASTMAN_EVT_DIALEND:
+    case ASTMAN_EVT_BRIDGE:
+    case ASTMAN_EVT_BRIDGEENTER:
+    case ASTMAN_EVT_BRIDGELEAVE:
+    case ASTMAN_EVT_LINK:
+    case ASTMAN_EVT_UNLINK:
+    case ASTMAN_EVT_ORIGINATERESPONSE:
+    case ASTMAN_EVT_CDR:
+    case ASTMAN_EVT_SHUTDOWN:
+    case ASTMAN_EVT_FULLYBOOTED:
+    case ASTMAN_EVT_RELOAD:
+        return 1;
+    default:
+        return 0;
+    }
+}
+/*******************************************************************************
+ * @fn static struct flow_queue *flow_find(struct astman_flow *f,
+ *                                         const char *event)
+ ******************************************************************************/
+static struct flow_queue *flow_find(struct astman_flow *f, const char *event) {
+    struct flow_queue *q;
+
+    for (q = f ? f->queues : NULL; q; q = q->next)
+        if (!strcasecmp(q->event, event))
+            return q;
+    return NULL;
+}
+/*******************************************************************************
+ * @fn static struct flow_entry *flow_pop(struct mansession *s,
+ *                                        struct flow_queue *q,
+ *                                        int droppable)
+ * @brief Unlink the first entry (the first non critical one if droppable)
+ ******************************************************************************/
+static struct flow_entry *flow_pop(struct flow_queue *q, int droppable) {
+    struct flow_entry **pp, *e, *prev = NULL;
+
+    for (pp = &q->head; (e = *pp); prev = e, pp = &e->next)
+        if (!droppable || !e->critical)
+            break;
+    if (!e)
+        return NULL;
+    *pp = e->next;
+    if (q->tail == e)
+        q->tail = prev;
+    q->count--;
+    return e;
+}
+/*******************************************************************************
+ * @fn static void flow_drop(struct mansession *s, struct flow_entry *e)
+ ******************************************************************************/
+static void flow_drop(struct mansession *s, struct flow_entry *e) {
+    astman_mem_release(s, ASTMAN_MEM_QUEUES, e->size);
+    free(e);
+}
+/*******************************************************************************
+ * @fn int astman_flow_push(struct mansession *s, void *queue,
+ *                          ASTMAN_EVENT_CALLBACK func, struct message *m)
+ ******************************************************************************/
+int astman_flow_push(struct mansession *s, void *queue,
+                     ASTMAN_EVENT_CALLBACK func, struct message *m) {
+    struct flow_queue *q = queue;
+    struct flow_entry *e;
+    int critical = astman_flow_critical(astman_message_event(m));
+    size_t size;
+
+    if (q->count >= q->depth) {
+        if (critical) {
+            q->stats.kept++;
+        } else if (q->policy == ASTMAN_FLOW_DROP_NEWEST) {
+            q->stats.dropped++;
+            return ASTMAN_SUCCESS;
+        } else if (q->policy == ASTMAN_FLOW_SAMPLE && ++q->seen % q->sample) {
+            q->stats.sampled++;
+            return ASTMAN_SUCCESS;
+        } else if ((e = flow_pop(q, 1))) {
+            flow_drop(s, e);
+            if (q->policy == ASTMAN_FLOW_SAMPLE)
+                q->stats.sampled++;
+            else
+                q->stats.dropped++;
+        } else {
+            /* only critical events waiting */
+            q->stats.dropped++;
+            return ASTMAN_SUCCESS;
+        }
+    }
+    size = offsetof(struct flow_entry, m) + astman_message_packed_size(m);
+    if (astman_mem_charge(s, ASTMAN_MEM_QUEUES, size) != ASTMAN_MEM_OK ||
+        !(e = malloc(size))) {
+        if (critical)
+            return ASTMAN_FAILURE;
+        q->stats.dropped++;
+        return ASTMAN_SUCCESS;
+    }
+    e->next = NULL;
+    e->func = func;
+    e->size = size;
+    e->critical = critical;
+    astman_message_pack(e->m, m);
+    if (q->tail)
+        q->tail->next = e;
+    else
+        q->head = e;
+    q->tail = e;
+    if (++q->count > q->stats.peak)
+        q->stats.peak = q->count;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static int flow_deliver(struct mansession *s, struct flow_queue *q)
+ * @return 1 if an event was delivered
+ ******************************************************************************/
+static int flow_deliver(struct mansession *s, struct flow_queue *q) {
+    struct astman_flow *f = s->flow;
+    struct flow_entry *e = flow_pop(q, 0);
+    ASTMAN_EVENT_CALLBACK func;
+
+    if (!e)
+        return 0;
+    astman_message_unpack(f->scratch, e->m);
+    q->stats.delivered++;
+    func = e->func;
+    flow_drop(s, e);
+    /* timed by the profiler as if delivered on arrival */
+    if (astman_call_handler(s, astman_get_header_id(f->scratch, ASTMAN_HDR_EVENT),
+                            func, f->scratch, 0) < 0)
+        astlog(ASTLOG_WARNING, "%s handler error", q->event);
+    return 1;
+}
+/*******************************************************************************
+ * @fn int astman_flow_drain(struct mansession *s, int max)
+ ******************************************************************************/
+int astman_flow_drain(struct mansession *s, int max) {
+    struct astman_flow *f = s->flow;
+    struct flow_queue *q;
+    int n = 0, idle = 0, nqueues = 0;
+
+    if (!f || f->draining)
+        return 0;
+    for (q = f->queues; q; q = q->next)
+        nqueues++;
+    f->draining = 1;
+    /* One event per queue in turn, until every queue is empty */
+    while (nqueues && idle < nqueues && (max <= 0 || n < max)) {
+        if (!f->turn)
+            f->turn = f->queues;
+        q = f->turn;
+        f->turn = q->next;
+        if (flow_deliver(s, q)) {
+            n++;
+            idle = 0;
+        } else {
+            idle++;
+        }
+    }
+    f->draining = 0;
+    return n;
+}
+/*******************************************************************************
+ * @fn static void flow_queue_free(struct mansession *s, struct flow_queue *q)
+ ******************************************************************************/
+static void flow_queue_free(struct mansession *s, struct flow_queue *q) {
+    struct flow_entry *e;
+
+    while ((e = flow_pop(q, 0)))
+        flow_drop(s, e);
+    free(q->event);
+    free(q);
+}
+/*******************************************************************************
+ * @fn int astman_set_flow(struct mansession *s, char *event, int depth,
+ *                         int policy, int sample)
+ ******************************************************************************/
+int astman_set_flow(struct mansession *s, char *event, int depth, int policy,
+                    int sample) {
+    struct astman_flow *f = s->flow;
+    struct flow_queue *q, **pp;
+
+    if (astman_strlen_zero(event))
+        return ASTMAN_FAILURE;
+    q = flow_find(f, event);
+    if (depth <= 0) {
+        if (!q)
+            return ASTMAN_SUCCESS;
+        astman_subs_set_data(s->subs, event, NULL);
+        while (!f->draining && flow_deliver(s, q))
+            ;
+        for (pp = &f->queues; *pp != q; pp = &(*pp)->next)
+            ;
+        *pp = q->next;
+        if (f->turn == q)
+            f->turn = q->next;
+        flow_queue_free(s, q);
+        return ASTMAN_SUCCESS;
+    }
+    if (policy < ASTMAN_FLOW_DROP_OLDEST || policy > ASTMAN_FLOW_SAMPLE ||
+        (policy == ASTMAN_FLOW_SAMPLE && sample <= 0))
+        return ASTMAN_FAILURE;
+    if (!f) {
+        f = calloc(1, sizeof(*f));
+        if (!f)
+            return ASTMAN_FAILURE;
+        f->scratch = malloc(sizeof(struct message));
+        if (!f->scratch) {
+            free(f);
+            return ASTMAN_FAILURE;
+        }
+        s->flow = f;
+    }
+    if (!q) {
+        q = calloc(1, sizeof(*q));
+        if (!q || !(q->event = strdup(event))) {
+            free(q);
+            return ASTMAN_FAILURE;
+        }
+        q->next = f->queues;
+        f->queues = q;
+    }
+    q->depth = depth;
+    q->policy = policy;
+    q->sample = sample;
+    /* (re)attached: a handler registered again loses it */
+    if (astman_subs_set_data(s->subs, event, q) != ASTMAN_SUCCESS) {
+        astlog(ASTLOG_ERROR, "No subscription to %s", event);
+        for (pp = &f->queues; *pp != q; pp = &(*pp)->next)
+            ;
+        *pp = q->next;
+        if (f->turn == q)
+            f->turn = q->next;
+        flow_queue_free(s, q);
+        return ASTMAN_FAILURE;
+    }
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_flow_stats(struct mansession *s, char *event,
+ *                           struct astman_flow_stats *st)
+ ******************************************************************************/
+int astman_flow_stats(struct mansession *s, char *event,
+                      struct astman_flow_stats *st) {
+    struct flow_queue *q = flow_find(s->flow, event);
+
+    if (!q || !st)
+        return ASTMAN_FAILURE;
+    *st = q->stats;
+    st->queued = q->count;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn void astman_flow_free(struct mansession *s)
+ ******************************************************************************/
+void astman_flow_free(struct mansession *s) {
+    struct astman_flow *f = s->flow;
+    struct flow_queue *q;
+
+    if (!f)
+        return;
+    while ((q = f->queues)) {
+        f->queues = q->next;
+        flow_queue_free(s, q);
+    }
+    free(f->scratch);
+    free(f);
+    s->flow = NULL;
+}
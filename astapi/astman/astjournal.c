@@ -0,0 +1,719 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astjournal.c
+ *  @brief Durable event journal
+ *
+ *  A segment is a file named after its first sequence number, allocated to
+ *  its full size and mapped shared. After a small header come the frames:
+ *  length, CRC-32, sequence number, wall clock time, then the headers of
+ *  the event one after another, NUL terminated. A zero length ends the
+ *  segment (the file is zero filled). The writer publishes the next
+ *  sequence number once a frame is complete, readers never look past it.
+ *  Cursors are one 8 byte file each.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astmetrics.h"
+#include "astnames.h"
+#include "astjournal.h"
+/*******************************************************************************
+ *  \def JOURNAL_MAGIC
+ *  \brief  First bytes of a segment
+ ******************************************************************************/
+#define JOURNAL_MAGIC           "ASTJRNL1"
+/*******************************************************************************
+ *  \def JOURNAL_HEADER
+ *  \brief  Segment header size, the first frame follows
+ ******************************************************************************/
+#define JOURNAL_HEADER          64
+/*******************************************************************************
+ *  \def JOURNAL_MIN_SEGMENT
+ ******************************************************************************/
+#define JOURNAL_MIN_SEGMENT     (64 * 1024)
+#define JOURNAL_ALIGN(n)        (((n) + 7) & ~(size_t)7)
+/*******************************************************************************
+ * @struct  jframe
+ * @brief   Frame header, the payload follows (padded to 8 bytes)
+ ******************************************************************************/
+struct jframe {
+    uint32_t len;                   /**!< payload bytes, 0 = end of segment */
+    uint32_t crc;                   /**!< CRC-32 of seq, time and payload */
+    uint64_t seq;
+    uint64_t time;                  /**!< CLOCK_REALTIME (ns) */
+};
+/*******************************************************************************
+ * @struct  jsegment
+ ******************************************************************************/
+struct jsegment {
+    unsigned long long first;       /**!< sequence number of its first frame */
+    char *map;
+    size_t size;
+    int fd;
+};
+/*******************************************************************************
+ * @struct  astman_journal_cursor
+ ******************************************************************************/
+struct astman_journal_cursor {
+    struct astman_journal *j;
+    char name[MAX_NAME_LEN];
+    int fd;                         /**!< its position file */
+    unsigned long long seq;         /**!< next event to read */
+    unsigned long long committed;   /**!< stored position (atomic) */
+    unsigned long long seg_first;   /**!< segment off is in, 0 = unknown */
+    size_t off;                     /**!< next frame to look at */
+    struct astman_journal_cursor *next;
+};
+/*******************************************************************************
+ * @struct  astman_journal
+ ******************************************************************************/
+struct astman_journal {
+    char *dir;
+    struct astman_journal_config cfg;
+    pthread_mutex_t lock;           /**!< segment list and cursors */
+    struct jsegment *segs;          /**!< oldest first, the last one is written */
+    int nsegs;
+    int cap;
+    size_t end;                     /**!< write offset in the last segment */
+    size_t synced;                  /**!< synced up to there */
+    unsigned long long next_seq;    /**!< published (release) after a frame */
+    int unsynced;                   /**!< appends since the last sync */
+    unsigned long long unsynced_since; /**!< time of the oldest one (ns) */
+    struct astman_journal_cursor *cursors;
+};
+
+static uint32_t _crc_table[256];
+static pthread_once_t _crc_once = PTHREAD_ONCE_INIT;
+/*******************************************************************************
+ * @fn static void jnl_crc_init(void)
+ ******************************************************************************/
+static void jnl_crc_init(void) {
+    uint32_t c;
+    int x, y;
+    for (x = 0; x < 256; x++) {
+        c = (uint32_t)x;
+        for (y = 0; y < 8; y++)
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        _crc_table[x] = c;
+    }
+}
+/*******************************************************************************
+ * @fn static uint32_t jnl_crc(uint32_t crc, const void *data, size_t len)
+ ******************************************************************************/
+static uint32_t jnl_crc(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *p = data;
+    crc = ~crc;
+    while (len--)
+        crc = _crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+/*******************************************************************************
+ * @fn static uint32_t jnl_frame_crc(const struct jframe *f)
+ ******************************************************************************/
+static uint32_t jnl_frame_crc(const struct jframe *f) {
+    uint32_t crc = jnl_crc(0, &f->seq, sizeof(f->seq) + sizeof(f->time));
+    return jnl_crc(crc, f + 1, f->len);
+}
+/*******************************************************************************
+ * @fn static int jnl_map(struct jsegment *seg, const char *path, size_t size)
+ * @param size: 0 maps an existing segment, else creates one of that size
+ ******************************************************************************/
+static int jnl_map(struct jsegment *seg, const char *path, size_t size) {
+    struct stat st;
+    int err;
+
+    seg->fd = open(path, O_RDWR | (size ? O_CREAT | O_EXCL : 0) | O_CLOEXEC, 0640);
+    if (seg->fd < 0)
+        goto Error;
+    if (size) {
+        /* Reserve the blocks: a full disk must not SIGBUS the writer */
+        err = posix_fallocate(seg->fd, 0, size);
+        if (err) {
+            errno = err;
+            goto Error;
+        }
+    } else {
+        if (fstat(seg->fd, &st) < 0)
+            goto Error;
+        size = st.st_size;
+        if (size < JOURNAL_HEADER) {
+            errno = EINVAL;
+            goto Error;
+        }
+    }
+    seg->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+    if (seg->map == MAP_FAILED)
+        goto Error;
+    seg->size = size;
+    return ASTMAN_SUCCESS;
+Error:
+    astlog(ASTLOG_ERROR, "journal segment %s: %s", path, strerror(errno));
+    if (seg->fd >= 0) {
+        close(seg->fd);
+        if (size)
+            unlink(path);
+    }
+    seg->fd = -1;
+    seg->map = NULL;
+    return ASTMAN_FAILURE;
+}
+/*******************************************************************************
+ * @fn static void jnl_path(struct astman_journal *j, char *buf, size_t len,
+ *                          unsigned long long first)
+ ******************************************************************************/
+static void jnl_path(struct astman_journal *j, char *buf, size_t len,
+                     unsigned long long first) {
+    snprintf(buf, len, "%s/%020llu.journal", j->dir, first);
+}
+/*******************************************************************************
+ * @fn static int jnl_segment_add(struct astman_journal *j,
+ *                                unsigned long long first, int create)
+ ******************************************************************************/
+static int jnl_segment_add(struct astman_journal *j, unsigned long long first,
+                           int create) {
+    char path[PATH_MAX];
+    struct jsegment *seg;
+
+    if (j->nsegs == j->cap) {
+        seg = realloc(j->segs, (j->cap ? j->cap * 2 : 16) * sizeof(*seg));
+        if (!seg)
+            return ASTMAN_FAILURE;
+        j->segs = seg;
+        j->cap = j->cap ? j->cap * 2 : 16;
+    }
+    seg = &j->segs[j->nsegs];
+    memset(seg, 0, sizeof(*seg));
+    seg->first = first;
+    jnl_path(j, path, sizeof(path), first);
+    if (jnl_map(seg, path, create ? j->cfg.segment_size : 0) != ASTMAN_SUCCESS)
+        return ASTMAN_FAILURE;
+    if (create) {
+        memcpy(seg->map, JOURNAL_MAGIC, 8);
+        memcpy(seg->map + 8, &first, sizeof(first));
+    } else if (memcmp(seg->map, JOURNAL_MAGIC, 8)) {
+        astlog(ASTLOG_ERROR, "journal segment %s: bad magic", path);
+        munmap(seg->map, seg->size);
+        close(seg->fd);
+        return ASTMAN_FAILURE;
+    }
+    j->nsegs++;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static void jnl_segment_drop(struct astman_journal *j)
+ * @brief Delete the oldest segment
+ ******************************************************************************/
+static void jnl_segment_drop(struct astman_journal *j) {
+    char path[PATH_MAX];
+    jnl_path(j, path, sizeof(path), j->segs[0].first);
+    munmap(j->segs[0].map, j->segs[0].size);
+    close(j->segs[0].fd);
+    unlink(path);
+    memmove(j->segs, j->segs + 1, (j->nsegs - 1) * sizeof(*j->segs));
+    j->nsegs--;
+}
+/*******************************************************************************
+ * @fn static void jnl_recover(struct astman_journal *j)
+ * @brief Find the end of the last segment, drop a torn frame
+ ******************************************************************************/
+static void jnl_recover(struct astman_journal *j) {
+    struct jsegment *seg = &j->segs[j->nsegs - 1];
+    unsigned long long seq = seg->first;
+    struct jframe *f;
+    size_t off = JOURNAL_HEADER, size;
+
+    for (;;) {
+        if (off + sizeof(*f) > seg->size)
+            break;
+        f = (struct jframe *)(seg->map + off);
+        if (!f->len)
+            break;
+        size = sizeof(*f) + JOURNAL_ALIGN(f->len);
+        if (off + size > seg->size || f->seq != seq || jnl_frame_crc(f) != f->crc) {
+            astlog(ASTLOG_WARNING, "journal: dropping torn frame %llu", seq);
+            memset(f, 0, sizeof(*f));
+            msync(seg->map, seg->size, MS_SYNC);
+            break;
+        }
+        off += size;
+        seq++;
+    }
+    j->end = j->synced = off;
+    j->next_seq = seq;
+}
+/*******************************************************************************
+ * @fn static int jnl_cmp(const void *a, const void *b)
+ ******************************************************************************/
+static int jnl_cmp(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+/*******************************************************************************
+ * @fn static struct astman_journal_cursor *jnl_cursor_new(
+ *                          struct astman_journal *j, const char *name,
+ *                          unsigned long long seq)
+ ******************************************************************************/
+static struct astman_journal_cursor *jnl_cursor_new(struct astman_journal *j,
+                                                    const char *name,
+                                                    unsigned long long seq) {
+    char path[PATH_MAX];
+    struct astman_journal_cursor *c;
+    unsigned long long stored;
+
+    c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+    c->j = j;
+    strncpy(c->name, name, sizeof(c->name) - 1);
+    snprintf(path, sizeof(path), "%s/%s.cursor", j->dir, name);
+    c->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+    if (c->fd < 0) {
+        astlog(ASTLOG_ERROR, "journal cursor %s: %s", path, strerror(errno));
+        free(c);
+        return NULL;
+    }
+    if (pread(c->fd, &stored, sizeof(stored), 0) == sizeof(stored))
+        seq = stored;
+    else if (pwrite(c->fd, &seq, sizeof(seq), 0) != sizeof(seq))
+        astlog(ASTLOG_WARNING, "journal cursor %s: %s", path, strerror(errno));
+    if (seq < j->segs[0].first)
+        seq = j->segs[0].first;
+    c->seq = c->committed = seq;
+    c->next = j->cursors;
+    j->cursors = c;
+    return c;
+}
+/*******************************************************************************
+ * @fn static int jnl_load(struct astman_journal *j)
+ * @brief Map the segments and load the cursors of the directory
+ ******************************************************************************/
+static int jnl_load(struct astman_journal *j) {
+    unsigned long long *firsts = NULL, *tmp;
+    int count = 0, cap = 0, x;
+    struct dirent *de;
+    char name[MAX_NAME_LEN], *end;
+    size_t len;
+    DIR *d;
+
+    d = opendir(j->dir);
+    if (!d)
+        return ASTMAN_FAILURE;
+    while ((de = readdir(d))) {
+        len = strlen(de->d_name);
+        if (len == 28 && !strcmp(de->d_name + 20, ".journal")) {
+            if (count == cap) {
+                tmp = realloc(firsts, (cap ? cap * 2 : 64) * sizeof(*firsts));
+                if (!tmp)
+                    goto Error;
+                firsts = tmp;
+                cap = cap ? cap * 2 : 64;
+            }
+            firsts[count++] = strtoull(de->d_name, &end, 10);
+        }
+    }
+    qsort(firsts, count, sizeof(*firsts), jnl_cmp);
+    for (x = 0; x < count; x++) {
+        if (jnl_segment_add(j, firsts[x], 0) != ASTMAN_SUCCESS)
+            goto Error;
+    }
+    if (!j->nsegs && jnl_segment_add(j, 1, 1) != ASTMAN_SUCCESS)
+        goto Error;
+    jnl_recover(j);
+
+    rewinddir(d);
+    while ((de = readdir(d))) {
+        len = strlen(de->d_name);
+        if (len > 7 && len - 7 < sizeof(name) && !strcmp(de->d_name + len - 7, ".cursor")) {
+            memcpy(name, de->d_name, len - 7);
+            name[len - 7] = '\0';
+            if (!jnl_cursor_new(j, name, j->segs[0].first))
+                goto Error;
+        }
+    }
+    closedir(d);
+    free(firsts);
+    return ASTMAN_SUCCESS;
+Error:
+    closedir(d);
+    free(firsts);
+    return ASTMAN_FAILURE;
+}
+/*******************************************************************************
+ * @fn struct astman_journal *astman_journal_open(const char *dir,
+ *                                   const struct astman_journal_config *cfg)
+ ******************************************************************************/
+struct astman_journal *astman_journal_open(const char *dir,
+                                           const struct astman_journal_config *cfg) {
+    struct astman_journal *j;
+
+    pthread_once(&_crc_once, jnl_crc_init);
+    if (mkdir(dir, 0750) < 0 && errno != EEXIST) {
+        astlog(ASTLOG_ERROR, "journal %s: %s", dir, strerror(errno));
+        return NULL;
+    }
+    j = calloc(1, sizeof(*j));
+    if (!j)
+        return NULL;
+    if (cfg)
+        j->cfg = *cfg;
+    if (!j->cfg.segment_size)
+        j->cfg.segment_size = ASTMAN_JOURNAL_SEGMENT_SIZE;
+    if (j->cfg.segment_size < JOURNAL_MIN_SEGMENT)
+        j->cfg.segment_size = JOURNAL_MIN_SEGMENT;
+    pthread_mutex_init(&j->lock, NULL);
+    j->dir = strdup(dir);
+    if (!j->dir || jnl_load(j) != ASTMAN_SUCCESS) {
+        astlog(ASTLOG_ERROR, "journal %s: cannot be opened", dir);
+        astman_journal_close(j);
+        return NULL;
+    }
+    return j;
+}
+/*******************************************************************************
+ * @fn void astman_journal_close(struct astman_journal *j)
+ ******************************************************************************/
+void astman_journal_close(struct astman_journal *j) {
+    struct astman_journal_cursor *c;
+    int x;
+
+    if (!j)
+        return;
+    if (j->nsegs)
+        astman_journal_sync(j);
+    for (x = 0; x < j->nsegs; x++) {
+        munmap(j->segs[x].map, j->segs[x].size);
+        close(j->segs[x].fd);
+    }
+    while ((c = j->cursors)) {
+        j->cursors = c->next;
+        close(c->fd);
+        free(c);
+    }
+    pthread_mutex_destroy(&j->lock);
+    free(j->segs);
+    free(j->dir);
+    free(j);
+}
+/*******************************************************************************
+ * @fn static int jnl_sync_range(struct jsegment *seg, size_t from, size_t to)
+ ******************************************************************************/
+static int jnl_sync_range(struct jsegment *seg, size_t from, size_t to) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    from &= ~(page - 1);
+    if (to <= from)
+        return ASTMAN_SUCCESS;
+    if (msync(seg->map + from, to - from, MS_SYNC) < 0) {
+        astlog(ASTLOG_ERROR, "journal msync: %s", strerror(errno));
+        return ASTMAN_FAILURE;
+    }
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_journal_sync(struct astman_journal *j)
+ ******************************************************************************/
+int astman_journal_sync(struct astman_journal *j) {
+    int ret = jnl_sync_range(&j->segs[j->nsegs - 1], j->synced, j->end);
+    if (ret == ASTMAN_SUCCESS) {
+        j->synced = j->end;
+        j->unsynced = 0;
+    }
+    return ret;
+}
+/*******************************************************************************
+ * @fn static void jnl_retention(struct astman_journal *j)
+ * @brief Delete the segments over max_segments that every cursor committed
+ *        past
+ ******************************************************************************/
+static void jnl_retention(struct astman_journal *j) {
+    struct astman_journal_cursor *c;
+    unsigned long long min = ~0ULL, pos;
+
+    if (j->cfg.max_segments <= 0)
+        return;
+    for (c = j->cursors; c; c = c->next) {
+        pos = __atomic_load_n(&c->committed, __ATOMIC_ACQUIRE);
+        if (pos < min)
+            min = pos;
+    }
+    while (j->nsegs > j->cfg.max_segments && j->nsegs > 1 && j->segs[1].first <= min)
+        jnl_segment_drop(j);
+}
+/*******************************************************************************
+ * @fn static int jnl_roll(struct astman_journal *j)
+ * @brief Seal the written segment, start the next one
+ ******************************************************************************/
+static int jnl_roll(struct astman_journal *j) {
+    int ret;
+
+    if (j->cfg.sync_events > 0 || j->cfg.sync_ms > 0)
+        astman_journal_sync(j);
+    pthread_mutex_lock(&j->lock);
+    ret = jnl_segment_add(j, j->next_seq, 1);
+    if (ret == ASTMAN_SUCCESS) {
+        j->end = j->synced = JOURNAL_HEADER;
+        jnl_retention(j);
+    }
+    pthread_mutex_unlock(&j->lock);
+    return ret;
+}
+/*******************************************************************************
+ * @fn unsigned long long astman_journal_append(struct astman_journal *j,
+ *                                              struct message *m)
+ ******************************************************************************/
+unsigned long long astman_journal_append(struct astman_journal *j,
+                                         struct message *m) {
+    struct jsegment *seg;
+    struct jframe *f;
+    struct timespec ts;
+    size_t len = 0, need, n;
+    unsigned long long now;
+    char *p;
+    int x;
+
+    for (x = 0; x < m->hdrcount; x++)
+        len += strlen(m->headers[x]) + 1;
+    need = sizeof(*f) + JOURNAL_ALIGN(len);
+    if (need > j->cfg.segment_size - JOURNAL_HEADER) {
+        astlog(ASTLOG_ERROR, "journal: %zu bytes event does not fit a segment", len);
+        return 0;
+    }
+    seg = &j->segs[j->nsegs - 1];
+    if (j->end + need > seg->size) {
+        if (jnl_roll(j) != ASTMAN_SUCCESS)
+            return 0;
+        seg = &j->segs[j->nsegs - 1];
+    }
+    f = (struct jframe *)(seg->map + j->end);
+    p = (char *)(f + 1);
+    for (x = 0; x < m->hdrcount; x++) {
+        n = strlen(m->headers[x]) + 1;
+        memcpy(p, m->headers[x], n);
+        p += n;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    f->seq = j->next_seq;
+    f->time = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    f->len = (uint32_t)len;
+    f->crc = jnl_frame_crc(f);
+    j->end += need;
+    __atomic_store_n(&j->next_seq, j->next_seq + 1, __ATOMIC_RELEASE);
+
+    /* fsync batching */
+    if (j->cfg.sync_events > 0 || j->cfg.sync_ms > 0) {
+        now = astman_metrics_now();
+        if (!j->unsynced++)
+            j->unsynced_since = now;
+        if ((j->cfg.sync_events > 0 && j->unsynced >= j->cfg.sync_events) ||
+            (j->cfg.sync_ms > 0 &&
+             now - j->unsynced_since >= (unsigned long long)j->cfg.sync_ms * 1000000ULL))
+            astman_journal_sync(j);
+    }
+    return f->seq;
+}
+/*******************************************************************************
+ * @fn unsigned long long astman_journal_next_seq(struct astman_journal *j)
+ ******************************************************************************/
+unsigned long long astman_journal_next_seq(struct astman_journal *j) {
+    return __atomic_load_n(&j->next_seq, __ATOMIC_ACQUIRE);
+}
+/*******************************************************************************
+ * @fn unsigned long long astman_journal_first_seq(struct astman_journal *j)
+ ******************************************************************************/
+unsigned long long astman_journal_first_seq(struct astman_journal *j) {
+    unsigned long long first;
+    pthread_mutex_lock(&j->lock);
+    first = j->segs[0].first;
+    pthread_mutex_unlock(&j->lock);
+    return first;
+}
+/*******************************************************************************
+ * @fn int astman_journal_attach(struct mansession *s,
+ *                               struct astman_journal *j)
+ ******************************************************************************/
+int astman_journal_attach(struct mansession *s, struct astman_journal *j) {
+    s->journal = j;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn struct astman_journal_cursor *astman_journal_cursor(
+ *                          struct astman_journal *j, const char *name,
+ *                          int from_oldest)
+ ******************************************************************************/
+struct astman_journal_cursor *astman_journal_cursor(struct astman_journal *j,
+                                                    const char *name,
+                                                    int from_oldest) {
+    struct astman_journal_cursor *c;
+
+    if (astman_strlen_zero(name) || strchr(name, '/') ||
+        strlen(name) >= MAX_NAME_LEN || name[0] == '.')
+        return NULL;
+    pthread_mutex_lock(&j->lock);
+    for (c = j->cursors; c; c = c->next) {
+        if (!strcmp(c->name, name))
+            break;
+    }
+    if (!c)
+        c = jnl_cursor_new(j, name, from_oldest ? j->segs[0].first
+                                                : astman_journal_next_seq(j));
+    pthread_mutex_unlock(&j->lock);
+    return c;
+}
+/*******************************************************************************
+ * @fn int astman_journal_cursor_remove(struct astman_journal *j,
+ *                                      const char *name)
+ ******************************************************************************/
+int astman_journal_cursor_remove(struct astman_journal *j, const char *name) {
+    struct astman_journal_cursor **pc, *c;
+    char path[PATH_MAX];
+
+    pthread_mutex_lock(&j->lock);
+    for (pc = &j->cursors; *pc && strcmp((*pc)->name, name); pc = &(*pc)->next)
+        ;
+    c = *pc;
+    if (c)
+        *pc = c->next;
+    pthread_mutex_unlock(&j->lock);
+    if (!c)
+        return ASTMAN_FAILURE;
+    snprintf(path, sizeof(path), "%s/%s.cursor", j->dir, c->name);
+    unlink(path);
+    close(c->fd);
+    free(c);
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static int jnl_find(struct astman_journal *j, unsigned long long seq)
+ * @return index of the segment holding seq
+ ******************************************************************************/
+static int jnl_find(struct astman_journal *j, unsigned long long seq) {
+    int lo = 0, hi = j->nsegs - 1, mid;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (j->segs[mid].first <= seq)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+/*******************************************************************************
+ * @fn int astman_journal_read(struct astman_journal_cursor *c,
+ *                             struct message *m, unsigned long long *seq)
+ ******************************************************************************/
+int astman_journal_read(struct astman_journal_cursor *c, struct message *m,
+                        unsigned long long *seq) {
+    struct astman_journal *j = c->j;
+    struct jsegment *seg;
+    struct jframe *f;
+    const char *p, *end;
+    size_t n, len;
+    int x, ret = -1;
+
+    if (c->seq >= __atomic_load_n(&j->next_seq, __ATOMIC_ACQUIRE))
+        return 0;
+    /* Held while reading: retention never unmaps a segment under us */
+    pthread_mutex_lock(&j->lock);
+    if (c->seq < j->segs[0].first) {
+        astlog(ASTLOG_WARNING, "journal cursor %s: events %llu to %llu are gone",
+               c->name, c->seq, j->segs[0].first - 1);
+        c->seq = j->segs[0].first;
+        c->seg_first = 0;
+    }
+    x = jnl_find(j, c->seq);
+    if (c->seg_first != j->segs[x].first) {
+        c->seg_first = j->segs[x].first;
+        c->off = JOURNAL_HEADER;
+    }
+    seg = &j->segs[x];
+    for (;;) {
+        f = (struct jframe *)(seg->map + c->off);
+        if (c->off + sizeof(*f) > seg->size || !f->len || f->seq > c->seq) {
+            astlog(ASTLOG_ERROR, "journal cursor %s: event %llu not found", c->name, c->seq);
+            goto Exit;
+        }
+        if (f->seq == c->seq)
+            break;
+        /* After a seek: skip to the position */
+        c->off += sizeof(*f) + JOURNAL_ALIGN(f->len);
+    }
+    m->hdrcount = 0;
+    m->gettingdata = 0;
+    for (p = (const char *)(f + 1), end = p + f->len; p < end && m->hdrcount < MAX_HEADERS - 1; p += len + 1) {
+        len = strnlen(p, end - p);
+        n = len < MAX_LEN ? len : MAX_LEN - 1;
+        memcpy(m->headers[m->hdrcount], p, n);
+        m->headers[m->hdrcount][n] = '\0';
+        astman_message_intern(m, m->hdrcount);
+        m->hdrcount++;
+    }
+    if (seq)
+        *seq = c->seq;
+    c->off += sizeof(*f) + JOURNAL_ALIGN(f->len);
+    c->seq++;
+    ret = 1;
+Exit:
+    pthread_mutex_unlock(&j->lock);
+    return ret;
+}
+/*******************************************************************************
+ * @fn int astman_journal_seek(struct astman_journal_cursor *c,
+ *                             unsigned long long seq)
+ ******************************************************************************/
+int astman_journal_seek(struct astman_journal_cursor *c, unsigned long long seq) {
+    struct astman_journal *j = c->j;
+    unsigned long long next = astman_journal_next_seq(j);
+    unsigned long long first = astman_journal_first_seq(j);
+
+    if (seq < first)
+        seq = first;
+    if (seq > next)
+        seq = next;
+    c->seq = seq;
+    c->seg_first = 0;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_journal_commit(struct astman_journal_cursor *c)
+ ******************************************************************************/
+int astman_journal_commit(struct astman_journal_cursor *c) {
+    if (pwrite(c->fd, &c->seq, sizeof(c->seq), 0) != sizeof(c->seq) ||
+        fdatasync(c->fd) < 0) {
+        astlog(ASTLOG_ERROR, "journal cursor %s: %s", c->name, strerror(errno));
+        return ASTMAN_FAILURE;
+    }
+    __atomic_store_n(&c->committed, c->seq, __ATOMIC_RELEASE);
+    return ASTMAN_SUCCESS;
+}
@@ -22,6 +22,7 @@
  *  @author Baligh.GUESMI
  *  @date 20100524
  ******************************************************************************/
+#define _GNU_SOURCE     /* pthread_setaffinity_np */
 #include <sys/types.h>
 #include <sys/socket.h> /* send/recv */
 #include <netinet/in.h>  /* struct sockaddr_in */
@@ -31,13 +32,29 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <stdarg.h>  /* vsnprintf */
 #include <string.h>
 #include <errno.h>
 #include <time.h>   /* time */
+#include <pthread.h>
+#include <sched.h>
 #include "astman.h"
 #include "astevent.h"
 #include "astlog.h"
+#include "astconfig.h"
+#include "astmetrics.h"
+#include "astprofile.h"
+#include "astbatch.h"
+#include "astasync.h"
+#include "astsub.h"
+#include "astnames.h"
+#include "astjournal.h"
+#include "aststate.h"
+#include "astcache.h"
+#include "astsync.h"
+#include "astmem.h"
+#include "astflow.h"
 /*******************************************************************************
  *  \def ASTMAN_DEFAULT_MANAGER_PORT
  *  \brief  Default port used to connect to the AMI Asterisk
@@ -122,6 +139,54 @@ struct mansession *astman_open(void) {
     s.fd = so;
     return &s;
 }
+/*******************************************************************************
+ *  \fn struct mansession *astman_session_new(void)
+ *  \brief  Allocate a session of its own, for programs talking to several
+ *          servers. Released by astman_session_free().
+ *  \return the session, NULL if out of memory
+ ******************************************************************************/
+struct mansession *astman_session_new(void) {
+    return calloc(1, sizeof(struct mansession));
+}
+/*******************************************************************************
+ *  \fn void astman_session_free(struct mansession *s)
+ *  \brief  Disconnect and release a session from astman_session_new()
+ ******************************************************************************/
+void astman_session_free(struct mansession *s) {
+    if (!s)
+        return;
+    astman_disconnect(s);
+    astman_add_event_batch_handler(s, NULL, 0, 0);
+    astman_profiler_disable(s);
+    while (s->eventcount > 0)
+        free(s->events[--s->eventcount].event);
+    astman_flow_free(s);
+    astman_subs_free(s->subs);
+    astman_mem_release(s, ASTMAN_MEM_OUTPUT, s->wsize);
+    free(s->wbuf);
+    astman_mem_free(s);
+    free(s);
+}
+/*******************************************************************************
+ *  \fn static int astman_set_busy_poll(struct mansession *s)
+ *  \return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+static int astman_set_busy_poll(struct mansession *s) {
+#ifdef SO_BUSY_POLL
+    int val = s->busy_poll_usec;
+    if (setsockopt(s->fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)) < 0) {
+        astlog(ASTLOG_WARNING, "SO_BUSY_POLL refused: %s", strerror(errno));
+        return ASTMAN_FAILURE;
+    }
+#ifdef SO_PREFER_BUSY_POLL
+    val = 1;
+    setsockopt(s->fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &val, sizeof(val));
+#endif
+    return ASTMAN_SUCCESS;
+#else
+    return ASTMAN_FAILURE;
+#endif
+}
 /*******************************************************************************
  *  \fn astman_add_param(char *buf, int buflen, char *header, char *value)
  *  \brief  Add a new parameter to the Command
@@ -160,8 +225,33 @@ int astman_connect(struct mansession *s, char *hostname, int port) {
         perror("connect");
         return -1;
     }
+    if (s->busy_poll_usec > 0)
+        astman_set_busy_poll(s);
     return 0;
 }
+/*******************************************************************************
+ *  \fn int astman_set_latency_mode(struct mansession *s, int spin_usec,
+ *                                  int busy_poll_usec, int cpu)
+ ******************************************************************************/
+int astman_set_latency_mode(struct mansession *s, int spin_usec,
+                            int busy_poll_usec, int cpu) {
+    cpu_set_t cpus;
+    int ret = ASTMAN_SUCCESS;
+
+    s->spin_usec = spin_usec > 0 ? spin_usec : 0;
+    s->busy_poll_usec = busy_poll_usec > 0 ? busy_poll_usec : 0;
+    if (s->busy_poll_usec && s->fd > 0 && astman_set_busy_poll(s) != ASTMAN_SUCCESS)
+        ret = ASTMAN_FAILURE;
+    if (cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+            astlog(ASTLOG_WARNING, "Unable to pin the reader to CPU %d", cpu);
+            ret = ASTMAN_FAILURE;
+        }
+    }
+    return ret;
+}
 /*******************************************************************************
  *  \fn astman_add_param(char *buf, int buflen, char *header, char *value)
  *  \brief  Add a new parameter to the Command
@@ -172,6 +262,7 @@ int astman_connect(struct mansession *s, char *hostname, int port) {
  *  \return Number of wrote characters into the buf
  ******************************************************************************/
 void astman_disconnect(struct mansession *s) {
+    astman_async_abort(s);
     if (s->fd) {
         close(s->fd);
         s->fd = 0;
@@ -189,10 +280,6 @@ static int astman_get_input(struct mansession *s, char *output) {
     /* output must have at least sizeof(s->inbuf) space */
     int res = 0;
     unsigned int x = 0;
-    struct timeval tv = {
-        0, 0
-    };
-    fd_set fds;
     for (x=1;x<s->inlen;x++) {
         if ((s->inbuf[x] == '\n')) {
             /* Copy output data up to and including \r\n */
@@ -206,28 +293,78 @@ static int astman_get_input(struct mansession *s, char *output) {
         }
     }
 
+    /* Everything parsed from the last read is collected */
+    if (s->batch)
+        astman_batch_flush(s);
+
     if (s->inlen >= sizeof(s->inbuf) - 1) {
         astlog(ASTLOG_ERROR, "Dumping long line with no return from %s: %s", inet_ntoa(s->sin.sin_addr), s->inbuf);
+        astman_metrics_parse_error();
         s->inlen = 0;
     }
-    FD_ZERO(&fds);
-    FD_SET(s->fd, &fds);
-    res = select(s->fd + 1, &fds, NULL, NULL, &tv);
-
+    /* One non blocking recv() instead of select() then recv() */
+    res = recv(s->fd, s->inbuf + s->inlen, sizeof(s->inbuf) - 1 - s->inlen, MSG_DONTWAIT);
     if (res < 0) {
-        astlog(ASTLOG_ERROR, "Select returned error: %s", strerror(errno));
-    } else if (res > 0) {
-        res = recv(s->fd, s->inbuf + s->inlen, sizeof(s->inbuf) - 1 - s->inlen, 0);
-
-        if (res < 1)
-            return -1;
-        s->inlen += res;
-        s->inbuf[s->inlen] = '\0';
-    } else {
-        return 2;
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 2;
+        astlog(ASTLOG_ERROR, "recv returned error: %s", strerror(errno));
+        return -1;
     }
+    if (res == 0)
+        return -1;
+    astman_metrics_received(res);
+    s->inlen += res;
+    s->inbuf[s->inlen] = '\0';
     return 0;
 }
+/*******************************************************************************
+ *  \fn static int astman_wait_input(struct mansession *s, int timeout_ms)
+ *  \brief  Wait for data on the socket. In latency mode, spin on non
+ *          blocking reads for s->spin_usec first, then park in poll().
+ *  \param  timeout_ms: < 0 waits forever
+ *  \return 1 data (or an error) to read, 0 on timeout, -1 on error
+ ******************************************************************************/
+static int astman_wait_input(struct mansession *s, int timeout_ms) {
+    struct pollfd pfd;
+    unsigned long long end;
+    int res;
+
+    if (s->spin_usec > 0 && timeout_ms != 0) {
+        end = astman_metrics_now() + (unsigned long long)s->spin_usec * 1000ULL;
+        do {
+            res = recv(s->fd, s->inbuf + s->inlen, sizeof(s->inbuf) - 1 - s->inlen,
+                       MSG_DONTWAIT);
+            if (res > 0) {
+                astman_metrics_received(res);
+                s->inlen += res;
+                s->inbuf[s->inlen] = '\0';
+                return 1;
+            }
+            /* end of file and errors are reported by the next read */
+            if (res == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                return 1;
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        } while (astman_metrics_now() < end);
+        if (timeout_ms > 0) {
+            timeout_ms -= s->spin_usec / 1000;
+            if (timeout_ms <= 0)
+                return 0;
+        }
+    }
+    pfd.fd = s->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    res = poll(&pfd, 1, timeout_ms);
+    if (res < 0) {
+        if (errno == EINTR)
+            return 0;
+        astlog(ASTLOG_ERROR, "poll returned error: %s", strerror(errno));
+        return -1;
+    }
+    return res > 0;
+}
 /*******************************************************************************
  * @fn char *astman_get_header(struct message *m, const char *var)
  * @brief
@@ -237,12 +374,34 @@ static int astman_get_input(struct mansession *s, char *output) {
 char *astman_get_header(struct message *m, const char *var) {
     char cmp[80];
     int x;
+    int id = astman_header_id(var, -1);
+    /* Known names: integer compares against the parser's tags */
+    if (id != ASTMAN_HDR_OTHER)
+        return astman_get_header_id(m, id);
     snprintf(cmp, sizeof(cmp), "%s: ", var);
     for (x=0;x<m->hdrcount;x++)
         if (!strncasecmp(cmp, m->headers[x], strlen(cmp)))
             return m->headers[x] + strlen(cmp);
     return "";
 }
+/*******************************************************************************
+ *  \fn int astman_call_handler(struct mansession *s, const char *event,
+ *                              ASTMAN_EVENT_CALLBACK func,
+ *                              struct message *m, int system)
+ ******************************************************************************/
+int astman_call_handler(struct mansession *s, const char *event,
+                        ASTMAN_EVENT_CALLBACK func, struct message *m,
+                        int system) {
+    unsigned long long begin;
+    int res;
+    if (!s->profiler)
+        return func(s, m);
+    begin = astman_metrics_now();
+    res = func(s, m);
+    astman_profiler_record(s, event, m, astman_metrics_now() - begin,
+                           system && !res);
+    return res;
+}
 /*******************************************************************************
  *  \fn astman_add_param(char *buf, int buflen, char *header, char *value)
  *  \brief  Add a new parameter to the Command
@@ -252,14 +411,19 @@ char *astman_get_header(struct message *m, const char *var) {
  *  \param  value
  *  \return Number of wrote characters into the buf
  ******************************************************************************/
-static int astman_process_message(struct mansession *s, struct message *m) {
+static int astman_process_message(struct mansession *s, struct message *m,
+                                  int replay) {
     int x;
     int res;
+    int sys_declined = 0;
     char event[80];
+    ASTMAN_EVENT_CALLBACK func;
+    void *queue;
 
-    strncpy(event, astman_get_header(m, "Event"), sizeof(event));
+    strncpy(event, astman_get_header_id(m, ASTMAN_HDR_EVENT), sizeof(event));
     if (!strlen(event)) {
         astlog(ASTLOG_ERROR, "Missing event in request");
+        astman_metrics_parse_error();
         return 0;
     }
     if (s->debug) {
@@ -268,32 +432,63 @@ static int astman_process_message(struct mansession *s, struct message *m) {
             astlog(ASTLOG_DEBUG, "Header: %s", m->headers[x]);
         }
     }
+    /* Durable copy before any handler sees it, in arrival order */
+    if (s->journal && !replay)
+        astman_journal_append(s->journal, m);
+    /* A snapshot is being taken, state and handlers get it after */
+    if (s->sync && !replay && astman_sync_hold(s->sync, m) == ASTMAN_SUCCESS)
+        return 0;
+    if (s->state)
+        astman_state_update(s->state, m);
+    /* Configuration files may have changed, drop the parsed copies */
+    if (astman_message_event(m) == ASTMAN_EVT_RELOAD) {
+        astman_config_invalidate(s, NULL);
+        astman_cache_invalidate(s, NULL);
+    }
+
+    /* Named and pattern subscriptions */
+    func = astman_subs_match_data(s->subs, astman_message_event(m), event, &queue);
+    if (func) {
+        /* Flow controlled: delivered by astman_flow_drain() */
+        if (queue && astman_flow_push(s, queue, func, m) == ASTMAN_SUCCESS)
+            return 0;
+        res = astman_call_handler(s, event, func, m, 0);
+        return res < 0 ? -1 : res;
+    }
+    /* Execute system event handler */
     for (x=0; x < s->eventcount; x++) {
-        if (s->events[x].event && !strcasecmp(event, s->events[x].event)) {
-            res = s->events[x].func(s, m);
-            if (res < 0) {
-                return -1;
-            } else if (res > 0) {
-                return res;
-            }
-            break;
-        }
-        /* Execute system event handler */
         if (s->events[x].event && !strcasecmp(ASTMAN_DEFAULT_EVENT, s->events[x].event)) {
-            res = s->events[x].func(s, m);
+            res = astman_call_handler(s, event, s->events[x].func, m, 1);
             if (res < 0) {
                 return -1;
             } else if (res > 0) {
                 return res;
             }
+            sys_declined = 1;
             break;
         }
     }
-    if (s->debug && x >= s->eventcount)
-        astlog(ASTLOG_DEBUG, "Ignoring unknown event '%s'", event);
+    /* Not consumed by a handler: batched delivery */
+    if (s->batch && (x >= s->eventcount || sys_declined))
+        astman_batch_add(s, m);
+    if (x >= s->eventcount) {
+        if (s->debug)
+            astlog(ASTLOG_DEBUG, "Ignoring unknown event '%s'", event);
+        if (s->profiler)
+            astman_profiler_record(s, event, m, 0, 1);
+    }
 
     return 0;
 }
+/*******************************************************************************
+ *  \fn static void astman_copy_message(struct message *dst, struct message *src)
+ *  \brief  Copy the used headers only, a message is 40 KB
+ ******************************************************************************/
+static void astman_copy_message(struct message *dst, struct message *src) {
+    astman_message_copy(dst, src);
+    src->hdrcount = 0;
+    src->gettingdata = 0;
+}
 /*******************************************************************************
  *  \fn int astman_wait_for_response(struct mansession *s, struct message *msg, time_t timeout)
  *  \brief
@@ -303,7 +498,7 @@ int astman_wait_for_response(struct mansession *s, struct message *msg, time_t t
     int res = 0;
     int proc_ev;
     char *sp;
-    time_t begin, end;
+    unsigned long long deadline = 0, now;
     int ret = -1;
     struct message m;
 
@@ -312,7 +507,8 @@ int astman_wait_for_response(struct mansession *s, struct message *msg, time_t t
     m.hdrcount = 0;
     m.gettingdata = 0;
 
-    time(&begin);
+    if (timeout > 0)
+        deadline = astman_metrics_now() + (unsigned long long)timeout * 1000000000ULL;
 
     for (;;) {
         res = 0;
@@ -327,42 +523,59 @@ int astman_wait_for_response(struct mansession *s, struct message *msg, time_t t
                 if (strlen(m.headers[m.hdrcount]) == 0) {
                     if (s->debug)
                         astman_dump_message(&m);
+                    /* Answer or list entry of an asynchronous action */
+                    if (s->async && astman_async_dispatch(s, &m)) {
+                        m.hdrcount = 0;
+                        m.gettingdata = 0;
+                        continue;
+                    }
                     /* Response packet */
                     if (strlen(astman_get_header(&m, "Response"))) {
                         //astlog(ASTLOG_INFO, "response=%s", astman_get_header(&m, "Response"));
                         if ((!strncasecmp(astman_get_header(&m, "Response"), "Success", strlen("Success")))) {
-                            memcpy(msg, &m, sizeof(struct message));
-                            memset(&m, 0, sizeof(struct message));
+                            astman_metrics_response(s, &m, 1);
+                            astman_copy_message(msg, &m);
                             ret = ASTMAN_SUCCESS;
                             goto Exit;
                         } else {
-                            memcpy(msg, &m, sizeof(struct message));
-                            memset(&m, 0, sizeof(struct message));
+                            astman_metrics_response(s, &m, 0);
+                            astman_copy_message(msg, &m);
                             ret = ASTMAN_FAILURE;
                             goto Exit;
                         }
                     }
                     /* Event packet */
-                    if ((proc_ev = astman_process_message(s, &m)) < 0) {
+                    astman_metrics_event(s, &m);
+                    if ((proc_ev = astman_process_message(s, &m, 0)) < 0) {
                         /* Error */
                         break;
                         /* Complete */
                     } else if ( proc_ev > 0 ) {
-                        memcpy(msg, &m, sizeof(m));
-                        memset(&m, 0, sizeof(m));
+                        astman_copy_message(msg, &m);
                         ret = ASTMAN_SUCCESS;
                         goto Exit;
                     }
-                    memset(&m, 0, sizeof(m));
+                    /* only the used headers are ever read, no 40 KB memset */
+                    m.hdrcount = 0;
+                    m.gettingdata = 0;
 
-                } else if (m.hdrcount < MAX_HEADERS - 1) {
-                    /* headers in packet */
+                } else {
+                    /* a GetConfig being cached sees every line */
+                    if (s->config_build)
+                        astman_config_feed(s->config_build, &m, m.headers[m.hdrcount]);
+                    if (m.hdrcount < MAX_HEADERS - 1) {
+                        /* headers in packet */
+                        astman_message_intern(&m, m.hdrcount);
 
-                    /* Response: Follows */
-                    if (!strncasecmp(m.headers[m.hdrcount], "Response: Follows", strlen("Response: Follows"))) {
-                        m.gettingdata = 1;
+                        /* Response: Follows */
+                        if (!strncasecmp(m.headers[m.hdrcount], "Response: Follows", strlen("Response: Follows"))) {
+                            m.gettingdata = 1;
+                        }
+                        m.hdrcount++;
+                    } else {
+                        /* header dropped, the next line overwrites it */
+                        astman_metrics_parse_error();
                     }
-                    m.hdrcount++;
                 }
             } else {
                 /* Get raw data from command (m.gettingdata = 1) */
@@ -371,24 +584,240 @@ int astman_wait_for_response(struct mansession *s, struct message *msg, time_t t
                     *sp = '\0';
                     m.gettingdata = 0;
                 }
-                if (m.hdrcount < MAX_HEADERS - 1)
+                if (m.hdrcount < MAX_HEADERS - 1) {
+                    m.hdrid[m.hdrcount] = ASTMAN_HDR_OTHER;
                     m.hdrcount++;
+                }
             }
         } else if (res < 0) {
             ret =  -1;
             goto Exit;
         } else if (res == 2) {
-            if ( timeout > 0 ) {
-                time(&end);
-                if ( (end - begin) > timeout ) return 0;
+            /* Nothing buffered: park (or spin in latency mode) for data */
+            if (deadline) {
+                now = astman_metrics_now();
+                if (now >= deadline ||
+                    !astman_wait_input(s, (int)((deadline - now + 999999ULL) / 1000000ULL))) {
+                    if (astman_metrics_now() < deadline)
+                        continue;
+                    astman_metrics_timeout(s);
+                    ret = 0;
+                    goto Exit;
+                }
+            } else if (astman_wait_input(s, -1) < 0) {
+                ret = -1;
+                goto Exit;
             }
         }
     } /* end loop */
 Exit:
+    /* Events received before the response are delivered first */
+    if (s->batch)
+        astman_batch_flush(s);
     astlog_end();
     return ret;
 
 }
+/*******************************************************************************
+ *  \fn static int astman_message_line(struct mansession *s, struct message *m,
+ *                                     char *line)
+ *  \brief  Account a line (with its \\r\\n) read into m->headers[m->hdrcount]
+ *  \return 1 when it ends the message, 0 otherwise
+ ******************************************************************************/
+static int astman_message_line(struct mansession *s, struct message *m, char *line) {
+    char *sp;
+    if (!m->gettingdata) {
+        /* Strip trailing \r\n */
+        if (strlen(line) < 2)
+            return 0;
+        line[strlen(line) - 2] = '\0';
+        if (strlen(line) == 0) {
+            /* stray empty line */
+            if (!m->hdrcount)
+                return 0;
+            if (s->debug)
+                astman_dump_message(m);
+            return 1;
+        }
+        if (s->config_build)
+            astman_config_feed(s->config_build, m, line);
+        if (m->hdrcount < MAX_HEADERS - 1) {
+            astman_message_intern(m, m->hdrcount);
+            if (!strncasecmp(line, "Response: Follows", strlen("Response: Follows")))
+                m->gettingdata = 1;
+            m->hdrcount++;
+        } else {
+            astman_metrics_parse_error();
+        }
+    } else {
+        if ((sp = strstr(line, "--END COMMAND--"))) {
+            *sp = '\0';
+            m->gettingdata = 0;
+        }
+        if (m->hdrcount < MAX_HEADERS - 1) {
+            m->hdrid[m->hdrcount] = ASTMAN_HDR_OTHER;
+            m->hdrcount++;
+        }
+    }
+    return 0;
+}
+/*******************************************************************************
+ *  \fn int astman_message_input(struct mansession *s, struct message *m,
+ *                               const char **data, size_t *len)
+ ******************************************************************************/
+int astman_message_input(struct mansession *s, struct message *m,
+                         const char **data, size_t *len) {
+    const char *nl;
+    char *line;
+    size_t n;
+
+    while (*len) {
+        nl = memchr(*data, '\n', *len);
+        if (!nl) {
+            /* Keep the partial line for the next buffer */
+            n = *len;
+            if (s->inlen + n >= sizeof(s->inbuf) - 1) {
+                astlog(ASTLOG_ERROR, "Dumping long line with no return from %s", inet_ntoa(s->sin.sin_addr));
+                astman_metrics_parse_error();
+                s->inlen = 0;
+                n = n < sizeof(s->inbuf) - 1 ? n : 0;
+            }
+            memcpy(s->inbuf + s->inlen, *data, n);
+            s->inlen += n;
+            s->inbuf[s->inlen] = '\0';
+            *data += *len;
+            *len = 0;
+            return 0;
+        }
+        n = nl - *data + 1;
+        line = m->headers[m->hdrcount];
+        if (s->inlen + n > MAX_LEN - 1) {
+            astlog(ASTLOG_ERROR, "Dumping long line from %s", inet_ntoa(s->sin.sin_addr));
+            astman_metrics_parse_error();
+            s->inlen = 0;
+            *data += n;
+            *len -= n;
+            continue;
+        }
+        /* Straight from the receive buffer to the header */
+        memcpy(line, s->inbuf, s->inlen);
+        memcpy(line + s->inlen, *data, n);
+        line[s->inlen + n] = '\0';
+        s->inlen = 0;
+        *data += n;
+        *len -= n;
+        if (astman_message_line(s, m, line))
+            return 1;
+    }
+    return 0;
+}
+/*******************************************************************************
+ *  \fn int astman_read_message(struct mansession *s, struct message *m,
+ *                              int timeout_ms)
+ *  \brief  Assemble the next message into m without dispatching it.
+ *          A partial message stays in m: pass the same m again to go on.
+ *  \param  timeout_ms: 0 only uses the data already received, < 0 waits
+ *                      forever
+ *  \return 1 when m holds a complete message, 0 if not yet, -1 on error
+ ******************************************************************************/
+int astman_read_message(struct mansession *s, struct message *m, int timeout_ms) {
+    int res;
+    char *line;
+    unsigned long long deadline = 0, now;
+
+    if (timeout_ms > 0)
+        deadline = astman_metrics_now() + (unsigned long long)timeout_ms * 1000000ULL;
+
+    for (;;) {
+        line = m->headers[m->hdrcount];
+        res = astman_get_input(s, line);
+        if (res == 1) { /* get single line */
+            if (astman_message_line(s, m, line))
+                return 1;
+        } else if (res < 0) {
+            return -1;
+        } else if (res == 2) {
+            if (timeout_ms == 0)
+                return 0;
+            if (timeout_ms < 0) {
+                res = astman_wait_input(s, -1);
+            } else {
+                now = astman_metrics_now();
+                if (now >= deadline)
+                    return 0;
+                res = astman_wait_input(s, (int)((deadline - now + 999999ULL) / 1000000ULL));
+            }
+            if (res < 0)
+                return -1;
+        }
+    }
+}
+/*******************************************************************************
+ *  \fn int astman_dispatch_message(struct mansession *s, struct message *m)
+ *  \brief  Account and dispatch a message read by astman_read_message() to
+ *          the event handlers.
+ *  \return the handler result (> 0 consumed, < 0 error), 0 otherwise
+ ******************************************************************************/
+int astman_dispatch_message(struct mansession *s, struct message *m) {
+    if (strlen(astman_get_header(m, "Response"))) {
+        astman_metrics_response(s, m, !strcasecmp(astman_get_header(m, "Response"), "Success"));
+        return 0;
+    }
+    astman_metrics_event(s, m);
+    return astman_process_message(s, m, 0);
+}
+/*******************************************************************************
+ *  \fn int astman_dispatch_event(struct mansession *s, struct message *m)
+ ******************************************************************************/
+int astman_dispatch_event(struct mansession *s, struct message *m) {
+    return astman_process_message(s, m, 1);
+}
+/*******************************************************************************
+ * @fn static int astman_send(struct mansession *s, const char *buf, size_t len)
+ * @brief Write the whole buffer, send() may stop early on large actions
+ * @return 0 or -1 on error
+ ******************************************************************************/
+static int astman_send(struct mansession *s, const char *buf, size_t len) {
+    ssize_t res;
+    char *wbuf;
+    unsigned int size;
+
+    if (s->corked) {
+        if (s->wlen + len > s->wsize) {
+            size = s->wsize ? s->wsize : 4096;
+            while (size < s->wlen + len)
+                size *= 2;
+            if (astman_mem_charge(s, ASTMAN_MEM_OUTPUT, size - s->wsize) != ASTMAN_MEM_OK) {
+                astlog(ASTLOG_ERROR, "Corked output over the memory budget");
+                return -1;
+            }
+            wbuf = realloc(s->wbuf, size);
+            if (!wbuf) {
+                astman_mem_release(s, ASTMAN_MEM_OUTPUT, size - s->wsize);
+                return -1;
+            }
+            s->wbuf = wbuf;
+            s->wsize = size;
+        }
+        memcpy(s->wbuf + s->wlen, buf, len);
+        s->wlen += len;
+        return 0;
+    }
+    if (s->transport)
+        return s->transport->send(s, buf, len, s->transport->data);
+    while (len > 0) {
+        res = send(s->fd, buf, len, 0);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            astlog(ASTLOG_ERROR, "send failed: %s", strerror(errno));
+            return -1;
+        }
+        buf += res;
+        len -= res;
+    }
+    return 0;
+}
 /*******************************************************************************
  * @fn int astman_manager_action(struct mansession *s, char *action, char *fmt, ...)
  * @brief
@@ -396,20 +825,68 @@ Exit:
  ******************************************************************************/
 int astman_manager_action(struct mansession *s, char *action, char *fmt, ...) {
     char tmp[4096];
-    va_list ap;
+    char *buf = tmp;
+    int hlen, len, ret = 0;
+    va_list ap, aq;
     astlog_init();
-    snprintf(tmp, sizeof(tmp), "Action: %s\r\n", action);
+    hlen = snprintf(tmp, sizeof(tmp), "Action: %s\r\n", action);
     va_start(ap, fmt);
-    vsnprintf(tmp+strlen(tmp), sizeof(tmp)-strlen(tmp), fmt, ap);
+    va_copy(aq, ap);
+    len = vsnprintf(tmp+hlen, sizeof(tmp)-hlen, fmt, ap);
     va_end(ap);
-    strcpy(tmp+strlen(tmp), "\r\n");
+    if (len < 0) {
+        ret = -1;
+        goto Exit;
+    }
+    if (hlen + len + 3 > (int)sizeof(tmp)) {
+        /* Large actions (UpdateConfig...) do not fit the stack buffer */
+        buf = malloc(hlen + len + 3);
+        if (!buf) {
+            ret = -1;
+            goto Exit;
+        }
+        memcpy(buf, tmp, hlen);
+        vsnprintf(buf+hlen, len + 1, fmt, aq);
+    }
+    strcpy(buf+hlen+len, "\r\n");
 
-    send(s->fd, tmp, strlen(tmp), 0);
+    if (astman_send(s, buf, hlen + len + 2) < 0)
+        ret = -1;
+    else
+        astman_metrics_sent(s, action, hlen + len + 2);
 
     if (s->debug)
-        astman_dump_out_message(tmp);
+        astman_dump_out_message(buf);
+    if (buf != tmp)
+        free(buf);
+Exit:
+    va_end(aq);
     astlog_end();
-    return 0;
+    return ret;
+}
+/*******************************************************************************
+ * @fn int astman_cork(struct mansession *s)
+ ******************************************************************************/
+int astman_cork(struct mansession *s) {
+    if (!s)
+        return ASTMAN_FAILURE;
+    s->corked++;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_uncork(struct mansession *s)
+ ******************************************************************************/
+int astman_uncork(struct mansession *s) {
+    int ret = ASTMAN_SUCCESS;
+
+    if (!s || s->corked <= 0)
+        return ASTMAN_FAILURE;
+    if (--s->corked)
+        return ASTMAN_SUCCESS;
+    if (s->wlen && astman_send(s, s->wbuf, s->wlen) < 0)
+        ret = ASTMAN_FAILURE;
+    s->wlen = 0;
+    return ret;
 }
 /*******************************************************************************
  *  \fn int astman_manager_action_params(struct mansession *s, char *action, char *params)
@@ -432,8 +909,23 @@ int astman_add_event_handler(struct mansession *s, char *event, ASTMAN_EVENT_CAL
     int x;
     int ret = 1;
     astlog_init();
+
+    /* Event names and patterns are compiled into the subscriptions trie,
+       the table only keeps the system handler */
+    if (strcasecmp(event, ASTMAN_DEFAULT_EVENT)) {
+        if (!callback) {
+            ret = s->subs && astman_subs_remove(s->subs, event) == ASTMAN_SUCCESS ? 0 : -1;
+        } else if (!s->subs && !(s->subs = astman_subs_new())) {
+            ret = -1;
+        } else if (astman_subs_add(s->subs, event, callback) != ASTMAN_SUCCESS) {
+            astlog(ASTLOG_INFO, "%s handler is already defined, not over-writing.", event);
+            ret = -1;
+        }
+        goto Exit;
+    }
     if (s->eventcount >= MAX_EVENTS) {
-        return -1;
+        ret = -1;
+        goto Exit;
     }
 
     for (x=0; x < s->eventcount; x++) {
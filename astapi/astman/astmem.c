@@ -0,0 +1,183 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astmem.c
+ *  @brief Memory accounting and budgets. The library wide account is shared
+ *         by every thread and updated with atomics; a session account is
+ *         allocated on its first charge.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "astman.h"
+#include "astmem.h"
+/*******************************************************************************
+ * @struct  astman_mem
+ * @brief   An account
+ ******************************************************************************/
+struct astman_mem {
+    size_t current[ASTMAN_MEM_CATEGORIES];
+    size_t peak[ASTMAN_MEM_CATEGORIES];
+    size_t limit[ASTMAN_MEM_CATEGORIES];
+    int policy[ASTMAN_MEM_CATEGORIES];
+    unsigned long long overflows[ASTMAN_MEM_CATEGORIES][ASTMAN_MEM_SPILL + 1];
+    size_t total;
+    size_t total_peak;
+};
+/*******************************************************************************
+ *  \var    static struct astman_mem _mem
+ *  \brief  Library wide account
+ ******************************************************************************/
+static struct astman_mem _mem;
+/*******************************************************************************
+ *  \var    static const char *_mem_names[]
+ ******************************************************************************/
+static const char *_mem_names[ASTMAN_MEM_CATEGORIES] = {
+    "output", "lists", "pending", "cache", "queues"
+};
+/*******************************************************************************
+ * @fn static void mem_peak(size_t *peak, size_t value)
+ ******************************************************************************/
+static void mem_peak(size_t *peak, size_t value) {
+    size_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+    while (value > old &&
+           !__atomic_compare_exchange_n(peak, &old, value, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        ;
+}
+/*******************************************************************************
+ * @fn static int mem_take(struct astman_mem *a, int category, size_t bytes)
+ * @return ASTMAN_MEM_OK or the policy of the exceeded limit
+ ******************************************************************************/
+static int mem_take(struct astman_mem *a, int category, size_t bytes) {
+    size_t now, limit = __atomic_load_n(&a->limit[category], __ATOMIC_RELAXED);
+    int policy;
+
+    now = __atomic_add_fetch(&a->current[category], bytes, __ATOMIC_RELAXED);
+    if (limit && now > limit) {
+        __atomic_sub_fetch(&a->current[category], bytes, __ATOMIC_RELAXED);
+        policy = a->policy[category];
+        __atomic_add_fetch(&a->overflows[category][policy], 1, __ATOMIC_RELAXED);
+        return policy;
+    }
+    mem_peak(&a->peak[category], now);
+    mem_peak(&a->total_peak, __atomic_add_fetch(&a->total, bytes, __ATOMIC_RELAXED));
+    return ASTMAN_MEM_OK;
+}
+/*******************************************************************************
+ * @fn static void mem_give(struct astman_mem *a, int category, size_t bytes)
+ ******************************************************************************/
+static void mem_give(struct astman_mem *a, int category, size_t bytes) {
+    __atomic_sub_fetch(&a->current[category], bytes, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&a->total, bytes, __ATOMIC_RELAXED);
+}
+/*******************************************************************************
+ * @fn int astman_mem_charge(struct mansession *s, int category, size_t bytes)
+ ******************************************************************************/
+int astman_mem_charge(struct mansession *s, int category, size_t bytes) {
+    int res;
+
+    if (category < 0 || category >= ASTMAN_MEM_CATEGORIES || !bytes)
+        return ASTMAN_MEM_OK;
+    if (s && !s->mem)
+        s->mem = calloc(1, sizeof(*s->mem));
+    if (s && s->mem && (res = mem_take(s->mem, category, bytes)) != ASTMAN_MEM_OK)
+        return res;
+    if ((res = mem_take(&_mem, category, bytes)) != ASTMAN_MEM_OK) {
+        if (s && s->mem)
+            mem_give(s->mem, category, bytes);
+        return res;
+    }
+    return ASTMAN_MEM_OK;
+}
+/*******************************************************************************
+ * @fn void astman_mem_release(struct mansession *s, int category,
+ *                             size_t bytes)
+ ******************************************************************************/
+void astman_mem_release(struct mansession *s, int category, size_t bytes) {
+    if (category < 0 || category >= ASTMAN_MEM_CATEGORIES || !bytes)
+        return;
+    if (s && s->mem)
+        mem_give(s->mem, category, bytes);
+    mem_give(&_mem, category, bytes);
+}
+/*******************************************************************************
+ * @fn int astman_mem_set_limit(struct mansession *s, int category,
+ *                              size_t limit, int policy)
+ ******************************************************************************/
+int astman_mem_set_limit(struct mansession *s, int category, size_t limit,
+                         int policy) {
+    struct astman_mem *a = &_mem;
+
+    if (category < 0 || category >= ASTMAN_MEM_CATEGORIES ||
+        policy < ASTMAN_MEM_REJECT || policy > ASTMAN_MEM_SPILL)
+        return ASTMAN_FAILURE;
+    if (s) {
+        if (!s->mem && !(s->mem = calloc(1, sizeof(*s->mem))))
+            return ASTMAN_FAILURE;
+        a = s->mem;
+    }
+    a->policy[category] = policy;
+    __atomic_store_n(&a->limit[category], limit, __ATOMIC_RELAXED);
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_mem_stats(struct mansession *s, struct astman_mem_stats *st)
+ ******************************************************************************/
+int astman_mem_stats(struct mansession *s, struct astman_mem_stats *st) {
+    struct astman_mem *a = s ? s->mem : &_mem;
+    struct astman_mem_usage *u;
+    int x;
+
+    if (!st)
+        return ASTMAN_FAILURE;
+    memset(st, 0, sizeof(*st));
+    if (!a)
+        return ASTMAN_SUCCESS;
+    st->current = __atomic_load_n(&a->total, __ATOMIC_RELAXED);
+    st->peak = __atomic_load_n(&a->total_peak, __ATOMIC_RELAXED);
+    for (x = 0; x < ASTMAN_MEM_CATEGORIES; x++) {
+        u = &st->category[x];
+        u->current = __atomic_load_n(&a->current[x], __ATOMIC_RELAXED);
+        u->peak = __atomic_load_n(&a->peak[x], __ATOMIC_RELAXED);
+        u->limit = __atomic_load_n(&a->limit[x], __ATOMIC_RELAXED);
+        u->policy = a->policy[x] ? a->policy[x] : ASTMAN_MEM_REJECT;
+        u->rejected = __atomic_load_n(&a->overflows[x][ASTMAN_MEM_REJECT], __ATOMIC_RELAXED);
+        u->shed = __atomic_load_n(&a->overflows[x][ASTMAN_MEM_SHED], __ATOMIC_RELAXED);
+        u->spilled = __atomic_load_n(&a->overflows[x][ASTMAN_MEM_SPILL], __ATOMIC_RELAXED);
+    }
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn const char *astman_mem_category_name(int category)
+ ******************************************************************************/
+const char *astman_mem_category_name(int category) {
+    if (category < 0 || category >= ASTMAN_MEM_CATEGORIES)
+        return "";
+    return _mem_names[category];
+}
+/*******************************************************************************
+ * @fn void astman_mem_free(struct mansession *s)
+ ******************************************************************************/
+void astman_mem_free(struct mansession *s) {
+    free(s->mem);
+    s->mem = NULL;
+}
@@ -0,0 +1,497 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astmetrics.c
+ *  @brief Latency histograms and throughput counters
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astmetrics.h"
+/*******************************************************************************
+ *  \def M_ADD
+ *  \brief  Counters have a single writer (their thread): a relaxed store is
+ *          enough for the readers and does not lock the bus.
+ ******************************************************************************/
+#define M_ADD(x, v)     __atomic_store_n(&(x), (x) + (v), __ATOMIC_RELAXED)
+#define M_GET(x)        __atomic_load_n(&(x), __ATOMIC_RELAXED)
+/*******************************************************************************
+ *  \def M_OTHER
+ *  \brief  Index of the actions not fitting the name table
+ ******************************************************************************/
+#define M_OTHER         0
+
+enum metrics_counter {
+    MC_BYTES_IN,
+    MC_BYTES_OUT,
+    MC_PACKETS_IN,
+    MC_PACKETS_OUT,
+    MC_MESSAGES_IN,
+    MC_EVENTS_IN,
+    MC_PARSE_ERRORS,
+    MC_TIMEOUTS,
+    MC_UNTRACKED,
+    MC_MAX,
+};
+/*******************************************************************************
+ * @struct  metrics_tls_action
+ * @brief   Per thread, per action counters (allocated on first use)
+ ******************************************************************************/
+struct metrics_tls_action {
+    unsigned long long sent;
+    unsigned long long success;
+    unsigned long long failure;
+    unsigned long long timeouts;
+    struct astman_metrics_histogram first_response;
+    struct astman_metrics_histogram list_complete;
+};
+/*******************************************************************************
+ * @struct  metrics_tls
+ * @brief   Counters of one thread
+ ******************************************************************************/
+struct metrics_tls {
+    unsigned long long counters[MC_MAX];
+    struct metrics_tls_action *actions[ASTMAN_METRICS_MAX_ACTIONS];
+    struct metrics_tls *next;
+    struct metrics_tls **pprev;
+};
+
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _once = PTHREAD_ONCE_INIT;
+static pthread_key_t _key;
+static __thread struct metrics_tls *_tls = NULL;
+/* alive threads */
+static struct metrics_tls *_threads = NULL;
+/* counters of the exited threads */
+static struct metrics_tls _retired;
+/* action names, append only: readers only need the count */
+static char _names[ASTMAN_METRICS_MAX_ACTIONS][MAX_NAME_LEN] = { "Other" };
+static int _nnames = 1;
+/*******************************************************************************
+ * @fn static void hist_merge(struct astman_metrics_histogram *dst,
+ *                            const struct astman_metrics_histogram *src)
+ ******************************************************************************/
+static void hist_merge(struct astman_metrics_histogram *dst,
+                       const struct astman_metrics_histogram *src) {
+    int x;
+    unsigned long long max = M_GET(src->max);
+    if (!M_GET(src->count))
+        return;
+    dst->count += M_GET(src->count);
+    dst->sum += M_GET(src->sum);
+    if (max > dst->max)
+        dst->max = max;
+    for (x = 0; x < ASTMAN_METRICS_BUCKETS; x++)
+        dst->buckets[x] += M_GET(src->buckets[x]);
+}
+/*******************************************************************************
+ * @fn static void tls_merge(struct metrics_tls *dst, struct metrics_tls *src)
+ * @brief Fold src into dst, dst must be owned by the caller (lock held)
+ ******************************************************************************/
+static void tls_merge(struct metrics_tls *dst, struct metrics_tls *src) {
+    int x;
+    for (x = 0; x < MC_MAX; x++)
+        dst->counters[x] += M_GET(src->counters[x]);
+    for (x = 0; x < ASTMAN_METRICS_MAX_ACTIONS; x++) {
+        struct metrics_tls_action *a = __atomic_load_n(&src->actions[x], __ATOMIC_ACQUIRE);
+        if (!a)
+            continue;
+        if (!dst->actions[x]) {
+            dst->actions[x] = calloc(1, sizeof(*a));
+            if (!dst->actions[x])
+                continue;
+        }
+        dst->actions[x]->sent += M_GET(a->sent);
+        dst->actions[x]->success += M_GET(a->success);
+        dst->actions[x]->failure += M_GET(a->failure);
+        dst->actions[x]->timeouts += M_GET(a->timeouts);
+        hist_merge(&dst->actions[x]->first_response, &a->first_response);
+        hist_merge(&dst->actions[x]->list_complete, &a->list_complete);
+    }
+}
+/*******************************************************************************
+ * @fn static void tls_destroy(void *arg)
+ * @brief Thread exit: keep its counters in _retired
+ ******************************************************************************/
+static void tls_destroy(void *arg) {
+    struct metrics_tls *t = arg;
+    int x;
+    pthread_mutex_lock(&_lock);
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    tls_merge(&_retired, t);
+    pthread_mutex_unlock(&_lock);
+    for (x = 0; x < ASTMAN_METRICS_MAX_ACTIONS; x++)
+        free(t->actions[x]);
+    free(t);
+}
+/*******************************************************************************
+ * @fn static void metrics_init(void)
+ ******************************************************************************/
+static void metrics_init(void) {
+    pthread_key_create(&_key, tls_destroy);
+}
+/*******************************************************************************
+ * @fn static struct metrics_tls *tls_get(void)
+ * @brief Counters of the calling thread, registered on first use
+ ******************************************************************************/
+static struct metrics_tls *tls_get(void) {
+    struct metrics_tls *t = _tls;
+    if (t)
+        return t;
+    pthread_once(&_once, metrics_init);
+    t = calloc(1, sizeof(*t));
+    if (!t)
+        return NULL;
+    pthread_mutex_lock(&_lock);
+    t->next = _threads;
+    if (_threads)
+        _threads->pprev = &t->next;
+    t->pprev = &_threads;
+    _threads = t;
+    pthread_mutex_unlock(&_lock);
+    pthread_setspecific(_key, t);
+    _tls = t;
+    return t;
+}
+/*******************************************************************************
+ * @fn static struct metrics_tls_action *tls_action(int idx)
+ ******************************************************************************/
+static struct metrics_tls_action *tls_action(int idx) {
+    struct metrics_tls *t = tls_get();
+    struct metrics_tls_action *a;
+    if (!t || idx < 0 || idx >= ASTMAN_METRICS_MAX_ACTIONS)
+        return NULL;
+    a = t->actions[idx];
+    if (!a) {
+        a = calloc(1, sizeof(*a));
+        if (!a)
+            return NULL;
+        __atomic_store_n(&t->actions[idx], a, __ATOMIC_RELEASE);
+    }
+    return a;
+}
+/*******************************************************************************
+ * @fn static int action_index(const char *action)
+ * @brief Index of the action name, registered on first use
+ ******************************************************************************/
+static int action_index(const char *action) {
+    int x, n = __atomic_load_n(&_nnames, __ATOMIC_ACQUIRE);
+    for (x = 1; x < n; x++)
+        if (!strcasecmp(_names[x], action))
+            return x;
+    pthread_mutex_lock(&_lock);
+    for (x = 1; x < _nnames; x++)
+        if (!strcasecmp(_names[x], action))
+            break;
+    if (x == _nnames) {
+        if (_nnames < ASTMAN_METRICS_MAX_ACTIONS) {
+            strncpy(_names[x], action, MAX_NAME_LEN - 1);
+            __atomic_store_n(&_nnames, _nnames + 1, __ATOMIC_RELEASE);
+        } else {
+            x = M_OTHER;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    return x;
+}
+/*******************************************************************************
+ * @fn static int hist_index(unsigned long long v)
+ * @brief Linear below 2^SUB_BITS, then 2^SUB_BITS buckets per power of two
+ ******************************************************************************/
+static int hist_index(unsigned long long v) {
+    int e, idx;
+    if (v < ASTMAN_METRICS_SUB_BUCKETS)
+        return (int)v;
+    e = 63 - __builtin_clzll(v);
+    idx = (e - ASTMAN_METRICS_SUB_BITS + 1) * ASTMAN_METRICS_SUB_BUCKETS +
+          (int)((v >> (e - ASTMAN_METRICS_SUB_BITS)) & (ASTMAN_METRICS_SUB_BUCKETS - 1));
+    return idx < ASTMAN_METRICS_BUCKETS ? idx : ASTMAN_METRICS_BUCKETS - 1;
+}
+/*******************************************************************************
+ * @fn static unsigned long long hist_value(int idx)
+ * @brief Middle of the bucket idx
+ ******************************************************************************/
+static unsigned long long hist_value(int idx) {
+    int e;
+    unsigned long long low;
+    if (idx < ASTMAN_METRICS_SUB_BUCKETS)
+        return idx;
+    e = idx / ASTMAN_METRICS_SUB_BUCKETS + ASTMAN_METRICS_SUB_BITS - 1;
+    low = (unsigned long long)(ASTMAN_METRICS_SUB_BUCKETS + idx % ASTMAN_METRICS_SUB_BUCKETS)
+          << (e - ASTMAN_METRICS_SUB_BITS);
+    return low + ((1ULL << (e - ASTMAN_METRICS_SUB_BITS)) >> 1);
+}
+/*******************************************************************************
+ * @fn static void hist_record(struct astman_metrics_histogram *h,
+ *                             unsigned long long usec)
+ ******************************************************************************/
+static void hist_record(struct astman_metrics_histogram *h, unsigned long long usec) {
+    int idx = hist_index(usec);
+    M_ADD(h->buckets[idx], 1);
+    M_ADD(h->sum, usec);
+    if (usec > h->max)
+        __atomic_store_n(&h->max, usec, __ATOMIC_RELAXED);
+    M_ADD(h->count, 1);
+}
+/*******************************************************************************
+ * @fn unsigned long long astman_metrics_now(void)
+ * @brief Monotonic time in nano-seconds
+ ******************************************************************************/
+unsigned long long astman_metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/*******************************************************************************
+ * @fn static void counter_add(enum metrics_counter c, unsigned long long v)
+ ******************************************************************************/
+static void counter_add(enum metrics_counter c, unsigned long long v) {
+    struct metrics_tls *t = tls_get();
+    if (t)
+        M_ADD(t->counters[c], v);
+}
+/*******************************************************************************
+ * @fn void astman_metrics_sent(struct mansession *s, const char *action,
+ *                              size_t bytes)
+ * @brief Queue the send time, Asterisk answers the actions of a session in
+ *        the order they were sent. With the queue full the action is only
+ *        counted after the last one queued: its response is skipped, so
+ *        the responses that follow still find their own action.
+ ******************************************************************************/
+void astman_metrics_sent(struct mansession *s, const char *action, size_t bytes) {
+    struct metrics_tls_action *a;
+    int idx = action_index(action);
+
+    counter_add(MC_BYTES_OUT, bytes);
+    counter_add(MC_PACKETS_OUT, 1);
+    a = tls_action(idx);
+    if (a)
+        M_ADD(a->sent, 1);
+    if (s->mtail - s->mhead >= MAX_PENDING_ACTIONS) {
+        counter_add(MC_UNTRACKED, 1);
+        s->mpending[(s->mtail - 1) % MAX_PENDING_ACTIONS].skip++;
+        return;
+    }
+    s->mpending[s->mtail % MAX_PENDING_ACTIONS].action = idx;
+    s->mpending[s->mtail % MAX_PENDING_ACTIONS].sent = astman_metrics_now();
+    s->mpending[s->mtail % MAX_PENDING_ACTIONS].skip = 0;
+    s->mtail++;
+}
+/*******************************************************************************
+ * @fn void astman_metrics_received(size_t bytes)
+ ******************************************************************************/
+void astman_metrics_received(size_t bytes) {
+    counter_add(MC_BYTES_IN, bytes);
+    counter_add(MC_PACKETS_IN, 1);
+}
+/*******************************************************************************
+ * @fn void astman_metrics_response(struct mansession *s, struct message *m,
+ *                                  int success)
+ ******************************************************************************/
+void astman_metrics_response(struct mansession *s, struct message *m, int success) {
+    struct metrics_tls_action *a;
+    unsigned long long now, sent;
+    int action;
+
+    counter_add(MC_MESSAGES_IN, 1);
+    if (s->mskip) {
+        /* answers an untracked action */
+        s->mskip--;
+        return;
+    }
+    if (s->mhead == s->mtail)
+        return;
+    /* by value: the session is packed */
+    action = s->mpending[s->mhead % MAX_PENDING_ACTIONS].action;
+    sent = s->mpending[s->mhead % MAX_PENDING_ACTIONS].sent;
+    s->mskip = s->mpending[s->mhead % MAX_PENDING_ACTIONS].skip;
+    s->mhead++;
+    now = astman_metrics_now();
+    a = tls_action(action);
+    if (!a)
+        return;
+    /* Pong, Follows and Goodbye answers are not failures */
+    if (success || strcasecmp(astman_get_header(m, "Response"), "Error"))
+        M_ADD(a->success, 1);
+    else
+        M_ADD(a->failure, 1);
+    hist_record(&a->first_response, (now - sent) / 1000);
+
+    /* The list events follow this response */
+    if (success && !strcasecmp(astman_get_header(m, "EventList"), "start")) {
+        s->mlist_action = action + 1;
+        s->mlist_first = now;
+    }
+}
+/*******************************************************************************
+ * @fn void astman_metrics_event(struct mansession *s, struct message *m)
+ ******************************************************************************/
+void astman_metrics_event(struct mansession *s, struct message *m) {
+    counter_add(MC_MESSAGES_IN, 1);
+    counter_add(MC_EVENTS_IN, 1);
+    if (s->mlist_action && !strcasecmp(astman_get_header(m, "EventList"), "Complete"))
+        astman_metrics_list_complete(s);
+}
+/*******************************************************************************
+ * @fn void astman_metrics_list_complete(struct mansession *s)
+ * @brief End of the list of the last list action (XxxComplete event)
+ ******************************************************************************/
+void astman_metrics_list_complete(struct mansession *s) {
+    struct metrics_tls_action *a;
+    if (!s->mlist_action)
+        return;
+    a = tls_action(s->mlist_action - 1);
+    if (a)
+        hist_record(&a->list_complete, (astman_metrics_now() - s->mlist_first) / 1000);
+    s->mlist_action = 0;
+}
+/*******************************************************************************
+ * @fn void astman_metrics_timeout(struct mansession *s)
+ * @brief astman_wait_for_response gave up: the oldest pending action is late
+ ******************************************************************************/
+void astman_metrics_timeout(struct mansession *s) {
+    struct metrics_tls_action *a;
+    counter_add(MC_TIMEOUTS, 1);
+    if (s->mskip || s->mhead == s->mtail)
+        return;
+    a = tls_action(s->mpending[s->mhead % MAX_PENDING_ACTIONS].action);
+    if (a)
+        M_ADD(a->timeouts, 1);
+}
+/*******************************************************************************
+ * @fn void astman_metrics_parse_error(void)
+ ******************************************************************************/
+void astman_metrics_parse_error(void) {
+    counter_add(MC_PARSE_ERRORS, 1);
+}
+/*******************************************************************************
+ * @fn int astman_metrics_snapshot(struct astman_metrics_snapshot *snap)
+ ******************************************************************************/
+int astman_metrics_snapshot(struct astman_metrics_snapshot *snap) {
+    struct metrics_tls *sum, *t;
+    struct astman_metrics_action *out;
+    int x;
+
+    if (!snap)
+        return ASTMAN_FAILURE;
+    sum = calloc(1, sizeof(*sum));
+    if (!sum)
+        return ASTMAN_FAILURE;
+
+    pthread_mutex_lock(&_lock);
+    tls_merge(sum, &_retired);
+    for (t = _threads; t; t = t->next)
+        tls_merge(sum, t);
+    memset(snap, 0, sizeof(*snap));
+    snap->nactions = _nnames;
+    for (x = 0; x < _nnames; x++)
+        strncpy(snap->actions[x].name, _names[x], MAX_NAME_LEN - 1);
+    pthread_mutex_unlock(&_lock);
+
+    snap->bytes_in = sum->counters[MC_BYTES_IN];
+    snap->bytes_out = sum->counters[MC_BYTES_OUT];
+    snap->packets_in = sum->counters[MC_PACKETS_IN];
+    snap->packets_out = sum->counters[MC_PACKETS_OUT];
+    snap->messages_in = sum->counters[MC_MESSAGES_IN];
+    snap->events_in = sum->counters[MC_EVENTS_IN];
+    snap->parse_errors = sum->counters[MC_PARSE_ERRORS];
+    snap->timeouts = sum->counters[MC_TIMEOUTS];
+    snap->untracked = sum->counters[MC_UNTRACKED];
+    for (x = 0; x < ASTMAN_METRICS_MAX_ACTIONS; x++) {
+        if (!sum->actions[x])
+            continue;
+        out = &snap->actions[x];
+        out->sent = sum->actions[x]->sent;
+        out->success = sum->actions[x]->success;
+        out->failure = sum->actions[x]->failure;
+        out->timeouts = sum->actions[x]->timeouts;
+        out->first_response = sum->actions[x]->first_response;
+        out->list_complete = sum->actions[x]->list_complete;
+        free(sum->actions[x]);
+    }
+    free(sum);
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn unsigned long long astman_metrics_percentile(
+ *                          const struct astman_metrics_histogram *h, double p)
+ ******************************************************************************/
+unsigned long long astman_metrics_percentile(const struct astman_metrics_histogram *h,
+                                             double p) {
+    unsigned long long rank, seen = 0, v;
+    int x;
+    if (!h || !h->count)
+        return 0;
+    if (p >= 100.0)
+        return h->max;
+    rank = (unsigned long long)(p / 100.0 * h->count);
+    for (x = 0; x < ASTMAN_METRICS_BUCKETS; x++) {
+        seen += h->buckets[x];
+        if (seen > rank) {
+            v = hist_value(x);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+/*******************************************************************************
+ * @fn void astman_metrics_dump(FILE *f)
+ ******************************************************************************/
+void astman_metrics_dump(FILE *f) {
+    struct astman_metrics_snapshot *snap;
+    struct astman_metrics_action *a;
+    int x;
+
+    snap = malloc(sizeof(*snap));
+    if (!snap || astman_metrics_snapshot(snap) != ASTMAN_SUCCESS) {
+        free(snap);
+        return;
+    }
+    fprintf(f, "bytes in/out: %llu/%llu packets in/out: %llu/%llu "
+               "messages: %llu events: %llu parse errors: %llu timeouts: %llu "
+               "untracked: %llu\n",
+            snap->bytes_in, snap->bytes_out, snap->packets_in, snap->packets_out,
+            snap->messages_in, snap->events_in, snap->parse_errors, snap->timeouts,
+            snap->untracked);
+    fprintf(f, "%-20s %8s %8s %8s %8s %10s %10s %10s %10s %10s\n",
+            "Action", "sent", "success", "failure", "timeout",
+            "resp p50", "resp p99", "resp max", "list p50", "list p99");
+    for (x = 0; x < snap->nactions; x++) {
+        a = &snap->actions[x];
+        if (!a->sent && !a->first_response.count)
+            continue;
+        fprintf(f, "%-20s %8llu %8llu %8llu %8llu %10llu %10llu %10llu %10llu %10llu\n",
+                a->name, a->sent, a->success, a->failure, a->timeouts,
+                astman_metrics_percentile(&a->first_response, 50.0),
+                astman_metrics_percentile(&a->first_response, 99.0),
+                a->first_response.max,
+                astman_metrics_percentile(&a->list_complete, 50.0),
+                astman_metrics_percentile(&a->list_complete, 99.0));
+    }
+    free(snap);
+}
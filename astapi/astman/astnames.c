@@ -0,0 +1,281 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astnames.c
+ *  @brief Interned AMI vocabulary
+ *
+ *  The IDs are compile time constants (the X-macro lists of astnames.h).
+ *  The lookup tables are perfect hashes built once, on first use, from
+ *  the same lists: the seed is searched until no two known names share a
+ *  slot, so a lookup is one hash, one slot and one compare to rule out
+ *  unknown names.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astnames.h"
+/*******************************************************************************
+ *  \def NAMES_MAX_SEEDS
+ *  \brief  Seeds tried at a table size before doubling it
+ ******************************************************************************/
+#define NAMES_MAX_SEEDS     4096
+/*******************************************************************************
+ *  \def NAMES_TAGGED
+ *  \brief  An ID the parser set: anything else (hand built, stale) is
+ *          compared by name
+ ******************************************************************************/
+#define NAMES_TAGGED(id)    ((id) != ASTMAN_HDR_NONE && (id) < ASTMAN_HDR_IDS)
+/*******************************************************************************
+ * @struct  name_table
+ ******************************************************************************/
+struct name_table {
+    const char *const *names;       /**!< by ID */
+    int count;                      /**!< IDs, NONE and OTHER included */
+    int other;                      /**!< ID of unknown names */
+    unsigned char len[256];         /**!< name lengths by ID */
+    unsigned int seed;
+    unsigned int mask;
+    unsigned short *slots;          /**!< ID, 0 = empty */
+};
+
+#define NAMES_STRING(id, name) name,
+static const char *const _header_names[] = {
+    "", "", ASTMAN_HEADER_NAMES(NAMES_STRING)
+};
+static const char *const _event_names[] = {
+    "", "", ASTMAN_EVENT_NAMES(NAMES_STRING)
+};
+static struct name_table _headers = {
+    _header_names, ASTMAN_HDR_IDS, ASTMAN_HDR_OTHER, {0}, 0, 0, NULL
+};
+static struct name_table _events = {
+    _event_names, ASTMAN_EVT_IDS, ASTMAN_EVT_OTHER, {0}, 0, 0, NULL
+};
+static pthread_once_t _names_once = PTHREAD_ONCE_INIT;
+/*******************************************************************************
+ * @fn static inline unsigned int names_hash(unsigned int seed,
+ *                                           const char *str, int len)
+ * @brief Case-insensitive for letters (c | 0x20), the compare does the rest
+ ******************************************************************************/
+static inline unsigned int names_hash(unsigned int seed, const char *str, int len) {
+    unsigned int h = seed;
+    int x;
+    for (x = 0; x < len; x++) {
+        h ^= (unsigned char)str[x] | 0x20;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+/*******************************************************************************
+ * @fn static int names_build(struct name_table *t)
+ ******************************************************************************/
+static int names_build(struct name_table *t) {
+    unsigned int size, seed, h;
+    int x;
+
+    for (x = 2; x < t->count; x++)
+        t->len[x] = (unsigned char)strlen(t->names[x]);
+    for (size = 64; size < (unsigned int)t->count * 2; size *= 2)
+        ;
+    for (; size <= 65536; size *= 2) {
+        t->slots = calloc(size, sizeof(*t->slots));
+        if (!t->slots)
+            return ASTMAN_FAILURE;
+        for (seed = 2166136261u; seed < 2166136261u + NAMES_MAX_SEEDS; seed++) {
+            for (x = 2; x < t->count; x++) {
+                h = names_hash(seed, t->names[x], t->len[x]) & (size - 1);
+                if (t->slots[h])
+                    break;
+                t->slots[h] = (unsigned short)x;
+            }
+            if (x == t->count) {
+                t->seed = seed;
+                t->mask = size - 1;
+                return ASTMAN_SUCCESS;
+            }
+            memset(t->slots, 0, size * sizeof(*t->slots));
+        }
+        free(t->slots);
+        t->slots = NULL;
+    }
+    return ASTMAN_FAILURE;
+}
+/*******************************************************************************
+ * @fn static void names_init(void)
+ ******************************************************************************/
+static void names_init(void) {
+    if (names_build(&_headers) != ASTMAN_SUCCESS ||
+        names_build(&_events) != ASTMAN_SUCCESS)
+        astlog(ASTLOG_ERROR, "No perfect hash for the AMI names, lookups disabled");
+}
+/*******************************************************************************
+ * @fn static int names_lookup(struct name_table *t, const char *name, int len)
+ ******************************************************************************/
+static int names_lookup(struct name_table *t, const char *name, int len) {
+    int id;
+
+    pthread_once(&_names_once, names_init);
+    if (len < 0)
+        len = strlen(name);
+    if (!t->slots)
+        return t->other;
+    id = t->slots[names_hash(t->seed, name, len) & t->mask];
+    if (id && t->len[id] == len && !strncasecmp(t->names[id], name, len))
+        return id;
+    return t->other;
+}
+/*******************************************************************************
+ * @fn int astman_header_id(const char *name, int len)
+ ******************************************************************************/
+int astman_header_id(const char *name, int len) {
+    return names_lookup(&_headers, name, len);
+}
+/*******************************************************************************
+ * @fn int astman_event_id(const char *name, int len)
+ ******************************************************************************/
+int astman_event_id(const char *name, int len) {
+    return names_lookup(&_events, name, len);
+}
+/*******************************************************************************
+ * @fn const char *astman_header_name(int id)
+ ******************************************************************************/
+const char *astman_header_name(int id) {
+    return id > 0 && id < ASTMAN_HDR_IDS ? _header_names[id] : "";
+}
+/*******************************************************************************
+ * @fn const char *astman_event_name(int id)
+ ******************************************************************************/
+const char *astman_event_name(int id) {
+    return id > 0 && id < ASTMAN_EVT_IDS ? _event_names[id] : "";
+}
+/*******************************************************************************
+ * @fn void astman_message_intern(struct message *m, int x)
+ ******************************************************************************/
+void astman_message_intern(struct message *m, int x) {
+    const char *h = m->headers[x];
+    const char *colon;
+    int id;
+
+    if (x == 0)
+        m->event = ASTMAN_EVT_NONE;
+    colon = m->gettingdata ? NULL : strchr(h, ':');
+    if (!colon) {
+        m->hdrid[x] = ASTMAN_HDR_OTHER;
+        return;
+    }
+    id = astman_header_id(h, colon - h);
+    m->hdrid[x] = (unsigned short)id;
+    if (id == ASTMAN_HDR_EVENT) {
+        for (h = colon + 1; *h == ' '; h++)
+            ;
+        m->event = astman_event_id(h, -1);
+    }
+}
+/*******************************************************************************
+ * @fn char *astman_get_header_id(struct message *m, int id)
+ ******************************************************************************/
+char *astman_get_header_id(struct message *m, int id) {
+    const char *name;
+    char *v;
+    int x, len;
+
+    for (x = 0; x < m->hdrcount; x++) {
+        if (m->hdrid[x] == id && id != ASTMAN_HDR_NONE) {
+            v = strchr(m->headers[x], ':');
+            if (v) {
+                for (v++; *v == ' '; v++)
+                    ;
+                return v;
+            }
+        } else if (!NAMES_TAGGED(m->hdrid[x])) {
+            /* Header added by hand: compare the name */
+            name = astman_header_name(id);
+            len = strlen(name);
+            if (len && !strncasecmp(m->headers[x], name, len) &&
+                m->headers[x][len] == ':')
+                return m->headers[x] + len + (m->headers[x][len + 1] == ' ' ? 2 : 1);
+        }
+    }
+    return "";
+}
+/*******************************************************************************
+ * @fn int astman_message_event(struct message *m)
+ ******************************************************************************/
+int astman_message_event(struct message *m) {
+    char *event;
+    if (m->hdrcount <= 0)
+        return ASTMAN_EVT_NONE;
+    if (NAMES_TAGGED(m->hdrid[0]) && m->event >= 0 && m->event < ASTMAN_EVT_IDS)
+        return m->event;
+    /* Built by hand: nothing was tagged */
+    event = astman_get_header_id(m, ASTMAN_HDR_EVENT);
+    return *event ? astman_event_id(event, -1) : ASTMAN_EVT_NONE;
+}
+/*******************************************************************************
+ * @fn void astman_message_copy(struct message *dst, const struct message *src)
+ ******************************************************************************/
+void astman_message_copy(struct message *dst, const struct message *src) {
+    memcpy(dst, src, offsetof(struct message, headers) + (size_t)src->hdrcount * MAX_LEN);
+    dst->event = src->event;
+    memcpy(dst->hdrid, src->hdrid, (size_t)src->hdrcount * sizeof(src->hdrid[0]));
+}
+/*******************************************************************************
+ * @fn size_t astman_message_packed_size(const struct message *m)
+ ******************************************************************************/
+size_t astman_message_packed_size(const struct message *m) {
+    return offsetof(struct message, headers) + (size_t)m->hdrcount * MAX_LEN +
+           sizeof(m->event) + (size_t)m->hdrcount * sizeof(m->hdrid[0]);
+}
+/*******************************************************************************
+ * @fn void astman_message_pack(void *buf, const struct message *m)
+ ******************************************************************************/
+void astman_message_pack(void *buf, const struct message *m) {
+    char *p = buf;
+    size_t len = offsetof(struct message, headers) + (size_t)m->hdrcount * MAX_LEN;
+
+    memcpy(p, m, len);
+    p += len;
+    memcpy(p, &m->event, sizeof(m->event));
+    p += sizeof(m->event);
+    memcpy(p, m->hdrid, (size_t)m->hdrcount * sizeof(m->hdrid[0]));
+}
+/*******************************************************************************
+ * @fn void astman_message_unpack(struct message *m, const void *buf)
+ ******************************************************************************/
+void astman_message_unpack(struct message *m, const void *buf) {
+    const char *p = buf;
+    size_t len;
+
+    memcpy(m, p, offsetof(struct message, headers));
+    len = offsetof(struct message, headers) + (size_t)m->hdrcount * MAX_LEN;
+    memcpy(m, p, len);
+    p += len;
+    memcpy(&m->event, p, sizeof(m->event));
+    p += sizeof(m->event);
+    memcpy(m->hdrid, p, (size_t)m->hdrcount * sizeof(m->hdrid[0]));
+    if (m->hdrcount < MAX_HEADERS)
+        m->headers[m->hdrcount][0] = '\0';
+}
@@ -0,0 +1,271 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astprofile.c
+ *  @brief Opt-in event stream profiler
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astmetrics.h"
+#include "astprofile.h"
+/*******************************************************************************
+ *  \def PROFILE_DUMP_TOP
+ *  \brief  Event names printed by the periodic dump
+ ******************************************************************************/
+#define PROFILE_DUMP_TOP    10
+/*******************************************************************************
+ * @struct  prof_entry
+ * @brief   Hash table slot
+ ******************************************************************************/
+struct prof_entry {
+    unsigned int hash;                  /**!< 0 = free slot */
+    unsigned long long last_count;      /**!< count at the last dump */
+    struct astman_profile_entry st;     /**!< statistics */
+};
+/*******************************************************************************
+ * @struct  astman_profiler
+ * @brief   Profiler of one session
+ ******************************************************************************/
+struct astman_profiler {
+    struct prof_entry *tab;             /**!< open addressing table */
+    int size;                           /**!< power of two */
+    int used;                           /**!< distinct Event names */
+    unsigned long long start;           /**!< enable time (ns) */
+    unsigned long long last_dump;       /**!< last dump time (ns) */
+    int interval;                       /**!< dump interval (s), 0 = never */
+    FILE *dump;                         /**!< periodic dump output */
+};
+/*******************************************************************************
+ * @fn static unsigned int prof_hash(const char *str)
+ * @brief Case-insensitive FNV-1a, never 0
+ ******************************************************************************/
+static unsigned int prof_hash(const char *str) {
+    unsigned int h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char)tolower((unsigned char)*str++);
+        h *= 16777619u;
+    }
+    return h ? h : 1;
+}
+/*******************************************************************************
+ * @fn static int prof_grow(struct astman_profiler *p)
+ ******************************************************************************/
+static int prof_grow(struct astman_profiler *p) {
+    struct prof_entry *tab;
+    int x, y, size = p->size ? p->size * 2 : 64;
+
+    tab = calloc(size, sizeof(*tab));
+    if (!tab)
+        return ASTMAN_FAILURE;
+    for (x = 0; x < p->size; x++) {
+        if (!p->tab[x].hash)
+            continue;
+        for (y = p->tab[x].hash & (size - 1); tab[y].hash; y = (y + 1) & (size - 1))
+            ;
+        tab[y] = p->tab[x];
+    }
+    free(p->tab);
+    p->tab = tab;
+    p->size = size;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static struct prof_entry *prof_get(struct astman_profiler *p,
+ *                                        const char *event)
+ ******************************************************************************/
+static struct prof_entry *prof_get(struct astman_profiler *p, const char *event) {
+    unsigned int h = prof_hash(event);
+    int x;
+
+    if ((p->used + 1) * 2 > p->size && prof_grow(p) != ASTMAN_SUCCESS)
+        return NULL;
+    for (x = h & (p->size - 1); p->tab[x].hash; x = (x + 1) & (p->size - 1)) {
+        if (p->tab[x].hash == h && !strcasecmp(p->tab[x].st.event, event))
+            return &p->tab[x];
+    }
+    p->tab[x].hash = h;
+    strncpy(p->tab[x].st.event, event, MAX_NAME_LEN - 1);
+    p->used++;
+    return &p->tab[x];
+}
+/*******************************************************************************
+ * @fn int astman_profiler_enable(struct mansession *s, int dump_interval,
+ *                                FILE *dump)
+ ******************************************************************************/
+int astman_profiler_enable(struct mansession *s, int dump_interval, FILE *dump) {
+    struct astman_profiler *p;
+
+    astman_profiler_disable(s);
+    p = calloc(1, sizeof(*p));
+    if (!p || prof_grow(p) != ASTMAN_SUCCESS) {
+        free(p);
+        return ASTMAN_FAILURE;
+    }
+    p->start = p->last_dump = astman_metrics_now();
+    p->interval = dump_interval;
+    p->dump = dump ? dump : stdout;
+    s->profiler = p;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn void astman_profiler_disable(struct mansession *s)
+ ******************************************************************************/
+void astman_profiler_disable(struct mansession *s) {
+    if (!s->profiler)
+        return;
+    free(s->profiler->tab);
+    free(s->profiler);
+    s->profiler = NULL;
+}
+/*******************************************************************************
+ * @fn void astman_profiler_record(struct mansession *s, const char *event,
+ *                                 struct message *m,
+ *                                 unsigned long long handler_ns, int dropped)
+ ******************************************************************************/
+void astman_profiler_record(struct mansession *s, const char *event,
+                            struct message *m,
+                            unsigned long long handler_ns, int dropped) {
+    struct astman_profiler *p = s->profiler;
+    struct prof_entry *e;
+    unsigned int bytes = 2;   /* empty line ending the event */
+    unsigned long long now;
+    int x;
+
+    if (!p)
+        return;
+    e = prof_get(p, event);
+    if (!e)
+        return;
+    for (x = 0; x < m->hdrcount; x++)
+        bytes += strlen(m->headers[x]) + 2;
+
+    e->st.count++;
+    e->st.headers += m->hdrcount;
+    if (m->hdrcount > e->st.max_headers)
+        e->st.max_headers = m->hdrcount;
+    e->st.bytes += bytes;
+    if (bytes > e->st.max_bytes)
+        e->st.max_bytes = bytes;
+    e->st.handler_ns += handler_ns;
+    if (handler_ns > e->st.max_handler_ns)
+        e->st.max_handler_ns = handler_ns;
+    if (dropped)
+        e->st.drops++;
+
+    if (p->interval > 0) {
+        now = astman_metrics_now();
+        if (now - p->last_dump >= (unsigned long long)p->interval * 1000000000ULL)
+            astman_profiler_dump(s, p->dump, PROFILE_DUMP_TOP);
+    }
+}
+/*******************************************************************************
+ * @fn static unsigned long long prof_key(const struct astman_profile_entry *e,
+ *                                        enum astman_profile_sort sort)
+ ******************************************************************************/
+static unsigned long long prof_key(const struct astman_profile_entry *e,
+                                   enum astman_profile_sort sort) {
+    switch (sort) {
+    case ASTMAN_PROFILE_BY_BYTES:
+        return e->bytes;
+    case ASTMAN_PROFILE_BY_HANDLER_TIME:
+        return e->handler_ns;
+    case ASTMAN_PROFILE_BY_DROPS:
+        return e->drops;
+    case ASTMAN_PROFILE_BY_COUNT:
+    default:
+        return e->count;
+    }
+}
+/*******************************************************************************
+ * @fn int astman_profiler_report(struct mansession *s,
+ *                                enum astman_profile_sort sort,
+ *                                struct astman_profile_entry *top, int n)
+ * @brief Insertion into the n sized output keeps it sorted: O(names * n)
+ ******************************************************************************/
+int astman_profiler_report(struct mansession *s, enum astman_profile_sort sort,
+                           struct astman_profile_entry *top, int n) {
+    struct astman_profiler *p = s->profiler;
+    struct prof_entry *e;
+    unsigned long long now, key;
+    double elapsed, recent;
+    int x, y, filled = 0;
+
+    if (!p || !top || n <= 0)
+        return 0;
+    now = astman_metrics_now();
+    elapsed = (now - p->start) / 1e9;
+    recent = (now - p->last_dump) / 1e9;
+
+    for (x = 0; x < p->size; x++) {
+        e = &p->tab[x];
+        if (!e->hash)
+            continue;
+        key = prof_key(&e->st, sort);
+        if (filled == n && key <= prof_key(&top[n - 1], sort))
+            continue;
+        for (y = (filled < n) ? filled++ : n - 1;
+             y > 0 && prof_key(&top[y - 1], sort) < key; y--)
+            top[y] = top[y - 1];
+        top[y] = e->st;
+        top[y].rate = elapsed > 0 ? e->st.count / elapsed : 0;
+        top[y].recent_rate = recent > 0 ? (e->st.count - e->last_count) / recent : 0;
+    }
+    return filled;
+}
+/*******************************************************************************
+ * @fn void astman_profiler_dump(struct mansession *s, FILE *f, int n)
+ ******************************************************************************/
+void astman_profiler_dump(struct mansession *s, FILE *f, int n) {
+    struct astman_profiler *p = s->profiler;
+    struct astman_profile_entry *top;
+    int x, filled;
+
+    if (!p || n <= 0)
+        return;
+    top = calloc(n, sizeof(*top));
+    if (!top)
+        return;
+    filled = astman_profiler_report(s, ASTMAN_PROFILE_BY_HANDLER_TIME, top, n);
+    fprintf(f, "%-24s %10s %9s %9s %7s %7s %9s %7s %11s %9s %9s\n",
+            "Event", "count", "rate/s", "recent/s", "avg hdr", "max hdr",
+            "avg bytes", "max b", "handler us", "max us", "drops");
+    for (x = 0; x < filled; x++) {
+        fprintf(f, "%-24s %10llu %9.1f %9.1f %7.1f %7d %9.1f %7u %11llu %9llu %9llu\n",
+                top[x].event, top[x].count, top[x].rate, top[x].recent_rate,
+                top[x].count ? (double)top[x].headers / top[x].count : 0.0,
+                top[x].max_headers,
+                top[x].count ? (double)top[x].bytes / top[x].count : 0.0,
+                top[x].max_bytes,
+                top[x].handler_ns / 1000, top[x].max_handler_ns / 1000,
+                top[x].drops);
+    }
+    free(top);
+
+    /* Start a new "recent" window */
+    for (x = 0; x < p->size; x++)
+        p->tab[x].last_count = p->tab[x].st.count;
+    p->last_dump = astman_metrics_now();
+}
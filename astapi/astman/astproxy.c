@@ -0,0 +1,1004 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astproxy.c
+ *  @brief AMI multiplexing proxy
+ *
+ *  One thread, one epoll set: the listening socket, the upstream sessions
+ *  and the clients. Only the first upstream session that comes up keeps
+ *  its events on, the others carry actions. An event is framed once into
+ *  a reference counted buffer that every matching client queues; a client
+ *  queue is a bounded ring written with writev() when the socket allows.
+ *  Actions leave with ActionID "astproxy-<n>", n indexing a ring of pending
+ *  entries that remember the client (and its generation, so a late
+ *  response never reaches the next client of the slot) and the original
+ *  ActionID.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astnames.h"
+#include "astsub.h"
+#include "astmetrics.h"
+#include "astproxy.h"
+/*******************************************************************************
+ *  \def PROXY_ACTIONID
+ *  \brief  Prefix of the rewritten ActionIDs, n = 0 is the proxy's own
+ ******************************************************************************/
+#define PROXY_ACTIONID          "astproxy-"
+/*******************************************************************************
+ *  \def PROXY_PENDING
+ *  \brief  Actions in flight (power of two), older entries are reused
+ ******************************************************************************/
+#define PROXY_PENDING           4096
+/*******************************************************************************
+ *  \def PROXY_CLIENT_INBUF
+ *  \brief  Largest action a client can send
+ ******************************************************************************/
+#define PROXY_CLIENT_INBUF      8192
+/*******************************************************************************
+ *  \def PROXY_RETRY
+ *  \brief  Seconds between two attempts to reopen an upstream session
+ ******************************************************************************/
+#define PROXY_RETRY             3
+/*******************************************************************************
+ *  \def PROXY_MAX_EVENTS
+ *  \brief  epoll_wait() batch
+ ******************************************************************************/
+#define PROXY_MAX_EVENTS        64
+/*******************************************************************************
+ *  \def PROXY_IOV
+ *  \brief  Frames per writev()
+ ******************************************************************************/
+#define PROXY_IOV               64
+/*******************************************************************************
+ *  \def PROXY_BANNER
+ ******************************************************************************/
+#define PROXY_BANNER            "Asterisk Call Manager/1.1\r\n"
+
+/* epoll data: (index << 8) | kind */
+enum proxy_kind {
+    PROXY_LISTEN,
+    PROXY_STOP,
+    PROXY_UPSTREAM,
+    PROXY_CLIENT
+};
+/*******************************************************************************
+ * @struct  proxy_frame
+ * @brief   A message as sent to the clients, shared by their queues
+ ******************************************************************************/
+struct proxy_frame {
+    int refcount;
+    unsigned int len;
+    char data[];
+};
+/*******************************************************************************
+ * @struct  proxy_client
+ ******************************************************************************/
+struct proxy_client {
+    int fd;
+    int slot;
+    unsigned int gen;
+    int authed;
+    int events;                     /**!< wants events */
+    int closing;                    /**!< Logoff: close once flushed */
+    int dead;                       /**!< released by the next flush */
+    int wantout;                    /**!< EPOLLOUT armed */
+    struct astman_subs *filter;     /**!< NULL: every event */
+    struct proxy_frame **queue;
+    unsigned int mask, head, tail;
+    unsigned int off;               /**!< bytes of queue[head] already sent */
+    int dirty;
+    struct proxy_client *next_dirty;
+    unsigned int inlen;
+    char in[PROXY_CLIENT_INBUF];
+};
+/*******************************************************************************
+ * @struct  proxy_upstream
+ ******************************************************************************/
+struct proxy_upstream {
+    struct mansession *s;
+    int up;
+    int events;                     /**!< the event source */
+    time_t retry;                   /**!< next reconnect attempt */
+    struct message rx;
+};
+/*******************************************************************************
+ * @struct  proxy_pending
+ ******************************************************************************/
+struct proxy_pending {
+    unsigned long long n;
+    int active;
+    int slot;
+    unsigned int gen;
+    int upstream;
+    char actionid[MAX_LEN];         /**!< "" if the client sent none */
+};
+/*******************************************************************************
+ * @struct  astman_proxy
+ ******************************************************************************/
+struct astman_proxy {
+    struct astman_proxy_config cfg; /**!< strings owned */
+    int lfd;
+    int epfd;
+    int stopfd;
+    struct proxy_upstream *up;
+    int rr;                         /**!< next upstream for an action */
+    struct proxy_client **clients;
+    unsigned int *gens;
+    struct proxy_pending *pending;
+    unsigned long long next_id;
+    struct proxy_client *dirty;
+    struct astman_proxy_stats stats;
+    struct message req;             /**!< client action being handled */
+    char params[PROXY_CLIENT_INBUF + MAX_LEN];
+    char rxbuf[65536];
+};
+/*******************************************************************************
+ * @fn static char *proxy_strdup(const char *str)
+ ******************************************************************************/
+static char *proxy_strdup(const char *str) {
+    return str ? strdup(str) : NULL;
+}
+/*******************************************************************************
+ * @fn static int proxy_epoll(struct astman_proxy *p, int op, int fd,
+ *                            uint32_t events, int kind, int index)
+ ******************************************************************************/
+static int proxy_epoll(struct astman_proxy *p, int op, int fd, uint32_t events,
+                       int kind, int index) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = ((uint64_t)index << 8) | kind;
+    return epoll_ctl(p->epfd, op, fd, &ev);
+}
+/*******************************************************************************
+ * @fn static struct proxy_frame *proxy_frame_new(struct message *m,
+ *                                                const char *actionid)
+ * @brief Frame a message
+ * @param actionid: replaces the ActionID header ("" drops it), NULL keeps
+ *                  the message as received
+ ******************************************************************************/
+static struct proxy_frame *proxy_frame_new(struct message *m,
+                                           const char *actionid) {
+    struct proxy_frame *f;
+    size_t len = 2, n;
+    int x, follows;
+    char *p;
+
+    follows = !strcasecmp(astman_get_header_id(m, ASTMAN_HDR_RESPONSE), "Follows");
+    for (x = 0; x < m->hdrcount; x++)
+        len += strlen(m->headers[x]) + 2;
+    if (actionid)
+        len += strlen(actionid) + sizeof("ActionID: ");
+    if (follows)
+        len += sizeof("--END COMMAND--\r\n");
+    f = malloc(sizeof(*f) + len);
+    if (!f)
+        return NULL;
+    f->refcount = 1;
+    p = f->data;
+    for (x = 0; x < m->hdrcount; x++) {
+        if (actionid && m->hdrid[x] == ASTMAN_HDR_ACTIONID) {
+            if (*actionid)
+                p += sprintf(p, "ActionID: %s\r\n", actionid);
+            continue;
+        }
+        n = strlen(m->headers[x]);
+        memcpy(p, m->headers[x], n);
+        p += n;
+        /* Command output lines keep their own line ends, the last one is
+           what preceded --END COMMAND-- */
+        if (follows && x == m->hdrcount - 1) {
+            p += sprintf(p, "--END COMMAND--\r\n");
+        } else if (!n || p[-1] != '\n') {
+            *p++ = '\r';
+            *p++ = '\n';
+        }
+    }
+    *p++ = '\r';
+    *p++ = '\n';
+    f->len = p - f->data;
+    return f;
+}
+/*******************************************************************************
+ * @fn static struct proxy_frame *proxy_frame_text(const char *text,
+ *                                                 const char *actionid)
+ * @brief Frame a reply of the proxy itself
+ ******************************************************************************/
+static struct proxy_frame *proxy_frame_text(const char *text, const char *actionid) {
+    struct proxy_frame *f;
+    size_t len = strlen(text) + strlen(actionid) + sizeof("ActionID: \r\n\r\n");
+
+    f = malloc(sizeof(*f) + len);
+    if (!f)
+        return NULL;
+    f->refcount = 1;
+    if (*actionid)
+        f->len = sprintf(f->data, "%sActionID: %s\r\n\r\n", text, actionid);
+    else
+        f->len = sprintf(f->data, "%s\r\n", text);
+    return f;
+}
+/*******************************************************************************
+ * @fn static void proxy_frame_unref(struct proxy_frame *f)
+ ******************************************************************************/
+static void proxy_frame_unref(struct proxy_frame *f) {
+    if (f && !--f->refcount)
+        free(f);
+}
+/*******************************************************************************
+ * @fn static void proxy_dirty(struct astman_proxy *p, struct proxy_client *c)
+ ******************************************************************************/
+static void proxy_dirty(struct astman_proxy *p, struct proxy_client *c) {
+    if (c->dirty)
+        return;
+    c->dirty = 1;
+    c->next_dirty = p->dirty;
+    p->dirty = c;
+}
+/*******************************************************************************
+ * @fn static void proxy_client_close(struct astman_proxy *p,
+ *                                    struct proxy_client *c)
+ * @brief Mark the client, it is released by the next flush (it may be in
+ *        the flush list already)
+ ******************************************************************************/
+static void proxy_client_close(struct astman_proxy *p, struct proxy_client *c) {
+    if (c->dead)
+        return;
+    c->dead = 1;
+    proxy_dirty(p, c);
+}
+/*******************************************************************************
+ * @fn static void proxy_client_release(struct astman_proxy *p,
+ *                                      struct proxy_client *c)
+ ******************************************************************************/
+static void proxy_client_release(struct astman_proxy *p, struct proxy_client *c) {
+    epoll_ctl(p->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    while (c->head != c->tail)
+        proxy_frame_unref(c->queue[c->head++ & c->mask]);
+    astman_subs_free(c->filter);
+    p->clients[c->slot] = NULL;
+    p->stats.clients--;
+    free(c->queue);
+    free(c);
+}
+/*******************************************************************************
+ * @fn static int proxy_client_push(struct astman_proxy *p,
+ *                                  struct proxy_client *c,
+ *                                  struct proxy_frame *f, int event)
+ * @brief Queue a frame (a reference is taken). A full queue drops events,
+ *        or the client with ASTMAN_PROXY_DISCONNECT_SLOW; responses are
+ *        never dropped, the client is.
+ ******************************************************************************/
+static int proxy_client_push(struct astman_proxy *p, struct proxy_client *c,
+                             struct proxy_frame *f, int event) {
+    if (c->dead)
+        return ASTMAN_FAILURE;
+    if (c->tail - c->head > c->mask) {
+        if (event && !(p->cfg.flags & ASTMAN_PROXY_DISCONNECT_SLOW)) {
+            p->stats.dropped++;
+            return ASTMAN_FAILURE;
+        }
+        astlog(ASTLOG_WARNING, "proxy: client %d is not reading, disconnected", c->slot);
+        p->stats.slow++;
+        proxy_client_close(p, c);
+        return ASTMAN_FAILURE;
+    }
+    f->refcount++;
+    c->queue[c->tail++ & c->mask] = f;
+    proxy_dirty(p, c);
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static void proxy_client_reply(struct astman_proxy *p,
+ *                                    struct proxy_client *c,
+ *                                    const char *text, const char *actionid)
+ ******************************************************************************/
+static void proxy_client_reply(struct astman_proxy *p, struct proxy_client *c,
+                               const char *text, const char *actionid) {
+    struct proxy_frame *f = proxy_frame_text(text, actionid);
+    if (!f) {
+        proxy_client_close(p, c);
+        return;
+    }
+    proxy_client_push(p, c, f, 0);
+    proxy_frame_unref(f);
+}
+/*******************************************************************************
+ * @fn static void proxy_client_write(struct astman_proxy *p,
+ *                                    struct proxy_client *c)
+ * @brief As much of the queue as the socket takes
+ ******************************************************************************/
+static void proxy_client_write(struct astman_proxy *p, struct proxy_client *c) {
+    struct iovec iov[PROXY_IOV];
+    struct proxy_frame *f;
+    unsigned int x, n;
+    ssize_t res;
+
+    while (c->head != c->tail) {
+        for (x = c->head, n = 0; x != c->tail && n < PROXY_IOV; x++, n++) {
+            f = c->queue[x & c->mask];
+            iov[n].iov_base = f->data + (n ? 0 : c->off);
+            iov[n].iov_len = f->len - (n ? 0 : c->off);
+        }
+        res = writev(c->fd, iov, n);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                c->dead = 1;
+            break;
+        }
+        while (res > 0) {
+            f = c->queue[c->head & c->mask];
+            if ((size_t)res < f->len - c->off) {
+                c->off += res;
+                break;
+            }
+            res -= f->len - c->off;
+            c->off = 0;
+            c->head++;
+            proxy_frame_unref(f);
+        }
+    }
+    if (c->dead)
+        return;
+    if (c->head == c->tail && c->closing) {
+        c->dead = 1;
+        return;
+    }
+    /* Wait for room only while something is left */
+    if ((c->head != c->tail) != c->wantout) {
+        c->wantout = !c->wantout;
+        proxy_epoll(p, EPOLL_CTL_MOD, c->fd, EPOLLIN | (c->wantout ? EPOLLOUT : 0),
+                    PROXY_CLIENT, c->slot);
+    }
+}
+/*******************************************************************************
+ * @fn static void proxy_flush(struct astman_proxy *p)
+ * @brief Write to the clients queued since the last flush, release the
+ *        closed ones
+ ******************************************************************************/
+static void proxy_flush(struct astman_proxy *p) {
+    struct proxy_client *c;
+
+    while ((c = p->dirty)) {
+        p->dirty = c->next_dirty;
+        c->dirty = 0;
+        if (!c->dead)
+            proxy_client_write(p, c);
+        if (c->dead)
+            proxy_client_release(p, c);
+    }
+}
+/*******************************************************************************
+ * @fn static void proxy_accept(struct astman_proxy *p)
+ ******************************************************************************/
+static void proxy_accept(struct astman_proxy *p) {
+    struct proxy_client *c;
+    unsigned int size;
+    int fd, slot;
+
+    while ((fd = accept4(p->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        for (slot = 0; slot < p->cfg.max_clients && p->clients[slot]; slot++);
+        c = slot < p->cfg.max_clients ? calloc(1, sizeof(*c)) : NULL;
+        for (size = 1; size < p->cfg.queue_size; size *= 2);
+        if (c && !(c->queue = malloc(size * sizeof(*c->queue)))) {
+            free(c);
+            c = NULL;
+        }
+        if (!c) {
+            astlog(ASTLOG_WARNING, "proxy: client refused (%s)",
+                   slot < p->cfg.max_clients ? "out of memory" : "too many clients");
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->slot = slot;
+        c->gen = ++p->gens[slot];
+        c->mask = size - 1;
+        c->events = 1;
+        if (proxy_epoll(p, EPOLL_CTL_ADD, fd, EPOLLIN, PROXY_CLIENT, slot) < 0) {
+            close(fd);
+            free(c->queue);
+            free(c);
+            continue;
+        }
+        p->clients[slot] = c;
+        p->stats.clients++;
+        if (send(fd, PROXY_BANNER, strlen(PROXY_BANNER), MSG_NOSIGNAL) < 0)
+            proxy_client_close(p, c);
+    }
+}
+/*******************************************************************************
+ * @fn static int proxy_pick(struct astman_proxy *p)
+ * @brief Next logged in upstream session, round robin, -1 if none
+ ******************************************************************************/
+static int proxy_pick(struct astman_proxy *p) {
+    int x, u;
+
+    for (x = 0; x < p->cfg.sessions; x++) {
+        u = (p->rr + x) % p->cfg.sessions;
+        if (p->up[u].up) {
+            p->rr = u + 1;
+            return u;
+        }
+    }
+    return -1;
+}
+/*******************************************************************************
+ * @fn static void proxy_forward(struct astman_proxy *p, struct proxy_client *c,
+ *                               const char *action, const char *actionid)
+ * @brief Send the client's action upstream under a proxy ActionID
+ ******************************************************************************/
+static void proxy_forward(struct astman_proxy *p, struct proxy_client *c,
+                          const char *action, const char *actionid) {
+    struct proxy_pending *pe;
+    struct message *m = &p->req;
+    size_t len = 0;
+    int x, u;
+
+    u = proxy_pick(p);
+    if (u < 0) {
+        proxy_client_reply(p, c, "Response: Error\r\nMessage: No upstream connection\r\n", actionid);
+        return;
+    }
+    for (x = 0; x < m->hdrcount; x++) {
+        if (m->hdrid[x] == ASTMAN_HDR_ACTION || m->hdrid[x] == ASTMAN_HDR_ACTIONID)
+            continue;
+        len += snprintf(p->params + len, sizeof(p->params) - len, "%s\r\n", m->headers[x]);
+    }
+    pe = &p->pending[(p->next_id + 1) & (PROXY_PENDING - 1)];
+    if (pe->active) {
+        /* the oldest still waits for its response, refuse the new one */
+        astlog(ASTLOG_WARNING, "proxy: more than %d actions in flight", PROXY_PENDING);
+        proxy_client_reply(p, c, "Response: Error\r\nMessage: Too many actions in flight\r\n", actionid);
+        return;
+    }
+    pe->n = ++p->next_id;
+    pe->active = 1;
+    pe->slot = c->slot;
+    pe->gen = c->gen;
+    pe->upstream = u;
+    snprintf(pe->actionid, sizeof(pe->actionid), "%s", actionid);
+    snprintf(p->params + len, sizeof(p->params) - len, "ActionID: " PROXY_ACTIONID "%llu\r\n", pe->n);
+    p->stats.actions++;
+    if (astman_manager_action(p->up[u].s, (char *)action, "%s", p->params) < 0)
+        p->up[u].up = 0; /* reopened by the next tick, pe answered then */
+}
+/*******************************************************************************
+ * @fn static int proxy_filter(struct mansession *s, struct message *m)
+ * @brief Callback of the client filters, which are only matched
+ ******************************************************************************/
+static int proxy_filter(struct mansession *s, struct message *m) {
+    (void)s;
+    (void)m;
+    return 0;
+}
+/*******************************************************************************
+ * @fn static void proxy_client_action(struct astman_proxy *p,
+ *                                     struct proxy_client *c)
+ * @brief An action in p->req: the session ones are answered here, the rest
+ *        goes upstream
+ ******************************************************************************/
+static void proxy_client_action(struct astman_proxy *p, struct proxy_client *c) {
+    struct message *m = &p->req;
+    const char *action = astman_get_header_id(m, ASTMAN_HDR_ACTION);
+    const char *actionid = astman_get_header_id(m, ASTMAN_HDR_ACTIONID);
+    const char *v;
+
+    if (!*action) {
+        proxy_client_reply(p, c, "Response: Error\r\nMessage: Missing action in request\r\n", actionid);
+    } else if (!strcasecmp(action, "Login")) {
+        if (p->cfg.client_username &&
+            (strcmp(astman_get_header(m, "Username"), p->cfg.client_username) ||
+             strcmp(astman_get_header(m, "Secret"), p->cfg.client_secret ? p->cfg.client_secret : ""))) {
+            proxy_client_reply(p, c, "Response: Error\r\nMessage: Authentication failed\r\n", actionid);
+            c->closing = 1;
+            return;
+        }
+        c->authed = 1;
+        v = astman_get_header(m, "Events");
+        c->events = strcasecmp(v, "off") != 0;
+        proxy_client_reply(p, c, "Response: Success\r\nMessage: Authentication accepted\r\n", actionid);
+    } else if (!c->authed) {
+        proxy_client_reply(p, c, "Response: Error\r\nMessage: Authentication Required\r\n", actionid);
+    } else if (!strcasecmp(action, "Logoff")) {
+        proxy_client_reply(p, c, "Response: Goodbye\r\nMessage: Thanks for all the fish.\r\n", actionid);
+        c->closing = 1;
+    } else if (!strcasecmp(action, "Events")) {
+        v = astman_get_header(m, "EventMask");
+        c->events = strcasecmp(v, "off") != 0;
+        proxy_client_reply(p, c, c->events ? "Response: Success\r\nEvents: On\r\n" :
+                                             "Response: Success\r\nEvents: Off\r\n", actionid);
+    } else if (!strcasecmp(action, "Filter")) {
+        /* Event name patterns (astsub.h) rather than Asterisk's regular
+           expressions, "Event: " in front is accepted */
+        v = astman_get_header(m, "Filter");
+        if (!strncasecmp(v, "Event: ", 7))
+            v += 7;
+        if (strcasecmp(astman_get_header(m, "Operation"), "Add") ||
+            !astman_subs_pattern(v) ||
+            (!c->filter && !(c->filter = astman_subs_new()))) {
+            proxy_client_reply(p, c, "Response: Error\r\nMessage: Filter Not Added\r\n", actionid);
+        } else {
+            /* Already there is as good as added */
+            astman_subs_add(c->filter, v, proxy_filter);
+            proxy_client_reply(p, c, "Response: Success\r\nMessage: Filter Added Successfully\r\n", actionid);
+        }
+    } else {
+        proxy_forward(p, c, action, actionid);
+    }
+}
+/*******************************************************************************
+ * @fn static void proxy_client_read(struct astman_proxy *p,
+ *                                   struct proxy_client *c)
+ ******************************************************************************/
+static void proxy_client_read(struct astman_proxy *p, struct proxy_client *c) {
+    struct message *m = &p->req;
+    char *start, *nl, *line;
+    const char *error;
+    unsigned int used;
+    size_t len;
+    ssize_t res;
+
+    for (;;) {
+        res = recv(c->fd, c->in + c->inlen, sizeof(c->in) - 1 - c->inlen, 0);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (res <= 0) {
+            proxy_client_close(p, c);
+            return;
+        }
+        c->inlen += res;
+        c->in[c->inlen] = '\0';
+        /* Every complete action in the buffer */
+        start = c->in;
+        line = start;
+        m->hdrcount = 0;
+        error = NULL;
+        while (!c->dead && (nl = strchr(line, '\n'))) {
+            *nl = '\0';
+            if (nl > line && nl[-1] == '\r')
+                nl[-1] = '\0';
+            if (*line) {
+                /* never forwarded cut short: the whole action is refused */
+                len = strlen(line);
+                if (len >= MAX_LEN) {
+                    error = "Response: Error\r\nMessage: Header line too long\r\n";
+                } else if (m->hdrcount >= MAX_HEADERS - 1) {
+                    error = "Response: Error\r\nMessage: Too many headers\r\n";
+                } else {
+                    memcpy(m->headers[m->hdrcount], line, len + 1);
+                    astman_message_intern(m, m->hdrcount);
+                    m->hdrcount++;
+                }
+            } else if (error) {
+                proxy_client_reply(p, c, error, astman_get_header_id(m, ASTMAN_HDR_ACTIONID));
+                error = NULL;
+                m->hdrcount = 0;
+                start = nl + 1;
+            } else if (m->hdrcount) {
+                proxy_client_action(p, c);
+                m->hdrcount = 0;
+                start = nl + 1;
+            } else {
+                start = nl + 1;
+            }
+            line = nl + 1;
+        }
+        used = start - c->in;
+        /* The unfinished action is parsed again with the next data */
+        memmove(c->in, start, c->inlen - used);
+        c->inlen -= used;
+        if (c->inlen >= sizeof(c->in) - 1) {
+            astlog(ASTLOG_WARNING, "proxy: client %d sent an oversized action", c->slot);
+            proxy_client_close(p, c);
+            return;
+        }
+    }
+}
+/*******************************************************************************
+ * @fn static void proxy_response(struct astman_proxy *p, struct message *m,
+ *                                const char *id)
+ * @brief A response, or an event of a list, to a forwarded action
+ ******************************************************************************/
+static void proxy_response(struct astman_proxy *p, struct message *m,
+                           const char *id) {
+    struct proxy_pending *pe;
+    struct proxy_client *c;
+    struct proxy_frame *f;
+    unsigned long long n;
+    const char *list;
+
+    n = strtoull(id + strlen(PROXY_ACTIONID), NULL, 10);
+    if (!n)
+        return;     /* ours */
+    pe = &p->pending[n & (PROXY_PENDING - 1)];
+    if (!pe->active || pe->n != n) {
+        p->stats.orphans++;
+        return;
+    }
+    /* A list goes on until its EventList: Complete event */
+    list = astman_get_header(m, "EventList");
+    if (*astman_get_header_id(m, ASTMAN_HDR_RESPONSE) ? strcasecmp(list, "start")
+                                                      : !strcasecmp(list, "Complete"))
+        pe->active = 0;
+    c = p->clients[pe->slot];
+    if (!c || c->gen != pe->gen) {
+        p->stats.orphans++;
+        return;
+    }
+    f = proxy_frame_new(m, pe->actionid);
+    if (!f) {
+        proxy_client_close(p, c);
+        return;
+    }
+    proxy_client_push(p, c, f, 0);
+    proxy_frame_unref(f);
+}
+/*******************************************************************************
+ * @fn static void proxy_event(struct astman_proxy *p, struct message *m)
+ * @brief Frame once, queue to every subscriber
+ ******************************************************************************/
+static void proxy_event(struct astman_proxy *p, struct message *m) {
+    struct proxy_client *c;
+    struct proxy_frame *f = NULL;
+    int x, id = astman_message_event(m);
+    const char *name = astman_get_header_id(m, ASTMAN_HDR_EVENT);
+
+    p->stats.events++;
+    for (x = 0; x < p->cfg.max_clients; x++) {
+        c = p->clients[x];
+        if (!c || !c->authed || !c->events || c->dead)
+            continue;
+        if (c->filter && !astman_subs_match_id(c->filter, id, name))
+            continue;
+        if (!f && !(f = proxy_frame_new(m, NULL)))
+            return;
+        if (proxy_client_push(p, c, f, 1) == ASTMAN_SUCCESS)
+            p->stats.delivered++;
+    }
+    proxy_frame_unref(f);
+}
+/*******************************************************************************
+ * @fn static void proxy_upstream_message(struct astman_proxy *p,
+ *                                        struct proxy_upstream *u,
+ *                                        struct message *m)
+ ******************************************************************************/
+static void proxy_upstream_message(struct astman_proxy *p,
+                                   struct proxy_upstream *u,
+                                   struct message *m) {
+    const char *id = astman_get_header_id(m, ASTMAN_HDR_ACTIONID);
+
+    /* Metrics, journal, shared state... of the upstream session */
+    astman_dispatch_message(u->s, m);
+    if (!strncmp(id, PROXY_ACTIONID, strlen(PROXY_ACTIONID)))
+        proxy_response(p, m, id);
+    else if (*astman_get_header_id(m, ASTMAN_HDR_EVENT))
+        proxy_event(p, m);
+}
+/*******************************************************************************
+ * @fn static void proxy_upstream_down(struct astman_proxy *p, int u)
+ * @brief Close the session, fail the actions it was carrying
+ ******************************************************************************/
+static void proxy_upstream_down(struct astman_proxy *p, int u) {
+    struct proxy_upstream *up = &p->up[u];
+    struct proxy_pending *pe;
+    struct proxy_client *c;
+    int x;
+
+    if (up->s->fd > 0) {
+        epoll_ctl(p->epfd, EPOLL_CTL_DEL, up->s->fd, NULL);
+        astman_disconnect(up->s);
+    }
+    if (up->up) {
+        astlog(ASTLOG_WARNING, "proxy: upstream session %d lost", u);
+        p->stats.upstreams--;
+    }
+    up->up = 0;
+    up->events = 0;
+    up->retry = time(NULL) + PROXY_RETRY;
+    up->rx.hdrcount = 0;
+    up->rx.gettingdata = 0;
+    up->s->inlen = 0;
+    for (x = 0; x < PROXY_PENDING; x++) {
+        pe = &p->pending[x];
+        if (!pe->active || pe->upstream != u)
+            continue;
+        pe->active = 0;
+        c = p->clients[pe->slot];
+        if (c && c->gen == pe->gen)
+            proxy_client_reply(p, c, "Response: Error\r\nMessage: Upstream connection lost\r\n", pe->actionid);
+    }
+}
+/*******************************************************************************
+ * @fn static void proxy_upstream_open(struct astman_proxy *p, int u)
+ * @brief Connect and log in (blocking), events stay on for the first
+ *        session up only
+ ******************************************************************************/
+static void proxy_upstream_open(struct astman_proxy *p, int u) {
+    struct proxy_upstream *up = &p->up[u];
+    int x, events = 1;
+
+    up->retry = time(NULL) + PROXY_RETRY;
+    if (astman_connect(up->s, (char *)p->cfg.host, p->cfg.port) < 0 ||
+        astman_login(up->s, (char *)p->cfg.username, (char *)p->cfg.secret) != ASTMAN_SUCCESS) {
+        astlog(ASTLOG_ERROR, "proxy: upstream session %d to %s:%d failed", u, p->cfg.host, p->cfg.port);
+        astman_disconnect(up->s);
+        return;
+    }
+    for (x = 0; x < p->cfg.sessions; x++)
+        if (x != u && p->up[x].events)
+            events = 0;
+    /* The answer comes back through the loop under the proxy's own id */
+    if (astman_manager_action(up->s, "Events", "EventMask: %s\r\nActionID: " PROXY_ACTIONID "0\r\n",
+                              events ? "on" : "off") < 0 ||
+        proxy_epoll(p, EPOLL_CTL_ADD, up->s->fd, EPOLLIN, PROXY_UPSTREAM, u) < 0) {
+        astman_disconnect(up->s);
+        return;
+    }
+    up->up = 1;
+    up->events = events;
+    p->stats.upstreams++;
+    astlog(ASTLOG_INFO, "proxy: upstream session %d up%s", u, events ? ", events" : "");
+}
+/*******************************************************************************
+ * @fn static void proxy_upstream_read(struct astman_proxy *p, int u)
+ ******************************************************************************/
+static void proxy_upstream_read(struct astman_proxy *p, int u) {
+    struct proxy_upstream *up = &p->up[u];
+    const char *data;
+    size_t len;
+    ssize_t res;
+
+    for (;;) {
+        res = recv(up->s->fd, p->rxbuf, sizeof(p->rxbuf), MSG_DONTWAIT);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (res <= 0) {
+            proxy_upstream_down(p, u);
+            return;
+        }
+        astman_metrics_received(res);
+        data = p->rxbuf;
+        len = res;
+        while (astman_message_input(up->s, &up->rx, &data, &len) == 1) {
+            proxy_upstream_message(p, up, &up->rx);
+            up->rx.hdrcount = 0;
+            up->rx.gettingdata = 0;
+        }
+        if ((size_t)res < sizeof(p->rxbuf))
+            return;
+    }
+}
+/*******************************************************************************
+ * @fn static void proxy_tick(struct astman_proxy *p)
+ * @brief Reopen the lost upstream sessions, hand the events over if their
+ *        source is gone
+ ******************************************************************************/
+static void proxy_tick(struct astman_proxy *p) {
+    time_t now = time(NULL);
+    int x, source = -1;
+
+    for (x = 0; x < p->cfg.sessions; x++) {
+        if (!p->up[x].up && now >= p->up[x].retry)
+            proxy_upstream_open(p, x);
+        if (p->up[x].events)
+            source = x;
+    }
+    if (source < 0 && (x = proxy_pick(p)) >= 0 &&
+        astman_manager_action(p->up[x].s, "Events", "EventMask: on\r\nActionID: " PROXY_ACTIONID "0\r\n") >= 0) {
+        p->up[x].events = 1;
+        astlog(ASTLOG_INFO, "proxy: events moved to upstream session %d", x);
+    }
+}
+/*******************************************************************************
+ * @fn struct astman_proxy *astman_proxy_new(const struct astman_proxy_config *cfg)
+ ******************************************************************************/
+struct astman_proxy *astman_proxy_new(const struct astman_proxy_config *cfg) {
+    struct astman_proxy *p;
+    struct sockaddr_in sin;
+    int x, one = 1;
+
+    if (!cfg->host || !cfg->username || !cfg->listen_port)
+        return NULL;
+    p = calloc(1, sizeof(*p));
+    if (!p)
+        return NULL;
+    p->lfd = p->epfd = p->stopfd = -1;
+    p->cfg = *cfg;
+    p->cfg.host = proxy_strdup(cfg->host);
+    p->cfg.username = proxy_strdup(cfg->username);
+    p->cfg.secret = proxy_strdup(cfg->secret ? cfg->secret : "");
+    p->cfg.bind = proxy_strdup(cfg->bind ? cfg->bind : "127.0.0.1");
+    p->cfg.client_username = proxy_strdup(cfg->client_username);
+    p->cfg.client_secret = proxy_strdup(cfg->client_secret);
+    if (p->cfg.sessions <= 0)
+        p->cfg.sessions = 2;
+    if (p->cfg.max_clients <= 0)
+        p->cfg.max_clients = 1024;
+    if (!p->cfg.queue_size)
+        p->cfg.queue_size = ASTMAN_PROXY_QUEUE_SIZE;
+    if (!p->cfg.port)
+        p->cfg.port = 5038;
+    p->up = calloc(p->cfg.sessions, sizeof(*p->up));
+    p->clients = calloc(p->cfg.max_clients, sizeof(*p->clients));
+    p->gens = calloc(p->cfg.max_clients, sizeof(*p->gens));
+    p->pending = calloc(PROXY_PENDING, sizeof(*p->pending));
+    if (!p->up || !p->clients || !p->gens || !p->pending)
+        goto Error;
+    for (x = 0; x < p->cfg.sessions; x++)
+        if (!(p->up[x].s = astman_session_new()))
+            goto Error;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(p->cfg.listen_port);
+    if (inet_pton(AF_INET, p->cfg.bind, &sin.sin_addr) != 1) {
+        astlog(ASTLOG_ERROR, "proxy: bad bind address %s", p->cfg.bind);
+        goto Error;
+    }
+    p->lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (p->lfd < 0)
+        goto Error;
+    setsockopt(p->lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(p->lfd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+        listen(p->lfd, 128) < 0) {
+        astlog(ASTLOG_ERROR, "proxy: %s:%d: %s", p->cfg.bind, p->cfg.listen_port, strerror(errno));
+        goto Error;
+    }
+    p->epfd = epoll_create1(EPOLL_CLOEXEC);
+    p->stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (p->epfd < 0 || p->stopfd < 0 ||
+        proxy_epoll(p, EPOLL_CTL_ADD, p->lfd, EPOLLIN, PROXY_LISTEN, 0) < 0 ||
+        proxy_epoll(p, EPOLL_CTL_ADD, p->stopfd, EPOLLIN, PROXY_STOP, 0) < 0)
+        goto Error;
+    return p;
+Error:
+    astman_proxy_free(p);
+    return NULL;
+}
+/*******************************************************************************
+ * @fn int astman_proxy_run(struct astman_proxy *p)
+ ******************************************************************************/
+int astman_proxy_run(struct astman_proxy *p) {
+    struct epoll_event evs[PROXY_MAX_EVENTS];
+    struct proxy_client *c;
+    uint64_t value;
+    int n, x, index;
+
+    proxy_tick(p);
+    for (;;) {
+        n = epoll_wait(p->epfd, evs, PROXY_MAX_EVENTS, 1000);
+        if (n < 0 && errno != EINTR) {
+            astlog(ASTLOG_ERROR, "proxy: epoll_wait: %s", strerror(errno));
+            return ASTMAN_FAILURE;
+        }
+        for (x = 0; x < n; x++) {
+            index = evs[x].data.u64 >> 8;
+            switch (evs[x].data.u64 & 0xff) {
+            case PROXY_LISTEN:
+                proxy_accept(p);
+                break;
+            case PROXY_STOP:
+                if (read(p->stopfd, &value, sizeof(value)) > 0) {
+                    proxy_flush(p);
+                    return ASTMAN_SUCCESS;
+                }
+                break;
+            case PROXY_UPSTREAM:
+                if (p->up[index].up)
+                    proxy_upstream_read(p, index);
+                break;
+            case PROXY_CLIENT:
+                c = p->clients[index];
+                if (!c || c->dead)
+                    break;
+                if (evs[x].events & (EPOLLERR | EPOLLHUP))
+                    proxy_client_close(p, c);
+                else if (evs[x].events & EPOLLIN)
+                    proxy_client_read(p, c);
+                if (!c->dead && (evs[x].events & EPOLLOUT))
+                    proxy_dirty(p, c);
+                break;
+            }
+            /* A batch of events goes out in one writev() per client */
+            proxy_flush(p);
+        }
+        proxy_tick(p);
+    }
+}
+/*******************************************************************************
+ * @fn void astman_proxy_stop(struct astman_proxy *p)
+ ******************************************************************************/
+void astman_proxy_stop(struct astman_proxy *p) {
+    uint64_t one = 1;
+    if (write(p->stopfd, &one, sizeof(one)) < 0)
+        return;
+}
+/*******************************************************************************
+ * @fn void astman_proxy_free(struct astman_proxy *p)
+ ******************************************************************************/
+void astman_proxy_free(struct astman_proxy *p) {
+    int x;
+
+    if (!p)
+        return;
+    if (p->clients) {
+        for (x = 0; x < p->cfg.max_clients; x++)
+            if (p->clients[x])
+                proxy_client_release(p, p->clients[x]);
+    }
+    if (p->up) {
+        for (x = 0; x < p->cfg.sessions; x++) {
+            if (!p->up[x].s)
+                continue;
+            if (p->up[x].up)
+                astman_logoff(p->up[x].s);
+            astman_session_free(p->up[x].s);
+        }
+    }
+    if (p->lfd >= 0)
+        close(p->lfd);
+    if (p->stopfd >= 0)
+        close(p->stopfd);
+    if (p->epfd >= 0)
+        close(p->epfd);
+    free((char *)p->cfg.host);
+    free((char *)p->cfg.username);
+    free((char *)p->cfg.secret);
+    free((char *)p->cfg.bind);
+    free((char *)p->cfg.client_username);
+    free((char *)p->cfg.client_secret);
+    free(p->up);
+    free(p->clients);
+    free(p->gens);
+    free(p->pending);
+    free(p);
+}
+/*******************************************************************************
+ * @fn void astman_proxy_stats(struct astman_proxy *p,
+ *                             struct astman_proxy_stats *st)
+ ******************************************************************************/
+void astman_proxy_stats(struct astman_proxy *p, struct astman_proxy_stats *st) {
+    memcpy(st, &p->stats, sizeof(*st));
+}
@@ -0,0 +1,355 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astqueue.c
+ *  @brief Reference counted messages and bounded lock-free queues
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astqueue.h"
+/*******************************************************************************
+ *  \def CACHE_LINE
+ *  \brief  Producer and consumer indexes live on their own cache line
+ ******************************************************************************/
+#define CACHE_LINE  64
+/*******************************************************************************
+ * @struct  mpsc_cell
+ * @brief   Slot of the MPSC ring, seq tells who may use it next
+ ******************************************************************************/
+struct mpsc_cell {
+    unsigned long seq;
+    void *data;
+};
+/*******************************************************************************
+ * @struct  astman_queue
+ ******************************************************************************/
+struct astman_queue {
+    enum astman_queue_type type;
+    unsigned long mask;                                     /**!< capacity - 1 */
+    void **slots;                                           /**!< SPSC ring */
+    struct mpsc_cell *cells;                                /**!< MPSC ring */
+    int efd;                                                /**!< eventfd or -1 */
+    unsigned long head __attribute__((aligned(CACHE_LINE))); /**!< consumer */
+    unsigned long tail __attribute__((aligned(CACHE_LINE))); /**!< producers */
+    uint32_t wseq __attribute__((aligned(CACHE_LINE)));     /**!< futex word */
+    uint32_t waiting;                                       /**!< consumer asleep */
+};
+/*******************************************************************************
+ * @fn struct astman_msg *astman_msg_new(void)
+ ******************************************************************************/
+struct astman_msg *astman_msg_new(void) {
+    struct astman_msg *msg = malloc(sizeof(*msg));
+    if (!msg)
+        return NULL;
+    msg->refcount = 1;
+    msg->m.hdrcount = 0;
+    msg->m.gettingdata = 0;
+    return msg;
+}
+/*******************************************************************************
+ * @fn struct astman_msg *astman_msg_ref(struct astman_msg *msg)
+ ******************************************************************************/
+struct astman_msg *astman_msg_ref(struct astman_msg *msg) {
+    if (msg)
+        __atomic_fetch_add(&msg->refcount, 1, __ATOMIC_RELAXED);
+    return msg;
+}
+/*******************************************************************************
+ * @fn void astman_msg_unref(struct astman_msg *msg)
+ ******************************************************************************/
+void astman_msg_unref(struct astman_msg *msg) {
+    if (msg && __atomic_sub_fetch(&msg->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+        free(msg);
+}
+/*******************************************************************************
+ * @fn int astman_wait_for_msg(struct mansession *s, struct astman_msg **msg,
+ *                             time_t timeout)
+ ******************************************************************************/
+int astman_wait_for_msg(struct mansession *s, struct astman_msg **msg,
+                        time_t timeout) {
+    struct astman_msg *h;
+    int res;
+
+    *msg = NULL;
+    h = astman_msg_new();
+    if (!h)
+        return -1;
+    res = astman_wait_for_response(s, &h->m, timeout);
+    if (res > 0 || h->m.hdrcount > 0) {
+        *msg = h;
+        return res;
+    }
+    astman_msg_unref(h);
+    return res;
+}
+/*******************************************************************************
+ * @fn struct astman_queue *astman_queue_new(enum astman_queue_type type,
+ *                                           unsigned int capacity)
+ ******************************************************************************/
+struct astman_queue *astman_queue_new(enum astman_queue_type type,
+                                      unsigned int capacity) {
+    struct astman_queue *q;
+    unsigned long size = 2, x;
+
+    while (size < capacity)
+        size <<= 1;
+    if (posix_memalign((void **)&q, CACHE_LINE, sizeof(*q)))
+        return NULL;
+    memset(q, 0, sizeof(*q));
+    q->type = type;
+    q->mask = size - 1;
+    q->efd = -1;
+    if (type == ASTMAN_QUEUE_SPSC) {
+        q->slots = calloc(size, sizeof(void *));
+        if (!q->slots)
+            goto Error;
+    } else {
+        q->cells = calloc(size, sizeof(struct mpsc_cell));
+        if (!q->cells)
+            goto Error;
+        for (x = 0; x < size; x++)
+            q->cells[x].seq = x;
+    }
+    return q;
+Error:
+    free(q);
+    return NULL;
+}
+/*******************************************************************************
+ * @fn void astman_queue_free(struct astman_queue *q)
+ ******************************************************************************/
+void astman_queue_free(struct astman_queue *q) {
+    if (!q)
+        return;
+    if (q->efd >= 0)
+        close(q->efd);
+    free(q->slots);
+    free(q->cells);
+    free(q);
+}
+/*******************************************************************************
+ * @fn static int spsc_push(struct astman_queue *q, void *item)
+ ******************************************************************************/
+static int spsc_push(struct astman_queue *q, void *item) {
+    unsigned long t = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    if (t - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask)
+        return ASTMAN_FAILURE;
+    q->slots[t & q->mask] = item;
+    __atomic_store_n(&q->tail, t + 1, __ATOMIC_RELEASE);
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static void *spsc_pop(struct astman_queue *q)
+ ******************************************************************************/
+static void *spsc_pop(struct astman_queue *q) {
+    unsigned long h = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    void *item;
+    if (h == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    item = q->slots[h & q->mask];
+    __atomic_store_n(&q->head, h + 1, __ATOMIC_RELEASE);
+    return item;
+}
+/*******************************************************************************
+ * @fn static int mpsc_push(struct astman_queue *q, void *item)
+ * @brief Producers reserve a cell by moving tail, the cell sequence
+ *        publishes the item to the consumer (D. Vyukov bounded queue).
+ ******************************************************************************/
+static int mpsc_push(struct astman_queue *q, void *item) {
+    struct mpsc_cell *cell;
+    unsigned long pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    long dif;
+
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        dif = (long)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return ASTMAN_FAILURE;
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+    cell->data = item;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static void *mpsc_pop(struct astman_queue *q)
+ ******************************************************************************/
+static void *mpsc_pop(struct astman_queue *q) {
+    unsigned long pos = q->head;
+    struct mpsc_cell *cell = &q->cells[pos & q->mask];
+    void *item;
+
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        return NULL;
+    item = cell->data;
+    __atomic_store_n(&q->head, pos + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    return item;
+}
+/*******************************************************************************
+ * @fn static void queue_notify(struct astman_queue *q)
+ * @brief Wake the consumer, only when it announced it sleeps: through the
+ *        eventfd if there is one, and on the futex for astman_queue_pop_wait()
+ ******************************************************************************/
+static void queue_notify(struct astman_queue *q) {
+    uint64_t one = 1;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&q->waiting, __ATOMIC_RELAXED) ||
+        !__atomic_exchange_n(&q->waiting, 0, __ATOMIC_ACQ_REL))
+        return;
+    if (q->efd >= 0 && write(q->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        astlog(ASTLOG_ERROR, "eventfd write: %s", strerror(errno));
+    __atomic_fetch_add(&q->wseq, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &q->wseq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+/*******************************************************************************
+ * @fn int astman_queue_push(struct astman_queue *q, void *item)
+ ******************************************************************************/
+int astman_queue_push(struct astman_queue *q, void *item) {
+    int res;
+    if (!q || !item)
+        return ASTMAN_FAILURE;
+    res = (q->type == ASTMAN_QUEUE_SPSC) ? spsc_push(q, item) : mpsc_push(q, item);
+    if (res == ASTMAN_SUCCESS)
+        queue_notify(q);
+    return res;
+}
+/*******************************************************************************
+ * @fn void *astman_queue_pop(struct astman_queue *q)
+ ******************************************************************************/
+void *astman_queue_pop(struct astman_queue *q) {
+    if (!q)
+        return NULL;
+    return (q->type == ASTMAN_QUEUE_SPSC) ? spsc_pop(q) : mpsc_pop(q);
+}
+/*******************************************************************************
+ * @fn void *astman_queue_pop_wait(struct astman_queue *q, int timeout_ms)
+ ******************************************************************************/
+void *astman_queue_pop_wait(struct astman_queue *q, int timeout_ms) {
+    struct timespec ts, now, deadline, *pts = NULL;
+    uint32_t seq;
+    void *item;
+
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pts = &ts;
+    }
+    for (;;) {
+        item = astman_queue_pop(q);
+        if (item || !q)
+            return item;
+        seq = __atomic_load_n(&q->wseq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&q->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        /* A producer may have pushed before seeing waiting */
+        item = astman_queue_pop(q);
+        if (item) {
+            __atomic_store_n(&q->waiting, 0, __ATOMIC_RELAXED);
+            return item;
+        }
+        /* What is left of the timeout, retries included */
+        if (pts) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            ts.tv_sec = deadline.tv_sec - now.tv_sec;
+            ts.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (ts.tv_nsec < 0) {
+                ts.tv_sec--;
+                ts.tv_nsec += 1000000000L;
+            }
+            if (ts.tv_sec < 0) {
+                __atomic_store_n(&q->waiting, 0, __ATOMIC_RELAXED);
+                return astman_queue_pop(q);
+            }
+        }
+        if (syscall(SYS_futex, &q->wseq, FUTEX_WAIT_PRIVATE, seq, pts, NULL, 0) < 0 &&
+            errno == ETIMEDOUT) {
+            __atomic_store_n(&q->waiting, 0, __ATOMIC_RELAXED);
+            return astman_queue_pop(q);
+        }
+        /* woken up, spurious wake up or EAGAIN (seq moved): retry */
+    }
+}
+/*******************************************************************************
+ * @fn unsigned int astman_queue_size(struct astman_queue *q)
+ ******************************************************************************/
+unsigned int astman_queue_size(struct astman_queue *q) {
+    unsigned long t, h;
+    if (!q)
+        return 0;
+    h = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    t = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    return t > h ? (unsigned int)(t - h) : 0;
+}
+/*******************************************************************************
+ * @fn unsigned int astman_queue_capacity(struct astman_queue *q)
+ ******************************************************************************/
+unsigned int astman_queue_capacity(struct astman_queue *q) {
+    return q ? (unsigned int)(q->mask + 1) : 0;
+}
+/*******************************************************************************
+ * @fn int astman_queue_fd(struct astman_queue *q)
+ ******************************************************************************/
+int astman_queue_fd(struct astman_queue *q) {
+    if (!q)
+        return -1;
+    if (q->efd < 0)
+        q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return q->efd;
+}
+/*******************************************************************************
+ * @fn int astman_queue_arm(struct astman_queue *q)
+ ******************************************************************************/
+int astman_queue_arm(struct astman_queue *q) {
+    uint64_t cnt;
+    if (!q)
+        return 0;
+    if (q->efd >= 0 && read(q->efd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        astlog(ASTLOG_ERROR, "eventfd read: %s", strerror(errno));
+    __atomic_store_n(&q->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (astman_queue_size(q)) {
+        __atomic_store_n(&q->waiting, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,1187 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astshard.c
+ *  @brief Thread per core sharded runtime
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astevent.h"
+#include "astmetrics.h"
+#include "astasync.h"
+#include "astqueue.h"
+#include "asturing.h"
+#include "astshard.h"
+/*******************************************************************************
+ *  \def SHARD_TICK_MS
+ *  \brief  Period of the deadline scan while actions are pending
+ ******************************************************************************/
+#define SHARD_TICK_MS           50
+/*******************************************************************************
+ *  \def SHARD_MAX_EVENTS
+ *  \brief  epoll_wait() batch
+ ******************************************************************************/
+#define SHARD_MAX_EVENTS        64
+/*******************************************************************************
+ *  \def SHARD_INBOX
+ *  \brief  epoll data of the command queue eventfd
+ ******************************************************************************/
+#define SHARD_INBOX             ((uint64_t)-1)
+/*******************************************************************************
+ *  \def SHARD_MANAGER_PORT
+ *  \brief  Port used when a session is added with port 0
+ ******************************************************************************/
+#define SHARD_MANAGER_PORT      5038
+/*******************************************************************************
+ *  \def SHARD_URING_ENTRIES
+ *  \brief  io_uring submission queue size of a shard
+ ******************************************************************************/
+#define SHARD_URING_ENTRIES     256
+/*******************************************************************************
+ *  \def SHARD_URING_BUFS
+ *  \brief  Receive buffers shared by the sessions of a shard (power of two)
+ ******************************************************************************/
+#define SHARD_URING_BUFS        256
+/*******************************************************************************
+ *  \def SHARD_URING_BUFSIZE
+ ******************************************************************************/
+#define SHARD_URING_BUFSIZE     16384
+
+/* io_uring user_data: (session local index << 8) | operation */
+enum shard_uring_op {
+    SHARD_OP_CONNECT = 1,
+    SHARD_OP_RECV,
+    SHARD_OP_SEND
+};
+
+enum shard_state {
+    SHARD_DOWN,
+    SHARD_CONNECTING,
+    SHARD_LOGIN,
+    SHARD_UP,
+    SHARD_FAILED            /**!< login refused, closed after astman_poll() */
+};
+
+enum shard_cmd_type {
+    SHARD_CMD_ADD,
+    SHARD_CMD_ACTION,
+    SHARD_CMD_STEER,
+    SHARD_CMD_CALL,
+    SHARD_CMD_STOP
+};
+/*******************************************************************************
+ * @struct  shard_cmd
+ * @brief   Command sent to a shard. The strings follow the struct in the
+ *          same allocation.
+ ******************************************************************************/
+struct shard_cmd {
+    enum shard_cmd_type type;
+    int id;
+    int port;
+    int flags;
+    int timeout_ms;
+    int origin;                     /**!< ACTION: session it was steered from,
+                                         -1 not steered, -2 steered back */
+    int bulk;                       /**!< STEER: the bulk session */
+    char *host, *username, *secret;
+    struct sockaddr_in addr;        /**!< ADD: resolved by the caller */
+    char *action, *params;
+    ASTMAN_ACTION_CALLBACK cb;
+    ASTMAN_SHARD_CALLBACK func;
+    void *data;
+};
+/*******************************************************************************
+ * @struct  shard_session
+ ******************************************************************************/
+struct shard_session {
+    int id;
+    enum shard_state state;
+    struct mansession *s;
+    struct astman_shard *shard;
+    char host[80];
+    int port;
+    char username[80];
+    char secret[80];
+    struct sockaddr_in addr;        /**!< aligned, read when the ring submits */
+    struct astman_transport transport;
+    char *out;                      /**!< actions not handed to the kernel */
+    size_t outlen, outcap;
+    int dirty;                      /**!< in the shard's flush list */
+    struct shard_session *next_dirty;
+    /* epoll mode */
+    unsigned int events;            /**!< registered, EPOLLOUT while out is
+                                         not drained */
+    /* io_uring mode */
+    char *wire;                     /**!< send in flight */
+    size_t wirelen, wireoff, wirecap;
+    int bulk;                       /**!< bulk actions go there, -1 none */
+};
+/*******************************************************************************
+ * @struct  shard_handler
+ ******************************************************************************/
+struct shard_handler {
+    char *event;
+    ASTMAN_EVENT_CALLBACK func;
+};
+/*******************************************************************************
+ * @struct  astman_shard
+ * @brief   One event loop and what it owns
+ ******************************************************************************/
+struct astman_shard {
+    struct astman_runtime *rt;
+    int index;
+    pthread_t thread;
+    int started;
+    int epfd;
+    struct astman_queue *inbox;             /**!< MPSC, from any thread */
+    struct shard_session **sessions;        /**!< by id / nshards */
+    int len;
+    struct shard_handler *handlers;         /**!< this shard's copy */
+    int nhandlers;
+    int stop;
+    int deadlines;                          /**!< actions may expire */
+    struct astman_uring *uring;             /**!< NULL: epoll */
+    struct shard_session *dirty;            /**!< sessions with data to send */
+    int inflight;                           /**!< io_uring requests pending */
+    struct astman_shard_stats stats;
+};
+/*******************************************************************************
+ * @struct  astman_runtime
+ ******************************************************************************/
+struct astman_runtime {
+    int nshards;
+    struct astman_shard *shards;
+    struct shard_handler handlers[MAX_EVENTS];
+    int nhandlers;
+    ASTMAN_SESSION_STATE_CALLBACK state_cb;
+    void *state_data;
+    unsigned int next_id;
+    int running;
+    int flags;                              /**!< ASTMAN_RUNTIME_* */
+};
+
+static __thread int _current_shard = -1;
+/*******************************************************************************
+ * @fn static char *shard_strcpy(char **p, const char *str)
+ * @brief Copy str at *p (inside a shard_cmd allocation) and advance *p
+ ******************************************************************************/
+static char *shard_strcpy(char **p, const char *str) {
+    char *dst = *p;
+    size_t len = strlen(str ? str : "") + 1;
+    memcpy(dst, str ? str : "", len);
+    *p += len;
+    return dst;
+}
+/*******************************************************************************
+ * @fn static int shard_push(struct astman_shard *sh, struct shard_cmd *cmd)
+ ******************************************************************************/
+static int shard_push(struct astman_shard *sh, struct shard_cmd *cmd) {
+    if (astman_queue_push(sh->inbox, cmd) != ASTMAN_SUCCESS) {
+        astlog(ASTLOG_WARNING, "Shard %d: command queue full", sh->index);
+        free(cmd);
+        return ASTMAN_FAILURE;
+    }
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static void shard_state(struct shard_session *ss, enum shard_state state)
+ * @brief Change state, keep the counters, report up/down transitions
+ ******************************************************************************/
+static void shard_state(struct shard_session *ss, enum shard_state state) {
+    struct astman_shard *sh = ss->shard;
+    struct astman_runtime *rt = sh->rt;
+    int was_up = ss->state == SHARD_UP;
+
+    ss->state = state;
+    if (was_up == (state == SHARD_UP))
+        return;
+    __atomic_store_n(&sh->stats.up, sh->stats.up + (was_up ? -1 : 1), __ATOMIC_RELAXED);
+    if (rt->state_cb)
+        rt->state_cb(rt, ss->id, !was_up, rt->state_data);
+}
+/*******************************************************************************
+ * @fn static void shard_session_down(struct shard_session *ss)
+ ******************************************************************************/
+static void shard_session_down(struct shard_session *ss) {
+    if (ss->s->fd > 0) {
+        if (ss->shard->uring)
+            /* the ring holds the socket: end its receive */
+            shutdown(ss->s->fd, SHUT_RDWR);
+        else
+            epoll_ctl(ss->shard->epfd, EPOLL_CTL_DEL, ss->s->fd, NULL);
+    }
+    if (!ss->shard->uring) {
+        ss->outlen = 0;
+        ss->events = 0;
+    }
+    astman_disconnect(ss->s);
+    if (ss->state != SHARD_DOWN)
+        astlog(ASTLOG_WARNING, "Session %d (%s) down", ss->id, ss->host);
+    shard_state(ss, SHARD_DOWN);
+}
+/*******************************************************************************
+ * @fn static void shard_login_done(struct mansession *s,
+ *                                  struct astman_action_result *r, void *data)
+ ******************************************************************************/
+static void shard_login_done(struct mansession *s __attribute__((unused)),
+                             struct astman_action_result *r, void *data) {
+    struct shard_session *ss = data;
+    if (r->status == ASTMAN_SUCCESS) {
+        shard_state(ss, SHARD_UP);
+    } else if (r->status != ASTMAN_ACTION_ABORTED) {
+        astlog(ASTLOG_ERROR, "Session %d (%s): login failed", ss->id, ss->host);
+        /* Closing now would free the state astman_poll() is using */
+        ss->state = SHARD_FAILED;
+    }
+}
+/*******************************************************************************
+ * @fn static void shard_login(struct shard_session *ss)
+ ******************************************************************************/
+static void shard_login(struct shard_session *ss) {
+    char params[256];
+
+    ss->state = SHARD_LOGIN;
+    ss->shard->deadlines = 1;
+    snprintf(params, sizeof(params),
+             "Username: %s" CRLF "Secret: %s" CRLF "Events: on" CRLF,
+             ss->username, ss->secret);
+    if (astman_action_async(ss->s, "Login", params, NULL, 0, 10000,
+                            shard_login_done, ss) != ASTMAN_SUCCESS)
+        shard_session_down(ss);
+}
+/*******************************************************************************
+ * @fn static int shard_send(struct mansession *s, const char *buf,
+ *                           size_t len, void *data)
+ * @brief Transport send: queue the action, shard_flush() or
+ *        shard_uring_flush() hands everything queued by the loop iteration
+ *        to the kernel with a single send per session
+ ******************************************************************************/
+static int shard_send(struct mansession *s __attribute__((unused)),
+                      const char *buf, size_t len, void *data) {
+    struct shard_session *ss = data;
+    size_t cap;
+    char *out;
+
+    if (ss->outlen + len > ss->outcap) {
+        cap = ss->outcap ? ss->outcap : 4096;
+        while (cap < ss->outlen + len)
+            cap *= 2;
+        out = realloc(ss->out, cap);
+        if (!out)
+            return -1;
+        ss->out = out;
+        ss->outcap = cap;
+    }
+    memcpy(ss->out + ss->outlen, buf, len);
+    ss->outlen += len;
+    if (!ss->dirty) {
+        ss->dirty = 1;
+        ss->next_dirty = ss->shard->dirty;
+        ss->shard->dirty = ss;
+    }
+    return 0;
+}
+/*******************************************************************************
+ * @fn static void shard_connected(struct shard_session *ss)
+ * @brief The non blocking connect finished
+ ******************************************************************************/
+static void shard_connected(struct shard_session *ss) {
+    struct epoll_event ev;
+    socklen_t len = sizeof(int);
+    int err = 0, fd = ss->s->fd;
+
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err) {
+        astlog(ASTLOG_ERROR, "Session %d (%s): connect: %s", ss->id, ss->host, strerror(err));
+        shard_session_down(ss);
+        return;
+    }
+    /* still non blocking: the actions wait in ss->out, not in send() */
+    ss->events = EPOLLIN;
+    ev.events = ss->events;
+    ev.data.u64 = ss->id / ss->shard->rt->nshards;
+    epoll_ctl(ss->shard->epfd, EPOLL_CTL_MOD, fd, &ev);
+    ss->transport.send = shard_send;
+    ss->transport.data = ss;
+    ss->s->transport = &ss->transport;
+    shard_login(ss);
+}
+/*******************************************************************************
+ * @fn static int shard_write(struct shard_session *ss)
+ * @brief Send what the socket takes of ss->out, wait for EPOLLOUT while
+ *        something is left
+ * @return 0 or -1 on error
+ ******************************************************************************/
+static int shard_write(struct shard_session *ss) {
+    struct epoll_event ev;
+    ssize_t res;
+
+    while (ss->outlen > 0) {
+        res = send(ss->s->fd, ss->out, ss->outlen, MSG_DONTWAIT);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            astlog(ASTLOG_ERROR, "Session %d (%s): send: %s", ss->id, ss->host, strerror(errno));
+            return -1;
+        }
+        ss->outlen -= res;
+        memmove(ss->out, ss->out + res, ss->outlen);
+    }
+    ev.events = ss->outlen > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    if (ev.events != ss->events) {
+        ss->events = ev.events;
+        ev.data.u64 = ss->id / ss->shard->rt->nshards;
+        epoll_ctl(ss->shard->epfd, EPOLL_CTL_MOD, ss->s->fd, &ev);
+    }
+    return 0;
+}
+/*******************************************************************************
+ * @fn static void shard_flush(struct astman_shard *sh)
+ ******************************************************************************/
+static void shard_flush(struct astman_shard *sh) {
+    struct shard_session *ss;
+    while ((ss = sh->dirty)) {
+        sh->dirty = ss->next_dirty;
+        ss->dirty = 0;
+        if (ss->s->fd > 0 && shard_write(ss) < 0)
+            shard_session_down(ss);
+    }
+}
+/*******************************************************************************
+ * @fn static unsigned long long shard_ud(struct shard_session *ss,
+ *                                        enum shard_uring_op op)
+ ******************************************************************************/
+static unsigned long long shard_ud(struct shard_session *ss, enum shard_uring_op op) {
+    return ((unsigned long long)(ss->id / ss->shard->rt->nshards) << 8) | op;
+}
+/*******************************************************************************
+ * @fn static void shard_uring_submit(struct shard_session *ss)
+ * @brief Move the queued actions on the wire if no send is in flight
+ ******************************************************************************/
+static void shard_uring_submit(struct shard_session *ss) {
+    struct astman_shard *sh = ss->shard;
+    size_t cap;
+    char *p;
+
+    if (ss->wirelen || !ss->outlen || ss->s->fd <= 0)
+        return;
+    p = ss->wire;
+    cap = ss->wirecap;
+    ss->wire = ss->out;
+    ss->wirecap = ss->outcap;
+    ss->wirelen = ss->outlen;
+    ss->wireoff = 0;
+    ss->out = p;
+    ss->outcap = cap;
+    ss->outlen = 0;
+    if (astman_uring_send(sh->uring, ss->s->fd, ss->wire, ss->wirelen,
+                          shard_ud(ss, SHARD_OP_SEND)) == ASTMAN_SUCCESS)
+        sh->inflight++;
+    else
+        ss->state = SHARD_FAILED;
+}
+/*******************************************************************************
+ * @fn static void shard_uring_flush(struct astman_shard *sh)
+ ******************************************************************************/
+static void shard_uring_flush(struct astman_shard *sh) {
+    struct shard_session *ss;
+    while ((ss = sh->dirty)) {
+        sh->dirty = ss->next_dirty;
+        ss->dirty = 0;
+        shard_uring_submit(ss);
+        if (ss->state == SHARD_FAILED)
+            shard_session_down(ss);
+    }
+}
+/*******************************************************************************
+ * @fn static void shard_uring_connected(struct shard_session *ss, int res)
+ ******************************************************************************/
+static void shard_uring_connected(struct shard_session *ss, int res) {
+    if (res < 0) {
+        astlog(ASTLOG_ERROR, "Session %d (%s): connect: %s", ss->id, ss->host, strerror(-res));
+        shard_session_down(ss);
+        return;
+    }
+    ss->transport.send = shard_send;
+    ss->transport.data = ss;
+    ss->s->transport = &ss->transport;
+    if (astman_uring_recv(ss->shard->uring, ss->s->fd,
+                          shard_ud(ss, SHARD_OP_RECV)) != ASTMAN_SUCCESS) {
+        shard_session_down(ss);
+        return;
+    }
+    ss->shard->inflight++;
+    shard_login(ss);
+}
+/*******************************************************************************
+ * @fn static void shard_uring_complete(struct astman_shard *sh,
+ *                                      struct astman_uring_cqe *cqe)
+ ******************************************************************************/
+static void shard_uring_complete(struct astman_shard *sh,
+                                 struct astman_uring_cqe *cqe) {
+    struct shard_session *ss;
+    unsigned long long local = cqe->user_data >> 8;
+
+    if (!cqe->more)
+        sh->inflight--;
+    if (local >= (unsigned long long)sh->len || !(ss = sh->sessions[local])) {
+        astman_uring_recycle(sh->uring, cqe->bid);
+        return;
+    }
+    switch (cqe->user_data & 0xff) {
+    case SHARD_OP_CONNECT:
+        shard_uring_connected(ss, cqe->res);
+        break;
+    case SHARD_OP_RECV:
+        if (cqe->res > 0 && cqe->buf && ss->s->fd > 0)
+            astman_async_input(ss->s, cqe->buf, cqe->res);
+        /* parsed in place, the buffer goes straight back to the kernel */
+        astman_uring_recycle(sh->uring, cqe->bid);
+        if (ss->s->fd <= 0)
+            break;
+        if (cqe->res == 0 ||
+            (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -EINVAL)) {
+            shard_session_down(ss);
+        } else if (ss->state == SHARD_FAILED) {
+            shard_session_down(ss);
+        } else if (!cqe->more) {
+            if (astman_uring_recv(sh->uring, ss->s->fd,
+                                  shard_ud(ss, SHARD_OP_RECV)) == ASTMAN_SUCCESS)
+                sh->inflight++;
+            else
+                shard_session_down(ss);
+        }
+        break;
+    case SHARD_OP_SEND:
+        if (ss->s->fd <= 0) {
+            ss->wirelen = 0;
+            break;
+        }
+        if (cqe->res <= 0) {
+            astlog(ASTLOG_ERROR, "Session %d (%s): send: %s", ss->id, ss->host, strerror(-cqe->res));
+            ss->wirelen = 0;
+            shard_session_down(ss);
+            break;
+        }
+        ss->wireoff += cqe->res;
+        if (ss->wireoff < ss->wirelen) {
+            /* short send: the rest, still ahead of anything queued since */
+            if (astman_uring_send(sh->uring, ss->s->fd, ss->wire + ss->wireoff,
+                                  ss->wirelen - ss->wireoff,
+                                  shard_ud(ss, SHARD_OP_SEND)) == ASTMAN_SUCCESS)
+                sh->inflight++;
+            else
+                shard_session_down(ss);
+            break;
+        }
+        ss->wirelen = 0;
+        shard_uring_submit(ss);
+        if (ss->state == SHARD_FAILED)
+            shard_session_down(ss);
+        break;
+    }
+}
+/*******************************************************************************
+ * @fn static void shard_add(struct astman_shard *sh, struct shard_cmd *cmd)
+ * @brief Create the session (on the shard thread, so with its memory) and
+ *        start connecting
+ ******************************************************************************/
+static void shard_add(struct astman_shard *sh, struct shard_cmd *cmd) {
+    struct astman_runtime *rt = sh->rt;
+    struct shard_session *ss, **sessions;
+    struct epoll_event ev;
+    int local = cmd->id / rt->nshards, len, x;
+
+    if (local >= sh->len) {
+        len = sh->len ? sh->len : 64;
+        while (len <= local)
+            len *= 2;
+        sessions = realloc(sh->sessions, len * sizeof(*sessions));
+        if (!sessions)
+            return;
+        memset(sessions + sh->len, 0, (len - sh->len) * sizeof(*sessions));
+        sh->sessions = sessions;
+        sh->len = len;
+    }
+    ss = calloc(1, sizeof(*ss));
+    if (!ss)
+        return;
+    ss->s = astman_session_new();
+    if (!ss->s) {
+        free(ss);
+        return;
+    }
+    ss->id = cmd->id;
+    ss->bulk = -1;
+    ss->shard = sh;
+    strncpy(ss->host, cmd->host, sizeof(ss->host) - 1);
+    ss->port = cmd->port > 0 ? cmd->port : SHARD_MANAGER_PORT;
+    strncpy(ss->username, cmd->username, sizeof(ss->username) - 1);
+    strncpy(ss->secret, cmd->secret, sizeof(ss->secret) - 1);
+    for (x = 0; x < sh->nhandlers; x++)
+        astman_add_event_handler(ss->s, sh->handlers[x].event, sh->handlers[x].func);
+    sh->sessions[local] = ss;
+    __atomic_store_n(&sh->stats.sessions, sh->stats.sessions + 1, __ATOMIC_RELAXED);
+
+    /* the session is packed, connect from the aligned copy */
+    ss->addr = cmd->addr;
+    ss->addr.sin_port = htons(ss->port);
+    memcpy(&ss->s->sin, &ss->addr, sizeof(ss->addr));
+    ss->s->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (ss->s->fd < 0) {
+        ss->s->fd = 0;
+        return;
+    }
+    if (sh->uring) {
+        /* blocking socket, the ring does the waiting */
+        if (astman_uring_connect(sh->uring, ss->s->fd, (struct sockaddr *)&ss->addr,
+                                 sizeof(ss->addr), shard_ud(ss, SHARD_OP_CONNECT)) != ASTMAN_SUCCESS) {
+            astman_disconnect(ss->s);
+            return;
+        }
+        sh->inflight++;
+        ss->state = SHARD_CONNECTING;
+        return;
+    }
+    fcntl(ss->s->fd, F_SETFL, fcntl(ss->s->fd, F_GETFL) | O_NONBLOCK);
+    if (connect(ss->s->fd, (struct sockaddr *)&ss->addr, sizeof(ss->addr)) < 0 &&
+        errno != EINPROGRESS) {
+        astlog(ASTLOG_ERROR, "Session %d (%s): connect: %s", ss->id, ss->host, strerror(errno));
+        astman_disconnect(ss->s);
+        return;
+    }
+    ss->state = SHARD_CONNECTING;
+    ev.events = EPOLLOUT;
+    ev.data.u64 = local;
+    epoll_ctl(sh->epfd, EPOLL_CTL_ADD, ss->s->fd, &ev);
+}
+/*******************************************************************************
+ * @fn static struct shard_session *shard_session(struct astman_shard *sh,
+ *                                                int id)
+ ******************************************************************************/
+static struct shard_session *shard_session(struct astman_shard *sh, int id) {
+    int local = id / sh->rt->nshards;
+    if (id < 0 || local >= sh->len)
+        return NULL;
+    return sh->sessions[local];
+}
+/*******************************************************************************
+ * @fn static void shard_poll(struct shard_session *ss)
+ * @brief Read a session and close it if lost or refused
+ ******************************************************************************/
+static void shard_poll(struct shard_session *ss) {
+    if (astman_poll(ss->s, 0) < 0 || ss->state == SHARD_FAILED)
+        shard_session_down(ss);
+}
+/*******************************************************************************
+ * @fn static int shard_steer(struct astman_shard *sh, struct shard_session *ss,
+ *                            struct shard_cmd *cmd)
+ * @brief Hand a bulk action over to the bulk session of ss, or a steered
+ *        action whose bulk session is not up back to its origin
+ * @return 1 if cmd went to another shard queue
+ ******************************************************************************/
+static int shard_steer(struct astman_shard *sh, struct shard_session *ss,
+                       struct shard_cmd *cmd) {
+    struct astman_runtime *rt = sh->rt;
+    int id = cmd->id;
+
+    if (cmd->origin == -1 && ss && ss->bulk >= 0 &&
+        astman_action_class(cmd->action, cmd->flags) == ASTMAN_CLASS_BULK) {
+        cmd->origin = id;
+        cmd->id = ss->bulk;
+    } else if (cmd->origin >= 0 && (!ss || ss->state != SHARD_UP)) {
+        cmd->id = cmd->origin;
+        cmd->origin = -2;
+    } else {
+        return 0;
+    }
+    if (astman_queue_push(rt->shards[cmd->id % rt->nshards].inbox, cmd) == ASTMAN_SUCCESS)
+        return 1;
+    /* queue full: here, as if never steered */
+    cmd->id = id;
+    cmd->origin = -2;
+    return 0;
+}
+/*******************************************************************************
+ * @fn static void shard_command(struct astman_shard *sh, struct shard_cmd *cmd)
+ ******************************************************************************/
+static void shard_command(struct astman_shard *sh, struct shard_cmd *cmd) {
+    struct astman_action_result r;
+    struct shard_session *ss;
+
+    __atomic_store_n(&sh->stats.commands, sh->stats.commands + 1, __ATOMIC_RELAXED);
+    switch (cmd->type) {
+    case SHARD_CMD_ADD:
+        shard_add(sh, cmd);
+        break;
+    case SHARD_CMD_ACTION:
+        ss = shard_session(sh, cmd->id);
+        if (shard_steer(sh, ss, cmd))
+            return;
+        if (ss && ss->state == SHARD_UP &&
+            astman_action_async(ss->s, cmd->action, cmd->params, NULL, cmd->flags,
+                                cmd->timeout_ms, cmd->cb, cmd->data) == ASTMAN_SUCCESS) {
+            __atomic_store_n(&sh->stats.actions, sh->stats.actions + 1, __ATOMIC_RELAXED);
+            if (cmd->timeout_ms > 0)
+                sh->deadlines = 1;
+            break;
+        }
+        memset(&r, 0, sizeof(r));
+        r.actionid = "";
+        r.status = ASTMAN_ACTION_ABORTED;
+        r.complete = 1;
+        if (cmd->cb)
+            cmd->cb(ss ? ss->s : NULL, &r, cmd->data);
+        break;
+    case SHARD_CMD_STEER:
+        ss = shard_session(sh, cmd->id);
+        if (ss)
+            ss->bulk = cmd->bulk;
+        break;
+    case SHARD_CMD_CALL:
+        cmd->func(sh->rt, sh->index, cmd->data);
+        break;
+    case SHARD_CMD_STOP:
+        sh->stop = 1;
+        break;
+    }
+    free(cmd);
+}
+/*******************************************************************************
+ * @fn static int shard_expire(struct astman_shard *sh)
+ * @brief Complete the actions past their deadline
+ * @return number of sessions still waiting for answers
+ ******************************************************************************/
+static int shard_expire(struct astman_shard *sh) {
+    struct shard_session *ss;
+    int x, pending = 0;
+    for (x = 0; x < sh->len; x++) {
+        ss = sh->sessions[x];
+        if (!ss || ss->s->fd <= 0 || ss->state == SHARD_CONNECTING ||
+            !astman_pending_count(ss->s))
+            continue;
+        astman_async_expire(ss->s);
+        if (ss->state == SHARD_FAILED)
+            shard_session_down(ss);
+        pending += ss->s->fd > 0 && astman_pending_count(ss->s);
+    }
+    return pending;
+}
+/*******************************************************************************
+ * @fn static int shard_timeout(struct astman_shard *sh,
+ *                              unsigned long long next_tick)
+ * @brief How long the loop may sleep
+ ******************************************************************************/
+static int shard_timeout(struct astman_shard *sh, unsigned long long next_tick) {
+    unsigned long long now;
+    if (astman_queue_arm(sh->inbox))
+        return 0;
+    if (!sh->deadlines)
+        return -1;
+    now = astman_metrics_now();
+    return now >= next_tick ? 0 : (int)((next_tick - now + 999999ULL) / 1000000ULL);
+}
+/*******************************************************************************
+ * @fn static void shard_work(struct astman_shard *sh,
+ *                            unsigned long long *next_tick)
+ * @brief Run the queued commands and the deadline scan
+ ******************************************************************************/
+static void shard_work(struct astman_shard *sh, unsigned long long *next_tick) {
+    struct shard_cmd *cmd;
+    unsigned long long now;
+
+    while (!sh->stop && (cmd = astman_queue_pop(sh->inbox)))
+        shard_command(sh, cmd);
+    now = astman_metrics_now();
+    if (sh->deadlines && now >= *next_tick) {
+        sh->deadlines = shard_expire(sh) > 0;
+        *next_tick = now + SHARD_TICK_MS * 1000000ULL;
+    }
+}
+/*******************************************************************************
+ * @fn static void shard_loop_epoll(struct astman_shard *sh)
+ ******************************************************************************/
+static void shard_loop_epoll(struct astman_shard *sh) {
+    struct epoll_event evs[SHARD_MAX_EVENTS];
+    struct shard_session *ss;
+    unsigned long long next_tick = 0;
+    int n, x;
+
+    while (!sh->stop) {
+        x = shard_timeout(sh, next_tick);
+        shard_flush(sh);
+        n = epoll_wait(sh->epfd, evs, SHARD_MAX_EVENTS, x);
+        if (n < 0 && errno != EINTR) {
+            astlog(ASTLOG_ERROR, "Shard %d: epoll_wait: %s", sh->index, strerror(errno));
+            break;
+        }
+        for (x = 0; x < n; x++) {
+            if (evs[x].data.u64 == SHARD_INBOX)
+                continue;
+            ss = sh->sessions[evs[x].data.u64];
+            if (ss->state == SHARD_CONNECTING) {
+                shard_connected(ss);
+                continue;
+            }
+            if ((evs[x].events & EPOLLOUT) && shard_write(ss) < 0)
+                shard_session_down(ss);
+            if (ss->s->fd > 0 && (evs[x].events & ~EPOLLOUT))
+                shard_poll(ss);
+        }
+        shard_work(sh, &next_tick);
+    }
+
+    /* What is left goes out now, the log off is written directly */
+    for (x = 0; x < sh->len; x++) {
+        ss = sh->sessions[x];
+        if (!ss || ss->s->fd <= 0 || ss->s->transport != &ss->transport)
+            continue;
+        shard_write(ss);
+        ss->s->transport = NULL;
+    }
+}
+/*******************************************************************************
+ * @fn static void shard_loop_uring(struct astman_shard *sh)
+ * @brief Same loop on io_uring: the sends queued during an iteration are
+ *        submitted by the wait itself, the data arrives through multishot
+ *        receives and is parsed in the kernel filled buffers
+ ******************************************************************************/
+static void shard_loop_uring(struct astman_shard *sh) {
+    struct astman_uring_cqe cqes[SHARD_MAX_EVENTS];
+    struct shard_session *ss;
+    unsigned long long next_tick = 0, end;
+    int n, x, y;
+
+    astman_uring_poll(sh->uring, astman_queue_fd(sh->inbox), POLLIN, SHARD_INBOX);
+    while (!sh->stop) {
+        x = shard_timeout(sh, next_tick);
+        shard_uring_flush(sh);
+        n = astman_uring_wait(sh->uring, x, cqes, SHARD_MAX_EVENTS);
+        if (n < 0)
+            break;
+        for (x = 0; x < n; x++) {
+            if (cqes[x].user_data == SHARD_INBOX) {
+                if (!cqes[x].more)
+                    astman_uring_poll(sh->uring, astman_queue_fd(sh->inbox),
+                                      POLLIN, SHARD_INBOX);
+                continue;
+            }
+            shard_uring_complete(sh, &cqes[x]);
+        }
+        shard_work(sh, &next_tick);
+    }
+
+    /* Log off, then let the kernel release the buffers it still uses */
+    for (y = 0; y < sh->len; y++) {
+        ss = sh->sessions[y];
+        if (!ss || ss->s->fd <= 0)
+            continue;
+        if (ss->state == SHARD_UP) {
+            ss->s->transport = NULL;
+            astman_manager_action(ss->s, "Logoff", "");
+        }
+        shard_session_down(ss);
+    }
+    end = astman_metrics_now() + 1000000000ULL;
+    while (sh->inflight > 0 && astman_metrics_now() < end) {
+        n = astman_uring_wait(sh->uring, 100, cqes, SHARD_MAX_EVENTS);
+        if (n < 0)
+            break;
+        for (x = 0; x < n; x++)
+            if (cqes[x].user_data != SHARD_INBOX)
+                shard_uring_complete(sh, &cqes[x]);
+    }
+}
+/*******************************************************************************
+ * @fn static void *shard_main(void *arg)
+ ******************************************************************************/
+static void *shard_main(void *arg) {
+    struct astman_shard *sh = arg;
+
+    _current_shard = sh->index;
+    /* Created here: the ring is single issuer, owned by this thread */
+    if (sh->rt->flags & ASTMAN_RUNTIME_URING) {
+        sh->uring = astman_uring_new(SHARD_URING_ENTRIES, SHARD_URING_BUFS,
+                                     SHARD_URING_BUFSIZE);
+        if (!sh->uring)
+            astlog(ASTLOG_INFO, "Shard %d: io_uring unavailable, using epoll", sh->index);
+    }
+    if (sh->uring)
+        shard_loop_uring(sh);
+    else
+        shard_loop_epoll(sh);
+    return NULL;
+}
+/*******************************************************************************
+ * @fn static void shard_stop(struct astman_shard *sh)
+ * @brief Stop the shard thread and wait for it
+ ******************************************************************************/
+static void shard_stop(struct astman_shard *sh) {
+    struct shard_cmd *cmd;
+
+    if (!sh->started)
+        return;
+    cmd = calloc(1, sizeof(*cmd));
+    if (cmd) {
+        cmd->type = SHARD_CMD_STOP;
+        while (astman_queue_push(sh->inbox, cmd) != ASTMAN_SUCCESS)
+            sched_yield();
+    } else {
+        __atomic_store_n(&sh->stop, 1, __ATOMIC_RELAXED);
+    }
+    pthread_join(sh->thread, NULL);
+    sh->started = 0;
+}
+/*******************************************************************************
+ * @fn static void shard_release(struct astman_shard *sh)
+ * @brief Log off and free the sessions of a stopped shard, then what it owns
+ ******************************************************************************/
+static void shard_release(struct astman_shard *sh) {
+    struct shard_cmd *cmd;
+    int y;
+
+    for (y = 0; y < sh->len; y++) {
+        if (!sh->sessions[y])
+            continue;
+        if (sh->sessions[y]->state == SHARD_UP)
+            astman_logoff(sh->sessions[y]->s);
+        astman_session_free(sh->sessions[y]->s);
+        free(sh->sessions[y]->out);
+        free(sh->sessions[y]->wire);
+        free(sh->sessions[y]);
+    }
+    while (sh->inbox && (cmd = astman_queue_pop(sh->inbox)))
+        free(cmd);
+    astman_queue_free(sh->inbox);
+    astman_uring_free(sh->uring);
+    if (sh->epfd >= 0)
+        close(sh->epfd);
+    for (y = 0; y < sh->nhandlers; y++)
+        free(sh->handlers[y].event);
+    free(sh->handlers);
+    free(sh->sessions);
+    sh->sessions = NULL;
+    sh->len = 0;
+    sh->inbox = NULL;
+    sh->uring = NULL;
+    sh->epfd = -1;
+    sh->handlers = NULL;
+    sh->nhandlers = 0;
+    sh->stop = 0;
+}
+/*******************************************************************************
+ * @fn struct astman_runtime *astman_runtime_new(int nshards)
+ ******************************************************************************/
+struct astman_runtime *astman_runtime_new(int nshards) {
+    struct astman_runtime *rt;
+    int x;
+
+    if (nshards <= 0)
+        nshards = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nshards <= 0)
+        nshards = 1;
+    rt = calloc(1, sizeof(*rt));
+    if (!rt)
+        return NULL;
+    rt->shards = calloc(nshards, sizeof(*rt->shards));
+    if (!rt->shards) {
+        free(rt);
+        return NULL;
+    }
+    rt->nshards = nshards;
+    for (x = 0; x < nshards; x++) {
+        rt->shards[x].rt = rt;
+        rt->shards[x].index = x;
+        rt->shards[x].epfd = -1;
+    }
+    return rt;
+}
+/*******************************************************************************
+ * @fn int astman_runtime_add_event_handler(struct astman_runtime *rt,
+ *                                          char *event,
+ *                                          ASTMAN_EVENT_CALLBACK callback)
+ ******************************************************************************/
+int astman_runtime_add_event_handler(struct astman_runtime *rt, char *event,
+                                     ASTMAN_EVENT_CALLBACK callback) {
+    if (rt->running || rt->nhandlers >= MAX_EVENTS || astman_strlen_zero(event))
+        return ASTMAN_FAILURE;
+    rt->handlers[rt->nhandlers].event = strdup(event);
+    if (!rt->handlers[rt->nhandlers].event)
+        return ASTMAN_FAILURE;
+    rt->handlers[rt->nhandlers++].func = callback;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn void astman_runtime_set_state_callback(struct astman_runtime *rt,
+ *                                            ASTMAN_SESSION_STATE_CALLBACK cb,
+ *                                            void *data)
+ ******************************************************************************/
+void astman_runtime_set_state_callback(struct astman_runtime *rt,
+                                       ASTMAN_SESSION_STATE_CALLBACK cb,
+                                       void *data) {
+    if (rt->running)
+        return;
+    rt->state_cb = cb;
+    rt->state_data = data;
+}
+/*******************************************************************************
+ * @fn int astman_runtime_start(struct astman_runtime *rt, int pin)
+ ******************************************************************************/
+int astman_runtime_start(struct astman_runtime *rt, int flags) {
+    struct astman_shard *sh;
+    struct epoll_event ev;
+    cpu_set_t cpus;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int x, h;
+
+    if (rt->running)
+        return ASTMAN_FAILURE;
+    rt->flags = flags;
+    for (x = 0; x < rt->nshards; x++) {
+        sh = &rt->shards[x];
+        /* Own copy of the dispatch table */
+        sh->handlers = calloc(rt->nhandlers ? rt->nhandlers : 1, sizeof(*sh->handlers));
+        if (!sh->handlers)
+            goto Error;
+        for (h = 0; h < rt->nhandlers; h++) {
+            sh->handlers[h].event = strdup(rt->handlers[h].event);
+            sh->handlers[h].func = rt->handlers[h].func;
+        }
+        sh->nhandlers = rt->nhandlers;
+        sh->inbox = astman_queue_new(ASTMAN_QUEUE_MPSC, ASTMAN_SHARD_QUEUE_SIZE);
+        sh->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (!sh->inbox || sh->epfd < 0 || astman_queue_fd(sh->inbox) < 0)
+            goto Error;
+        ev.events = EPOLLIN;
+        ev.data.u64 = SHARD_INBOX;
+        if (epoll_ctl(sh->epfd, EPOLL_CTL_ADD, astman_queue_fd(sh->inbox), &ev) < 0)
+            goto Error;
+        if (pthread_create(&sh->thread, NULL, shard_main, sh))
+            goto Error;
+        sh->started = 1;
+        if ((flags & ASTMAN_RUNTIME_PIN) && ncpu > 0) {
+            CPU_ZERO(&cpus);
+            CPU_SET(x % ncpu, &cpus);
+            if (pthread_setaffinity_np(sh->thread, sizeof(cpus), &cpus))
+                astlog(ASTLOG_WARNING, "Shard %d: unable to pin to CPU %ld", x, x % ncpu);
+        }
+    }
+    rt->running = 1;
+    return ASTMAN_SUCCESS;
+
+Error:
+    astlog(ASTLOG_ERROR, "Unable to start shard %d", x);
+    /* Back to the state astman_runtime_new() left */
+    for (h = 0; h <= x && h < rt->nshards; h++) {
+        shard_stop(&rt->shards[h]);
+        shard_release(&rt->shards[h]);
+    }
+    return ASTMAN_FAILURE;
+}
+/*******************************************************************************
+ * @fn void astman_runtime_free(struct astman_runtime *rt)
+ ******************************************************************************/
+void astman_runtime_free(struct astman_runtime *rt) {
+    int x;
+
+    if (!rt)
+        return;
+    for (x = 0; x < rt->nshards; x++)
+        shard_stop(&rt->shards[x]);
+    for (x = 0; x < rt->nshards; x++)
+        shard_release(&rt->shards[x]);
+    for (x = 0; x < rt->nhandlers; x++)
+        free(rt->handlers[x].event);
+    free(rt->shards);
+    free(rt);
+}
+/*******************************************************************************
+ * @fn int astman_runtime_add_session(struct astman_runtime *rt,
+ *                                    const char *host, int port,
+ *                                    const char *username,
+ *                                    const char *secret)
+ ******************************************************************************/
+int astman_runtime_add_session(struct astman_runtime *rt, const char *host,
+                               int port, const char *username,
+                               const char *secret) {
+    struct shard_cmd *cmd;
+    struct addrinfo hints, *ai = NULL;
+    char *p;
+    int id;
+
+    if (!rt->running || astman_strlen_zero(host) ||
+        astman_strlen_zero(username) || astman_strlen_zero(secret))
+        return -1;
+    cmd = malloc(sizeof(*cmd) + strlen(host) + strlen(username) + strlen(secret) + 3);
+    if (!cmd)
+        return -1;
+    /* Resolved here, a lookup would stall every session of the shard */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &ai) || !ai) {
+        astlog(ASTLOG_ERROR, "No such address: %s", host);
+        free(cmd);
+        return -1;
+    }
+    memcpy(&cmd->addr, ai->ai_addr, sizeof(cmd->addr));
+    freeaddrinfo(ai);
+    p = (char *)(cmd + 1);
+    id = (int)__atomic_fetch_add(&rt->next_id, 1, __ATOMIC_RELAXED);
+    cmd->type = SHARD_CMD_ADD;
+    cmd->id = id;
+    cmd->port = port;
+    cmd->host = shard_strcpy(&p, host);
+    cmd->username = shard_strcpy(&p, username);
+    cmd->secret = shard_strcpy(&p, secret);
+    if (shard_push(&rt->shards[id % rt->nshards], cmd) != ASTMAN_SUCCESS)
+        return -1;
+    return id;
+}
+/*******************************************************************************
+ * @fn int astman_runtime_action(struct astman_runtime *rt, int session,
+ *                               char *action, char *params, int flags,
+ *                               int timeout_ms,
+ *                               ASTMAN_ACTION_CALLBACK callback, void *data)
+ ******************************************************************************/
+int astman_runtime_action(struct astman_runtime *rt, int session,
+                          char *action, char *params, int flags,
+                          int timeout_ms, ASTMAN_ACTION_CALLBACK callback,
+                          void *data) {
+    struct shard_cmd *cmd;
+    char *p;
+
+    if (!rt->running || session < 0 || astman_strlen_zero(action))
+        return ASTMAN_FAILURE;
+    cmd = malloc(sizeof(*cmd) + strlen(action) + (params ? strlen(params) : 0) + 2);
+    if (!cmd)
+        return ASTMAN_FAILURE;
+    p = (char *)(cmd + 1);
+    cmd->type = SHARD_CMD_ACTION;
+    cmd->id = session;
+    cmd->origin = -1;
+    cmd->flags = flags;
+    cmd->timeout_ms = timeout_ms;
+    cmd->action = shard_strcpy(&p, action);
+    cmd->params = shard_strcpy(&p, params);
+    cmd->cb = callback;
+    cmd->data = data;
+    return shard_push(&rt->shards[session % rt->nshards], cmd);
+}
+/*******************************************************************************
+ * @fn int astman_runtime_set_bulk_session(struct astman_runtime *rt,
+ *                                         int session, int bulk)
+ ******************************************************************************/
+int astman_runtime_set_bulk_session(struct astman_runtime *rt, int session,
+                                    int bulk) {
+    struct shard_cmd *cmd;
+
+    if (!rt->running || session < 0 || bulk == session)
+        return ASTMAN_FAILURE;
+    cmd = calloc(1, sizeof(*cmd));
+    if (!cmd)
+        return ASTMAN_FAILURE;
+    cmd->type = SHARD_CMD_STEER;
+    cmd->id = session;
+    cmd->bulk = bulk < 0 ? -1 : bulk;
+    return shard_push(&rt->shards[session % rt->nshards], cmd);
+}
+/*******************************************************************************
+ * @fn int astman_runtime_run_on(struct astman_runtime *rt, int shard,
+ *                               ASTMAN_SHARD_CALLBACK func, void *data)
+ ******************************************************************************/
+int astman_runtime_run_on(struct astman_runtime *rt, int shard,
+                          ASTMAN_SHARD_CALLBACK func, void *data) {
+    struct shard_cmd *cmd;
+
+    if (!rt->running || shard < 0 || shard >= rt->nshards || !func)
+        return ASTMAN_FAILURE;
+    cmd = calloc(1, sizeof(*cmd));
+    if (!cmd)
+        return ASTMAN_FAILURE;
+    cmd->type = SHARD_CMD_CALL;
+    cmd->func = func;
+    cmd->data = data;
+    return shard_push(&rt->shards[shard], cmd);
+}
+/*******************************************************************************
+ * @fn int astman_runtime_shard_count(struct astman_runtime *rt)
+ ******************************************************************************/
+int astman_runtime_shard_count(struct astman_runtime *rt) {
+    return rt->nshards;
+}
+/*******************************************************************************
+ * @fn int astman_runtime_shard_of(struct astman_runtime *rt, int session)
+ ******************************************************************************/
+int astman_runtime_shard_of(struct astman_runtime *rt, int session) {
+    return session < 0 ? -1 : session % rt->nshards;
+}
+/*******************************************************************************
+ * @fn int astman_runtime_current_shard(void)
+ ******************************************************************************/
+int astman_runtime_current_shard(void) {
+    return _current_shard;
+}
+/*******************************************************************************
+ * @fn struct mansession *astman_runtime_session(struct astman_runtime *rt,
+ *                                               int session)
+ ******************************************************************************/
+struct mansession *astman_runtime_session(struct astman_runtime *rt,
+                                          int session) {
+    struct shard_session *ss;
+    if (session < 0)
+        return NULL;
+    ss = shard_session(&rt->shards[session % rt->nshards], session);
+    return ss ? ss->s : NULL;
+}
+/*******************************************************************************
+ * @fn void astman_runtime_stats(struct astman_runtime *rt, int shard,
+ *                               struct astman_shard_stats *st)
+ ******************************************************************************/
+void astman_runtime_stats(struct astman_runtime *rt, int shard,
+                          struct astman_shard_stats *st) {
+    struct astman_shard *sh;
+    memset(st, 0, sizeof(*st));
+    if (shard < 0 || shard >= rt->nshards)
+        return;
+    sh = &rt->shards[shard];
+    st->sessions = __atomic_load_n(&sh->stats.sessions, __ATOMIC_RELAXED);
+    st->up = __atomic_load_n(&sh->stats.up, __ATOMIC_RELAXED);
+    st->actions = __atomic_load_n(&sh->stats.actions, __ATOMIC_RELAXED);
+    st->commands = __atomic_load_n(&sh->stats.commands, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,186 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file aststart.c
+ *  @brief Fast start
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astasync.h"
+#include "astmetrics.h"
+#include "aststate.h"
+#include "aststart.h"
+/*******************************************************************************
+ * @struct  start_request
+ ******************************************************************************/
+struct start_request {
+    struct start *st;
+    const char *action;
+};
+/*******************************************************************************
+ * @struct  start
+ ******************************************************************************/
+struct start {
+    struct astman_fast_start *fs;
+    unsigned long long t0;
+    int left;
+    int login;              /**!< status of the Login */
+};
+/*******************************************************************************
+ * @fn static void start_done(struct mansession *s,
+ *                            struct astman_action_result *r, void *data)
+ ******************************************************************************/
+static void start_done(struct mansession *s, struct astman_action_result *r,
+                       void *data) {
+    struct start_request *req = data;
+    struct start *st = req->st;
+    struct astman_fast_start *fs = st->fs;
+
+    if (!r->complete) {
+        /* A snapshot event, streamed */
+        if (s->state)
+            astman_state_update(s->state, r->events);
+        if (fs->callback)
+            fs->callback(s, req->action, r->events, fs->data);
+        return;
+    }
+    st->left--;
+    if (req->action) {
+        if (r->status != ASTMAN_SUCCESS) {
+            astlog(ASTLOG_WARNING, "Fast start: %s failed (%d)", req->action, r->status);
+            fs->failed++;
+        }
+        return;
+    }
+    st->login = r->status;
+    fs->login_ns = astman_metrics_now() - st->t0;
+}
+/*******************************************************************************
+ * @fn static int start_send(struct mansession *s, struct start *st,
+ *                           struct start_request *req, char *action,
+ *                           char *params, int flags)
+ ******************************************************************************/
+static int start_send(struct mansession *s, struct start *st,
+                      struct start_request *req, char *action, char *params,
+                      int flags) {
+    if (astman_action_async(s, action, params, NULL, flags, st->fs->timeout_ms,
+                            start_done, req) != ASTMAN_SUCCESS)
+        return ASTMAN_FAILURE;
+    st->left++;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_fast_start(struct mansession *s, char *host, int port,
+ *                           struct astman_fast_start *fs)
+ ******************************************************************************/
+int astman_fast_start(struct mansession *s, char *host, int port,
+                      struct astman_fast_start *fs) {
+    struct start st;
+    struct start_request login, *reqs = NULL;
+    char params[MAX_LEN];
+    unsigned long long deadline, now;
+    int i, n = 0, nfilters = 0, nsnapshot = 0, ret = ASTMAN_FAILURE;
+
+    if (!s || !fs || astman_strlen_zero(fs->username) || astman_strlen_zero(fs->secret))
+        return ASTMAN_FAILURE;
+    memset(&st, 0, sizeof(st));
+    st.fs = fs;
+    st.t0 = astman_metrics_now();
+    st.login = ASTMAN_ACTION_ABORTED;
+    fs->connect_ns = fs->login_ns = fs->ready_ns = 0;
+    fs->failed = 0;
+
+    while (fs->filters && fs->filters[nfilters])
+        nfilters++;
+    while (fs->snapshot && fs->snapshot[nsnapshot])
+        nsnapshot++;
+    if (nfilters + nsnapshot) {
+        reqs = calloc(nfilters + nsnapshot, sizeof(*reqs));
+        if (!reqs)
+            return ASTMAN_FAILURE;
+    }
+
+    if (astman_connect(s, host, port) < 0)
+        goto Exit;
+    fs->connect_ns = astman_metrics_now() - st.t0;
+
+    /* Asterisk runs the actions of a session in order: the ones behind
+       the Login see it logged in */
+    astman_cork(s);
+    params[0] = '\0';
+    astman_add_param(params, sizeof(params), "Username", fs->username);
+    astman_add_param(params, sizeof(params), "Secret", fs->secret);
+    astman_add_param(params, sizeof(params), "Events", fs->events ? fs->events : "on");
+    login.st = &st;
+    login.action = NULL;
+    start_send(s, &st, &login, "Login", params, ASTMAN_ACTION_CONTROL);
+    for (i = 0; i < nfilters; i++, n++) {
+        params[0] = '\0';
+        astman_add_param(params, sizeof(params), "Operation", "Add");
+        astman_add_param(params, sizeof(params), "Filter", fs->filters[i]);
+        reqs[n].st = &st;
+        reqs[n].action = "Filter";
+        if (start_send(s, &st, &reqs[n], "Filter", params, 0) != ASTMAN_SUCCESS)
+            fs->failed++;
+    }
+    /* The snapshot actions are bulk but go out with the rest, the bulk
+       window holds back the actions sent after them */
+    for (i = 0; i < nsnapshot; i++, n++) {
+        reqs[n].st = &st;
+        reqs[n].action = fs->snapshot[i];
+        if (start_send(s, &st, &reqs[n], fs->snapshot[i], NULL,
+                       ASTMAN_ACTION_LIST | ASTMAN_ACTION_STREAM |
+                       ASTMAN_ACTION_NOWINDOW) != ASTMAN_SUCCESS)
+            fs->failed++;
+    }
+    if (astman_uncork(s) != ASTMAN_SUCCESS) {
+        astman_disconnect(s);
+        goto Exit;
+    }
+
+    /* Without a timeout_ms the actions have no deadline of their own:
+       bound the wait anyway, a silent server must not hang the caller */
+    deadline = st.t0 + (unsigned long long)(fs->timeout_ms > 0 ?
+                        fs->timeout_ms : ASTMAN_FAST_START_TIMEOUT) * 1000000ULL;
+    while (st.left > 0) {
+        now = astman_metrics_now();
+        if (now >= deadline) {
+            astlog(ASTLOG_ERROR, "Fast start: %d actions still unanswered", st.left);
+            astman_disconnect(s);
+            goto Exit;
+        }
+        if (astman_poll(s, (int)((deadline - now + 999999ULL) / 1000000ULL)) < 0)
+            break;
+    }
+    if (st.login != ASTMAN_SUCCESS) {
+        astlog(ASTLOG_ERROR, "Fast start: login failed (%d)", st.login);
+        astman_disconnect(s);
+        goto Exit;
+    }
+    fs->ready_ns = astman_metrics_now() - st.t0;
+    ret = ASTMAN_SUCCESS;
+Exit:
+    free(reqs);
+    return ret;
+}
@@ -0,0 +1,770 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file aststate.c
+ *  @brief Shared memory channel and peer state
+ *
+ *  The region is a header followed by two open addressing tables (twice
+ *  the records asked for, a power of two), channels by Uniqueid and peers
+ *  by name. A slot is a sequence counter, a flag (free, used) and the
+ *  record. The publisher is the only writer: it makes the counter odd,
+ *  writes, and makes it even again. Readers copy a slot and keep the copy
+ *  if the counter was even and unchanged around it. A delete shifts the
+ *  rest of the probe chain back instead of leaving a tombstone (every call
+ *  brings a new Uniqueid, tombstones would fill the table); the table's
+ *  move counter is odd meanwhile and a reader missing a key retries if it
+ *  changed.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astnames.h"
+#include "astdecode.h"
+#include "aststate.h"
+#include "action.h"
+/*******************************************************************************
+ *  \def STATE_MAGIC
+ *  \brief  First bytes of the region, changes with the record layout
+ ******************************************************************************/
+#define STATE_MAGIC     "ASTSTAT2"
+/*******************************************************************************
+ *  \def STATE_FREE / STATE_USED
+ *  \brief  Slot flags
+ ******************************************************************************/
+#define STATE_FREE      0
+#define STATE_USED      1
+/*******************************************************************************
+ *  \def STATE_SPINS / STATE_RETRIES
+ *  \brief  A reader spins STATE_SPINS times on a record being written, then
+ *          yields and checks the publisher is still alive; it gives up
+ *          after STATE_RETRIES
+ ******************************************************************************/
+#define STATE_SPINS     1024
+#define STATE_RETRIES   (1024 * STATE_SPINS)
+/*******************************************************************************
+ * @struct  state_header
+ ******************************************************************************/
+struct state_header {
+    char magic[8];
+    uint32_t chan_slots;            /**!< power of two */
+    uint32_t peer_slots;            /**!< power of two */
+    uint32_t max_channels;
+    uint32_t max_peers;
+    uint32_t channels;              /**!< used records (atomic) */
+    uint32_t peers;
+    int32_t publisher;              /**!< pid */
+    uint32_t pad;
+    uint64_t events;                /**!< events applied (atomic) */
+    int64_t updated;                /**!< last change (us, atomic) */
+    uint32_t chan_moves;            /**!< odd while records are shifted back */
+    uint32_t peer_moves;
+};
+/*******************************************************************************
+ * @struct  state_slot
+ * @brief   Slot header, the record follows. Both records start with their
+ *          NUL terminated key.
+ ******************************************************************************/
+struct state_slot {
+    uint32_t seq;                   /**!< odd while written */
+    uint32_t flags;
+};
+struct chan_slot {
+    struct state_slot h;
+    struct astman_state_channel rec;
+};
+struct peer_slot {
+    struct state_slot h;
+    struct astman_state_peer rec;
+};
+/*******************************************************************************
+ * @struct  state_table
+ * @brief   One of the two tables
+ ******************************************************************************/
+struct state_table {
+    char *base;
+    size_t slot_size;
+    size_t rec_size;
+    size_t key_size;
+    uint32_t mask;
+    uint32_t max;                   /**!< records allowed */
+    uint32_t *used;                 /**!< header counter */
+    uint32_t *moves;                /**!< header move counter */
+    int32_t *publisher;             /**!< header publisher pid */
+};
+/*******************************************************************************
+ * @struct  astman_state
+ ******************************************************************************/
+struct astman_state {
+    struct state_header *hdr;
+    size_t size;
+    int writer;
+    struct state_table chans;
+    struct state_table peers;
+    int full_logged;                /**!< table full already reported */
+};
+/*******************************************************************************
+ * @fn static long long state_now(void)
+ ******************************************************************************/
+static long long state_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+/*******************************************************************************
+ * @fn static uint32_t state_hash(const char *key)
+ ******************************************************************************/
+static uint32_t state_hash(const char *key) {
+    uint32_t h = 2166136261u;
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+/*******************************************************************************
+ * @fn static uint32_t state_slots(int max)
+ ******************************************************************************/
+static uint32_t state_slots(int max) {
+    uint32_t n = 16;
+    while (n < (uint32_t)max * 2)
+        n *= 2;
+    return n;
+}
+/*******************************************************************************
+ * @fn static struct state_slot *state_slot(struct state_table *t, uint32_t x)
+ ******************************************************************************/
+static inline struct state_slot *state_slot(struct state_table *t, uint32_t x) {
+    return (struct state_slot *)(t->base + (size_t)x * t->slot_size);
+}
+/*******************************************************************************
+ * @fn static void state_layout(struct astman_state *st)
+ ******************************************************************************/
+static void state_layout(struct astman_state *st) {
+    struct state_header *hdr = st->hdr;
+
+    st->chans.base = (char *)(hdr + 1);
+    st->chans.slot_size = sizeof(struct chan_slot);
+    st->chans.rec_size = sizeof(struct astman_state_channel);
+    st->chans.key_size = sizeof(((struct astman_state_channel *)0)->uniqueid);
+    st->chans.mask = hdr->chan_slots - 1;
+    st->chans.max = hdr->max_channels;
+    st->chans.used = &hdr->channels;
+    st->chans.moves = &hdr->chan_moves;
+    st->chans.publisher = &hdr->publisher;
+    st->peers.base = st->chans.base + (size_t)hdr->chan_slots * sizeof(struct chan_slot);
+    st->peers.slot_size = sizeof(struct peer_slot);
+    st->peers.rec_size = sizeof(struct astman_state_peer);
+    st->peers.key_size = sizeof(((struct astman_state_peer *)0)->name);
+    st->peers.mask = hdr->peer_slots - 1;
+    st->peers.max = hdr->max_peers;
+    st->peers.used = &hdr->peers;
+    st->peers.moves = &hdr->peer_moves;
+    st->peers.publisher = &hdr->publisher;
+}
+/*******************************************************************************
+ * @fn static size_t state_size(uint32_t chan_slots, uint32_t peer_slots)
+ ******************************************************************************/
+static size_t state_size(uint32_t chan_slots, uint32_t peer_slots) {
+    return sizeof(struct state_header) +
+           (size_t)chan_slots * sizeof(struct chan_slot) +
+           (size_t)peer_slots * sizeof(struct peer_slot);
+}
+/*******************************************************************************
+ * @fn struct astman_state *astman_state_create(const char *name,
+ *                                              int max_channels,
+ *                                              int max_peers)
+ ******************************************************************************/
+struct astman_state *astman_state_create(const char *name, int max_channels,
+                                         int max_peers) {
+    struct astman_state *st;
+    uint32_t cs, ps;
+    size_t size;
+    void *map;
+    int fd;
+
+    if (max_channels <= 0 || max_peers <= 0)
+        return NULL;
+    cs = state_slots(max_channels);
+    ps = state_slots(max_peers);
+    size = state_size(cs, ps);
+    /* A new region: readers of the old one keep a valid (stale) mapping */
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        astlog(ASTLOG_ERROR, "state %s: %s", name, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, size) < 0) {
+        astlog(ASTLOG_ERROR, "state %s: %s", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        astlog(ASTLOG_ERROR, "state %s: %s", name, strerror(errno));
+        shm_unlink(name);
+        return NULL;
+    }
+    st = calloc(1, sizeof(*st));
+    if (!st) {
+        munmap(map, size);
+        shm_unlink(name);
+        return NULL;
+    }
+    st->hdr = map;
+    st->size = size;
+    st->writer = 1;
+    st->hdr->chan_slots = cs;
+    st->hdr->peer_slots = ps;
+    st->hdr->max_channels = max_channels;
+    st->hdr->max_peers = max_peers;
+    st->hdr->publisher = getpid();
+    st->hdr->updated = state_now();
+    state_layout(st);
+    /* Readers check the magic last */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(st->hdr->magic, STATE_MAGIC, 8);
+    return st;
+}
+/*******************************************************************************
+ * @fn struct astman_state *astman_state_open(const char *name)
+ ******************************************************************************/
+struct astman_state *astman_state_open(const char *name) {
+    struct astman_state *st;
+    struct state_header *hdr;
+    struct stat sb;
+    void *map;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(*hdr)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    hdr = map;
+    if (memcmp(hdr->magic, STATE_MAGIC, 8) ||
+        state_size(hdr->chan_slots, hdr->peer_slots) != (size_t)sb.st_size) {
+        astlog(ASTLOG_ERROR, "state %s: not a state region", name);
+        munmap(map, sb.st_size);
+        return NULL;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    st = calloc(1, sizeof(*st));
+    if (!st) {
+        munmap(map, sb.st_size);
+        return NULL;
+    }
+    st->hdr = hdr;
+    st->size = sb.st_size;
+    state_layout(st);
+    return st;
+}
+/*******************************************************************************
+ * @fn void astman_state_close(struct astman_state *st)
+ ******************************************************************************/
+void astman_state_close(struct astman_state *st) {
+    if (!st)
+        return;
+    munmap(st->hdr, st->size);
+    free(st);
+}
+/*******************************************************************************
+ * @fn int astman_state_unlink(const char *name)
+ ******************************************************************************/
+int astman_state_unlink(const char *name) {
+    return shm_unlink(name) < 0 ? ASTMAN_FAILURE : ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static int state_retry(struct state_table *t, unsigned int *tries)
+ * @brief Reader side: may a seqlock read be tried again? A publisher that
+ *        died in the middle of a write leaves the record odd for good.
+ * @return ASTMAN_SUCCESS to retry, ASTMAN_FAILURE to give up
+ ******************************************************************************/
+static int state_retry(struct state_table *t, unsigned int *tries) {
+    pid_t pid;
+
+    if (++*tries >= STATE_RETRIES)
+        return ASTMAN_FAILURE;
+    if (*tries % STATE_SPINS)
+        return ASTMAN_SUCCESS;
+    pid = __atomic_load_n(t->publisher, __ATOMIC_RELAXED);
+    if (pid > 0 && kill(pid, 0) < 0 && errno == ESRCH)
+        return ASTMAN_FAILURE;
+    sched_yield();
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static int state_read(struct state_table *t, uint32_t x, void *rec,
+ *                           uint32_t *flags)
+ * @brief Reader side: consistent copy of a slot
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (the publisher never finished
+ *         writing it)
+ ******************************************************************************/
+static int state_read(struct state_table *t, uint32_t x, void *rec,
+                      uint32_t *flags) {
+    struct state_slot *slot = state_slot(t, x);
+    unsigned int tries = 0;
+    uint32_t s1, s2;
+
+    do {
+        s1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1)
+            continue;
+        *flags = __atomic_load_n(&slot->flags, __ATOMIC_RELAXED);
+        if (*flags == STATE_USED)
+            memcpy(rec, slot + 1, t->rec_size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+        if (s1 == s2)
+            return ASTMAN_SUCCESS;
+    } while (state_retry(t, &tries) == ASTMAN_SUCCESS);
+    *flags = STATE_FREE;
+    return ASTMAN_FAILURE;
+}
+/*******************************************************************************
+ * @fn static void state_write(struct state_table *t, uint32_t x,
+ *                             const void *rec, uint32_t flags)
+ * @brief Publisher side
+ ******************************************************************************/
+static void state_write(struct state_table *t, uint32_t x, const void *rec,
+                        uint32_t flags) {
+    struct state_slot *slot = state_slot(t, x);
+    uint32_t seq = slot->seq;
+
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&slot->flags, flags, __ATOMIC_RELAXED);
+    if (rec)
+        memcpy(slot + 1, rec, t->rec_size);
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+/*******************************************************************************
+ * @fn static int state_lookup(struct state_table *t, const char *key,
+ *                             void *rec)
+ * @brief Reader side: find and copy a record. A miss while the publisher
+ *        shifted records back is retried.
+ ******************************************************************************/
+static int state_lookup(struct state_table *t, const char *key, void *rec) {
+    uint32_t x, n, flags, moves;
+    unsigned int tries = 0;
+
+    do {
+        moves = __atomic_load_n(t->moves, __ATOMIC_ACQUIRE);
+        if (moves & 1)
+            continue;
+        for (x = state_hash(key) & t->mask, n = 0; n <= t->mask; x = (x + 1) & t->mask, n++) {
+            if (state_read(t, x, rec, &flags) != ASTMAN_SUCCESS)
+                return ASTMAN_FAILURE;
+            if (flags == STATE_FREE)
+                break;
+            if (!strncmp(rec, key, t->key_size))
+                return ASTMAN_SUCCESS;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(t->moves, __ATOMIC_RELAXED) == moves)
+            return ASTMAN_FAILURE;
+    } while (state_retry(t, &tries) == ASTMAN_SUCCESS);
+    return ASTMAN_FAILURE;
+}
+/*******************************************************************************
+ * @fn static int state_find(struct state_table *t, const char *key,
+ *                           int *free_slot)
+ * @brief Publisher side (no seqlock needed to read)
+ * @param free_slot: the slot an insert would take, -1 if the table is full
+ * @return slot of key, -1 if none
+ ******************************************************************************/
+static int state_find(struct state_table *t, const char *key, int *free_slot) {
+    struct state_slot *slot;
+    uint32_t x, n;
+
+    *free_slot = -1;
+    for (x = state_hash(key) & t->mask, n = 0; n <= t->mask; x = (x + 1) & t->mask, n++) {
+        slot = state_slot(t, x);
+        if (slot->flags == STATE_FREE) {
+            *free_slot = x;
+            break;
+        }
+        if (!strncmp((char *)(slot + 1), key, t->key_size))
+            return x;
+    }
+    return -1;
+}
+/*******************************************************************************
+ * @fn static void state_copy(char *dst, size_t size, const char *src, int len)
+ * @brief Copy a non empty value, truncated to fit
+ ******************************************************************************/
+static void state_copy(char *dst, size_t size, const char *src, int len) {
+    if (len <= 0)
+        return;
+    if ((size_t)len >= size)
+        len = size - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+#define STATE_COPY(dst, slice) state_copy(dst, sizeof(dst), (slice).ptr, (slice).len)
+#define STATE_COPY_STR(dst, str) state_copy(dst, sizeof(dst), str, strlen(str))
+/*******************************************************************************
+ * @fn static int state_upsert(struct astman_state *st, struct state_table *t,
+ *                             const char *key, void *rec, int *created)
+ * @brief Publisher side: current record of key (zeroed if new) into rec
+ * @return its slot, -1 if the table is full
+ ******************************************************************************/
+static int state_upsert(struct astman_state *st, struct state_table *t,
+                        const char *key, void *rec, int *created) {
+    int x, free_slot;
+
+    x = state_find(t, key, &free_slot);
+    *created = x < 0;
+    if (x >= 0) {
+        memcpy(rec, state_slot(t, x) + 1, t->rec_size);
+        return x;
+    }
+    if (free_slot < 0 || *t->used >= t->max) {
+        if (!st->full_logged++)
+            astlog(ASTLOG_WARNING, "state: table full, %s not published", key);
+        return -1;
+    }
+    memset(rec, 0, t->rec_size);
+    state_copy(rec, t->key_size, key, strlen(key));
+    return free_slot;
+}
+/*******************************************************************************
+ * @fn static void state_commit(struct state_table *t, int x, const void *rec,
+ *                              int created)
+ ******************************************************************************/
+static void state_commit(struct state_table *t, int x, const void *rec,
+                         int created) {
+    state_write(t, x, rec, STATE_USED);
+    if (created)
+        __atomic_store_n(t->used, *t->used + 1, __ATOMIC_RELAXED);
+}
+/*******************************************************************************
+ * @fn static void state_delete(struct state_table *t, const char *key)
+ * @brief Backward shift: the records after the hole that may live closer to
+ *        their home slot move into it, the last hole is freed
+ ******************************************************************************/
+static void state_delete(struct state_table *t, const char *key) {
+    struct state_slot *slot;
+    uint32_t i, j, home;
+    int x, free_slot;
+
+    x = state_find(t, key, &free_slot);
+    if (x < 0)
+        return;
+    __atomic_store_n(t->moves, *t->moves + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = x, j = (i + 1) & t->mask; j != (uint32_t)x; j = (j + 1) & t->mask) {
+        slot = state_slot(t, j);
+        if (slot->flags == STATE_FREE)
+            break;
+        home = state_hash((char *)(slot + 1)) & t->mask;
+        /* home not in (i, j]: the record may move back to i */
+        if (((j - home) & t->mask) >= ((j - i) & t->mask)) {
+            state_write(t, i, slot + 1, STATE_USED);
+            i = j;
+        }
+    }
+    state_write(t, i, NULL, STATE_FREE);
+    __atomic_store_n(t->moves, *t->moves + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(t->used, *t->used - 1, __ATOMIC_RELAXED);
+}
+/*******************************************************************************
+ * @fn static void state_channel_apply(struct astman_state_channel *c,
+ *                                     const struct astman_ev_channel *ev)
+ ******************************************************************************/
+static void state_channel_apply(struct astman_state_channel *c,
+                                const struct astman_ev_channel *ev) {
+    STATE_COPY(c->linkedid, ev->linkedid);
+    STATE_COPY(c->channel, ev->channel);
+    STATE_COPY(c->calleridnum, ev->calleridnum);
+    STATE_COPY(c->calleridname, ev->calleridname);
+    STATE_COPY(c->context, ev->context);
+    STATE_COPY(c->exten, ev->exten);
+    if (ev->priority >= 0)
+        c->priority = ev->priority;
+    if (ev->state != ASTMAN_STATE_UNKNOWN)
+        c->state = ev->state;
+}
+/*******************************************************************************
+ * @fn static void state_peer_entry(struct astman_state *st, struct message *m)
+ * @brief SIPpeers list entry
+ ******************************************************************************/
+static void state_peer_entry(struct astman_state *st, struct message *m) {
+    struct astman_state_peer p;
+    char name[sizeof(p.name)];
+    const char *status;
+    int x, created;
+
+    snprintf(name, sizeof(name), "%s/%s", astman_get_header(m, "Channeltype"),
+             astman_get_header_id(m, ASTMAN_HDR_OBJECTNAME));
+    x = state_upsert(st, &st->peers, name, &p, &created);
+    if (x < 0)
+        return;
+    snprintf(p.address, sizeof(p.address), "%s:%s",
+             astman_get_header_id(m, ASTMAN_HDR_IPADDRESS),
+             astman_get_header_id(m, ASTMAN_HDR_IPPORT));
+    /* "OK (5 ms)", "LAGGED (300 ms)", "UNREACHABLE", "UNKNOWN", "Unmonitored" */
+    status = astman_get_header_id(m, ASTMAN_HDR_STATUS);
+    p.latency = -1;
+    if (!strncasecmp(status, "OK", 2)) {
+        p.status = ASTMAN_PEER_REACHABLE;
+    } else if (!strncasecmp(status, "LAGGED", 6)) {
+        p.status = ASTMAN_PEER_LAGGED;
+    } else if (!strncasecmp(status, "UNREACHABLE", 11)) {
+        p.status = ASTMAN_PEER_UNREACHABLE;
+    } else {
+        p.status = ASTMAN_PEER_UNKNOWN;
+    }
+    if ((status = strchr(status, '(')))
+        p.latency = atoi(status + 1);
+    p.updated = state_now();
+    state_commit(&st->peers, x, &p, created);
+}
+/*******************************************************************************
+ * @fn static void state_channel_event(struct astman_state *st,
+ *                                     struct message *m, int event)
+ * @brief Status list entry, NewCallerid, Rename
+ ******************************************************************************/
+static void state_channel_event(struct astman_state *st, struct message *m,
+                                int event) {
+    struct astman_state_channel c;
+    const char *uniqueid, *v;
+    long long n;
+    int x, created;
+
+    uniqueid = astman_get_header_id(m, ASTMAN_HDR_UNIQUEID);
+    if (!*uniqueid)
+        return;
+    x = state_upsert(st, &st->chans, uniqueid, &c, &created);
+    if (x < 0)
+        return;
+    if (event == ASTMAN_EVT_RENAME) {
+        v = astman_get_header(m, "Newname");
+        STATE_COPY_STR(c.channel, v);
+    } else {
+        STATE_COPY_STR(c.calleridnum, astman_get_header_id(m, ASTMAN_HDR_CALLERIDNUM));
+        STATE_COPY_STR(c.calleridname, astman_get_header_id(m, ASTMAN_HDR_CALLERIDNAME));
+    }
+    if (event == ASTMAN_EVT_STATUS) {
+        STATE_COPY_STR(c.channel, astman_get_header_id(m, ASTMAN_HDR_CHANNEL));
+        STATE_COPY_STR(c.linkedid, astman_get_header_id(m, ASTMAN_HDR_LINKEDID));
+        STATE_COPY_STR(c.context, astman_get_header_id(m, ASTMAN_HDR_CONTEXT));
+        v = astman_get_header_id(m, ASTMAN_HDR_EXTEN);
+        STATE_COPY_STR(c.exten, *v ? v : astman_get_header_id(m, ASTMAN_HDR_EXTENSION));
+        v = astman_get_header_id(m, ASTMAN_HDR_PRIORITY);
+        if (astman_parse_int(v, strlen(v), &n) == ASTMAN_SUCCESS)
+            c.priority = (int)n;
+        v = astman_get_header_id(m, ASTMAN_HDR_CHANNELSTATE);
+        if (astman_parse_int(v, strlen(v), &n) == ASTMAN_SUCCESS)
+            c.state = (int)n;
+    }
+    c.updated = state_now();
+    if (created)
+        c.created = c.updated;
+    state_commit(&st->chans, x, &c, created);
+}
+/*******************************************************************************
+ * @fn void astman_state_update(struct astman_state *st, struct message *m)
+ ******************************************************************************/
+void astman_state_update(struct astman_state *st, struct message *m) {
+    struct astman_event ev;
+    struct astman_state_channel c;
+    struct astman_state_peer p;
+    char key[sizeof(c.uniqueid)];
+    int event = astman_message_event(m);
+    int x, created;
+
+    switch (event) {
+    case ASTMAN_EVT_NEWCHANNEL:
+    case ASTMAN_EVT_NEWSTATE:
+        if (astman_event_decode(m, &ev) != ASTMAN_SUCCESS || !ev.chan.uniqueid.len)
+            return;
+        state_copy(key, sizeof(key), ev.chan.uniqueid.ptr, ev.chan.uniqueid.len);
+        x = state_upsert(st, &st->chans, key, &c, &created);
+        if (x < 0)
+            return;
+        state_channel_apply(&c, &ev.chan);
+        c.updated = state_now();
+        if (created)
+            c.created = c.updated;
+        state_commit(&st->chans, x, &c, created);
+        break;
+    case ASTMAN_EVT_HANGUP:
+        state_delete(&st->chans, astman_get_header_id(m, ASTMAN_HDR_UNIQUEID));
+        break;
+    case ASTMAN_EVT_NEWCALLERID:
+    case ASTMAN_EVT_RENAME:
+    case ASTMAN_EVT_STATUS:
+        state_channel_event(st, m, event);
+        break;
+    case ASTMAN_EVT_PEERSTATUS:
+        if (astman_event_decode(m, &ev) != ASTMAN_SUCCESS || !ev.u.peerstatus.peer.len)
+            return;
+        state_copy(key, sizeof(key), ev.u.peerstatus.peer.ptr, ev.u.peerstatus.peer.len);
+        x = state_upsert(st, &st->peers, key, &p, &created);
+        if (x < 0)
+            return;
+        p.status = ev.u.peerstatus.status;
+        if (ev.u.peerstatus.status == ASTMAN_PEER_REACHABLE ||
+            ev.u.peerstatus.status == ASTMAN_PEER_LAGGED)
+            p.latency = ev.u.peerstatus.time;
+        else if (ev.u.peerstatus.status == ASTMAN_PEER_UNREACHABLE)
+            p.latency = -1;
+        STATE_COPY(p.address, ev.u.peerstatus.address);
+        p.updated = state_now();
+        state_commit(&st->peers, x, &p, created);
+        break;
+    case ASTMAN_EVT_PEERENTRY:
+        state_peer_entry(st, m);
+        break;
+    default:
+        return;
+    }
+    __atomic_store_n(&st->hdr->events, st->hdr->events + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->hdr->updated, state_now(), __ATOMIC_RELAXED);
+}
+/*******************************************************************************
+ * @fn int astman_state_attach(struct mansession *s, struct astman_state *st)
+ ******************************************************************************/
+int astman_state_attach(struct mansession *s, struct astman_state *st) {
+    if (st && !st->writer)
+        return ASTMAN_FAILURE;
+    s->state = st;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_state_seed(struct astman_state *st, struct mansession *s)
+ ******************************************************************************/
+int astman_state_seed(struct astman_state *st, struct mansession *s) {
+    struct message *list = NULL;
+    int x, ret = ASTMAN_SUCCESS;
+
+    if (!st->writer)
+        return ASTMAN_FAILURE;
+    /* The lists are terminated by an empty message */
+    if (astman_status(s, &list, NULL) == ASTMAN_SUCCESS && list) {
+        for (x = 0; list[x].hdrcount; x++)
+            astman_state_update(st, &list[x]);
+    } else {
+        ret = ASTMAN_FAILURE;
+    }
+    free(list);
+    list = NULL;
+    astman_sip_peers(s, &list, NULL);
+    if (list) {
+        for (x = 0; list[x].hdrcount; x++)
+            astman_state_update(st, &list[x]);
+    } else {
+        ret = ASTMAN_FAILURE;
+    }
+    free(list);
+    return ret;
+}
+/*******************************************************************************
+ * @fn int astman_state_channel(struct astman_state *st, const char *uniqueid,
+ *                              struct astman_state_channel *c)
+ ******************************************************************************/
+int astman_state_channel(struct astman_state *st, const char *uniqueid,
+                         struct astman_state_channel *c) {
+    return state_lookup(&st->chans, uniqueid, c);
+}
+/*******************************************************************************
+ * @fn int astman_state_peer(struct astman_state *st, const char *name,
+ *                           struct astman_state_peer *p)
+ ******************************************************************************/
+int astman_state_peer(struct astman_state *st, const char *name,
+                      struct astman_state_peer *p) {
+    return state_lookup(&st->peers, name, p);
+}
+/*******************************************************************************
+ * @fn int astman_state_channels(struct astman_state *st,
+ *                               ASTMAN_STATE_CHANNEL_CALLBACK cb, void *data)
+ ******************************************************************************/
+int astman_state_channels(struct astman_state *st,
+                          ASTMAN_STATE_CHANNEL_CALLBACK cb, void *data) {
+    struct astman_state_channel c;
+    uint32_t x, flags;
+    int count = 0;
+
+    for (x = 0; x <= st->chans.mask; x++) {
+        state_read(&st->chans, x, &c, &flags);
+        if (flags != STATE_USED)
+            continue;
+        count++;
+        if (!cb(&c, data))
+            break;
+    }
+    return count;
+}
+/*******************************************************************************
+ * @fn int astman_state_peers(struct astman_state *st,
+ *                            ASTMAN_STATE_PEER_CALLBACK cb, void *data)
+ ******************************************************************************/
+int astman_state_peers(struct astman_state *st, ASTMAN_STATE_PEER_CALLBACK cb,
+                       void *data) {
+    struct astman_state_peer p;
+    uint32_t x, flags;
+    int count = 0;
+
+    for (x = 0; x <= st->peers.mask; x++) {
+        state_read(&st->peers, x, &p, &flags);
+        if (flags != STATE_USED)
+            continue;
+        count++;
+        if (!cb(&p, data))
+            break;
+    }
+    return count;
+}
+/*******************************************************************************
+ * @fn void astman_state_info(struct astman_state *st,
+ *                            struct astman_state_info *info)
+ ******************************************************************************/
+void astman_state_info(struct astman_state *st, struct astman_state_info *info) {
+    info->max_channels = st->hdr->max_channels;
+    info->max_peers = st->hdr->max_peers;
+    info->channels = __atomic_load_n(&st->hdr->channels, __ATOMIC_RELAXED);
+    info->peers = __atomic_load_n(&st->hdr->peers, __ATOMIC_RELAXED);
+    info->publisher = st->hdr->publisher;
+    info->events = __atomic_load_n(&st->hdr->events, __ATOMIC_RELAXED);
+    info->updated = __atomic_load_n(&st->hdr->updated, __ATOMIC_RELAXED);
+}
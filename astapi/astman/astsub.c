@@ -0,0 +1,423 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astsub.c
+ *  @brief Event subscriptions trie
+ *
+ *  Every subscription is a path of the trie, one node per (lower case)
+ *  character, '*' and '?' being nodes of their own. Matching runs the trie
+ *  as an NFA: the set of nodes reached so far advances by one character of
+ *  the Event name at a time, a '*' node stays in the set until the end.
+ *  Event names come from a small vocabulary, so the outcome is kept in a
+ *  direct mapped cache (an array for interned names) that any change of
+ *  the subscriptions invalidates.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "astman.h"
+#include "astsub.h"
+#include "astnames.h"
+/*******************************************************************************
+ *  \def SUBS_CACHE_SIZE
+ *  \brief  Cached Event names (power of two)
+ ******************************************************************************/
+#define SUBS_CACHE_SIZE     128
+/*******************************************************************************
+ *  \def SUBS_NAME_LEN
+ *  \brief  Longer Event names are matched without the cache
+ ******************************************************************************/
+#define SUBS_NAME_LEN       64
+/*******************************************************************************
+ * @struct  sub_node
+ * @brief   Trie node
+ ******************************************************************************/
+struct sub_node {
+    unsigned char c;                /**!< lower case character, '*' or '?' */
+    struct sub_node *child;         /**!< first child */
+    struct sub_node *next;          /**!< next sibling */
+    ASTMAN_EVENT_CALLBACK func;     /**!< subscription ending here, or NULL */
+    void *data;                     /**!< attached by astman_subs_set_data() */
+    int score;                      /**!< 2 * literal characters, + 1 if exact */
+    unsigned int order;             /**!< registration order */
+    unsigned long long mark;        /**!< already in the set of this step */
+};
+/*******************************************************************************
+ * @struct  sub_cache
+ * @brief   Outcome of a lookup
+ ******************************************************************************/
+struct sub_cache {
+    unsigned int gen;               /**!< subscriptions generation, 0 = free */
+    char name[SUBS_NAME_LEN];       /**!< lower case Event name */
+    struct sub_node *node;          /**!< NULL: no subscription matches */
+};
+/*******************************************************************************
+ * @struct  astman_subs
+ ******************************************************************************/
+struct astman_subs {
+    struct sub_node root;
+    int count;                      /**!< subscriptions */
+    int nodes;                      /**!< trie nodes, root included */
+    unsigned int order;             /**!< last registration order */
+    unsigned int gen;               /**!< bumped by every change */
+    unsigned long long stamp;       /**!< matching step */
+    struct sub_node **cur;          /**!< nodes reached so far */
+    struct sub_node **nxt;          /**!< nodes reached with one more char */
+    int cap;                        /**!< size of cur and nxt */
+    struct sub_cache cache[SUBS_CACHE_SIZE];
+    struct {
+        unsigned int gen;           /**!< 0 = not looked up */
+        struct sub_node *node;
+    } byid[ASTMAN_EVT_IDS];         /**!< outcome by interned Event name */
+};
+/*******************************************************************************
+ * @fn int astman_subs_pattern(const char *event)
+ ******************************************************************************/
+int astman_subs_pattern(const char *event) {
+    return strpbrk(event, "*?") != NULL;
+}
+/*******************************************************************************
+ * @fn struct astman_subs *astman_subs_new(void)
+ ******************************************************************************/
+struct astman_subs *astman_subs_new(void) {
+    struct astman_subs *subs = calloc(1, sizeof(*subs));
+    if (!subs)
+        return NULL;
+    subs->nodes = 1;
+    subs->gen = 1;
+    return subs;
+}
+/*******************************************************************************
+ * @fn static void subs_free_nodes(struct sub_node *n)
+ ******************************************************************************/
+static void subs_free_nodes(struct sub_node *n) {
+    struct sub_node *next;
+    for (; n; n = next) {
+        next = n->next;
+        subs_free_nodes(n->child);
+        free(n);
+    }
+}
+/*******************************************************************************
+ * @fn void astman_subs_free(struct astman_subs *subs)
+ ******************************************************************************/
+void astman_subs_free(struct astman_subs *subs) {
+    if (!subs)
+        return;
+    subs_free_nodes(subs->root.child);
+    free(subs->cur);
+    free(subs->nxt);
+    free(subs);
+}
+/*******************************************************************************
+ * @fn static void subs_changed(struct astman_subs *subs)
+ * @brief Invalidate the cache
+ ******************************************************************************/
+static void subs_changed(struct astman_subs *subs) {
+    if (++subs->gen == 0) {
+        memset(subs->cache, 0, sizeof(subs->cache));
+        memset(subs->byid, 0, sizeof(subs->byid));
+        subs->gen = 1;
+    }
+}
+/*******************************************************************************
+ * @fn static struct sub_node *subs_child(struct sub_node *n, unsigned char c)
+ ******************************************************************************/
+static struct sub_node *subs_child(struct sub_node *n, unsigned char c) {
+    for (n = n->child; n && n->c != c; n = n->next)
+        ;
+    return n;
+}
+/*******************************************************************************
+ * @fn static int subs_label(const char **pattern, unsigned char *c)
+ * @brief Next node label of a pattern, runs of '*' count as one
+ * @return 0 at the end of the pattern
+ ******************************************************************************/
+static int subs_label(const char **pattern, unsigned char *c) {
+    if (!**pattern)
+        return 0;
+    *c = (unsigned char)tolower((unsigned char)**pattern);
+    if (*c == '*') {
+        while (**pattern == '*')
+            (*pattern)++;
+    } else {
+        (*pattern)++;
+    }
+    return 1;
+}
+/*******************************************************************************
+ * @fn int astman_subs_add(struct astman_subs *subs, const char *pattern,
+ *                         ASTMAN_EVENT_CALLBACK callback)
+ ******************************************************************************/
+int astman_subs_add(struct astman_subs *subs, const char *pattern,
+                    ASTMAN_EVENT_CALLBACK callback) {
+    struct sub_node *n = &subs->root, *child;
+    struct sub_node **set;
+    int literals = 0, exact = 1;
+    int need;
+    unsigned char c;
+
+    if (!callback || astman_strlen_zero(pattern))
+        return ASTMAN_FAILURE;
+    /* The sets of reached nodes hold each node at most once */
+    need = subs->nodes + (int)strlen(pattern);
+    if (need > subs->cap) {
+        need += 16;
+        set = realloc(subs->cur, need * sizeof(*set));
+        if (!set)
+            return ASTMAN_FAILURE;
+        subs->cur = set;
+        set = realloc(subs->nxt, need * sizeof(*set));
+        if (!set)
+            return ASTMAN_FAILURE;
+        subs->nxt = set;
+        subs->cap = need;
+    }
+    while (subs_label(&pattern, &c)) {
+        if (c == '*' || c == '?')
+            exact = 0;
+        else
+            literals++;
+        child = subs_child(n, c);
+        if (!child) {
+            child = calloc(1, sizeof(*child));
+            if (!child)
+                return ASTMAN_FAILURE;
+            child->c = c;
+            child->next = n->child;
+            n->child = child;
+            subs->nodes++;
+        }
+        n = child;
+    }
+    if (n->func)
+        return ASTMAN_FAILURE;
+    n->func = callback;
+    n->score = literals * 2 + exact;
+    n->order = ++subs->order;
+    subs->count++;
+    subs_changed(subs);
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_subs_remove(struct astman_subs *subs, const char *pattern)
+ ******************************************************************************/
+int astman_subs_remove(struct astman_subs *subs, const char *pattern) {
+    struct sub_node **path, **pp, *n = &subs->root;
+    int depth = 0, ret = ASTMAN_FAILURE;
+    unsigned char c;
+
+    path = malloc((strlen(pattern) + 1) * sizeof(*path));
+    if (!path)
+        return ASTMAN_FAILURE;
+    path[depth++] = n;
+    while (subs_label(&pattern, &c)) {
+        n = subs_child(n, c);
+        if (!n)
+            goto Exit;
+        path[depth++] = n;
+    }
+    if (!n->func)
+        goto Exit;
+    n->func = NULL;
+    n->data = NULL;
+    subs->count--;
+    subs_changed(subs);
+    /* Drop the nodes no other subscription goes through */
+    while (depth > 1) {
+        n = path[--depth];
+        if (n->func || n->child)
+            break;
+        for (pp = &path[depth - 1]->child; *pp != n; pp = &(*pp)->next)
+            ;
+        *pp = n->next;
+        free(n);
+        subs->nodes--;
+    }
+    ret = ASTMAN_SUCCESS;
+Exit:
+    free(path);
+    return ret;
+}
+/*******************************************************************************
+ * @fn int astman_subs_count(struct astman_subs *subs)
+ ******************************************************************************/
+int astman_subs_count(struct astman_subs *subs) {
+    return subs ? subs->count : 0;
+}
+/*******************************************************************************
+ * @fn static void subs_reach(struct astman_subs *subs, struct sub_node *n,
+ *                            struct sub_node **set, int *count)
+ * @brief Add n to a set, with the '*' node below it (it matches nothing too)
+ ******************************************************************************/
+static void subs_reach(struct astman_subs *subs, struct sub_node *n,
+                       struct sub_node **set, int *count) {
+    struct sub_node *child;
+    if (n->mark == subs->stamp)
+        return;
+    n->mark = subs->stamp;
+    set[(*count)++] = n;
+    for (child = n->child; child; child = child->next) {
+        if (child->c == '*')
+            subs_reach(subs, child, set, count);
+    }
+}
+/*******************************************************************************
+ * @fn static struct sub_node *subs_walk(struct astman_subs *subs,
+ *                                       const char *event)
+ ******************************************************************************/
+static struct sub_node *subs_walk(struct astman_subs *subs, const char *event) {
+    struct sub_node *n, *child, *best = NULL, **set;
+    int x, ncur = 0, nnxt;
+    unsigned char c;
+
+    subs->stamp++;
+    subs_reach(subs, &subs->root, subs->cur, &ncur);
+    for (; *event && ncur; event++) {
+        c = (unsigned char)tolower((unsigned char)*event);
+        nnxt = 0;
+        subs->stamp++;
+        for (x = 0; x < ncur; x++) {
+            n = subs->cur[x];
+            if (n->c == '*')
+                subs_reach(subs, n, subs->nxt, &nnxt);
+            for (child = n->child; child; child = child->next) {
+                if (child->c == c || child->c == '?')
+                    subs_reach(subs, child, subs->nxt, &nnxt);
+            }
+        }
+        set = subs->cur;
+        subs->cur = subs->nxt;
+        subs->nxt = set;
+        ncur = nnxt;
+    }
+    for (x = 0; x < ncur; x++) {
+        n = subs->cur[x];
+        if (n->func && (!best || n->score > best->score ||
+                        (n->score == best->score && n->order < best->order)))
+            best = n;
+    }
+    return best;
+}
+/*******************************************************************************
+ * @fn static struct sub_node *subs_lookup(struct astman_subs *subs,
+ *                                         const char *event)
+ ******************************************************************************/
+static struct sub_node *subs_lookup(struct astman_subs *subs, const char *event) {
+    char name[SUBS_NAME_LEN];
+    struct sub_cache *e = NULL;
+    struct sub_node *node;
+    unsigned int h = 2166136261u;
+    size_t x, len;
+
+    len = strlen(event);
+    if (len < SUBS_NAME_LEN) {
+        for (x = 0; x < len; x++) {
+            name[x] = (char)tolower((unsigned char)event[x]);
+            h ^= (unsigned char)name[x];
+            h *= 16777619u;
+        }
+        name[len] = '\0';
+        e = &subs->cache[h & (SUBS_CACHE_SIZE - 1)];
+        if (e->gen == subs->gen && !strcmp(e->name, name))
+            return e->node;
+    }
+    node = subs_walk(subs, event);
+    if (e) {
+        e->gen = subs->gen;
+        memcpy(e->name, name, len + 1);
+        e->node = node;
+    }
+    return node;
+}
+/*******************************************************************************
+ * @fn static struct sub_node *subs_lookup_id(struct astman_subs *subs,
+ *                                            int id, const char *event)
+ ******************************************************************************/
+static struct sub_node *subs_lookup_id(struct astman_subs *subs, int id,
+                                       const char *event) {
+    if (id <= ASTMAN_EVT_OTHER || id >= ASTMAN_EVT_IDS)
+        return subs_lookup(subs, event);
+    if (subs->byid[id].gen != subs->gen) {
+        subs->byid[id].node = subs_walk(subs, event);
+        subs->byid[id].gen = subs->gen;
+    }
+    return subs->byid[id].node;
+}
+/*******************************************************************************
+ * @fn ASTMAN_EVENT_CALLBACK astman_subs_match(struct astman_subs *subs,
+ *                                             const char *event)
+ ******************************************************************************/
+ASTMAN_EVENT_CALLBACK astman_subs_match(struct astman_subs *subs,
+                                        const char *event) {
+    struct sub_node *node;
+
+    if (!subs || !subs->count)
+        return NULL;
+    node = subs_lookup(subs, event);
+    return node ? node->func : NULL;
+}
+/*******************************************************************************
+ * @fn ASTMAN_EVENT_CALLBACK astman_subs_match_id(struct astman_subs *subs,
+ *                                                int id, const char *event)
+ ******************************************************************************/
+ASTMAN_EVENT_CALLBACK astman_subs_match_id(struct astman_subs *subs, int id,
+                                           const char *event) {
+    return astman_subs_match_data(subs, id, event, NULL);
+}
+/*******************************************************************************
+ * @fn ASTMAN_EVENT_CALLBACK astman_subs_match_data(struct astman_subs *subs,
+ *                                                  int id, const char *event,
+ *                                                  void **data)
+ ******************************************************************************/
+ASTMAN_EVENT_CALLBACK astman_subs_match_data(struct astman_subs *subs, int id,
+                                             const char *event, void **data) {
+    struct sub_node *node;
+
+    if (data)
+        *data = NULL;
+    if (!subs || !subs->count)
+        return NULL;
+    node = subs_lookup_id(subs, id, event);
+    if (!node)
+        return NULL;
+    if (data)
+        *data = node->data;
+    return node->func;
+}
+/*******************************************************************************
+ * @fn int astman_subs_set_data(struct astman_subs *subs, const char *pattern,
+ *                              void *data)
+ ******************************************************************************/
+int astman_subs_set_data(struct astman_subs *subs, const char *pattern,
+                         void *data) {
+    struct sub_node *n;
+    unsigned char c;
+
+    if (!subs || astman_strlen_zero(pattern))
+        return ASTMAN_FAILURE;
+    for (n = &subs->root; n && subs_label(&pattern, &c); )
+        n = subs_child(n, c);
+    if (!n || !n->func)
+        return ASTMAN_FAILURE;
+    n->data = data;
+    return ASTMAN_SUCCESS;
+}
@@ -0,0 +1,237 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astsweep.c
+ *  @brief Bulk SIP peer sweep
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astasync.h"
+#include "astsweep.h"
+/*******************************************************************************
+ * @struct  sweep_request
+ * @brief   A request slot, one per possible request in flight
+ ******************************************************************************/
+struct sweep_request {
+    struct sweep *sw;
+    int peer;
+    int op;
+    int session;
+};
+/*******************************************************************************
+ * @struct  sweep
+ ******************************************************************************/
+struct sweep {
+    struct mansession **sessions;
+    int nsessions;
+    char **peers;
+    int npeers;
+    int ops;
+    int window;
+    int timeout_ms;
+    ASTMAN_SWEEP_CALLBACK callback;
+    void *data;
+    int next;                       /**!< next request: peer * 2 + op bit */
+    int *inflight;                  /**!< per session */
+    int *lost;                      /**!< per session */
+    struct sweep_request **free;    /**!< unused slots */
+    int nfree;
+    int succeeded;
+};
+/*******************************************************************************
+ * @fn static void sweep_report(struct sweep *sw, int peer, int op,
+ *                              int session, int status,
+ *                              struct message *response)
+ ******************************************************************************/
+static void sweep_report(struct sweep *sw, int peer, int op, int session,
+                         int status, struct message *response) {
+    struct astman_sweep_result r;
+
+    if (status == ASTMAN_SUCCESS)
+        sw->succeeded++;
+    if (!sw->callback)
+        return;
+    r.peer = sw->peers[peer];
+    r.index = peer;
+    r.op = op;
+    r.session = session;
+    r.status = status;
+    r.response = response;
+    sw->callback(&r, sw->data);
+}
+/*******************************************************************************
+ * @fn static void sweep_done(struct mansession *s,
+ *                            struct astman_action_result *r, void *data)
+ ******************************************************************************/
+static void sweep_done(struct mansession *s, struct astman_action_result *r,
+                       void *data) {
+    struct sweep_request *req = data;
+    struct sweep *sw = req->sw;
+
+    (void)s;
+    sw->inflight[req->session]--;
+    sw->free[sw->nfree++] = req;
+    sweep_report(sw, req->peer, req->op, req->session, r->status, r->response);
+}
+/*******************************************************************************
+ * @fn static int sweep_take(struct sweep *sw, int *peer, int *op)
+ * @brief Next request of the sweep
+ * @return ASTMAN_FAILURE when everything was sent
+ ******************************************************************************/
+static int sweep_take(struct sweep *sw, int *peer, int *op) {
+    while (sw->next < sw->npeers * 2) {
+        *peer = sw->next / 2;
+        *op = sw->next % 2 ? ASTMAN_SWEEP_SHOW : ASTMAN_SWEEP_QUALIFY;
+        sw->next++;
+        if (sw->ops & *op)
+            return ASTMAN_SUCCESS;
+    }
+    return ASTMAN_FAILURE;
+}
+/*******************************************************************************
+ * @fn static void sweep_fill(struct sweep *sw, int i)
+ * @brief Send requests on session i up to its window
+ ******************************************************************************/
+static void sweep_fill(struct sweep *sw, int i) {
+    struct sweep_request *req;
+    char params[MAX_LEN];
+    int peer, op;
+
+    while (!sw->lost[i] && sw->inflight[i] < sw->window && sw->nfree &&
+           sweep_take(sw, &peer, &op) == ASTMAN_SUCCESS) {
+        req = sw->free[--sw->nfree];
+        req->peer = peer;
+        req->op = op;
+        req->session = i;
+        params[0] = '\0';
+        astman_add_param(params, sizeof(params), "Peer", sw->peers[peer]);
+        sw->inflight[i]++;
+        if (astman_action_async(sw->sessions[i],
+                                op == ASTMAN_SWEEP_QUALIFY ? "SIPqualifypeer" : "SIPshowpeer",
+                                params, NULL, 0, sw->timeout_ms, sweep_done,
+                                req) != ASTMAN_SUCCESS) {
+            /* the request goes back for another session */
+            sw->inflight[i]--;
+            sw->free[sw->nfree++] = req;
+            sw->next = peer * 2 + (op == ASTMAN_SWEEP_SHOW);
+            /* out of memory or a full table is retried next round */
+            if (sw->sessions[i]->fd <= 0)
+                sw->lost[i] = 1;
+            break;
+        }
+    }
+}
+/*******************************************************************************
+ * @fn int astman_sip_sweep(struct mansession **sessions, int nsessions,
+ *                          char **peers, int npeers, int ops, int window,
+ *                          int timeout_ms, ASTMAN_SWEEP_CALLBACK callback,
+ *                          void *data)
+ ******************************************************************************/
+int astman_sip_sweep(struct mansession **sessions, int nsessions, char **peers,
+                     int npeers, int ops, int window, int timeout_ms,
+                     ASTMAN_SWEEP_CALLBACK callback, void *data) {
+    struct sweep sw;
+    struct sweep_request *reqs = NULL;
+    struct pollfd *pfd = NULL;
+    int *map = NULL;
+    int i, n, t, wait, live, pending, peer, op, ret = -1;
+
+    if (!sessions || nsessions <= 0 || npeers < 0 ||
+        !(ops & (ASTMAN_SWEEP_QUALIFY | ASTMAN_SWEEP_SHOW)))
+        return -1;
+    memset(&sw, 0, sizeof(sw));
+    sw.sessions = sessions;
+    sw.nsessions = nsessions;
+    sw.peers = peers;
+    sw.npeers = npeers;
+    sw.ops = ops;
+    sw.window = window > 0 ? window : ASTMAN_SWEEP_WINDOW;
+    sw.timeout_ms = timeout_ms;
+    sw.callback = callback;
+    sw.data = data;
+    sw.inflight = calloc(nsessions, sizeof(int));
+    sw.lost = calloc(nsessions, sizeof(int));
+    sw.free = calloc(nsessions * sw.window, sizeof(*sw.free));
+    reqs = calloc(nsessions * sw.window, sizeof(*reqs));
+    pfd = calloc(nsessions, sizeof(*pfd));
+    map = calloc(nsessions, sizeof(int));
+    if (!sw.inflight || !sw.lost || !sw.free || !reqs || !pfd || !map)
+        goto Exit;
+    for (i = 0; i < nsessions * sw.window; i++) {
+        reqs[i].sw = &sw;
+        sw.free[sw.nfree++] = &reqs[i];
+    }
+    for (i = 0; i < nsessions; i++)
+        sw.lost[i] = sessions[i]->fd <= 0;
+
+    for (;;) {
+        live = pending = 0;
+        for (i = 0; i < nsessions; i++) {
+            sweep_fill(&sw, i);
+            if (!sw.lost[i])
+                live++;
+            pending += sw.inflight[i];
+        }
+        if (!pending)
+            break;
+        /* Every session with requests in flight, up to the earliest deadline */
+        wait = -1;
+        for (i = 0, n = 0; i < nsessions; i++) {
+            if (sw.lost[i] || !sw.inflight[i])
+                continue;
+            t = astman_async_timeout(sessions[i]);
+            if (t >= 0 && (wait < 0 || t < wait))
+                wait = t;
+            pfd[n].fd = sessions[i]->fd;
+            pfd[n].events = POLLIN;
+            pfd[n].revents = 0;
+            map[n++] = i;
+        }
+        if (poll(pfd, n, wait) < 0 && errno != EINTR)
+            break;
+        for (i = 0; i < n; i++) {
+            if (!pfd[i].revents && astman_async_timeout(sessions[map[i]]) != 0)
+                continue;
+            if (astman_poll(sessions[map[i]], 0) < 0) {
+                /* its requests were reported aborted */
+                astlog(ASTLOG_WARNING, "SIP sweep: session %d lost", map[i]);
+                sw.lost[map[i]] = 1;
+            }
+        }
+    }
+    /* No session left for these */
+    while (sweep_take(&sw, &peer, &op) == ASTMAN_SUCCESS)
+        sweep_report(&sw, peer, op, -1, ASTMAN_ACTION_ABORTED, NULL);
+    ret = sw.succeeded;
+Exit:
+    free(sw.inflight);
+    free(sw.lost);
+    free(sw.free);
+    free(reqs);
+    free(pfd);
+    free(map);
+    return ret;
+}
@@ -0,0 +1,224 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astsync.c
+ *  @brief Snapshot plus delta synchronization
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "astman.h"
+#include "astlog.h"
+#include "astasync.h"
+#include "astnames.h"
+#include "aststate.h"
+#include "astsync.h"
+#include "astmem.h"
+/*******************************************************************************
+ * @struct  sync_held
+ * @brief   A live event waiting for the replay
+ ******************************************************************************/
+struct sync_held {
+    char uniqueid[80];      /**!< "" if none */
+    unsigned int seq;       /**!< arrival order */
+    void *m;                /**!< astman_message_pack(), NULL when spilled */
+    long offset;            /**!< in the spill file */
+    size_t len;             /**!< bytes of the packed message */
+};
+/*******************************************************************************
+ * @struct  astman_sync
+ ******************************************************************************/
+struct astman_sync {
+    struct mansession *s;
+    struct sync_held *held;
+    unsigned int count;
+    unsigned int size;
+    ASTMAN_SYNC_CALLBACK callback;
+    void *data;
+    int status;             /**!< of the list action, 1 while running */
+    int done;
+    FILE *spill;            /**!< held events over the memory budget */
+    size_t charged;         /**!< bytes accounted to ASTMAN_MEM_LISTS */
+};
+/*******************************************************************************
+ * @fn int astman_sync_hold(struct astman_sync *sync, struct message *m)
+ ******************************************************************************/
+int astman_sync_hold(struct astman_sync *sync, struct message *m) {
+    struct sync_held *held;
+    void *copy = NULL, *spill;
+    size_t len;
+    long offset = 0;
+    unsigned int size;
+    int res;
+
+    if (sync->count == sync->size) {
+        size = sync->size ? sync->size * 2 : 64;
+        len = (size - sync->size) * sizeof(*held);
+        /* Spilling still needs the index, it grows past the budget */
+        res = astman_mem_charge(sync->s, ASTMAN_MEM_LISTS, len);
+        if (res != ASTMAN_MEM_OK && res != ASTMAN_MEM_SPILL)
+            return ASTMAN_FAILURE;
+        held = realloc(sync->held, size * sizeof(*held));
+        if (!held) {
+            if (res == ASTMAN_MEM_OK)
+                astman_mem_release(sync->s, ASTMAN_MEM_LISTS, len);
+            return ASTMAN_FAILURE;
+        }
+        if (res == ASTMAN_MEM_OK)
+            sync->charged += len;
+        sync->held = held;
+        sync->size = size;
+    }
+    /* only the used headers, a message is 40 KB */
+    len = astman_message_packed_size(m);
+    res = astman_mem_charge(sync->s, ASTMAN_MEM_LISTS, len);
+    if (res == ASTMAN_MEM_OK) {
+        copy = malloc(len);
+        if (!copy) {
+            astman_mem_release(sync->s, ASTMAN_MEM_LISTS, len);
+            return ASTMAN_FAILURE;
+        }
+        astman_message_pack(copy, m);
+        sync->charged += len;
+    } else if (res == ASTMAN_MEM_SPILL) {
+        if (!sync->spill && !(sync->spill = tmpfile()))
+            return ASTMAN_FAILURE;
+        if (!(spill = malloc(len)))
+            return ASTMAN_FAILURE;
+        astman_message_pack(spill, m);
+        res = fseek(sync->spill, 0, SEEK_END) < 0 || (offset = ftell(sync->spill)) < 0 ||
+              fwrite(spill, len, 1, sync->spill) != 1;
+        free(spill);
+        if (res)
+            return ASTMAN_FAILURE;
+    } else {
+        /* rejected or shed: dispatched now, out of order */
+        return ASTMAN_FAILURE;
+    }
+    held = &sync->held[sync->count];
+    held->m = copy;
+    held->offset = offset;
+    held->len = len;
+    held->seq = sync->count++;
+    strncpy(held->uniqueid, astman_get_header_id(m, ASTMAN_HDR_UNIQUEID),
+            sizeof(held->uniqueid) - 1);
+    held->uniqueid[sizeof(held->uniqueid) - 1] = '\0';
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn static int sync_compare(const void *a, const void *b)
+ * @brief By Uniqueid, then by arrival
+ ******************************************************************************/
+static int sync_compare(const void *a, const void *b) {
+    const struct sync_held *x = a, *y = b;
+    int res = strcmp(x->uniqueid, y->uniqueid);
+
+    if (res)
+        return res;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+/*******************************************************************************
+ * @fn static void sync_entry(struct mansession *s,
+ *                            struct astman_action_result *r, void *data)
+ ******************************************************************************/
+static void sync_entry(struct mansession *s, struct astman_action_result *r,
+                       void *data) {
+    struct astman_sync *sync = data;
+
+    if (r->complete) {
+        sync->status = r->status;
+        sync->done = 1;
+        return;
+    }
+    if (sync->callback)
+        sync->callback(s, r->events, sync->data);
+    if (s->state)
+        astman_state_update(s->state, r->events);
+}
+/*******************************************************************************
+ * @fn int astman_sync(struct mansession *s, char *action, char *params,
+ *                     int timeout_ms, ASTMAN_SYNC_CALLBACK callback,
+ *                     void *data)
+ ******************************************************************************/
+int astman_sync(struct mansession *s, char *action, char *params,
+                int timeout_ms, ASTMAN_SYNC_CALLBACK callback, void *data) {
+    struct astman_sync sync;
+    struct message *m = NULL;
+    void *spilled = NULL, *packed;
+    unsigned int x;
+
+    if (!s || s->sync || astman_strlen_zero(action))
+        return ASTMAN_FAILURE;
+    memset(&sync, 0, sizeof(sync));
+    sync.s = s;
+    sync.callback = callback;
+    sync.data = data;
+    sync.status = ASTMAN_FAILURE;
+
+    /* Hold from before the action is sent: whatever the dump does not
+       show yet is in the deltas */
+    s->sync = &sync;
+    if (astman_action_async(s, action, params, NULL,
+                            ASTMAN_ACTION_LIST | ASTMAN_ACTION_STREAM,
+                            timeout_ms, sync_entry, &sync) == ASTMAN_SUCCESS) {
+        while (!sync.done)
+            if (astman_poll(s, -1) < 0)
+                break;
+    }
+    s->sync = NULL;
+
+    /* Deltas, one channel after the other */
+    qsort(sync.held, sync.count, sizeof(*sync.held), sync_compare);
+    /* a packed message is never larger than a full one */
+    if (sync.count)
+        m = malloc(sizeof(struct message));
+    if (sync.spill)
+        spilled = malloc(sizeof(struct message));
+    for (x = 0; x < sync.count; x++) {
+        packed = sync.held[x].m;
+        if (!packed) {
+            /* spilled */
+            if (!spilled || fseek(sync.spill, sync.held[x].offset, SEEK_SET) < 0 ||
+                fread(spilled, sync.held[x].len, 1, sync.spill) != 1) {
+                astlog(ASTLOG_ERROR, "Spilled event lost");
+                continue;
+            }
+            packed = spilled;
+        }
+        if (!m) {
+            astlog(ASTLOG_ERROR, "Held event lost");
+            free(sync.held[x].m);
+            continue;
+        }
+        astman_message_unpack(m, packed);
+        if (astman_dispatch_event(s, m) < 0)
+            astlog(ASTLOG_WARNING, "Replayed event %s: handler error",
+                   astman_get_header_id(m, ASTMAN_HDR_EVENT));
+        free(sync.held[x].m);
+    }
+    free(m);
+    free(spilled);
+    if (sync.spill)
+        fclose(sync.spill);
+    astman_mem_release(s, ASTMAN_MEM_LISTS, sync.charged);
+    free(sync.held);
+    return sync.status == ASTMAN_SUCCESS ? ASTMAN_SUCCESS : ASTMAN_FAILURE;
+}
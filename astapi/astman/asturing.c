@@ -0,0 +1,419 @@
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file asturing.c
+ *  @brief io_uring transport
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <linux/io_uring.h>
+#include "astman.h"
+#include "astlog.h"
+#include "asturing.h"
+
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+/*******************************************************************************
+ *  \def URING_BGID
+ *  \brief  Buffer group of the receive buffers
+ ******************************************************************************/
+#define URING_BGID  0
+/*******************************************************************************
+ * @struct  astman_uring
+ ******************************************************************************/
+struct astman_uring {
+    int fd;
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr;
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int sq_entries;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *br;   /**!< provided buffer ring */
+    size_t br_len;
+    char *bufs;                     /**!< nbufs * bufsize */
+    unsigned int nbufs;
+    unsigned int bufsize;
+    unsigned short br_tail;
+    int multishot;
+};
+/*******************************************************************************
+ * @fn static int uring_enter(struct astman_uring *u, unsigned int submit,
+ *                            unsigned int wait, unsigned int flags,
+ *                            void *arg, size_t argsz)
+ ******************************************************************************/
+static int uring_enter(struct astman_uring *u, unsigned int submit,
+                       unsigned int wait, unsigned int flags, void *arg,
+                       size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, u->fd, submit, wait, flags, arg, argsz);
+}
+/*******************************************************************************
+ * @fn static unsigned int uring_unsubmitted(struct astman_uring *u)
+ ******************************************************************************/
+static unsigned int uring_unsubmitted(struct astman_uring *u) {
+    return *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+/*******************************************************************************
+ * @fn static struct io_uring_sqe *uring_sqe(struct astman_uring *u)
+ * @brief Next free submission entry, submitting when the queue is full
+ ******************************************************************************/
+static struct io_uring_sqe *uring_sqe(struct astman_uring *u) {
+    struct io_uring_sqe *sqe;
+    unsigned int tail = *u->sq_tail, idx;
+
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+        if (uring_enter(u, uring_unsubmitted(u), 0, 0, NULL, 0) < 0)
+            return NULL;
+        if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+            return NULL;
+    }
+    idx = tail & *u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+/*******************************************************************************
+ * @fn static void uring_buf_add(struct astman_uring *u, int bid)
+ ******************************************************************************/
+static void uring_buf_add(struct astman_uring *u, int bid) {
+    struct io_uring_buf *b = &u->br->bufs[u->br_tail & (u->nbufs - 1)];
+    b->addr = (unsigned long long)(unsigned long)(u->bufs + (size_t)bid * u->bufsize);
+    b->len = u->bufsize;
+    b->bid = bid;
+    u->br_tail++;
+}
+/*******************************************************************************
+ * @fn struct astman_uring *astman_uring_new(unsigned int entries,
+ *                                           unsigned int nbufs,
+ *                                           unsigned int bufsize)
+ ******************************************************************************/
+struct astman_uring *astman_uring_new(unsigned int entries, unsigned int nbufs,
+                                      unsigned int bufsize) {
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    struct astman_uring *u;
+    unsigned int x;
+
+    if (!nbufs || (nbufs & (nbufs - 1)) || nbufs > 32768 || !bufsize)
+        return NULL;
+    u = calloc(1, sizeof(*u));
+    if (!u)
+        return NULL;
+    u->fd = -1;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    u->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0 && errno == EINVAL) {
+        /* older kernel: plain ring */
+        memset(&p, 0, sizeof(p));
+        u->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    }
+    if (u->fd < 0) {
+        astlog(ASTLOG_INFO, "io_uring unavailable: %s", strerror(errno));
+        goto Error;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        astlog(ASTLOG_INFO, "io_uring too old (features 0x%x)", p.features);
+        goto Error;
+    }
+
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (u->cq_len > u->sq_len)
+        u->sq_len = u->cq_len;
+    u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) {
+        u->sq_ptr = NULL;
+        goto Error;
+    }
+    u->cq_ptr = u->sq_ptr;
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        goto Error;
+    }
+    u->sq_head = (unsigned int *)((char *)u->sq_ptr + p.sq_off.head);
+    u->sq_tail = (unsigned int *)((char *)u->sq_ptr + p.sq_off.tail);
+    u->sq_mask = (unsigned int *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+    u->sq_array = (unsigned int *)((char *)u->sq_ptr + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->cq_head = (unsigned int *)((char *)u->cq_ptr + p.cq_off.head);
+    u->cq_tail = (unsigned int *)((char *)u->cq_ptr + p.cq_off.tail);
+    u->cq_mask = (unsigned int *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+
+    /* Provided buffer ring: the kernel picks a buffer per receive */
+    u->nbufs = nbufs;
+    u->bufsize = bufsize;
+    u->br_len = nbufs * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (u->br == MAP_FAILED) {
+        u->br = NULL;
+        goto Error;
+    }
+    u->bufs = malloc((size_t)nbufs * bufsize);
+    if (!u->bufs)
+        goto Error;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(unsigned long)u->br;
+    reg.ring_entries = nbufs;
+    reg.bgid = URING_BGID;
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        astlog(ASTLOG_INFO, "io_uring provided buffer rings unavailable: %s", strerror(errno));
+        goto Error;
+    }
+    for (x = 0; x < nbufs; x++)
+        uring_buf_add(u, x);
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+    u->multishot = 1;
+    return u;
+
+Error:
+    astman_uring_free(u);
+    return NULL;
+}
+/*******************************************************************************
+ * @fn void astman_uring_free(struct astman_uring *u)
+ ******************************************************************************/
+void astman_uring_free(struct astman_uring *u) {
+    if (!u)
+        return;
+    if (u->sqes)
+        munmap(u->sqes, u->sqes_len);
+    if (u->sq_ptr)
+        munmap(u->sq_ptr, u->sq_len);
+    if (u->fd >= 0)
+        close(u->fd);
+    /* after the ring: the kernel no longer references the buffers */
+    if (u->br)
+        munmap(u->br, u->br_len);
+    free(u->bufs);
+    free(u);
+}
+/*******************************************************************************
+ * @fn int astman_uring_recv(struct astman_uring *u, int fd,
+ *                           unsigned long long user_data)
+ ******************************************************************************/
+int astman_uring_recv(struct astman_uring *u, int fd,
+                      unsigned long long user_data) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    if (!sqe)
+        return ASTMAN_FAILURE;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    if (u->multishot)
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = user_data;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_uring_send(struct astman_uring *u, int fd, const void *buf,
+ *                           unsigned int len, unsigned long long user_data)
+ ******************************************************************************/
+int astman_uring_send(struct astman_uring *u, int fd, const void *buf,
+                      unsigned int len, unsigned long long user_data) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    if (!sqe)
+        return ASTMAN_FAILURE;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(unsigned long)buf;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_uring_connect(struct astman_uring *u, int fd,
+ *                              const struct sockaddr *addr, socklen_t len,
+ *                              unsigned long long user_data)
+ ******************************************************************************/
+int astman_uring_connect(struct astman_uring *u, int fd,
+                         const struct sockaddr *addr, socklen_t len,
+                         unsigned long long user_data) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    if (!sqe)
+        return ASTMAN_FAILURE;
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(unsigned long)addr;
+    sqe->off = len;
+    sqe->user_data = user_data;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_uring_poll(struct astman_uring *u, int fd, unsigned int events,
+ *                           unsigned long long user_data)
+ ******************************************************************************/
+int astman_uring_poll(struct astman_uring *u, int fd, unsigned int events,
+                      unsigned long long user_data) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    if (!sqe)
+        return ASTMAN_FAILURE;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = user_data;
+    return ASTMAN_SUCCESS;
+}
+/*******************************************************************************
+ * @fn int astman_uring_wait(struct astman_uring *u, int timeout_ms,
+ *                           struct astman_uring_cqe *cqes, int max)
+ ******************************************************************************/
+int astman_uring_wait(struct astman_uring *u, int timeout_ms,
+                      struct astman_uring_cqe *cqes, int max) {
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    struct io_uring_cqe *cqe;
+    unsigned int head, tail;
+    int n = 0, res;
+
+    head = *u->cq_head;
+    tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail && timeout_ms != 0) {
+        /* Submit and sleep in the same system call */
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        if (timeout_ms > 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000LL;
+            arg.ts = (unsigned long long)(unsigned long)&ts;
+        }
+        res = uring_enter(u, uring_unsubmitted(u), 1,
+                          IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                          &arg, sizeof(arg));
+        if (res < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            astlog(ASTLOG_ERROR, "io_uring_enter: %s", strerror(errno));
+            return -1;
+        }
+    } else if (uring_unsubmitted(u)) {
+        if (uring_enter(u, uring_unsubmitted(u), 0, 0, NULL, 0) < 0 && errno != EBUSY) {
+            astlog(ASTLOG_ERROR, "io_uring_enter: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && n < max) {
+        cqe = &u->cqes[head & *u->cq_mask];
+        cqes[n].user_data = cqe->user_data;
+        cqes[n].res = cqe->res;
+        cqes[n].more = !!(cqe->flags & IORING_CQE_F_MORE);
+        cqes[n].buf = NULL;
+        cqes[n].bid = -1;
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            cqes[n].bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            cqes[n].buf = u->bufs + (size_t)cqes[n].bid * u->bufsize;
+        }
+        if (cqe->res == -EINVAL && u->multishot && !cqes[n].more) {
+            /* receive rejected the multishot flag: single shots from now */
+            astlog(ASTLOG_INFO, "io_uring: multishot receive unsupported");
+            u->multishot = 0;
+        }
+        head++;
+        n++;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+/*******************************************************************************
+ * @fn void astman_uring_recycle(struct astman_uring *u, int bid)
+ ******************************************************************************/
+void astman_uring_recycle(struct astman_uring *u, int bid) {
+    if (bid < 0 || (unsigned int)bid >= u->nbufs)
+        return;
+    uring_buf_add(u, bid);
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+/*******************************************************************************
+ * @fn int astman_uring_multishot(struct astman_uring *u)
+ ******************************************************************************/
+int astman_uring_multishot(struct astman_uring *u) {
+    return u->multishot;
+}
+#else
+/* Kernel headers without multishot receive: always fall back */
+struct astman_uring *astman_uring_new(unsigned int entries __attribute__((unused)),
+                                      unsigned int nbufs __attribute__((unused)),
+                                      unsigned int bufsize __attribute__((unused))) {
+    return NULL;
+}
+void astman_uring_free(struct astman_uring *u __attribute__((unused))) {
+}
+int astman_uring_recv(struct astman_uring *u __attribute__((unused)),
+                      int fd __attribute__((unused)),
+                      unsigned long long user_data __attribute__((unused))) {
+    return ASTMAN_FAILURE;
+}
+int astman_uring_send(struct astman_uring *u __attribute__((unused)),
+                      int fd __attribute__((unused)),
+                      const void *buf __attribute__((unused)),
+                      unsigned int len __attribute__((unused)),
+                      unsigned long long user_data __attribute__((unused))) {
+    return ASTMAN_FAILURE;
+}
+int astman_uring_connect(struct astman_uring *u __attribute__((unused)),
+                         int fd __attribute__((unused)),
+                         const struct sockaddr *addr __attribute__((unused)),
+                         socklen_t len __attribute__((unused)),
+                         unsigned long long user_data __attribute__((unused))) {
+    return ASTMAN_FAILURE;
+}
+int astman_uring_poll(struct astman_uring *u __attribute__((unused)),
+                      int fd __attribute__((unused)),
+                      unsigned int events __attribute__((unused)),
+                      unsigned long long user_data __attribute__((unused))) {
+    return ASTMAN_FAILURE;
+}
+int astman_uring_wait(struct astman_uring *u __attribute__((unused)),
+                      int timeout_ms __attribute__((unused)),
+                      struct astman_uring_cqe *cqes __attribute__((unused)),
+                      int max __attribute__((unused))) {
+    return -1;
+}
+void astman_uring_recycle(struct astman_uring *u __attribute__((unused)),
+                          int bid __attribute__((unused))) {
+}
+int astman_uring_multishot(struct astman_uring *u __attribute__((unused))) {
+    return 0;
+}
+#endif
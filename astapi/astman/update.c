@@ -30,14 +30,94 @@
 #include "astevent.h"
 #include "astlog.h"
 #include "action.h"
+#include "astconfig.h"
+#include "astcache.h"
 
-#define NB_PARAMS_IN_ACTION 6
-#define MAX_ACTIONS         20
-#define MAX_PARAMS_LEN          (((MAX_ACTIONS)*(MAX_LEN)))
-#define MAX_PARAM_NAME_LEN  14
+/* "Value-" and any int */
+#define MAX_PARAM_NAME_LEN  24
+#define MAX_ACTIONID_LEN    48
 
-static int _nb_action = -1;
-static char params[MAX_PARAMS_LEN];
+/**
+ * One edit of the transaction
+ */
+struct update_action {
+    char *action;
+    char *cat;
+    char *var;
+    char *val;
+    char *match;
+    char *line;
+};
+/**
+ * UpdateConfig transaction
+ */
+struct astman_update {
+    char *src_filename;
+    char *dst_filename;
+    int reload;
+    struct update_action *actions;
+    int nb_action;
+    int len_action;
+};
+/**
+ * Growable params buffer of one UpdateConfig request
+ */
+struct update_buf {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+static unsigned int _transaction = 0;
+static struct astman_update *_legacy = NULL;
+/**
+ * Append "header: value\r\n" to the buffer, empty values are skipped as in
+ * astman_add_param()
+ *
+ * @param b
+ * @param header
+ * @param value
+ * @return
+ */
+static int update_buf_add(struct update_buf *b, const char *header, const char *value)
+{
+    size_t need;
+    char *data;
+    if (astman_strlen_zero(value))
+        return ASTMAN_SUCCESS;
+    need = b->len + strlen(header) + strlen(value) + 5;
+    if (need > b->size) {
+        data = realloc(b->data, need * 2);
+        if (!data)
+            return ASTMAN_FAILURE;
+        b->data = data;
+        b->size = need * 2;
+    }
+    b->len += sprintf(b->data + b->len, "%s: %s\r\n", header, value);
+    return ASTMAN_SUCCESS;
+}
+/**
+ *
+ * @param a
+ */
+static void update_action_free(struct update_action *a)
+{
+    free(a->action);
+    free(a->cat);
+    free(a->var);
+    free(a->val);
+    free(a->match);
+    free(a->line);
+}
+/**
+ *
+ * @param str
+ * @return
+ */
+static char *update_strdup(const char *str)
+{
+    return astman_strlen_zero(str) ? NULL : strdup(str);
+}
 /**
  *
  * @param src_filename
@@ -45,17 +125,21 @@ static char params[MAX_PARAMS_LEN];
  * @param reload
  * @return
  */
-int astman_update_config_init(char *src_filename,
-                              char *dst_filename,
-                              int reload)
+struct astman_update *astman_update_new(char *src_filename,
+                                        char *dst_filename,
+                                        int reload)
 {
-    astman_add_param(params, sizeof(params), "SrcFilename", src_filename);
-    astman_add_param(params, sizeof(params), "DstFilename", dst_filename);
-    astman_add_param(params, sizeof(params), "Reload", reload?"yes":"no");
-    return ASTMAN_SUCCESS;
+    struct astman_update *u = calloc(1, sizeof(*u));
+    if (!u)
+        return NULL;
+    u->src_filename = update_strdup(src_filename);
+    u->dst_filename = update_strdup(dst_filename);
+    u->reload = reload;
+    return u;
 }
 /**
  *
+ * @param u
  * @param action
  * @param cat
  * @param var
@@ -64,43 +148,318 @@ int astman_update_config_init(char *src_filename,
  * @param line
  * @return
  */
-int astman_update_config_add_action(char *action,
-                                    char *cat,
-                                    char *var, char *val,
-                                    char *match,
-                                    char *line)
+int astman_update_add_action(struct astman_update *u,
+                             char *action,
+                             char *cat,
+                             char *var, char *val,
+                             char *match,
+                             char *line)
 {
-    char a_tmp[MAX_PARAM_NAME_LEN];
-    if(astman_strlen_zero(action) ||
+    struct update_action *a;
+    if(!u ||
+        astman_strlen_zero(action) ||
         astman_strlen_zero(cat)) {
             return ASTMAN_FAILURE;
     }
 
-    _nb_action++;
+    if (u->nb_action >= u->len_action) {
+        a = realloc(u->actions, (u->len_action * 2 + 16) * sizeof(*a));
+        if (!a)
+            return ASTMAN_FAILURE;
+        u->actions = a;
+        u->len_action = u->len_action * 2 + 16;
+    }
+    a = &u->actions[u->nb_action];
+    a->action = strdup(action);
+    a->cat = strdup(cat);
+    a->var = update_strdup(var);
+    a->val = update_strdup(val);
+    a->match = update_strdup(match);
+    a->line = update_strdup(line);
+    if (!a->action || !a->cat) {
+        update_action_free(a);
+        return ASTMAN_FAILURE;
+    }
+    u->nb_action++;
+    return ASTMAN_SUCCESS;
+}
+/**
+ *
+ * @param u
+ * @return
+ */
+int astman_update_count(struct astman_update *u)
+{
+    return u ? u->nb_action : 0;
+}
+/**
+ * Drop the edits, keep the filenames
+ *
+ * @param u
+ */
+static void update_reset(struct astman_update *u)
+{
+    int x;
+    for (x = 0; x < u->nb_action; x++)
+        update_action_free(&u->actions[x]);
+    u->nb_action = 0;
+}
+/**
+ *
+ * @param u
+ */
+void astman_update_free(struct astman_update *u)
+{
+    if (!u)
+        return;
+    update_reset(u);
+    free(u->actions);
+    free(u->src_filename);
+    free(u->dst_filename);
+    free(u);
+}
+/**
+ * Encode the request number req: edits [first, first + count[ numbered
+ * from 0 as Asterisk expects in each request.
+ *
+ * @param u
+ * @param b
+ * @param actionid
+ * @param req
+ * @param first
+ * @param count
+ * @param last
+ * @return
+ */
+static int update_encode(struct astman_update *u, struct update_buf *b,
+                         const char *actionid, int req, int first, int count,
+                         int last)
+{
+    char a_tmp[MAX_PARAM_NAME_LEN];
+    struct update_action *a;
+    int x, rv = ASTMAN_SUCCESS;
+
+    b->len = 0;
+    if (b->data)
+        b->data[0] = '\0';
+    rv &= update_buf_add(b, "ActionID", actionid);
+    /* Next requests continue from what the previous one wrote */
+    rv &= update_buf_add(b, "SrcFilename", req ? u->dst_filename : u->src_filename);
+    rv &= update_buf_add(b, "DstFilename", u->dst_filename);
+    rv &= update_buf_add(b, "Reload", (last && u->reload) ? "yes" : "no");
+
+    for (x = 0; x < count; x++) {
+        a = &u->actions[first + x];
 
-    snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Action-%06d", _nb_action);
-    astman_add_param(params, sizeof(params), a_tmp, action);
+        snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Action-%06d", x);
+        rv &= update_buf_add(b, a_tmp, a->action);
 
-    snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Cat-%06d", _nb_action);
-    astman_add_param(params, sizeof(params), a_tmp, cat);
+        snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Cat-%06d", x);
+        rv &= update_buf_add(b, a_tmp, a->cat);
 
-    snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Var-%06d", _nb_action);
-    astman_add_param(params, sizeof(params), a_tmp, var);
+        snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Var-%06d", x);
+        rv &= update_buf_add(b, a_tmp, a->var);
 
-    snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Value-%06d", _nb_action);
-    astman_add_param(params, sizeof(params), a_tmp, val);
+        snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Value-%06d", x);
+        rv &= update_buf_add(b, a_tmp, a->val);
 
-    if(!astman_strlen_zero(match)) {
-        snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Match-%06d", _nb_action);
-        astman_add_param(params, sizeof(params), a_tmp, match);
+        snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Match-%06d", x);
+        rv &= update_buf_add(b, a_tmp, a->match);
+
+        snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Line-%06d", x);
+        rv &= update_buf_add(b, a_tmp, a->line);
     }
+    return rv;
+}
+/**
+ * Map a response ActionID back to the request number
+ *
+ * @param prefix
+ * @param actionid
+ * @return request number or -1 if the response is not ours
+ */
+static int update_request_of(const char *prefix, const char *actionid)
+{
+    size_t len = strlen(prefix);
+    char *end;
+    long req;
+    if (strncmp(actionid, prefix, len))
+        return -1;
+    req = strtol(actionid + len, &end, 10);
+    if (end == actionid + len || *end)
+        return -1;
+    return (int)req;
+}
+/**
+ * Send one UpdateConfig request of the transaction
+ *
+ * @param s
+ * @param u
+ * @param b
+ * @param prefix
+ * @param req
+ * @param nreq
+ * @return ASTMAN_SUCCESS or ASTMAN_FAILURE
+ */
+static int update_send(struct mansession *s, struct astman_update *u,
+                       struct update_buf *b, const char *prefix,
+                       int req, int nreq)
+{
+    char actionid[MAX_ACTIONID_LEN];    /* prefix and request number */
+    int per_req = ASTMAN_UPDATE_ACTIONS_PER_REQUEST;
+    int first = req * per_req;
+    int count = (u->nb_action - first < per_req) ? u->nb_action - first : per_req;
+
+    snprintf(actionid, sizeof(actionid), "%s%d", prefix, req);
+    if (update_encode(u, b, actionid, req, first, count, req == nreq - 1) != ASTMAN_SUCCESS ||
+        astman_manager_action_params(s, "UpdateConfig", b->data) < 0) {
+        astlog(ASTLOG_ERROR, "UpdateConfig request %d/%d not sent", req + 1, nreq);
+        return ASTMAN_FAILURE;
+    }
+    return ASTMAN_SUCCESS;
+}
+/**
+ * Read the responses of the requests sent so far
+ *
+ * @param s
+ * @param m receives the last response
+ * @param prefix
+ * @param sent requests sent
+ * @param answered responses read so far, updated
+ * @param result
+ * @return ASTMAN_SUCCESS if every response was read
+ */
+static int update_wait(struct mansession *s, struct message *m,
+                       const char *prefix, int sent, int *answered,
+                       struct astman_update_result *result)
+{
+    int per_req = ASTMAN_UPDATE_ACTIONS_PER_REQUEST;
+    int req, res;
 
-    if(!astman_strlen_zero(line)) {
-        snprintf(a_tmp, MAX_PARAM_NAME_LEN, "Line-%06d", _nb_action);
-        astman_add_param(params, sizeof(params), a_tmp, line);
+    while (*answered < sent) {
+        m->hdrcount = 0;
+        res = astman_wait_for_response(s, m, ASTMAN_UPDATE_TIMEOUT);
+        /* connection lost, or timed out (nothing received) */
+        if (res < 0 || (res == 0 && !m->hdrcount)) {
+            astlog(ASTLOG_ERROR, "UpdateConfig: %d of %d responses missing",
+                   sent - *answered, sent);
+            return ASTMAN_FAILURE;
+        }
+        req = update_request_of(prefix, astman_get_header(m, "ActionID"));
+        if (req < 0 || req >= sent)
+            continue;
+        (*answered)++;
+        if (res > 0 && response_is(m, "Success")) {
+            result->succeeded++;
+        } else if (!result->failed++) {
+            /* in order: the first failure is the lowest request */
+            result->first_failed_action = req * per_req;
+            strncpy(result->message, astman_get_header(m, "Message"), sizeof(result->message) - 1);
+        }
     }
     return ASTMAN_SUCCESS;
 }
+/**
+ *
+ * @param s
+ * @param u
+ * @param result
+ * @param m receives the last response
+ * @return
+ */
+static int update_execute(struct mansession *s, struct astman_update *u,
+                          struct astman_update_result *result,
+                          struct message *m)
+{
+    struct update_buf b = { NULL, 0, 0 };
+    char prefix[32];                    /* "astapi-update-<uint>-" */
+    int per_req = ASTMAN_UPDATE_ACTIONS_PER_REQUEST;
+    int nreq, sent = 0, answered = 0;
+
+    memset(result, 0, sizeof(*result));
+    result->first_failed_action = -1;
+    if (!u || !u->nb_action)
+        return ASTMAN_FAILURE;
+
+    nreq = (u->nb_action + per_req - 1) / per_req;
+    snprintf(prefix, sizeof(prefix), "astapi-update-%u-",
+             __atomic_add_fetch(&_transaction, 1, __ATOMIC_RELAXED));
+
+    /* Pipeline every request but the last, Asterisk runs them in order on
+       the session. The last one (with Reload) only goes out once all the
+       others succeeded. */
+    while (sent < nreq - 1 && update_send(s, u, &b, prefix, sent, nreq) == ASTMAN_SUCCESS)
+        sent++;
+    if (update_wait(s, m, prefix, sent, &answered, result) == ASTMAN_SUCCESS &&
+        sent == nreq - 1 && !result->failed &&
+        update_send(s, u, &b, prefix, sent, nreq) == ASTMAN_SUCCESS) {
+        sent++;
+        update_wait(s, m, prefix, sent, &answered, result);
+    }
+    free(b.data);
+    result->requests = sent;
+
+    /* Lost responses (connection closed, timeout), requests not sent after
+       a failure and the skipped Reload are failures */
+    result->failed = nreq - result->succeeded;
+    if (result->failed && result->first_failed_action < 0)
+        result->first_failed_action = result->succeeded * per_req;
+
+    astlog(ASTLOG_INFO, "UpdateConfig %d edits in %d requests: %d succeeded, %d failed",
+           u->nb_action, nreq, result->succeeded, result->failed);
+    /* The cached copy of the destination file is stale now */
+    astman_config_invalidate(s, u->dst_filename);
+    astman_cache_invalidate(s, "ListCategories");
+    update_reset(u);
+    return result->failed ? ASTMAN_FAILURE : ASTMAN_SUCCESS;
+}
+/**
+ *
+ * @param s
+ * @param u
+ * @param result
+ * @return
+ */
+int astman_update_execute(struct mansession *s, struct astman_update *u,
+                          struct astman_update_result *result)
+{
+    struct message m;
+    struct astman_update_result r;
+    return update_execute(s, u, result ? result : &r, &m);
+}
+/**
+ *
+ * @param src_filename
+ * @param dst_filename
+ * @param reload
+ * @return
+ */
+int astman_update_config_init(char *src_filename,
+                              char *dst_filename,
+                              int reload)
+{
+    astman_update_free(_legacy);
+    _legacy = astman_update_new(src_filename, dst_filename, reload);
+    return _legacy ? ASTMAN_SUCCESS : ASTMAN_FAILURE;
+}
+/**
+ *
+ * @param action
+ * @param cat
+ * @param var
+ * @param val
+ * @param match
+ * @param line
+ * @return
+ */
+int astman_update_config_add_action(char *action,
+                                    char *cat,
+                                    char *var, char *val,
+                                    char *match,
+                                    char *line)
+{
+    return astman_update_add_action(_legacy, action, cat, var, val, match, line);
+}
 /**
  *
  * @param s
@@ -110,21 +469,17 @@ int astman_update_config_add_action(char *action,
 int astman_update_config_execute(struct mansession *s, struct message *m)
 {
     int res = ASTMAN_FAILURE;
+    struct astman_update_result result;
     astlog_init();
-    if(_nb_action == -1) {
+    if(!_legacy || !_legacy->nb_action) {
         res = ASTMAN_FAILURE;
         goto Exit;
     }
 
-    astman_manager_action_params(s, "UpdateConfig", params);
-
-    res = astman_wait_for_response(s, m, 0);
-    if ( res > 0 && response_is(m, "Success")) {
-        res = ASTMAN_SUCCESS;
-    }
+    res = update_execute(s, _legacy, &result, m);
     astlog(ASTLOG_INFO, "UpdateConfig %s", astman_get_header(m, "Response"));
-    _nb_action = -1;
-    memset(params, 0, MAX_PARAMS_LEN);
+    astman_update_free(_legacy);
+    _legacy = NULL;
 Exit:
     astlog_end();
     return res;
@@ -1,6 +1,6 @@
-#ifndef ACTION_H_INCLUDED
-#define ACTION_H_INCLUDED
-
+#ifndef ACTION_H_INCLUDED
+#define ACTION_H_INCLUDED
+
 /*******************************************************************************
  * astapi - library for using Asterisk Manager API.
  * Copyright (C) 2010 Baligh GUESMI
@@ -26,7 +26,8 @@
  *  @date 20100524
  ******************************************************************************/
 #include "astman.h"
-#include "update.h"
+#include "update.h"
+#include "astasync.h"
 /*******************************************************************************
  * @def esponse_is(M, RES)
  * @brief Get response Code
@@ -46,6 +47,16 @@
  ******************************************************************************/
 int astman_get_config(struct mansession *s, struct message *m,
                       char *filename, char * category, char *actionid);
+/*******************************************************************************
+ * @brief Action: Status
+ *        Synopsis: Lists channel status
+ *        Privilege: system,call,reporting,all
+ *        Description: One Status event per channel, followed by StatusComplete.
+ *
+ * @param m: the Status events, terminated by an empty message (to free)
+ ******************************************************************************/
+int astman_status(struct mansession *s, struct message **m,
+                  char *actionid);
 /*******************************************************************************
  * @brief Action: SIPpeers
  *        Synopsis: List SIP peers (text format)
@@ -82,5 +93,31 @@ Variables:
  * @param ActionID: <id>	Action ID for this transaction. Will be returned.
  ******************************************************************************/
 int astman_sip_show_registry(struct mansession *s, struct message **m,
-                     char *actionid);
-#endif // ACTION_H_INCLUDED
+                     char *actionid);
+/*******************************************************************************
+ * @struct  astman_var
+ * @brief   One variable of astman_getvars() / astman_setvars()
+ ******************************************************************************/
+struct astman_var {
+    char *channel;          /**!< NULL or empty for a global variable */
+    char *variable;         /**!< name, or a function like CALLERID(num) */
+    char *value;            /**!< SetVar: value to set */
+    char result[MAX_LEN];   /**!< GetVar: value read */
+    int status;             /**!< ASTMAN_SUCCESS, ASTMAN_FAILURE,
+                                 ASTMAN_ACTION_TIMEOUT or ASTMAN_ACTION_ABORTED */
+};
+/*******************************************************************************
+ * @brief GetVar on count variables in one round trip: the actions are
+ *        written together and their responses matched by ActionID.
+ * @param timeout_ms: for the whole batch, <= 0 for no deadline
+ * @return number of variables read, -1 if nothing could be sent
+ ******************************************************************************/
+int astman_getvars(struct mansession *s, struct astman_var *vars, int count,
+                   int timeout_ms);
+/*******************************************************************************
+ * @brief SetVar on count variables in one round trip, as astman_getvars()
+ * @return number of variables set, -1 if nothing could be sent
+ ******************************************************************************/
+int astman_setvars(struct mansession *s, struct astman_var *vars, int count,
+                   int timeout_ms);
+#endif // ACTION_H_INCLUDED
@@ -0,0 +1,207 @@
+#ifndef ASTASYNC_H_INCLUDED
+#define ASTASYNC_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astasync.h
+ *  @brief Asynchronous actions: any number of actions in flight on one
+ *         session, completed by ActionID from astman_poll(). This is the
+ *         completion layer an event loop (or astcoro.h, the C++20
+ *         front-end) drives instead of parking one thread per blocking
+ *         call.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ *  @def    ASTMAN_ACTION_TIMEOUT
+ *  @brief  astman_action_result status: no answer before the deadline
+ ******************************************************************************/
+#define ASTMAN_ACTION_TIMEOUT   (-2)
+/*******************************************************************************
+ *  @def    ASTMAN_ACTION_ABORTED
+ *  @brief  astman_action_result status: connection lost or session closed
+ ******************************************************************************/
+#define ASTMAN_ACTION_ABORTED   (-1)
+/*******************************************************************************
+ *  @def    ASTMAN_ACTION_LIST
+ *  @brief  Flag: the response is followed by events carrying the same
+ *          ActionID, ended by a "...Complete" event. Detected anyway when
+ *          the response holds "EventList: start".
+ ******************************************************************************/
+#define ASTMAN_ACTION_LIST      0x01
+/*******************************************************************************
+ *  @def    ASTMAN_ACTION_STREAM
+ *  @brief  Flag: hand each list event to the callback as it arrives instead
+ *          of collecting them
+ ******************************************************************************/
+#define ASTMAN_ACTION_STREAM    0x02
+/*******************************************************************************
+ *  @def    ASTMAN_ACTION_CONTROL
+ *  @brief  Flag: latency critical action, never held back (Hangup,
+ *          Redirect, AbsoluteTimeout... are control actions anyway)
+ ******************************************************************************/
+#define ASTMAN_ACTION_CONTROL   0x04
+/*******************************************************************************
+ *  @def    ASTMAN_ACTION_BULK
+ *  @brief  Flag: bulk query (SIPpeers, Status... and list actions are bulk
+ *          anyway). Bulk actions beyond the session's bulk window wait on
+ *          the client side, so that the actions sent after them do not
+ *          queue behind them in Asterisk.
+ ******************************************************************************/
+#define ASTMAN_ACTION_BULK      0x08
+/*******************************************************************************
+ *  @def    ASTMAN_ACTION_NOWINDOW
+ *  @brief  Flag: bulk action sent at once even with the bulk window full.
+ *          It stays a bulk action and still counts in the window.
+ ******************************************************************************/
+#define ASTMAN_ACTION_NOWINDOW  0x10
+/*******************************************************************************
+ *  @def    ASTMAN_BULK_WINDOW
+ *  @brief  Default bulk actions in flight per session
+ ******************************************************************************/
+#define ASTMAN_BULK_WINDOW      1
+/*******************************************************************************
+ * @enum    astman_action_class
+ * @brief   Send lanes, in priority order
+ ******************************************************************************/
+enum astman_action_class {
+  ASTMAN_CLASS_CONTROL,     /**!< call control, sent at once */
+  ASTMAN_CLASS_NORMAL,      /**!< sent at once */
+  ASTMAN_CLASS_BULK         /**!< sent within the bulk window */
+};
+/*******************************************************************************
+ *  @def    ASTMAN_MAX_ACTIONID_LEN
+ ******************************************************************************/
+#define ASTMAN_MAX_ACTIONID_LEN 64
+/*******************************************************************************
+ * @struct  astman_action_result
+ * @brief   What an ASTMAN_ACTION_CALLBACK receives
+ ******************************************************************************/
+struct astman_action_result {
+  const char *actionid;     /**!< ActionID of the action */
+  int status;               /**!< ASTMAN_SUCCESS, ASTMAN_FAILURE (Response:
+                                  Error...), ASTMAN_ACTION_TIMEOUT or
+                                  ASTMAN_ACTION_ABORTED */
+  struct message *response; /**!< the response, NULL if none arrived */
+  struct message *events;   /**!< list events collected (or the current
+                                 one in ASTMAN_ACTION_STREAM mode) */
+  int count;                /**!< number of events */
+  int complete;             /**!< 1 on the last call for this action */
+};
+/*******************************************************************************
+ * @typedef (*ASTMAN_ACTION_CALLBACK)
+ * @brief   Completion callback. The result and its messages are only valid
+ *          during the call. New actions may be sent from the callback.
+ ******************************************************************************/
+typedef void (*ASTMAN_ACTION_CALLBACK)(struct mansession *s,
+                                       struct astman_action_result *r,
+                                       void *data);
+/*******************************************************************************
+ * @fn int astman_action_async(struct mansession *s, char *action,
+ *                             char *params, char *actionid, int flags,
+ *                             int timeout_ms, ASTMAN_ACTION_CALLBACK callback,
+ *                             void *data)
+ * @brief Send an action without waiting for its response
+ * @param params: headers built with astman_add_param(), without ActionID
+ * @param actionid: NULL or empty to let the library generate a unique one
+ * @param flags: ASTMAN_ACTION_LIST, ASTMAN_ACTION_STREAM,
+ *               ASTMAN_ACTION_CONTROL, ASTMAN_ACTION_BULK,
+ *               ASTMAN_ACTION_NOWINDOW
+ * @param timeout_ms: <= 0 for no deadline, counted from this call (a bulk
+ *                    action waiting for the window included)
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (not sent, callback not called)
+ ******************************************************************************/
+int astman_action_async(struct mansession *s, char *action, char *params,
+                        char *actionid, int flags, int timeout_ms,
+                        ASTMAN_ACTION_CALLBACK callback, void *data);
+/*******************************************************************************
+ * @fn int astman_action_class(const char *action, int flags)
+ * @brief Lane of an action: the CONTROL / BULK flags, else the action name
+ * @return enum astman_action_class
+ ******************************************************************************/
+int astman_action_class(const char *action, int flags);
+/*******************************************************************************
+ * @fn int astman_set_bulk_window(struct mansession *s, int window)
+ * @brief Bulk actions allowed in flight on s (ASTMAN_BULK_WINDOW by
+ *        default), the next ones are sent as these complete
+ * @param window: 0 for no limit
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_set_bulk_window(struct mansession *s, int window);
+/*******************************************************************************
+ * @fn int astman_poll(struct mansession *s, int timeout_ms)
+ * @brief Read what arrived (waiting up to timeout_ms for the first message),
+ *        complete the asynchronous actions and dispatch the other events to
+ *        the event handlers.
+ * @param timeout_ms: 0 never blocks, < 0 waits for a message
+ * @return Number of actions completed, -1 if the connection is lost (the
+ *         pending actions are then completed with ASTMAN_ACTION_ABORTED) or
+ *         a callback disconnected s
+ ******************************************************************************/
+int astman_poll(struct mansession *s, int timeout_ms);
+/*******************************************************************************
+ * @fn int astman_pending_count(struct mansession *s)
+ * @return Number of asynchronous actions in flight (or waiting for the bulk
+ *         window)
+ ******************************************************************************/
+int astman_pending_count(struct mansession *s);
+/*******************************************************************************
+ * @fn int astman_session_fd(struct mansession *s)
+ * @brief Socket to watch for POLLIN in an external event loop, call
+ *        astman_poll(s, 0) when readable.
+ ******************************************************************************/
+int astman_session_fd(struct mansession *s);
+/*******************************************************************************
+ * @fn int astman_async_timeout(struct mansession *s)
+ * @brief Time left before the earliest pending deadline, to bound the wait
+ *        of an external event loop
+ * @return milliseconds, -1 if no pending action has a deadline
+ ******************************************************************************/
+int astman_async_timeout(struct mansession *s);
+/*******************************************************************************
+ * @fn int astman_async_expire(struct mansession *s)
+ * @brief Complete the actions past their deadline with ASTMAN_ACTION_TIMEOUT,
+ *        without reading the socket
+ * @return number of actions completed, -1 if a callback disconnected s
+ ******************************************************************************/
+int astman_async_expire(struct mansession *s);
+/*******************************************************************************
+ * @fn int astman_async_input(struct mansession *s, const char *data,
+ *                            size_t len)
+ * @brief astman_poll() for transports that receive into their own buffers:
+ *        parse data in place, complete the asynchronous actions and
+ *        dispatch the other events
+ * @return number of actions completed, -1 if a callback disconnected s
+ ******************************************************************************/
+int astman_async_input(struct mansession *s, const char *data, size_t len);
+/*******************************************************************************
+ * @fn void astman_async_abort(struct mansession *s)
+ * @brief Complete every pending action with ASTMAN_ACTION_ABORTED and free
+ *        the asynchronous state of s
+ ******************************************************************************/
+void astman_async_abort(struct mansession *s);
+/*******************************************************************************
+ * @fn int astman_async_dispatch(struct mansession *s, struct message *m)
+ * @brief Library side: route a message to its pending action
+ * @return 1 if m belonged to an asynchronous action, 0 otherwise
+ ******************************************************************************/
+int astman_async_dispatch(struct mansession *s, struct message *m);
+#endif // ASTASYNC_H_INCLUDED
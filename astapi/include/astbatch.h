@@ -0,0 +1,62 @@
+#ifndef ASTBATCH_H_INCLUDED
+#define ASTBATCH_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astbatch.h
+ *  @brief Batched event delivery
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ * @typedef (*ASTMAN_EVENT_BATCH_CALLBACK)
+ * @brief   Batch callback proto-type: msgs is a contiguous array of count
+ *          events, valid until the callback returns.
+ ******************************************************************************/
+typedef void (*ASTMAN_EVENT_BATCH_CALLBACK)(struct mansession *s,
+                                            struct message *msgs, int count);
+/*******************************************************************************
+ * @fn int astman_add_event_batch_handler(struct mansession *s,
+ *                                        ASTMAN_EVENT_BATCH_CALLBACK callback,
+ *                                        int max_events, int max_usec)
+ * @brief Deliver the events no astman_add_event_handler() callback consumed
+ *        in batches. A batch is handed over when everything parsed from
+ *        the last read is collected, when it holds max_events events, when
+ *        its first event is max_usec old, or before a response is returned.
+ * @param callback: NULL removes the batch handler (pending events are
+ *                  delivered first)
+ * @warning The callback must not wait for responses on s.
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_add_event_batch_handler(struct mansession *s,
+                                   ASTMAN_EVENT_BATCH_CALLBACK callback,
+                                   int max_events, int max_usec);
+/*******************************************************************************
+ * @fn void astman_batch_add(struct mansession *s, struct message *m)
+ * @brief Library side: queue an event (only the used headers are copied)
+ ******************************************************************************/
+void astman_batch_add(struct mansession *s, struct message *m);
+/*******************************************************************************
+ * @fn void astman_batch_flush(struct mansession *s)
+ * @brief Library side: hand the pending events to the callback
+ ******************************************************************************/
+void astman_batch_flush(struct mansession *s);
+#endif // ASTBATCH_H_INCLUDED
@@ -0,0 +1,78 @@
+#ifndef ASTCACHE_H_INCLUDED
+#define ASTCACHE_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astcache.h
+ *  @brief Response cache of idempotent query actions. Entries are keyed by
+ *         server, action and parameters (names case folded, sorted) and live
+ *         for the TTL of their action. Identical requests made while one is
+ *         on the wire wait for it and share its response.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ *  @def    ASTMAN_CACHE_MAX_ENTRIES
+ *  @brief  Most responses kept: the expired ones, then the least recently
+ *          used, make room for a new one
+ ******************************************************************************/
+#define ASTMAN_CACHE_MAX_ENTRIES    1024
+/*******************************************************************************
+ * @struct  astman_cache_stats
+ ******************************************************************************/
+struct astman_cache_stats {
+    unsigned long long hits;        /**!< served from the cache */
+    unsigned long long coalesced;   /**!< waited for an identical request */
+    unsigned long long misses;      /**!< sent on the wire */
+    unsigned long long evicted;     /**!< dropped before expiry for room */
+    int entries;                    /**!< cached responses */
+};
+/*******************************************************************************
+ * @fn int astman_cache_set_ttl(const char *action, int ttl_ms)
+ * @brief Cache the responses of action (ListCommands, ListCategories,
+ *        SIPshowpeer, GetVar without Channel) for ttl_ms. Nothing is cached
+ *        by default. With ttl_ms 0 responses are not kept, but identical
+ *        requests in flight are still coalesced; < 0 turns both off.
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (too many actions)
+ ******************************************************************************/
+int astman_cache_set_ttl(const char *action, int ttl_ms);
+/*******************************************************************************
+ * @fn int astman_cache_query(struct mansession *s, struct message *m,
+ *                            char *action, const char *params,
+ *                            char *actionid)
+ * @brief Send action (params built with astman_add_param(), without
+ *        ActionID) and wait for its response, or take it from the cache.
+ *        The response handed back carries actionid.
+ * @return as astman_wait_for_response()
+ ******************************************************************************/
+int astman_cache_query(struct mansession *s, struct message *m, char *action,
+                       const char *params, char *actionid);
+/*******************************************************************************
+ * @fn void astman_cache_invalidate(struct mansession *s, const char *action)
+ * @brief Drop the responses of action, of every action when NULL (Reload),
+ *        from the server of s (of every server when s is NULL)
+ ******************************************************************************/
+void astman_cache_invalidate(struct mansession *s, const char *action);
+/*******************************************************************************
+ * @fn void astman_cache_stats(struct astman_cache_stats *st)
+ ******************************************************************************/
+void astman_cache_stats(struct astman_cache_stats *st);
+#endif // ASTCACHE_H_INCLUDED
@@ -0,0 +1,140 @@
+#ifndef ASTCLUSTER_H_INCLUDED
+#define ASTCLUSTER_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astcluster.h
+ *  @brief Cluster client: one session per Asterisk server, all driven by the
+ *         same poll() loop. An action is sent to every node at once and the
+ *         answers come back tagged by node, so a cluster-wide query costs
+ *         the time of the slowest node instead of the sum.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+#include "astasync.h"
+/*******************************************************************************
+ * @struct  astman_cluster
+ * @brief   Opaque set of nodes
+ ******************************************************************************/
+struct astman_cluster;
+/*******************************************************************************
+ * @typedef (*ASTMAN_CLUSTER_CALLBACK)
+ * @brief   Result of an action on one node. Called once per targeted node
+ *          with r->complete set (plus once per event before that with
+ *          ASTMAN_ACTION_STREAM). A node that is down or lost answers
+ *          ASTMAN_ACTION_ABORTED, a node past the deadline
+ *          ASTMAN_ACTION_TIMEOUT: the other nodes' results stand.
+ ******************************************************************************/
+typedef void (*ASTMAN_CLUSTER_CALLBACK)(struct astman_cluster *c, int node,
+                                        struct astman_action_result *r,
+                                        void *data);
+/*******************************************************************************
+ * @fn struct astman_cluster *astman_cluster_new(void)
+ * @return an empty cluster, NULL if out of memory
+ ******************************************************************************/
+struct astman_cluster *astman_cluster_new(void);
+/*******************************************************************************
+ * @fn void astman_cluster_free(struct astman_cluster *c)
+ * @brief Log off, disconnect and release every node. Pending actions are
+ *        completed with ASTMAN_ACTION_ABORTED.
+ ******************************************************************************/
+void astman_cluster_free(struct astman_cluster *c);
+/*******************************************************************************
+ * @fn int astman_cluster_add_node(struct astman_cluster *c, const char *name,
+ *                                 const char *host, int port,
+ *                                 const char *username, const char *secret)
+ * @param name: tag of the node in the results, host if NULL
+ * @param port: 0 for the default manager port
+ * @return index of the node, -1 on error
+ ******************************************************************************/
+int astman_cluster_add_node(struct astman_cluster *c, const char *name,
+                            const char *host, int port,
+                            const char *username, const char *secret);
+/*******************************************************************************
+ * @fn int astman_cluster_connect(struct astman_cluster *c, int timeout_ms)
+ * @brief Connect and log in every node that is down, concurrently. The
+ *        sessions log in with "Events: off": list actions still get their
+ *        events.
+ * @return number of nodes up
+ ******************************************************************************/
+int astman_cluster_connect(struct astman_cluster *c, int timeout_ms);
+/*******************************************************************************
+ * @fn int astman_cluster_node_count(struct astman_cluster *c)
+ ******************************************************************************/
+int astman_cluster_node_count(struct astman_cluster *c);
+/*******************************************************************************
+ * @fn const char *astman_cluster_node_name(struct astman_cluster *c, int node)
+ ******************************************************************************/
+const char *astman_cluster_node_name(struct astman_cluster *c, int node);
+/*******************************************************************************
+ * @fn int astman_cluster_node_up(struct astman_cluster *c, int node)
+ * @return 1 when the node is connected and logged in
+ ******************************************************************************/
+int astman_cluster_node_up(struct astman_cluster *c, int node);
+/*******************************************************************************
+ * @fn struct mansession *astman_cluster_session(struct astman_cluster *c,
+ *                                               int node)
+ * @brief Session of a node, to register event handlers on it
+ ******************************************************************************/
+struct mansession *astman_cluster_session(struct astman_cluster *c, int node);
+/*******************************************************************************
+ * @fn int astman_cluster_action(struct astman_cluster *c, const int *nodes,
+ *                               int nnodes, char *action, char *params,
+ *                               int flags, int timeout_ms,
+ *                               ASTMAN_CLUSTER_CALLBACK callback, void *data)
+ * @brief Send an action to a set of nodes without waiting
+ * @param nodes: indexes of the targeted nodes, NULL for all of them
+ * @param flags, timeout_ms: as for astman_action_async(), the deadline is
+ *                           per node
+ * @return number of nodes the action was sent to
+ ******************************************************************************/
+int astman_cluster_action(struct astman_cluster *c, const int *nodes,
+                          int nnodes, char *action, char *params, int flags,
+                          int timeout_ms, ASTMAN_CLUSTER_CALLBACK callback,
+                          void *data);
+/*******************************************************************************
+ * @fn int astman_cluster_poll(struct astman_cluster *c, int timeout_ms)
+ * @brief Wait up to timeout_ms for any node, then read every node that has
+ *        data and complete its actions
+ * @return number of actions completed
+ ******************************************************************************/
+int astman_cluster_poll(struct astman_cluster *c, int timeout_ms);
+/*******************************************************************************
+ * @fn int astman_cluster_wait(struct astman_cluster *c, int timeout_ms)
+ * @brief Poll until no action is pending on any node
+ * @param timeout_ms: < 0 to wait without limit
+ * @return number of actions still pending
+ ******************************************************************************/
+int astman_cluster_wait(struct astman_cluster *c, int timeout_ms);
+/*******************************************************************************
+ * @fn int astman_cluster_gather(struct astman_cluster *c, const int *nodes,
+ *                               int nnodes, char *action, char *params,
+ *                               int flags, int timeout_ms,
+ *                               ASTMAN_CLUSTER_CALLBACK callback, void *data)
+ * @brief astman_cluster_action() then wait for every targeted node, in one
+ *        call
+ * @return number of nodes that answered with success
+ ******************************************************************************/
+int astman_cluster_gather(struct astman_cluster *c, const int *nodes,
+                          int nnodes, char *action, char *params, int flags,
+                          int timeout_ms, ASTMAN_CLUSTER_CALLBACK callback,
+                          void *data);
+#endif // ASTCLUSTER_H_INCLUDED
@@ -0,0 +1,162 @@
+#ifndef ASTCONFIG_H_INCLUDED
+#define ASTCONFIG_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astconfig.h
+ *  @brief Parsed and cached view of the GetConfig responses
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ * @struct  astman_config
+ * @brief   Opaque parsed configuration file (category -> variable -> value)
+ ******************************************************************************/
+struct astman_config;
+/*******************************************************************************
+ * @fn int astman_config_load(struct mansession *s, char *filename,
+ *                            struct astman_config **cfg)
+ * @brief Return the parsed configuration of filename on the server of s.
+ *        The configuration is served from the cache when present, otherwise
+ *        it is fetched with a GetConfig action, parsed and cached. A
+ *        response truncated to MAX_HEADERS is not cached (failure).
+ * @param IN s: session used when the file is not cached
+ * @param IN filename: Configuration filename (e.g. sip.conf)
+ * @param OUT cfg: referenced configuration, release it with
+ *                 astman_config_release()
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_config_load(struct mansession *s, char *filename,
+                       struct astman_config **cfg);
+/*******************************************************************************
+ * @fn void astman_config_release(struct astman_config *cfg)
+ * @brief Drop a reference taken by astman_config_load()
+ ******************************************************************************/
+void astman_config_release(struct astman_config *cfg);
+/*******************************************************************************
+ * @fn const char *astman_config_get_value(struct astman_config *cfg,
+ *                                         const char *category,
+ *                                         const char *variable)
+ * @brief Hashed lookup of the first value of variable in category
+ * @return the value or NULL if not found
+ ******************************************************************************/
+const char *astman_config_get_value(struct astman_config *cfg,
+                                    const char *category,
+                                    const char *variable);
+/*******************************************************************************
+ * @fn int astman_config_has_category(struct astman_config *cfg,
+ *                                    const char *category)
+ * @return 1 if category exists in cfg, 0 otherwise
+ ******************************************************************************/
+int astman_config_has_category(struct astman_config *cfg, const char *category);
+/*******************************************************************************
+ * @fn int astman_config_category_count(struct astman_config *cfg)
+ * @return Number of categories, in file order
+ ******************************************************************************/
+int astman_config_category_count(struct astman_config *cfg);
+/*******************************************************************************
+ * @fn const char *astman_config_category_name(struct astman_config *cfg, int idx)
+ * @return Name of the idx-th category or NULL
+ ******************************************************************************/
+const char *astman_config_category_name(struct astman_config *cfg, int idx);
+/*******************************************************************************
+ * @fn int astman_config_variable_count(struct astman_config *cfg,
+ *                                      const char *category)
+ * @return Number of lines of category (repeated variables included)
+ ******************************************************************************/
+int astman_config_variable_count(struct astman_config *cfg, const char *category);
+/*******************************************************************************
+ * @fn int astman_config_variable(struct astman_config *cfg,
+ *                                const char *category, int idx,
+ *                                const char **name, const char **value)
+ * @brief Get the idx-th line of category, in file order
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_config_variable(struct astman_config *cfg, const char *category,
+                           int idx, const char **name, const char **value);
+/*******************************************************************************
+ * @fn struct astman_config *astman_config_lookup(struct mansession *s,
+ *                                                const char *filename)
+ * @brief Cache lookup only, never touches the network. The cache is keyed
+ *        by the server address and port of s and the filename.
+ * @return referenced configuration or NULL when filename is not cached
+ ******************************************************************************/
+struct astman_config *astman_config_lookup(struct mansession *s,
+                                           const char *filename);
+/*******************************************************************************
+ * @fn struct astman_config *astman_config_parse(struct mansession *s,
+ *                                               const char *filename,
+ *                                               struct message *m)
+ * @brief Build a configuration from a GetConfig response of the server of s
+ *        and store it in the cache (replacing any previous entry for
+ *        filename). A response truncated to MAX_HEADERS is refused: build
+ *        large files with astman_config_begin() instead.
+ * @return referenced configuration or NULL on error
+ ******************************************************************************/
+struct astman_config *astman_config_parse(struct mansession *s,
+                                          const char *filename,
+                                          struct message *m);
+/*******************************************************************************
+ * @fn struct astman_config *astman_config_begin(struct mansession *s,
+ *                                               const char *filename)
+ * @brief Start building filename of the server of s while its GetConfig
+ *        response is read: set it in s->config_build before waiting, the
+ *        reader feeds it every header, past MAX_HEADERS too.
+ * @return the builder, NULL on error
+ ******************************************************************************/
+struct astman_config *astman_config_begin(struct mansession *s,
+                                          const char *filename);
+/*******************************************************************************
+ * @fn void astman_config_feed(struct astman_config *cfg, struct message *m,
+ *                             const char *line)
+ * @brief Reader side: line is the next header of m (m->hdrcount headers
+ *        before it). Only the last response read is kept.
+ ******************************************************************************/
+void astman_config_feed(struct astman_config *cfg, struct message *m,
+                        const char *line);
+/*******************************************************************************
+ * @fn struct astman_config *astman_config_commit(struct astman_config *cfg)
+ * @brief Index the built configuration and store it in the cache,
+ *        replacing any previous entry. cfg is freed on error.
+ * @return referenced configuration or NULL on error
+ ******************************************************************************/
+struct astman_config *astman_config_commit(struct astman_config *cfg);
+/*******************************************************************************
+ * @fn void astman_config_invalidate(struct mansession *s,
+ *                                   const char *filename)
+ * @brief Drop filename from the cache, or every file when filename is NULL,
+ *        of the server of s (of every server when s is NULL)
+ ******************************************************************************/
+void astman_config_invalidate(struct mansession *s, const char *filename);
+/*******************************************************************************
+ * @fn int astman_config_to_message(struct astman_config *cfg,
+ *                                  const char *category,
+ *                                  int categories_only,
+ *                                  char *actionid,
+ *                                  struct message *m)
+ * @brief Rebuild a GetConfig (or ListCategories when categories_only)
+ *        response from the cached configuration.
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_config_to_message(struct astman_config *cfg, const char *category,
+                             int categories_only, char *actionid,
+                             struct message *m);
+#endif // ASTCONFIG_H_INCLUDED
@@ -0,0 +1,475 @@
+#ifndef ASTCORO_H_INCLUDED
+#define ASTCORO_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astcoro.h
+ *  @brief C++20 front-end, header only: actions are awaitables resumed from
+ *         astman_poll(), list actions and events are asynchronous
+ *         generators, headers are std::string_view into the message.
+ *         Any number of coroutines share the thread polling the session.
+ *         A coroutine resumed with a message reads the library's own copy;
+ *         only messages buffered for a busy consumer are copied.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#ifdef __cplusplus
+extern "C" {
+#include "astman.h"
+#include "astevent.h"
+#include "astasync.h"
+#include "astnames.h"
+#include "astsub.h"
+}
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <strings.h>
+#include <utility>
+#include <vector>
+/*******************************************************************************
+ *  @def    ASTMAN_CORO_DEPTH
+ *  @brief  Messages a generator buffers for a consumer that is not waiting,
+ *          the oldest is dropped past it
+ ******************************************************************************/
+#define ASTMAN_CORO_DEPTH 1024
+
+namespace astman {
+/*******************************************************************************
+ * @class   Message
+ * @brief   A received message. It wraps the library's struct message
+ *          without copying it: valid during the callback, that is until the
+ *          coroutine resumed with it suspends again. keep() makes a packed
+ *          copy (used headers only) that lives as long as the Message.
+ ******************************************************************************/
+class Message {
+public:
+    Message() = default;
+    explicit Message(const struct message *m)
+        : m_(m), hdr_(m ? m->headers[0] : nullptr), count_(m ? m->hdrcount : 0) {}
+    /** Owned copy of m */
+    static Message copy(const struct message *m) {
+        Message c;
+        if (!m)
+            return c;
+        c.buf_.reset(new char[astman_message_packed_size(m)]);
+        astman_message_pack(c.buf_.get(), m);
+        c.hdr_ = c.buf_.get() + offsetof(struct message, headers);
+        c.count_ = m->hdrcount;
+        return c;
+    }
+    /** This message, owned, to use after the coroutine suspends */
+    Message keep() const { return buf_ || !m_ ? *this : copy(m_); }
+    bool owned() const { return buf_ != nullptr; }
+    /** Value of the first header called name (case insensitive), "" if none */
+    std::string_view header(std::string_view name) const {
+        std::string_view l;
+        for (std::size_t x = 0; x < size(); x++) {
+            l = line(x);
+            if (l.size() > name.size() && l[name.size()] == ':' &&
+                !strncasecmp(l.data(), name.data(), name.size())) {
+                l.remove_prefix(name.size() + 1);
+                while (!l.empty() && l.front() == ' ')
+                    l.remove_prefix(1);
+                return l;
+            }
+        }
+        return {};
+    }
+    std::size_t size() const { return static_cast<std::size_t>(count_); }
+    std::string_view line(std::size_t x) const {
+        const char *l = hdr_ + x * MAX_LEN;
+        return std::string_view(l, strnlen(l, MAX_LEN));
+    }
+private:
+    const struct message *m_ = nullptr;     /**!< wrapped, NULL if owned */
+    std::shared_ptr<char[]> buf_;           /**!< astman_message_pack() */
+    const char *hdr_ = nullptr;             /**!< headers[0] */
+    int count_ = 0;
+};
+/*******************************************************************************
+ * @struct  Result
+ * @brief   Outcome of an awaited action, its messages wrap the library's
+ *          (Message::keep() to use them after the next suspension)
+ ******************************************************************************/
+struct Result {
+    int status = ASTMAN_FAILURE;        /**!< as astman_action_result */
+    std::optional<Message> response;
+    std::vector<Message> events;        /**!< collected list events */
+    bool ok() const { return status == ASTMAN_SUCCESS; }
+};
+/*******************************************************************************
+ * @class   Task
+ * @brief   Lazy coroutine: starts when awaited (or detached), resumes its
+ *          awaiter when done
+ ******************************************************************************/
+template <typename T = void>
+class Task;
+
+namespace detail {
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+    bool detached = false;
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    struct Final {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            PromiseBase &p = h.promise();
+            if (p.continuation)
+                return p.continuation;
+            if (p.detached)
+                h.destroy();
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    Final final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+    Task<T> get_return_object();
+    template <typename U>
+    void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+    T result() {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void result() {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+}
+
+template <typename T>
+class Task {
+public:
+    using promise_type = detail::Promise<T>;
+    explicit Task(std::coroutine_handle<promise_type> h) : h_(h) {}
+    Task(Task &&o) noexcept : h_(std::exchange(o.h_, {})) {}
+    Task(const Task &) = delete;
+    ~Task() { if (h_) h_.destroy(); }
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+        h_.promise().continuation = c;
+        return h_;
+    }
+    T await_resume() { return h_.promise().result(); }
+    /** Start without an awaiter, the frame frees itself when done */
+    void detach() {
+        auto h = std::exchange(h_, {});
+        h.promise().detached = true;
+        h.resume();
+    }
+private:
+    std::coroutine_handle<promise_type> h_;
+};
+
+namespace detail {
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+/* Items handed from the library callbacks to one awaiting coroutine */
+struct Channel {
+    explicit Channel(std::size_t depth) : depth(depth ? depth : 1) {}
+    std::deque<Message> items;
+    std::size_t depth;
+    unsigned long long dropped = 0;
+    int status = ASTMAN_SUCCESS;
+    bool done = false;
+    std::coroutine_handle<> waiter;
+    void wake() {
+        if (auto h = std::exchange(waiter, {}))
+            h.resume();
+    }
+    /* A waiting consumer takes m at once, wrapped; otherwise it is copied */
+    void push(const struct message *m) {
+        if (waiter && items.empty()) {
+            items.emplace_back(m);
+            wake();
+            return;
+        }
+        if (items.size() >= depth) {
+            items.pop_front();
+            dropped++;
+        }
+        items.push_back(Message::copy(m));
+        wake();
+    }
+};
+}
+/*******************************************************************************
+ * @class   Generator
+ * @brief   Asynchronous generator: co_await next() gives the next message,
+ *          std::nullopt at the end of the list (status() then tells why).
+ *          At most depth messages wait for the consumer, dropped() counts
+ *          the ones lost past it.
+ ******************************************************************************/
+class Generator {
+public:
+    explicit Generator(std::shared_ptr<detail::Channel> ch) : ch_(std::move(ch)) {}
+    struct Next {
+        std::shared_ptr<detail::Channel> ch;
+        std::coroutine_handle<> h;
+        Next(std::shared_ptr<detail::Channel> c) : ch(std::move(c)) {}
+        Next(const Next &) = delete;
+        /* a frame destroyed while waiting must not be resumed */
+        ~Next() {
+            if (h && ch->waiter == h)
+                ch->waiter = {};
+        }
+        bool await_ready() const noexcept { return !ch->items.empty() || ch->done; }
+        void await_suspend(std::coroutine_handle<> c) noexcept {
+            h = c;
+            ch->waiter = c;
+        }
+        std::optional<Message> await_resume() {
+            std::optional<Message> m;
+            if (!ch->items.empty()) {
+                m.emplace(std::move(ch->items.front()));
+                ch->items.pop_front();
+            }
+            return m;
+        }
+    };
+    Next next() { return Next(ch_); }
+    int status() const { return ch_->status; }
+    unsigned long long dropped() const { return ch_->dropped; }
+private:
+    std::shared_ptr<detail::Channel> ch_;
+};
+/*******************************************************************************
+ * @class   Session
+ * @brief   Coroutine view of a session, it does not own it. Every callback
+ *          and resumption runs on the thread calling poll().
+ ******************************************************************************/
+class Session {
+public:
+    explicit Session(struct mansession *s) : s_(s) {}
+    struct mansession *get() const { return s_; }
+    /** astman_poll() */
+    int poll(int timeout_ms) { return astman_poll(s_, timeout_ms); }
+    /*******************************************************************************
+     * @brief co_await action(...) sends the action and resumes with its
+     *        Result; list events are collected with ASTMAN_ACTION_LIST
+     ******************************************************************************/
+    class Action {
+    public:
+        Action(struct mansession *s, std::string action, std::string params,
+               int flags, int timeout_ms)
+            : s_(s), action_(std::move(action)), params_(std::move(params)),
+              flags_(flags & ~ASTMAN_ACTION_STREAM), timeout_ms_(timeout_ms) {}
+        Action(const Action &) = delete;
+        /* The frame is destroyed with the action pending: its completion
+           finds no one to resume */
+        ~Action() {
+            if (pending_)
+                pending_->a = nullptr;
+        }
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h) {
+            h_ = h;
+            pending_ = new Pending{this};
+            if (astman_action_async(s_, action_.data(), params_.data(), nullptr,
+                                    flags_, timeout_ms_, &Action::done,
+                                    pending_) != ASTMAN_SUCCESS) {
+                delete std::exchange(pending_, nullptr);
+                return false;
+            }
+            return true;
+        }
+        Result await_resume() { return std::move(result_); }
+    private:
+        /* Outlives the Action until the library completes it */
+        struct Pending {
+            Action *a;
+        };
+        static void done(struct mansession *, struct astman_action_result *r,
+                         void *data) {
+            Pending *p = static_cast<Pending *>(data);
+            Action *a = p->a;
+            if (!r->complete)
+                return;
+            delete p;
+            if (!a)
+                return;
+            a->pending_ = nullptr;
+            a->result_.status = r->status;
+            if (r->response)
+                a->result_.response.emplace(r->response);
+            for (int x = 0; x < r->count; x++)
+                a->result_.events.emplace_back(&r->events[x]);
+            a->h_.resume();
+        }
+        struct mansession *s_;
+        std::string action_;
+        std::string params_;
+        int flags_;
+        int timeout_ms_;
+        std::coroutine_handle<> h_;
+        Pending *pending_ = nullptr;
+        Result result_;
+    };
+    Action action(std::string action, std::string params = {}, int flags = 0,
+                  int timeout_ms = 0) {
+        return Action(s_, std::move(action), std::move(params), flags, timeout_ms);
+    }
+    /*******************************************************************************
+     * @brief Events of a list action as they arrive (ASTMAN_ACTION_STREAM)
+     * @return the generator, already ended with ASTMAN_FAILURE if not sent
+     ******************************************************************************/
+    Generator list(std::string action, std::string params = {}, int timeout_ms = 0,
+                   std::size_t depth = ASTMAN_CORO_DEPTH) {
+        auto ch = std::make_shared<detail::Channel>(depth);
+        auto *ref = new std::shared_ptr<detail::Channel>(ch);
+        if (astman_action_async(s_, action.data(), params.data(), nullptr,
+                                ASTMAN_ACTION_LIST | ASTMAN_ACTION_STREAM,
+                                timeout_ms, &Session::listed, ref) != ASTMAN_SUCCESS) {
+            delete ref;
+            ch->status = ASTMAN_FAILURE;
+            ch->done = true;
+        }
+        return Generator(ch);
+    }
+    /*******************************************************************************
+     * @brief Stream of the Events matching a name or pattern (as
+     *        astman_add_event_handler()). An Event goes to the stream of the
+     *        subscription the library picks for it: the exact name first,
+     *        then the pattern with the most literal characters. It replaces
+     *        the handler of that name or pattern; the stream ends when the
+     *        session is closed with close_events().
+     * @return the generator, already ended with ASTMAN_FAILURE if not
+     *         subscribed
+     ******************************************************************************/
+    Generator events(const std::string &event, std::size_t depth = ASTMAN_CORO_DEPTH) {
+        auto ch = std::make_shared<detail::Channel>(depth);
+        std::lock_guard<std::mutex> lock(registry_lock());
+        Streams &st = registry()[s_];
+        std::string k = key(event);
+        auto it = st.channels.find(k);
+
+        if (it == st.channels.end()) {
+            /* The library matched the name already, the private set of
+               subscriptions tells which stream it matched */
+            if ((!st.subs && !(st.subs = astman_subs_new())) ||
+                astman_subs_add(st.subs, k.c_str(), &Session::event) != ASTMAN_SUCCESS) {
+                ch->status = ASTMAN_FAILURE;
+                ch->done = true;
+                return Generator(ch);
+            }
+            it = st.channels.emplace(k, std::vector<std::shared_ptr<detail::Channel>>()).first;
+            astman_subs_set_data(st.subs, k.c_str(), &it->second);
+            astman_add_event_handler(s_, const_cast<char *>(k.c_str()), &Session::event);
+        }
+        it->second.push_back(ch);
+        return Generator(ch);
+    }
+    /** End the event streams of this session */
+    void close_events() {
+        std::vector<std::shared_ptr<detail::Channel>> ended;
+        {
+            std::lock_guard<std::mutex> lock(registry_lock());
+            auto it = registry().find(s_);
+            if (it == registry().end())
+                return;
+            for (auto &e : it->second.channels) {
+                astman_add_event_handler(s_, const_cast<char *>(e.first.c_str()), nullptr);
+                for (auto &ch : e.second)
+                    ended.push_back(ch);
+            }
+            astman_subs_free(it->second.subs);
+            registry().erase(it);
+        }
+        for (auto &ch : ended) {
+            ch->done = true;
+            ch->wake();
+        }
+    }
+private:
+    /* The streams of one session, by name or pattern */
+    struct Streams {
+        struct astman_subs *subs = nullptr;
+        std::map<std::string, std::vector<std::shared_ptr<detail::Channel>>> channels;
+    };
+    using Registry = std::map<struct mansession *, Streams>;
+    static std::string key(std::string_view event) {
+        std::string k(event);
+        for (auto &c : k)
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        return k;
+    }
+    static Registry &registry() { static Registry r; return r; }
+    static std::mutex &registry_lock() { static std::mutex l; return l; }
+    static void listed(struct mansession *, struct astman_action_result *r,
+                       void *data) {
+        auto *ref = static_cast<std::shared_ptr<detail::Channel> *>(data);
+        auto ch = *ref;
+        if (!r->complete) {
+            ch->push(r->events);
+            return;
+        }
+        ch->status = r->status;
+        ch->done = true;
+        delete ref;
+        ch->wake();
+    }
+    static int event(struct mansession *s, struct message *m) {
+        std::vector<std::shared_ptr<detail::Channel>> chs;
+        void *data = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(registry_lock());
+            auto it = registry().find(s);
+            if (it == registry().end() ||
+                !astman_subs_match_data(it->second.subs, astman_message_event(m),
+                                        astman_get_header(m, "Event"), &data) || !data)
+                return 0;
+            chs = *static_cast<std::vector<std::shared_ptr<detail::Channel>> *>(data);
+        }
+        for (auto &ch : chs)
+            ch->push(m);
+        return 0;
+    }
+    struct mansession *s_;
+};
+}
+#endif
+#endif // ASTCORO_H_INCLUDED
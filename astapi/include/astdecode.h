@@ -0,0 +1,170 @@
+#ifndef ASTDECODE_H_INCLUDED
+#define ASTDECODE_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astdecode.h
+ *  @brief Typed decoding of the high volume events: one pass over the
+ *         headers fills a compact struct of enums, integers and string
+ *         slices, so handlers stop re-parsing values with astman_get_header
+ *         and atoi.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ * @enum    astman_event_type
+ ******************************************************************************/
+enum astman_event_type {
+    ASTMAN_EV_UNKNOWN = 0,
+    ASTMAN_EV_NEWCHANNEL,
+    ASTMAN_EV_NEWSTATE,
+    ASTMAN_EV_HANGUP,
+    ASTMAN_EV_PEERSTATUS,
+    ASTMAN_EV_QUEUEMEMBERSTATUS,
+    ASTMAN_EV_VARSET,
+    ASTMAN_EV_DIALBEGIN,            /**!< also Dial/SubEvent: Begin (1.4 - 11) */
+    ASTMAN_EV_DIALEND,              /**!< also Dial/SubEvent: End */
+    ASTMAN_EV_BRIDGEENTER,
+    ASTMAN_EV_BRIDGELEAVE,
+    ASTMAN_EV_COUNT
+};
+/*******************************************************************************
+ * @enum    astman_channel_state
+ * @brief   ChannelState values (AST_STATE_*)
+ ******************************************************************************/
+enum astman_channel_state {
+    ASTMAN_STATE_DOWN = 0,
+    ASTMAN_STATE_RSRVD,
+    ASTMAN_STATE_OFFHOOK,
+    ASTMAN_STATE_DIALING,
+    ASTMAN_STATE_RING,
+    ASTMAN_STATE_RINGING,
+    ASTMAN_STATE_UP,
+    ASTMAN_STATE_BUSY,
+    ASTMAN_STATE_DIALING_OFFHOOK,
+    ASTMAN_STATE_PRERING,
+    ASTMAN_STATE_UNKNOWN = -1
+};
+/*******************************************************************************
+ * @enum    astman_peer_status
+ ******************************************************************************/
+enum astman_peer_status {
+    ASTMAN_PEER_UNKNOWN = 0,
+    ASTMAN_PEER_REGISTERED,
+    ASTMAN_PEER_UNREGISTERED,
+    ASTMAN_PEER_REACHABLE,
+    ASTMAN_PEER_UNREACHABLE,
+    ASTMAN_PEER_LAGGED,
+    ASTMAN_PEER_REJECTED
+};
+/*******************************************************************************
+ * @struct  astman_slice
+ * @brief   A header value inside the message: never NULL, "" when the
+ *          header is missing, valid as long as the message is
+ ******************************************************************************/
+struct astman_slice {
+    const char *ptr;
+    int len;
+};
+/*******************************************************************************
+ * @struct  astman_ev_channel
+ * @brief   Channel snapshot (Dest* headers fill the second one of a dial)
+ ******************************************************************************/
+struct astman_ev_channel {
+    struct astman_slice channel;
+    struct astman_slice uniqueid;
+    struct astman_slice linkedid;
+    struct astman_slice calleridnum;
+    struct astman_slice calleridname;
+    struct astman_slice context;
+    struct astman_slice exten;
+    int priority;                   /**!< -1 if missing */
+    int state;                      /**!< enum astman_channel_state */
+};
+/*******************************************************************************
+ * @struct  astman_event
+ * @brief   A decoded event. Integers missing from the event are -1.
+ ******************************************************************************/
+struct astman_event {
+    int type;                       /**!< enum astman_event_type */
+    long long timestamp;            /**!< Timestamp header (us), 0 if none */
+    struct astman_ev_channel chan;  /**!< all but PeerStatus, QueueMemberStatus */
+    union {
+        struct {
+            int cause;
+            struct astman_slice cause_txt;
+        } hangup;
+        struct {
+            struct astman_slice channeltype;
+            struct astman_slice peer;
+            int status;             /**!< enum astman_peer_status */
+            struct astman_slice cause;
+            struct astman_slice address;
+            int time;               /**!< qualify time (ms) */
+        } peerstatus;
+        struct {
+            struct astman_slice queue;
+            struct astman_slice interface;  /**!< Interface or Location */
+            struct astman_slice membername;
+            struct astman_slice stateinterface;
+            int status;             /**!< device state (AST_DEVICE_*) */
+            int penalty;
+            int callstaken;
+            long long lastcall;     /**!< epoch seconds */
+            int paused;
+            int incall;
+        } queuemember;
+        struct {
+            struct astman_slice variable;
+            struct astman_slice value;
+        } varset;
+        struct {
+            struct astman_ev_channel dest;
+            struct astman_slice dialstring;
+            struct astman_slice dialstatus;
+        } dial;
+        struct {
+            struct astman_slice uniqueid;
+            struct astman_slice type;
+            struct astman_slice technology;
+            int numchannels;
+        } bridge;
+    } u;
+};
+/*******************************************************************************
+ * @fn int astman_event_type(const char *event)
+ * @return enum astman_event_type of an Event name
+ ******************************************************************************/
+int astman_event_type(const char *event);
+/*******************************************************************************
+ * @fn int astman_event_decode(struct message *m, struct astman_event *ev)
+ * @brief Decode m in one pass over its headers
+ * @return ASTMAN_SUCCESS, ASTMAN_FAILURE if m is not one of the decoded
+ *         events (ev->type is then ASTMAN_EV_UNKNOWN)
+ ******************************************************************************/
+int astman_event_decode(struct message *m, struct astman_event *ev);
+/*******************************************************************************
+ * @fn int astman_parse_int(const char *str, int len, long long *val)
+ * @brief Decimal integer, an optional sign, no locale, no sscanf
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (empty, not a number, overflow)
+ ******************************************************************************/
+int astman_parse_int(const char *str, int len, long long *val);
+#endif // ASTDECODE_H_INCLUDED
@@ -1,6 +1,6 @@
-#ifndef ASTEVENT_H_INCLUDED
-#define ASTEVENT_H_INCLUDED
-
+#ifndef ASTEVENT_H_INCLUDED
+#define ASTEVENT_H_INCLUDED
+
 /*******************************************************************************
  * astapi - library for using Asterisk Manager API.
  * Copyright (C) 2010 Baligh GUESMI
@@ -24,7 +24,7 @@
  *  @brief
  *  @author Baligh.GUESMI
  *  @date 20100524
- ******************************************************************************/
+ ******************************************************************************/
 #define ASTMAN_HEADER_EVENT                 "Event"
 
 #define ASTMAN_EVENT_PEER_ENTRY             "PeerEntry"
@@ -41,6 +41,8 @@
 #define ASTMAN_EVENT_REGISTRATIONS_COMPLETE "RegistrationsComplete"
 #define ASTMAN_EVENT_REGISTRY_ENTRY         "RegistryEntry"
 
+#define ASTMAN_EVENT_RELOAD                 "Reload"
+
 /*******************************************************************************
  * @typedef (*ASTMAN_EVENT_CALLBACK)
  * @brief   CallBack Event proto-type
@@ -58,6 +60,30 @@ typedef int (*ASTMAN_EVENT_CALLBACK)(struct mansession *, struct message *);
  ******************************************************************************/
 int astman_add_event_handler_system(struct mansession *s, ASTMAN_EVENT_CALLBACK callback );
 
+/*******************************************************************************
+ *  \fn int astman_add_event_handler(struct mansession *s, char *event,
+ *                                   ASTMAN_EVENT_CALLBACK callback)
+ *  \brief  Register (or remove, callback NULL) the handler of an Event.
+ *          event may be a pattern: "Queue*" catches every Queue event,
+ *          '?' matches one character. An exact name wins over patterns,
+ *          then the pattern with the most literal characters.
+ *  \return 1 registered, 0 removed, -1 on error
+ ******************************************************************************/
+int astman_add_event_handler(struct mansession *s, char *event, ASTMAN_EVENT_CALLBACK callback );
+
+/*******************************************************************************
+ *  \fn int astman_call_handler(struct mansession *s, const char *event,
+ *                              ASTMAN_EVENT_CALLBACK func,
+ *                              struct message *m, int system)
+ *  \brief  Library side: run an event callback, timed when the profiler is
+ *          enabled. Every path delivering events goes through it.
+ *  \param  system: func is the DEFAULT handler, a 0 return is a drop
+ *  \return the callback return
+ ******************************************************************************/
+int astman_call_handler(struct mansession *s, const char *event,
+                        ASTMAN_EVENT_CALLBACK func, struct message *m,
+                        int system);
+
 /*******************************************************************************
  *  \fn astman_add_param(char *buf, int buflen, char *header, char *value)
  *  \brief  Add a new parameter to the Command
@@ -99,5 +125,5 @@ int astman_status_callback(struct mansession *s, struct message *m);
  *  \param  value
  *  \return Number of wrote characters into the buf
  ******************************************************************************/
-int astman_sipshowregistry_callback(struct mansession *s, struct message *m);
-#endif // ASTEVENT_H_INCLUDED
+int astman_sipshowregistry_callback(struct mansession *s, struct message *m);
+#endif // ASTEVENT_H_INCLUDED
@@ -0,0 +1,115 @@
+#ifndef ASTFLOW_H_INCLUDED
+#define ASTFLOW_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astflow.h
+ *  @brief Flow control of event subscriptions: the events of a subscription
+ *         with a queue are only copied while the socket is read, and handed
+ *         to its callback by astman_flow_drain(). A full queue sheds low
+ *         value events according to its policy, so a slow handler never
+ *         stalls the connection.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+#include "astevent.h"
+/*******************************************************************************
+ *  @def    ASTMAN_FLOW_DROP_OLDEST
+ *  @brief  Full queue: the oldest droppable event makes room
+ ******************************************************************************/
+#define ASTMAN_FLOW_DROP_OLDEST     1
+/*******************************************************************************
+ *  @def    ASTMAN_FLOW_DROP_NEWEST
+ *  @brief  Full queue: the incoming event is dropped
+ ******************************************************************************/
+#define ASTMAN_FLOW_DROP_NEWEST     2
+/*******************************************************************************
+ *  @def    ASTMAN_FLOW_SAMPLE
+ *  @brief  Full queue: one incoming event in sample is kept (as with
+ *          ASTMAN_FLOW_DROP_OLDEST), the others are dropped
+ ******************************************************************************/
+#define ASTMAN_FLOW_SAMPLE          3
+/*******************************************************************************
+ * @struct  astman_flow_stats
+ ******************************************************************************/
+struct astman_flow_stats {
+    int queued;                     /**!< events waiting */
+    int peak;                       /**!< most events waiting */
+    unsigned long long delivered;   /**!< handed to the callback */
+    unsigned long long dropped;     /**!< shed by DROP_OLDEST / DROP_NEWEST */
+    unsigned long long sampled;     /**!< shed by SAMPLE */
+    unsigned long long kept;        /**!< critical events queued past the
+                                         depth */
+};
+/*******************************************************************************
+ * @fn int astman_set_flow(struct mansession *s, char *event, int depth,
+ *                         int policy, int sample)
+ * @brief Queue the events of a subscription made with
+ *        astman_add_event_handler(). Critical events (Hangup, Newchannel,
+ *        Dial, Bridge, OriginateResponse, Cdr, Shutdown...) are never
+ *        dropped: they go past the depth when the queue is full.
+ * @param event: name or pattern, as subscribed
+ * @param depth: queued events, 0 to deliver them at once again (the
+ *               queued ones are delivered first)
+ * @param policy: ASTMAN_FLOW_DROP_OLDEST, ASTMAN_FLOW_DROP_NEWEST or
+ *                ASTMAN_FLOW_SAMPLE
+ * @param sample: N of ASTMAN_FLOW_SAMPLE
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (not subscribed)
+ ******************************************************************************/
+int astman_set_flow(struct mansession *s, char *event, int depth, int policy,
+                    int sample);
+/*******************************************************************************
+ * @fn int astman_flow_drain(struct mansession *s, int max)
+ * @brief Hand queued events to their callbacks, the queues taking turns.
+ *        astman_poll() does it after reading what arrived; programs using
+ *        the blocking calls only call it themselves.
+ * @param max: events to deliver, <= 0 for all
+ * @return number of events delivered
+ ******************************************************************************/
+int astman_flow_drain(struct mansession *s, int max);
+/*******************************************************************************
+ * @fn int astman_flow_stats(struct mansession *s, char *event,
+ *                           struct astman_flow_stats *st)
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (no queue for event)
+ ******************************************************************************/
+int astman_flow_stats(struct mansession *s, char *event,
+                      struct astman_flow_stats *st);
+/*******************************************************************************
+ * @fn int astman_flow_critical(int event)
+ * @param event: interned Event name (astman_message_event())
+ * @return 1 if events of this name are never dropped
+ ******************************************************************************/
+int astman_flow_critical(int event);
+/*******************************************************************************
+ * @fn int astman_flow_push(struct mansession *s, void *queue,
+ *                          ASTMAN_EVENT_CALLBACK func, struct message *m)
+ * @brief Library side: queue an event matched by a subscription with a
+ *        queue
+ * @return ASTMAN_SUCCESS, ASTMAN_FAILURE to deliver it now
+ ******************************************************************************/
+int astman_flow_push(struct mansession *s, void *queue,
+                     ASTMAN_EVENT_CALLBACK func, struct message *m);
+/*******************************************************************************
+ * @fn void astman_flow_free(struct mansession *s)
+ * @brief Library side: drop the queues of a session being released
+ ******************************************************************************/
+void astman_flow_free(struct mansession *s);
+#endif // ASTFLOW_H_INCLUDED
@@ -0,0 +1,147 @@
+#ifndef ASTJOURNAL_H_INCLUDED
+#define ASTJOURNAL_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astjournal.h
+ *  @brief Durable event journal: events are appended as checksummed frames
+ *         to memory mapped segment files, consumers read them back through
+ *         named cursors that survive restarts. One writer (the session),
+ *         any number of readers, in this process or after a restart.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ *  @def    ASTMAN_JOURNAL_SEGMENT_SIZE
+ *  @brief  Default segment size (bytes)
+ ******************************************************************************/
+#define ASTMAN_JOURNAL_SEGMENT_SIZE (64 * 1024 * 1024)
+/*******************************************************************************
+ * @struct  astman_journal
+ * @brief   Opaque journal
+ ******************************************************************************/
+struct astman_journal;
+/*******************************************************************************
+ * @struct  astman_journal_cursor
+ * @brief   Opaque consumer position
+ ******************************************************************************/
+struct astman_journal_cursor;
+/*******************************************************************************
+ * @struct  astman_journal_config
+ ******************************************************************************/
+struct astman_journal_config {
+    size_t segment_size;    /**!< 0: ASTMAN_JOURNAL_SEGMENT_SIZE */
+    int max_segments;       /**!< older segments are deleted once every cursor
+                                 committed past them, 0 keeps them all */
+    int sync_events;        /**!< msync every sync_events appends, 0 = never */
+    int sync_ms;            /**!< msync when the oldest unsynced append is
+                                 sync_ms old (checked on append), 0 = never */
+};
+/*******************************************************************************
+ * @fn struct astman_journal *astman_journal_open(const char *dir,
+ *                                   const struct astman_journal_config *cfg)
+ * @brief Open (or create) the journal of a directory. A torn frame at the
+ *        end of the last segment (crash) is dropped.
+ * @param cfg: NULL for the defaults (no explicit sync, nothing deleted)
+ * @return the journal, NULL on error
+ ******************************************************************************/
+struct astman_journal *astman_journal_open(const char *dir,
+                                           const struct astman_journal_config *cfg);
+/*******************************************************************************
+ * @fn void astman_journal_close(struct astman_journal *j)
+ * @brief Sync, then release the journal and its cursors
+ ******************************************************************************/
+void astman_journal_close(struct astman_journal *j);
+/*******************************************************************************
+ * @fn unsigned long long astman_journal_append(struct astman_journal *j,
+ *                                              struct message *m)
+ * @warning One writer thread
+ * @return sequence number of the event (from 1), 0 on error
+ ******************************************************************************/
+unsigned long long astman_journal_append(struct astman_journal *j,
+                                         struct message *m);
+/*******************************************************************************
+ * @fn int astman_journal_sync(struct astman_journal *j)
+ * @brief Flush the appended events to disk
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_journal_sync(struct astman_journal *j);
+/*******************************************************************************
+ * @fn unsigned long long astman_journal_next_seq(struct astman_journal *j)
+ * @return sequence number the next append gets
+ ******************************************************************************/
+unsigned long long astman_journal_next_seq(struct astman_journal *j);
+/*******************************************************************************
+ * @fn unsigned long long astman_journal_first_seq(struct astman_journal *j)
+ * @return oldest sequence number still in the journal
+ ******************************************************************************/
+unsigned long long astman_journal_first_seq(struct astman_journal *j);
+/*******************************************************************************
+ * @fn int astman_journal_attach(struct mansession *s,
+ *                               struct astman_journal *j)
+ * @brief Journal every event of s before its handlers run (NULL detaches)
+ * @return ASTMAN_SUCCESS
+ ******************************************************************************/
+int astman_journal_attach(struct mansession *s, struct astman_journal *j);
+/*******************************************************************************
+ * @fn struct astman_journal_cursor *astman_journal_cursor(
+ *                          struct astman_journal *j, const char *name,
+ *                          int from_oldest)
+ * @brief The cursor of a consumer, created on first use. Its committed
+ *        position is stored in the journal directory.
+ * @param from_oldest: a new cursor starts at the oldest event kept (1) or
+ *                     at the next event appended (0)
+ * @return the cursor (owned by the journal), NULL on error
+ ******************************************************************************/
+struct astman_journal_cursor *astman_journal_cursor(struct astman_journal *j,
+                                                    const char *name,
+                                                    int from_oldest);
+/*******************************************************************************
+ * @fn int astman_journal_cursor_remove(struct astman_journal *j,
+ *                                      const char *name)
+ * @brief Forget a consumer: its position no longer holds segments back
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (unknown)
+ ******************************************************************************/
+int astman_journal_cursor_remove(struct astman_journal *j, const char *name);
+/*******************************************************************************
+ * @fn int astman_journal_read(struct astman_journal_cursor *c,
+ *                             struct message *m, unsigned long long *seq)
+ * @brief Next event of the cursor, straight from the mapped segment
+ * @param seq: NULL or its sequence number
+ * @warning One thread per cursor
+ * @return 1 an event, 0 caught up, -1 on error
+ ******************************************************************************/
+int astman_journal_read(struct astman_journal_cursor *c, struct message *m,
+                        unsigned long long *seq);
+/*******************************************************************************
+ * @fn int astman_journal_seek(struct astman_journal_cursor *c,
+ *                             unsigned long long seq)
+ * @brief Move the read position (seq is clamped to the journal)
+ ******************************************************************************/
+int astman_journal_seek(struct astman_journal_cursor *c, unsigned long long seq);
+/*******************************************************************************
+ * @fn int astman_journal_commit(struct astman_journal_cursor *c)
+ * @brief Store the read position: a restart resumes there, and segments
+ *        before it may be deleted
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_journal_commit(struct astman_journal_cursor *c);
+#endif // ASTJOURNAL_H_INCLUDED
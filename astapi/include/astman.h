@@ -1,6 +1,6 @@
-#ifndef ASTMAN_H_INCLUDED
-#define ASTMAN_H_INCLUDED
-
+#ifndef ASTMAN_H_INCLUDED
+#define ASTMAN_H_INCLUDED
+
 /*******************************************************************************
  * astapi - library for using Asterisk Manager API.
  * Copyright (C) 2010 Baligh GUESMI
@@ -31,7 +31,7 @@
  *  @def    CRLF
  *  @brief
  ******************************************************************************/
-#define CRLF "\r\n"
+#define CRLF "\r\n"
 /*******************************************************************************
  * @struct  message
  * @brief   The struct representing the message command to send
@@ -40,7 +40,20 @@ struct message {
   int hdrcount;                         /**!< Header count */
   int gettingdata;                      /**!< data */
   char headers[MAX_HEADERS][MAX_LEN];   /**!< Headers list */
+  int event;                            /**!< interned Event name (astnames.h) */
+  unsigned short hdrid[MAX_HEADERS];    /**!< interned header names, 0 if not */
 } __attribute__((packed));
+struct mansession;
+/*******************************************************************************
+ * @struct  astman_transport
+ * @brief   Replaces send() on the socket, for event loops that own the I/O
+ *          of the session (io_uring). send must take or copy the whole
+ *          buffer.
+ ******************************************************************************/
+struct astman_transport {
+  int (*send)(struct mansession *s, const char *buf, size_t len, void *data); /**!< 0 or -1 */
+  void *data;
+};
 /*******************************************************************************
  * @struct  mansession
  * @brief   The struct of an opened AMI session
@@ -55,7 +68,35 @@ struct mansession {
     int (*func)(struct mansession *s, struct message *m); /**!< callback associated to this event */
   } events[MAX_EVENTS]; /**!< event registred to */
   int eventcount; /**!< the real count of event that the session is registred to */
+  struct astman_subs *subs; /**!< named and pattern event handlers, NULL until used */
   int debug:1;    /**!< active/desactivated DEBUG */
+  struct metrics_pending {
+    int action;                   /**!< metrics index of the action name */
+    unsigned long long sent;      /**!< send time (ns) */
+    unsigned int skip;            /**!< untracked actions sent right after */
+  } mpending[MAX_PENDING_ACTIONS]; /**!< actions waiting for their response */
+  unsigned int mhead;             /**!< next response is mpending[mhead] */
+  unsigned int mtail;             /**!< next send goes to mpending[mtail] */
+  unsigned int mskip;             /**!< responses to untracked actions due
+                                       before mpending[mhead]'s */
+  int mlist_action;               /**!< action streaming its list + 1, 0 if none */
+  unsigned long long mlist_first; /**!< its first response time (ns) */
+  struct astman_profiler *profiler; /**!< event profiler, NULL if disabled */
+  struct astman_batch *batch;   /**!< batched event delivery, NULL if disabled */
+  struct astman_async *async;   /**!< asynchronous actions, NULL until used */
+  struct astman_transport *transport; /**!< NULL: blocking send() on fd */
+  int spin_usec;                /**!< latency mode: spin before parking, 0 = park */
+  int busy_poll_usec;           /**!< SO_BUSY_POLL of the socket, 0 = none */
+  struct astman_journal *journal; /**!< events are journaled first, NULL if not */
+  struct astman_state *state;     /**!< shared memory state, NULL if not published */
+  struct astman_sync *sync;     /**!< live events held during a snapshot, NULL if none */
+  int corked;                   /**!< astman_cork() depth, sends are held */
+  char *wbuf;                   /**!< actions held while corked */
+  unsigned int wlen;            /**!< bytes held */
+  unsigned int wsize;           /**!< size of wbuf */
+  struct astman_mem *mem;       /**!< memory accounting, NULL until charged */
+  struct astman_flow *flow;     /**!< subscription queues, NULL if none */
+  struct astman_config *config_build; /**!< GetConfig response being cached, NULL if none */
 } __attribute__((packed));
 /*******************************************************************************
  * @fn  astman_strlen_zero(const char *s)
@@ -89,6 +130,42 @@ int astman_manager_action_params(struct mansession *s, char *action, char *param
  *  \return
  ******************************************************************************/
 int astman_wait_for_response(struct mansession *s, struct message *msg, time_t timeout);
+/*******************************************************************************
+ *  \fn int astman_read_message(struct mansession *s, struct message *m,
+ *                              int timeout_ms)
+ *  \brief  Assemble the next message into m without dispatching it.
+ *          A partial message stays in m: pass the same m again to go on.
+ *  \param  timeout_ms: 0 only uses the data already received, < 0 waits
+ *                      forever
+ *  \return 1 when m holds a complete message, 0 if not yet, -1 on error
+ ******************************************************************************/
+int astman_read_message(struct mansession *s, struct message *m, int timeout_ms);
+/*******************************************************************************
+ *  \fn int astman_message_input(struct mansession *s, struct message *m,
+ *                               const char **data, size_t *len)
+ *  \brief  Parse received bytes in place, for transports that fill their
+ *          own buffers. Complete lines go straight into m, a trailing partial
+ *          line is kept in the session until the next buffer.
+ *  \param  data, len: advanced past what was consumed
+ *  \return 1 when m holds a complete message (call again for the rest of
+ *          data), 0 when data is exhausted
+ ******************************************************************************/
+int astman_message_input(struct mansession *s, struct message *m,
+                         const char **data, size_t *len);
+/*******************************************************************************
+ *  \fn int astman_dispatch_message(struct mansession *s, struct message *m)
+ *  \brief  Account and dispatch a message read by astman_read_message() to
+ *          the event handlers.
+ *  \return the handler result (> 0 consumed, < 0 error), 0 otherwise
+ ******************************************************************************/
+int astman_dispatch_message(struct mansession *s, struct message *m);
+/*******************************************************************************
+ *  \fn int astman_dispatch_event(struct mansession *s, struct message *m)
+ *  \brief  Dispatch an event already accounted for and journaled
+ *          (replayed)
+ *  \return as astman_dispatch_message()
+ ******************************************************************************/
+int astman_dispatch_event(struct mansession *s, struct message *m);
 /*******************************************************************************
  * @fn char *astman_get_header(struct message *m, const char *var)
  * @brief
@@ -102,6 +179,20 @@ char *astman_get_header(struct message *m, const char *var);
  * @return
  ******************************************************************************/
 int astman_manager_action(struct mansession *s, char *action, char *fmt, ...);
+/*******************************************************************************
+ * @fn int astman_cork(struct mansession *s)
+ * @brief Hold the actions sent on s until astman_uncork(), which writes them
+ *        in one go. Calls nest.
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_cork(struct mansession *s);
+/*******************************************************************************
+ * @fn int astman_uncork(struct mansession *s)
+ * @brief Write the actions held since the outermost astman_cork()
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (write error, the held actions
+ *         are lost)
+ ******************************************************************************/
+int astman_uncork(struct mansession *s);
 /*******************************************************************************
  *  \fn astman_add_param(char *buf, int buflen, char *header, char *value)
  *  \brief  Add a new parameter to the Command
@@ -112,6 +203,18 @@ int astman_manager_action(struct mansession *s, char *action, char *fmt, ...);
  *  \return Number of wrote characters into the buf
  ******************************************************************************/
 struct mansession *astman_open(void);
+/*******************************************************************************
+ *  \fn struct mansession *astman_session_new(void)
+ *  \brief  Allocate a session of its own (astman_open() always returns the
+ *          same static one)
+ *  \return the session, NULL if out of memory
+ ******************************************************************************/
+struct mansession *astman_session_new(void);
+/*******************************************************************************
+ *  \fn void astman_session_free(struct mansession *s)
+ *  \brief  Disconnect and release a session from astman_session_new()
+ ******************************************************************************/
+void astman_session_free(struct mansession *s);
 /*******************************************************************************
  *  \fn astman_add_param(char *buf, int buflen, char *header, char *value)
  *  \brief  Add a new parameter to the Command
@@ -152,6 +255,20 @@ int astman_logoff(struct mansession *s);
  *  \return Number of wrote characters into the buf
  ******************************************************************************/
 void astman_disconnect(struct mansession *s);
+/*******************************************************************************
+ *  \fn int astman_set_latency_mode(struct mansession *s, int spin_usec,
+ *                                  int busy_poll_usec, int cpu)
+ *  \brief  Latency mode of the session reader. When no data is buffered,
+ *          reads spin on non blocking recv() for up to spin_usec before
+ *          parking in poll() (the default, spin_usec 0). busy_poll_usec sets
+ *          SO_BUSY_POLL on the socket (kept across astman_connect()), cpu
+ *          pins the calling thread, the one reading s.
+ *  \param  cpu: < 0 leaves the thread where it is
+ *  \return ASTMAN_SUCCESS, ASTMAN_FAILURE if busy polling or pinning was
+ *          refused (the rest of the mode stays active)
+ ******************************************************************************/
+int astman_set_latency_mode(struct mansession *s, int spin_usec,
+                            int busy_poll_usec, int cpu);
 /*******************************************************************************
  *  \fn astman_add_param(char *buf, int buflen, char *header, char *value)
  *  \brief  Add a new parameter to the Command
@@ -162,4 +279,4 @@ void astman_disconnect(struct mansession *s);
  *  \return Number of wrote characters into the buf
  ******************************************************************************/
 void astman_dump_message(struct message *m);
-#endif // ASTMAN_H_INCLUDED
+#endif // ASTMAN_H_INCLUDED
@@ -0,0 +1,128 @@
+#ifndef ASTMEM_H_INCLUDED
+#define ASTMEM_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astmem.h
+ *  @brief Memory accounting and budgets, per session and for the whole
+ *         library, by category
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <stddef.h>
+#include "astman.h"
+/*******************************************************************************
+ * @enum    astman_mem_category
+ ******************************************************************************/
+enum astman_mem_category {
+    ASTMAN_MEM_OUTPUT,      /**!< buffered output of corked sessions */
+    ASTMAN_MEM_LISTS,       /**!< list results being assembled, snapshot
+                                 deltas held by astman_sync() */
+    ASTMAN_MEM_PENDING,     /**!< asynchronous actions and their responses */
+    ASTMAN_MEM_CACHE,       /**!< response cache (library wide) */
+    ASTMAN_MEM_QUEUES,      /**!< batched event delivery */
+    ASTMAN_MEM_CATEGORIES
+};
+/*******************************************************************************
+ *  @def    ASTMAN_MEM_OK
+ *  @brief  astman_mem_charge(): charged
+ ******************************************************************************/
+#define ASTMAN_MEM_OK       0
+/*******************************************************************************
+ *  @def    ASTMAN_MEM_REJECT
+ *  @brief  Overflow policy: the operation needing the memory fails (list
+ *          action answered ASTMAN_FAILURE, action not sent, send error)
+ ******************************************************************************/
+#define ASTMAN_MEM_REJECT   1
+/*******************************************************************************
+ *  @def    ASTMAN_MEM_SHED
+ *  @brief  Overflow policy: the item is dropped and the operation goes on
+ *          (list entry or event lost, response not cached). Held snapshot
+ *          deltas are dispatched at once instead.
+ ******************************************************************************/
+#define ASTMAN_MEM_SHED     2
+/*******************************************************************************
+ *  @def    ASTMAN_MEM_SPILL
+ *  @brief  Overflow policy: held snapshot deltas go to a temporary file and
+ *          are read back for the replay. Other categories behave as
+ *          ASTMAN_MEM_REJECT.
+ ******************************************************************************/
+#define ASTMAN_MEM_SPILL    3
+/*******************************************************************************
+ * @struct  astman_mem_usage
+ ******************************************************************************/
+struct astman_mem_usage {
+    size_t current;                 /**!< bytes in use */
+    size_t peak;                    /**!< highest current */
+    size_t limit;                   /**!< 0 for none */
+    int policy;                     /**!< on overflow */
+    unsigned long long rejected;    /**!< overflows per policy */
+    unsigned long long shed;
+    unsigned long long spilled;
+};
+/*******************************************************************************
+ * @struct  astman_mem_stats
+ ******************************************************************************/
+struct astman_mem_stats {
+    size_t current;                 /**!< all categories */
+    size_t peak;                    /**!< highest current */
+    struct astman_mem_usage category[ASTMAN_MEM_CATEGORIES];
+};
+/*******************************************************************************
+ * @fn int astman_mem_set_limit(struct mansession *s, int category,
+ *                              size_t limit, int policy)
+ * @brief Budget of a category for s, or for the whole library when s is
+ *        NULL. A charge must fit both.
+ * @param limit: bytes, 0 for no limit
+ * @param policy: ASTMAN_MEM_REJECT, ASTMAN_MEM_SHED or ASTMAN_MEM_SPILL
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_mem_set_limit(struct mansession *s, int category, size_t limit,
+                         int policy);
+/*******************************************************************************
+ * @fn int astman_mem_stats(struct mansession *s, struct astman_mem_stats *st)
+ * @brief Usage of s, or of the whole library when s is NULL
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_mem_stats(struct mansession *s, struct astman_mem_stats *st);
+/*******************************************************************************
+ * @fn const char *astman_mem_category_name(int category)
+ ******************************************************************************/
+const char *astman_mem_category_name(int category);
+/*******************************************************************************
+ * @fn int astman_mem_charge(struct mansession *s, int category, size_t bytes)
+ * @brief Library side: account bytes about to be allocated, to s (NULL for
+ *        library wide memory) and to the library
+ * @return ASTMAN_MEM_OK, else the policy of the budget that would be
+ *         exceeded (nothing charged)
+ ******************************************************************************/
+int astman_mem_charge(struct mansession *s, int category, size_t bytes);
+/*******************************************************************************
+ * @fn void astman_mem_release(struct mansession *s, int category,
+ *                             size_t bytes)
+ * @brief Library side: bytes charged earlier are freed
+ ******************************************************************************/
+void astman_mem_release(struct mansession *s, int category, size_t bytes);
+/*******************************************************************************
+ * @fn void astman_mem_free(struct mansession *s)
+ * @brief Library side: drop the accounting of a session being released
+ ******************************************************************************/
+void astman_mem_free(struct mansession *s);
+#endif // ASTMEM_H_INCLUDED
@@ -0,0 +1,121 @@
+#ifndef ASTMETRICS_H_INCLUDED
+#define ASTMETRICS_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astmetrics.h
+ *  @brief Latency histograms and throughput counters.
+ *         Counters are kept per thread without locking and merged when a
+ *         snapshot is taken.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <stddef.h>
+#include <stdio.h>
+#include "astman.h"
+/*******************************************************************************
+ *  @def    ASTMAN_METRICS_MAX_ACTIONS
+ *  @brief  Distinct action names tracked, others are accounted as "Other"
+ ******************************************************************************/
+#define ASTMAN_METRICS_MAX_ACTIONS  48
+/*******************************************************************************
+ *  @def    ASTMAN_METRICS_SUB_BITS
+ *  @brief  log-linear histogram: 2^SUB_BITS buckets per power of two,
+ *          values are recorded in micro-seconds.
+ ******************************************************************************/
+#define ASTMAN_METRICS_SUB_BITS     3
+#define ASTMAN_METRICS_SUB_BUCKETS  (1 << (ASTMAN_METRICS_SUB_BITS))
+#define ASTMAN_METRICS_BUCKETS      ((ASTMAN_METRICS_SUB_BUCKETS) * 38)
+/*******************************************************************************
+ * @struct  astman_metrics_histogram
+ * @brief   HDR style latency histogram (micro-seconds)
+ ******************************************************************************/
+struct astman_metrics_histogram {
+  unsigned long long count;                         /**!< recorded values */
+  unsigned long long sum;                           /**!< sum of the values */
+  unsigned long long max;                           /**!< biggest value */
+  unsigned int buckets[ASTMAN_METRICS_BUCKETS];     /**!< log-linear buckets */
+};
+/*******************************************************************************
+ * @struct  astman_metrics_action
+ * @brief   Per action name metrics
+ ******************************************************************************/
+struct astman_metrics_action {
+  char name[MAX_NAME_LEN];                          /**!< Action: name */
+  unsigned long long sent;                          /**!< requests sent */
+  unsigned long long success;                       /**!< Success responses */
+  unsigned long long failure;                       /**!< other responses */
+  unsigned long long timeouts;                      /**!< no response in time */
+  struct astman_metrics_histogram first_response;   /**!< send -> response */
+  struct astman_metrics_histogram list_complete;    /**!< response -> list
+                                                         complete event */
+};
+/*******************************************************************************
+ * @struct  astman_metrics_snapshot
+ * @brief   Merged view of every thread counters. The structure is big
+ *          (about 120 KB), do not put it on a small stack.
+ ******************************************************************************/
+struct astman_metrics_snapshot {
+  unsigned long long bytes_in;          /**!< bytes received */
+  unsigned long long bytes_out;         /**!< bytes sent */
+  unsigned long long packets_in;        /**!< successful recv() calls */
+  unsigned long long packets_out;       /**!< actions sent */
+  unsigned long long messages_in;       /**!< responses and events parsed */
+  unsigned long long events_in;         /**!< events parsed */
+  unsigned long long parse_errors;      /**!< dropped lines/headers/events */
+  unsigned long long timeouts;          /**!< astman_wait_for_response timeouts */
+  unsigned long long untracked;         /**!< actions sent while
+                                             MAX_PENDING_ACTIONS others were
+                                             unanswered: no latency */
+  int nactions;                         /**!< used entries of actions */
+  struct astman_metrics_action actions[ASTMAN_METRICS_MAX_ACTIONS];
+};
+/*******************************************************************************
+ * @fn int astman_metrics_snapshot(struct astman_metrics_snapshot *snap)
+ * @brief Merge the counters of every thread (alive or exited) into snap.
+ *        Only takes the registration lock, recording threads never wait.
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_metrics_snapshot(struct astman_metrics_snapshot *snap);
+/*******************************************************************************
+ * @fn unsigned long long astman_metrics_percentile(
+ *                          const struct astman_metrics_histogram *h, double p)
+ * @brief Value (micro-seconds) under which p percent of the records are
+ * @param p: 0.0 .. 100.0
+ ******************************************************************************/
+unsigned long long astman_metrics_percentile(const struct astman_metrics_histogram *h,
+                                             double p);
+/*******************************************************************************
+ * @fn void astman_metrics_dump(FILE *f)
+ * @brief Print a snapshot (counters, count/p50/p99/max per action)
+ ******************************************************************************/
+void astman_metrics_dump(FILE *f);
+/*******************************************************************************
+ * Library side instrumentation, called from astman.c
+ ******************************************************************************/
+unsigned long long astman_metrics_now(void);
+void astman_metrics_sent(struct mansession *s, const char *action, size_t bytes);
+void astman_metrics_received(size_t bytes);
+void astman_metrics_response(struct mansession *s, struct message *m, int success);
+void astman_metrics_event(struct mansession *s, struct message *m);
+void astman_metrics_list_complete(struct mansession *s);
+void astman_metrics_timeout(struct mansession *s);
+void astman_metrics_parse_error(void);
+#endif // ASTMETRICS_H_INCLUDED
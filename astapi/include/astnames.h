@@ -0,0 +1,357 @@
+#ifndef ASTNAMES_H_INCLUDED
+#define ASTNAMES_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astnames.h
+ *  @brief Interned AMI vocabulary: every well-known header and Event name
+ *         has a small integer ID. The parser tags each header and the Event
+ *         of a message with them, so comparisons become integer compares.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ * @def     ASTMAN_HEADER_NAMES
+ * @brief   Known header names: X(ID suffix, name)
+ ******************************************************************************/
+#define ASTMAN_HEADER_NAMES(X) \
+    X(ACTIONID, "ActionID") \
+    X(ACTION, "Action") \
+    X(EVENT, "Event") \
+    X(RESPONSE, "Response") \
+    X(MESSAGE, "Message") \
+    X(PRIVILEGE, "Privilege") \
+    X(EVENTLIST, "EventList") \
+    X(LISTITEMS, "ListItems") \
+    X(TIMESTAMP, "Timestamp") \
+    X(SYSTEMNAME, "SystemName") \
+    X(OUTPUT, "Output") \
+    X(REASON, "Reason") \
+    X(CHANNEL, "Channel") \
+    X(CHANNELSTATE, "ChannelState") \
+    X(CHANNELSTATEDESC, "ChannelStateDesc") \
+    X(CALLERIDNUM, "CallerIDNum") \
+    X(CALLERIDNAME, "CallerIDName") \
+    X(CALLERID, "CallerID") \
+    X(CONNECTEDLINENUM, "ConnectedLineNum") \
+    X(CONNECTEDLINENAME, "ConnectedLineName") \
+    X(LANGUAGE, "Language") \
+    X(ACCOUNTCODE, "AccountCode") \
+    X(CONTEXT, "Context") \
+    X(EXTEN, "Exten") \
+    X(PRIORITY, "Priority") \
+    X(UNIQUEID, "Uniqueid") \
+    X(LINKEDID, "Linkedid") \
+    X(STATE, "State") \
+    X(DESTCHANNEL, "DestChannel") \
+    X(DESTCHANNELSTATE, "DestChannelState") \
+    X(DESTCHANNELSTATEDESC, "DestChannelStateDesc") \
+    X(DESTCALLERIDNUM, "DestCallerIDNum") \
+    X(DESTCALLERIDNAME, "DestCallerIDName") \
+    X(DESTCALLERID, "DestCallerID") \
+    X(DESTCONNECTEDLINENUM, "DestConnectedLineNum") \
+    X(DESTCONNECTEDLINENAME, "DestConnectedLineName") \
+    X(DESTLANGUAGE, "DestLanguage") \
+    X(DESTACCOUNTCODE, "DestAccountCode") \
+    X(DESTCONTEXT, "DestContext") \
+    X(DESTEXTEN, "DestExten") \
+    X(DESTPRIORITY, "DestPriority") \
+    X(DESTUNIQUEID, "DestUniqueid") \
+    X(DESTLINKEDID, "DestLinkedid") \
+    X(DESTSTATE, "DestState") \
+    X(DESTINATION, "Destination") \
+    X(SRCUNIQUEID, "SrcUniqueID") \
+    X(SUBEVENT, "SubEvent") \
+    X(DIALSTRING, "DialString") \
+    X(DIALSTATUS, "DialStatus") \
+    X(CAUSE, "Cause") \
+    X(CAUSE_TXT, "Cause-txt") \
+    X(VARIABLE, "Variable") \
+    X(VALUE, "Value") \
+    X(CHANNELTYPE, "ChannelType") \
+    X(PEER, "Peer") \
+    X(PEERSTATUS, "PeerStatus") \
+    X(ADDRESS, "Address") \
+    X(PORT, "Port") \
+    X(TIME, "Time") \
+    X(OBJECTNAME, "ObjectName") \
+    X(CHANOBJECTTYPE, "ChanObjectType") \
+    X(IPADDRESS, "IPaddress") \
+    X(IPPORT, "IPport") \
+    X(DYNAMIC, "Dynamic") \
+    X(FORCERPORT, "Forcerport") \
+    X(COMEDIA, "Comedia") \
+    X(VIDEOSUPPORT, "VideoSupport") \
+    X(TEXTSUPPORT, "TextSupport") \
+    X(ACL, "ACL") \
+    X(STATUS, "Status") \
+    X(REALTIMEDEVICE, "RealtimeDevice") \
+    X(DESCRIPTION, "Description") \
+    X(QUEUE, "Queue") \
+    X(INTERFACE, "Interface") \
+    X(LOCATION, "Location") \
+    X(MEMBERNAME, "MemberName") \
+    X(STATEINTERFACE, "StateInterface") \
+    X(MEMBERSHIP, "Membership") \
+    X(PENALTY, "Penalty") \
+    X(CALLSTAKEN, "CallsTaken") \
+    X(LASTCALL, "LastCall") \
+    X(PAUSED, "Paused") \
+    X(INCALL, "InCall") \
+    X(RINGINUSE, "Ringinuse") \
+    X(MAX, "Max") \
+    X(STRATEGY, "Strategy") \
+    X(CALLS, "Calls") \
+    X(HOLDTIME, "Holdtime") \
+    X(TALKTIME, "TalkTime") \
+    X(COMPLETED, "Completed") \
+    X(ABANDONED, "Abandoned") \
+    X(SERVICELEVEL, "ServiceLevel") \
+    X(SERVICELEVELPERF, "ServicelevelPerf") \
+    X(WEIGHT, "Weight") \
+    X(POSITION, "Position") \
+    X(COUNT, "Count") \
+    X(WAIT, "Wait") \
+    X(BRIDGEUNIQUEID, "BridgeUniqueid") \
+    X(BRIDGETYPE, "BridgeType") \
+    X(BRIDGETECHNOLOGY, "BridgeTechnology") \
+    X(BRIDGECREATOR, "BridgeCreator") \
+    X(BRIDGENAME, "BridgeName") \
+    X(BRIDGENUMCHANNELS, "BridgeNumChannels") \
+    X(HOST, "Host") \
+    X(USERNAME, "Username") \
+    X(DOMAIN, "Domain") \
+    X(REFRESH, "Refresh") \
+    X(REGISTRATIONTIME, "RegistrationTime") \
+    X(MODULE, "Module") \
+    X(EXTENSION, "Extension") \
+    X(HINT, "Hint") \
+    X(APPLICATION, "Application") \
+    X(APPDATA, "AppData") \
+    X(DURATION, "Duration") \
+    X(SECONDS, "Seconds") \
+    X(FAMILY, "Family") \
+    X(KEY, "Key") \
+    X(VAL, "Val") \
+    X(MAILBOX, "Mailbox") \
+    X(WAITING, "Waiting") \
+    X(NEW, "New") \
+    X(OLD, "Old") \
+    X(CATEGORY, "Category") \
+    X(USEREVENT, "UserEvent") \
+    X(AGENT, "Agent") \
+    X(UPTIME, "Uptime") \
+    X(LASTRELOAD, "LastReload")
+/*******************************************************************************
+ * @def     ASTMAN_EVENT_NAMES
+ * @brief   Known Event names: X(ID suffix, name)
+ ******************************************************************************/
+#define ASTMAN_EVENT_NAMES(X) \
+    X(PEERENTRY, "PeerEntry") \
+    X(PEERLISTCOMPLETE, "PeerlistComplete") \
+    X(STATUS, "Status") \
+    X(STATUSCOMPLETE, "StatusComplete") \
+    X(QUEUEPARAMS, "QueueParams") \
+    X(QUEUEMEMBER, "QueueMember") \
+    X(QUEUEENTRY, "QueueEntry") \
+    X(QUEUEENTER, "QueueEnter") \
+    X(QUEUESTATUSCOMPLETE, "QueueStatusComplete") \
+    X(REGISTRYENTRY, "RegistryEntry") \
+    X(REGISTRATIONSCOMPLETE, "RegistrationsComplete") \
+    X(RELOAD, "Reload") \
+    X(FULLYBOOTED, "FullyBooted") \
+    X(SHUTDOWN, "Shutdown") \
+    X(NEWCHANNEL, "Newchannel") \
+    X(NEWSTATE, "Newstate") \
+    X(NEWEXTEN, "Newexten") \
+    X(NEWCALLERID, "NewCallerid") \
+    X(NEWCONNECTEDLINE, "NewConnectedLine") \
+    X(NEWACCOUNTCODE, "NewAccountCode") \
+    X(RENAME, "Rename") \
+    X(HANGUP, "Hangup") \
+    X(HANGUPREQUEST, "HangupRequest") \
+    X(SOFTHANGUPREQUEST, "SoftHangupRequest") \
+    X(VARSET, "VarSet") \
+    X(DIAL, "Dial") \
+    X(DIALBEGIN, "DialBegin") \
+    X(DIALEND, "DialEnd") \
+    X(BRIDGE, "Bridge") \
+    X(BRIDGECREATE, "BridgeCreate") \
+    X(BRIDGEDESTROY, "BridgeDestroy") \
+    X(BRIDGEENTER, "BridgeEnter") \
+    X(BRIDGELEAVE, "BridgeLeave") \
+    X(LINK, "Link") \
+    X(UNLINK, "Unlink") \
+    X(MASQUERADE, "Masquerade") \
+    X(TRANSFER, "Transfer") \
+    X(ATTENDEDTRANSFER, "AttendedTransfer") \
+    X(BLINDTRANSFER, "BlindTransfer") \
+    X(LOCALBRIDGE, "LocalBridge") \
+    X(HOLD, "Hold") \
+    X(UNHOLD, "Unhold") \
+    X(MUSICONHOLD, "MusicOnHold") \
+    X(MUSICONHOLDSTART, "MusicOnHoldStart") \
+    X(MUSICONHOLDSTOP, "MusicOnHoldStop") \
+    X(DTMF, "DTMF") \
+    X(DTMFBEGIN, "DTMFBegin") \
+    X(DTMFEND, "DTMFEnd") \
+    X(JOIN, "Join") \
+    X(LEAVE, "Leave") \
+    X(QUEUECALLERJOIN, "QueueCallerJoin") \
+    X(QUEUECALLERLEAVE, "QueueCallerLeave") \
+    X(QUEUECALLERABANDON, "QueueCallerAbandon") \
+    X(QUEUEMEMBERADDED, "QueueMemberAdded") \
+    X(QUEUEMEMBERREMOVED, "QueueMemberRemoved") \
+    X(QUEUEMEMBERPAUSE, "QueueMemberPause") \
+    X(QUEUEMEMBERPAUSED, "QueueMemberPaused") \
+    X(QUEUEMEMBERPENALTY, "QueueMemberPenalty") \
+    X(QUEUEMEMBERSTATUS, "QueueMemberStatus") \
+    X(AGENTCALLED, "AgentCalled") \
+    X(AGENTCONNECT, "AgentConnect") \
+    X(AGENTCOMPLETE, "AgentComplete") \
+    X(AGENTDUMP, "AgentDump") \
+    X(AGENTRINGNOANSWER, "AgentRingNoAnswer") \
+    X(AGENTLOGIN, "AgentLogin") \
+    X(AGENTLOGOFF, "AgentLogoff") \
+    X(AGENTS, "Agents") \
+    X(AGENTSCOMPLETE, "AgentsComplete") \
+    X(PEERSTATUS, "PeerStatus") \
+    X(REGISTRY, "Registry") \
+    X(CONTACTSTATUS, "ContactStatus") \
+    X(DEVICESTATECHANGE, "DeviceStateChange") \
+    X(EXTENSIONSTATUS, "ExtensionStatus") \
+    X(PRESENCESTATECHANGE, "PresenceStateChange") \
+    X(ORIGINATERESPONSE, "OriginateResponse") \
+    X(CDR, "Cdr") \
+    X(CEL, "CEL") \
+    X(USEREVENT, "UserEvent") \
+    X(MESSAGEWAITING, "MessageWaiting") \
+    X(CHANNELRELOAD, "ChannelReload") \
+    X(CORESHOWCHANNEL, "CoreShowChannel") \
+    X(CORESHOWCHANNELSCOMPLETE, "CoreShowChannelsComplete") \
+    X(DBGETRESPONSE, "DBGetResponse") \
+    X(DBGETCOMPLETE, "DBGetComplete") \
+    X(PARKEDCALL, "ParkedCall") \
+    X(PARKEDCALLSCOMPLETE, "ParkedCallsComplete") \
+    X(UNPARKEDCALL, "UnParkedCall") \
+    X(PARKEDCALLTIMEOUT, "ParkedCallTimeOut") \
+    X(PARKEDCALLGIVEUP, "ParkedCallGiveUp") \
+    X(MEETMEJOIN, "MeetmeJoin") \
+    X(MEETMELEAVE, "MeetmeLeave") \
+    X(CONFBRIDGEJOIN, "ConfbridgeJoin") \
+    X(CONFBRIDGELEAVE, "ConfbridgeLeave") \
+    X(CONFBRIDGESTART, "ConfbridgeStart") \
+    X(CONFBRIDGEEND, "ConfbridgeEnd") \
+    X(CONFBRIDGETALKING, "ConfbridgeTalking") \
+    X(CHANSPYSTART, "ChanSpyStart") \
+    X(CHANSPYSTOP, "ChanSpyStop") \
+    X(ALARM, "Alarm") \
+    X(ALARMCLEAR, "AlarmClear") \
+    X(SUCCESSFULAUTH, "SuccessfulAuth") \
+    X(CHALLENGESENT, "ChallengeSent") \
+    X(INVALIDPASSWORD, "InvalidPassword") \
+    X(RTCPSENT, "RTCPSent") \
+    X(RTCPRECEIVED, "RTCPReceived") \
+    X(VOICEMAILUSERENTRY, "VoicemailUserEntry") \
+    X(VOICEMAILUSERENTRYCOMPLETE, "VoicemailUserEntryComplete")
+
+#define ASTMAN_NAME_ENUM_HDR(id, name) ASTMAN_HDR_##id,
+#define ASTMAN_NAME_ENUM_EVT(id, name) ASTMAN_EVT_##id,
+/*******************************************************************************
+ * @enum    astman_header_id
+ * @brief   ASTMAN_HDR_NONE: not interned (a message built by hand),
+ *          ASTMAN_HDR_OTHER: interned but not a known name
+ ******************************************************************************/
+enum astman_header_id {
+    ASTMAN_HDR_NONE = 0,
+    ASTMAN_HDR_OTHER,
+    ASTMAN_HEADER_NAMES(ASTMAN_NAME_ENUM_HDR)
+    ASTMAN_HDR_IDS
+};
+/*******************************************************************************
+ * @enum    astman_event_id
+ * @brief   ASTMAN_EVT_NONE: no Event header, ASTMAN_EVT_OTHER: unknown name
+ ******************************************************************************/
+enum astman_event_id {
+    ASTMAN_EVT_NONE = 0,
+    ASTMAN_EVT_OTHER,
+    ASTMAN_EVENT_NAMES(ASTMAN_NAME_ENUM_EVT)
+    ASTMAN_EVT_IDS
+};
+/*******************************************************************************
+ * @fn int astman_header_id(const char *name, int len)
+ * @param len: length of name, < 0 if NUL terminated
+ * @return enum astman_header_id, ASTMAN_HDR_OTHER if unknown
+ ******************************************************************************/
+int astman_header_id(const char *name, int len);
+/*******************************************************************************
+ * @fn int astman_event_id(const char *name, int len)
+ * @param len: length of name, < 0 if NUL terminated
+ * @return enum astman_event_id, ASTMAN_EVT_OTHER if unknown
+ ******************************************************************************/
+int astman_event_id(const char *name, int len);
+/*******************************************************************************
+ * @fn const char *astman_header_name(int id)
+ * @return the name of an ID, "" for ASTMAN_HDR_NONE / ASTMAN_HDR_OTHER
+ ******************************************************************************/
+const char *astman_header_name(int id);
+/*******************************************************************************
+ * @fn const char *astman_event_name(int id)
+ ******************************************************************************/
+const char *astman_event_name(int id);
+/*******************************************************************************
+ * @fn void astman_message_intern(struct message *m, int x)
+ * @brief Library side: tag the header x of m (and m->event) once it is read
+ ******************************************************************************/
+void astman_message_intern(struct message *m, int x);
+/*******************************************************************************
+ * @fn int astman_message_event(struct message *m)
+ * @return the enum astman_event_id of m
+ ******************************************************************************/
+int astman_message_event(struct message *m);
+/*******************************************************************************
+ * @fn char *astman_get_header_id(struct message *m, int id)
+ * @brief astman_get_header() by ID: an integer compare per header
+ * @return the value, "" if m has no such header
+ ******************************************************************************/
+char *astman_get_header_id(struct message *m, int id);
+/*******************************************************************************
+ * @fn void astman_message_copy(struct message *dst, const struct message *src)
+ * @brief Copy the used headers and their IDs only, a message is 40 KB
+ ******************************************************************************/
+void astman_message_copy(struct message *dst, const struct message *src);
+/*******************************************************************************
+ * @fn size_t astman_message_packed_size(const struct message *m)
+ * @return bytes astman_message_pack() writes for m
+ ******************************************************************************/
+size_t astman_message_packed_size(const struct message *m);
+/*******************************************************************************
+ * @fn void astman_message_pack(void *buf, const struct message *m)
+ * @brief Store the used headers and their IDs of m back to back in buf,
+ *        for messages kept in queues or spilled to a file
+ ******************************************************************************/
+void astman_message_pack(void *buf, const struct message *m);
+/*******************************************************************************
+ * @fn void astman_message_unpack(struct message *m, const void *buf)
+ * @brief Rebuild a full size message from astman_message_pack()
+ ******************************************************************************/
+void astman_message_unpack(struct message *m, const void *buf);
+#endif // ASTNAMES_H_INCLUDED
@@ -0,0 +1,96 @@
+#ifndef ASTPROFILE_H_INCLUDED
+#define ASTPROFILE_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astprofile.h
+ *  @brief Opt-in event stream profiler: per Event name rates, sizes and
+ *         handler cost.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <stdio.h>
+#include "astman.h"
+/*******************************************************************************
+ * @enum    astman_profile_sort
+ * @brief   Sort key of astman_profiler_report()
+ ******************************************************************************/
+enum astman_profile_sort {
+  ASTMAN_PROFILE_BY_COUNT,          /**!< events received */
+  ASTMAN_PROFILE_BY_BYTES,          /**!< bytes received */
+  ASTMAN_PROFILE_BY_HANDLER_TIME,   /**!< time spent in the callbacks */
+  ASTMAN_PROFILE_BY_DROPS,          /**!< events nobody handled */
+};
+/*******************************************************************************
+ * @struct  astman_profile_entry
+ * @brief   Statistics of one Event name
+ ******************************************************************************/
+struct astman_profile_entry {
+  char event[MAX_NAME_LEN];         /**!< Event: name */
+  unsigned long long count;         /**!< events received */
+  double rate;                      /**!< events/s since the profiler start */
+  double recent_rate;               /**!< events/s since the last dump */
+  unsigned long long headers;       /**!< sum of the header counts */
+  int max_headers;                  /**!< biggest header count */
+  unsigned long long bytes;         /**!< sum of the wire sizes */
+  unsigned int max_bytes;           /**!< biggest wire size */
+  unsigned long long handler_ns;    /**!< time spent in ASTMAN_EVENT_CALLBACKs */
+  unsigned long long max_handler_ns;/**!< slowest callback */
+  unsigned long long drops;         /**!< no handler, or the DEFAULT handler
+                                         declined the event */
+};
+/*******************************************************************************
+ * @fn int astman_profiler_enable(struct mansession *s, int dump_interval,
+ *                                FILE *dump)
+ * @brief Start profiling the events dispatched on s.
+ * @param dump_interval: seconds between two dumps of the top 10 into
+ *                       dump, 0 for no periodic dump
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_profiler_enable(struct mansession *s, int dump_interval, FILE *dump);
+/*******************************************************************************
+ * @fn void astman_profiler_disable(struct mansession *s)
+ * @brief Stop profiling and free the statistics
+ ******************************************************************************/
+void astman_profiler_disable(struct mansession *s);
+/*******************************************************************************
+ * @fn int astman_profiler_report(struct mansession *s,
+ *                                enum astman_profile_sort sort,
+ *                                struct astman_profile_entry *top, int n)
+ * @brief Fill top with the n first Event names according to sort
+ * @return Number of entries filled
+ ******************************************************************************/
+int astman_profiler_report(struct mansession *s, enum astman_profile_sort sort,
+                           struct astman_profile_entry *top, int n);
+/*******************************************************************************
+ * @fn void astman_profiler_dump(struct mansession *s, FILE *f, int n)
+ * @brief Print the top n Event names by handler time
+ ******************************************************************************/
+void astman_profiler_dump(struct mansession *s, FILE *f, int n);
+/*******************************************************************************
+ * @fn void astman_profiler_record(struct mansession *s, const char *event,
+ *                                 struct message *m,
+ *                                 unsigned long long handler_ns, int dropped)
+ * @brief Library side hook, called by astman_process_message()
+ ******************************************************************************/
+void astman_profiler_record(struct mansession *s, const char *event,
+                            struct message *m,
+                            unsigned long long handler_ns, int dropped);
+#endif // ASTPROFILE_H_INCLUDED
@@ -0,0 +1,111 @@
+#ifndef ASTPROXY_H_INCLUDED
+#define ASTPROXY_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astproxy.h
+ *  @brief AMI multiplexing proxy: a few upstream sessions to one PBX, shared
+ *         by many local AMI clients. ActionIDs are rewritten on the way up
+ *         so that responses find their client; every event is read and
+ *         framed once, then the same buffer is queued to each subscriber.
+ *         Responses travel on any upstream session, so one may overtake
+ *         events the PBX sent before it on the event session.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ *  @def    ASTMAN_PROXY_QUEUE_SIZE
+ *  @brief  Default frames a client can have waiting
+ ******************************************************************************/
+#define ASTMAN_PROXY_QUEUE_SIZE     1024
+/*******************************************************************************
+ *  @def    ASTMAN_PROXY_DISCONNECT_SLOW
+ *  @brief  astman_proxy_config flag: disconnect a client whose queue is
+ *          full instead of dropping its events
+ ******************************************************************************/
+#define ASTMAN_PROXY_DISCONNECT_SLOW 0x01
+/*******************************************************************************
+ * @struct  astman_proxy
+ * @brief   Opaque proxy
+ ******************************************************************************/
+struct astman_proxy;
+/*******************************************************************************
+ * @struct  astman_proxy_config
+ ******************************************************************************/
+struct astman_proxy_config {
+    const char *host;               /**!< upstream PBX */
+    int port;
+    const char *username;
+    const char *secret;
+    int sessions;                   /**!< upstream sessions, 0 for 2 */
+    const char *bind;               /**!< local address, NULL for 127.0.0.1 */
+    int listen_port;                /**!< local AMI port */
+    const char *client_username;    /**!< local Login, NULL accepts any */
+    const char *client_secret;
+    int max_clients;                /**!< 0 for 1024 */
+    unsigned int queue_size;        /**!< frames per client, 0 for the default */
+    int flags;                      /**!< ASTMAN_PROXY_DISCONNECT_SLOW */
+};
+/*******************************************************************************
+ * @struct  astman_proxy_stats
+ ******************************************************************************/
+struct astman_proxy_stats {
+    int clients;                    /**!< connected */
+    int upstreams;                  /**!< upstream sessions logged in */
+    unsigned long long events;      /**!< events received */
+    unsigned long long delivered;   /**!< events queued to clients */
+    unsigned long long dropped;     /**!< events dropped on full queues */
+    unsigned long long actions;     /**!< actions forwarded */
+    unsigned long long orphans;     /**!< responses with no client left */
+    unsigned long long slow;        /**!< clients disconnected for a full queue */
+};
+/*******************************************************************************
+ * @fn struct astman_proxy *astman_proxy_new(const struct astman_proxy_config *cfg)
+ * @brief Bind the local port. The upstream sessions are opened by
+ *        astman_proxy_run().
+ * @return the proxy, NULL on error
+ ******************************************************************************/
+struct astman_proxy *astman_proxy_new(const struct astman_proxy_config *cfg);
+/*******************************************************************************
+ * @fn int astman_proxy_run(struct astman_proxy *p)
+ * @brief Serve until astman_proxy_stop(). Everything runs on the calling
+ *        thread; lost upstream sessions are reopened every few seconds.
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_proxy_run(struct astman_proxy *p);
+/*******************************************************************************
+ * @fn void astman_proxy_stop(struct astman_proxy *p)
+ * @brief Make astman_proxy_run() return. From any thread or a signal
+ *        handler.
+ ******************************************************************************/
+void astman_proxy_stop(struct astman_proxy *p);
+/*******************************************************************************
+ * @fn void astman_proxy_free(struct astman_proxy *p)
+ * @brief Close the clients and log off the upstream sessions
+ ******************************************************************************/
+void astman_proxy_free(struct astman_proxy *p);
+/*******************************************************************************
+ * @fn void astman_proxy_stats(struct astman_proxy *p,
+ *                             struct astman_proxy_stats *st)
+ * @brief Counters, from any thread (approximate)
+ ******************************************************************************/
+void astman_proxy_stats(struct astman_proxy *p, struct astman_proxy_stats *st);
+#endif // ASTPROXY_H_INCLUDED
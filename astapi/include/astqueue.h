@@ -0,0 +1,131 @@
+#ifndef ASTQUEUE_H_INCLUDED
+#define ASTQUEUE_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astqueue.h
+ *  @brief Reference counted messages and bounded lock-free queues to hand
+ *         them to application threads without copies.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <time.h>
+#include "astman.h"
+/*******************************************************************************
+ * @struct  astman_msg
+ * @brief   Reference counted message handle. Handles are passed by pointer,
+ *          the message itself is never copied.
+ ******************************************************************************/
+struct astman_msg {
+  int refcount;         /**!< references, atomically updated */
+  struct message m;     /**!< the parsed message */
+};
+/*******************************************************************************
+ * @enum    astman_queue_type
+ ******************************************************************************/
+enum astman_queue_type {
+  ASTMAN_QUEUE_SPSC,    /**!< one producer thread, one consumer thread */
+  ASTMAN_QUEUE_MPSC,    /**!< many producer threads, one consumer thread */
+};
+/*******************************************************************************
+ * @struct  astman_queue
+ * @brief   Opaque bounded queue of pointers
+ ******************************************************************************/
+struct astman_queue;
+/*******************************************************************************
+ * @fn struct astman_msg *astman_msg_new(void)
+ * @brief Allocate an empty message handle with one reference
+ ******************************************************************************/
+struct astman_msg *astman_msg_new(void);
+/*******************************************************************************
+ * @fn struct astman_msg *astman_msg_ref(struct astman_msg *msg)
+ * @brief Take one more reference (one per queue/consumer holding it)
+ ******************************************************************************/
+struct astman_msg *astman_msg_ref(struct astman_msg *msg);
+/*******************************************************************************
+ * @fn void astman_msg_unref(struct astman_msg *msg)
+ * @brief Drop a reference, the last one frees the message
+ ******************************************************************************/
+void astman_msg_unref(struct astman_msg *msg);
+/*******************************************************************************
+ * @fn int astman_wait_for_msg(struct mansession *s, struct astman_msg **msg,
+ *                             time_t timeout)
+ * @brief astman_wait_for_response() parsing straight into a new handle
+ * @param OUT msg: new handle (one reference) when the return is > 0
+ * @return see astman_wait_for_response()
+ ******************************************************************************/
+int astman_wait_for_msg(struct mansession *s, struct astman_msg **msg,
+                        time_t timeout);
+/*******************************************************************************
+ * @fn struct astman_queue *astman_queue_new(enum astman_queue_type type,
+ *                                           unsigned int capacity)
+ * @brief Create a queue, capacity is rounded up to a power of two
+ ******************************************************************************/
+struct astman_queue *astman_queue_new(enum astman_queue_type type,
+                                      unsigned int capacity);
+/*******************************************************************************
+ * @fn void astman_queue_free(struct astman_queue *q)
+ * @brief Free the queue, the items left are not released
+ ******************************************************************************/
+void astman_queue_free(struct astman_queue *q);
+/*******************************************************************************
+ * @fn int astman_queue_push(struct astman_queue *q, void *item)
+ * @brief Non blocking push, wakes the consumer if it is waiting
+ * @return ASTMAN_SUCCESS, ASTMAN_FAILURE if the queue is full
+ ******************************************************************************/
+int astman_queue_push(struct astman_queue *q, void *item);
+/*******************************************************************************
+ * @fn void *astman_queue_pop(struct astman_queue *q)
+ * @brief Non blocking pop (consumer thread only)
+ * @return the oldest item or NULL if empty
+ ******************************************************************************/
+void *astman_queue_pop(struct astman_queue *q);
+/*******************************************************************************
+ * @fn void *astman_queue_pop_wait(struct astman_queue *q, int timeout_ms)
+ * @brief Pop, sleeping on a futex while the queue is empty
+ * @param timeout_ms: < 0 waits forever
+ * @return the oldest item or NULL on timeout
+ ******************************************************************************/
+void *astman_queue_pop_wait(struct astman_queue *q, int timeout_ms);
+/*******************************************************************************
+ * @fn unsigned int astman_queue_size(struct astman_queue *q)
+ * @return Approximate number of queued items
+ ******************************************************************************/
+unsigned int astman_queue_size(struct astman_queue *q);
+/*******************************************************************************
+ * @fn unsigned int astman_queue_capacity(struct astman_queue *q)
+ ******************************************************************************/
+unsigned int astman_queue_capacity(struct astman_queue *q);
+/*******************************************************************************
+ * @fn int astman_queue_fd(struct astman_queue *q)
+ * @brief Also wake the consumer through an eventfd, for consumers running
+ *        a poll/epoll loop (astman_queue_pop_wait() still works). Call
+ *        astman_queue_arm() before sleeping.
+ * @return the eventfd or -1
+ ******************************************************************************/
+int astman_queue_fd(struct astman_queue *q);
+/*******************************************************************************
+ * @fn int astman_queue_arm(struct astman_queue *q)
+ * @brief Announce the consumer is going to sleep on astman_queue_fd().
+ *        Also drains the eventfd counter.
+ * @return 1 if items are already queued (do not sleep), 0 otherwise
+ ******************************************************************************/
+int astman_queue_arm(struct astman_queue *q);
+#endif // ASTQUEUE_H_INCLUDED
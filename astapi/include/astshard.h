@@ -0,0 +1,188 @@
+#ifndef ASTSHARD_H_INCLUDED
+#define ASTSHARD_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astshard.h
+ *  @brief Sharded runtime: one epoll loop per core, each owning a share of
+ *         the sessions. A session is only ever touched by its shard thread;
+ *         other threads reach it through the shard's MPSC command queue.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+#include "astevent.h"
+#include "astasync.h"
+/*******************************************************************************
+ *  @def    ASTMAN_SHARD_QUEUE_SIZE
+ *  @brief  Commands a shard can have waiting
+ ******************************************************************************/
+#define ASTMAN_SHARD_QUEUE_SIZE 4096
+/*******************************************************************************
+ *  @def    ASTMAN_RUNTIME_PIN
+ *  @brief  astman_runtime_start() flag: pin shard n to CPU n
+ ******************************************************************************/
+#define ASTMAN_RUNTIME_PIN      0x01
+/*******************************************************************************
+ *  @def    ASTMAN_RUNTIME_URING
+ *  @brief  astman_runtime_start() flag: io_uring transport (multishot
+ *          receive into a provided buffer ring, sends batched per loop
+ *          iteration). Shards fall back to epoll when the kernel lacks it.
+ ******************************************************************************/
+#define ASTMAN_RUNTIME_URING    0x02
+/*******************************************************************************
+ * @struct  astman_runtime
+ * @brief   Opaque set of shards
+ ******************************************************************************/
+struct astman_runtime;
+/*******************************************************************************
+ * @typedef (*ASTMAN_SESSION_STATE_CALLBACK)
+ * @brief   A session came up (logged in) or went down. Runs on its shard.
+ ******************************************************************************/
+typedef void (*ASTMAN_SESSION_STATE_CALLBACK)(struct astman_runtime *rt,
+                                              int session, int up, void *data);
+/*******************************************************************************
+ * @typedef (*ASTMAN_SHARD_CALLBACK)
+ * @brief   Function run on a shard thread by astman_runtime_run_on()
+ ******************************************************************************/
+typedef void (*ASTMAN_SHARD_CALLBACK)(struct astman_runtime *rt, int shard,
+                                      void *data);
+/*******************************************************************************
+ * @struct  astman_shard_stats
+ ******************************************************************************/
+struct astman_shard_stats {
+    int sessions;                   /**!< sessions owned */
+    int up;                         /**!< sessions logged in */
+    unsigned long long actions;     /**!< actions sent */
+    unsigned long long commands;    /**!< commands received from other threads */
+};
+/*******************************************************************************
+ * @fn struct astman_runtime *astman_runtime_new(int nshards)
+ * @param nshards: 0 for one shard per online CPU
+ * @return the runtime (not started), NULL on error
+ ******************************************************************************/
+struct astman_runtime *astman_runtime_new(int nshards);
+/*******************************************************************************
+ * @fn int astman_runtime_add_event_handler(struct astman_runtime *rt,
+ *                                          char *event,
+ *                                          ASTMAN_EVENT_CALLBACK callback)
+ * @brief Handler registered on every session. Each shard keeps its own
+ *        dispatch tables, the callback runs on the session's shard.
+ * @warning Before astman_runtime_start() only
+ ******************************************************************************/
+int astman_runtime_add_event_handler(struct astman_runtime *rt, char *event,
+                                     ASTMAN_EVENT_CALLBACK callback);
+/*******************************************************************************
+ * @fn void astman_runtime_set_state_callback(struct astman_runtime *rt,
+ *                                            ASTMAN_SESSION_STATE_CALLBACK cb,
+ *                                            void *data)
+ * @warning Before astman_runtime_start() only
+ ******************************************************************************/
+void astman_runtime_set_state_callback(struct astman_runtime *rt,
+                                       ASTMAN_SESSION_STATE_CALLBACK cb,
+                                       void *data);
+/*******************************************************************************
+ * @fn int astman_runtime_start(struct astman_runtime *rt, int flags)
+ * @brief Start the shard threads. On failure the shards already started
+ *        are stopped again and the runtime is left as it was.
+ * @param flags: ASTMAN_RUNTIME_PIN, ASTMAN_RUNTIME_URING
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_runtime_start(struct astman_runtime *rt, int flags);
+/*******************************************************************************
+ * @fn void astman_runtime_free(struct astman_runtime *rt)
+ * @brief Stop the shards, log off and release every session
+ ******************************************************************************/
+void astman_runtime_free(struct astman_runtime *rt);
+/*******************************************************************************
+ * @fn int astman_runtime_add_session(struct astman_runtime *rt,
+ *                                    const char *host, int port,
+ *                                    const char *username,
+ *                                    const char *secret)
+ * @brief Open a session on the next shard (round robin). Connect and login
+ *        run on the shard, the state callback reports the outcome.
+ * @return session id, -1 on error (unknown host, queue full)
+ ******************************************************************************/
+int astman_runtime_add_session(struct astman_runtime *rt, const char *host,
+                               int port, const char *username,
+                               const char *secret);
+/*******************************************************************************
+ * @fn int astman_runtime_action(struct astman_runtime *rt, int session,
+ *                               char *action, char *params, int flags,
+ *                               int timeout_ms,
+ *                               ASTMAN_ACTION_CALLBACK callback, void *data)
+ * @brief astman_action_async() on a session, from any thread. The callback
+ *        runs on the session's shard; a session that is not up answers
+ *        ASTMAN_ACTION_ABORTED.
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (queue full)
+ ******************************************************************************/
+int astman_runtime_action(struct astman_runtime *rt, int session,
+                          char *action, char *params, int flags,
+                          int timeout_ms, ASTMAN_ACTION_CALLBACK callback,
+                          void *data);
+/*******************************************************************************
+ * @fn int astman_runtime_set_bulk_session(struct astman_runtime *rt,
+ *                                         int session, int bulk)
+ * @brief Steer the bulk actions (astman_action_class()) sent to session to
+ *        bulk, another session to the same server, so that reporting never
+ *        delays the control actions of session. They stay on session while
+ *        bulk is not up.
+ * @param bulk: -1 to stop steering
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (queue full)
+ ******************************************************************************/
+int astman_runtime_set_bulk_session(struct astman_runtime *rt, int session,
+                                    int bulk);
+/*******************************************************************************
+ * @fn int astman_runtime_run_on(struct astman_runtime *rt, int shard,
+ *                               ASTMAN_SHARD_CALLBACK func, void *data)
+ * @brief Run func on a shard thread
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (queue full)
+ ******************************************************************************/
+int astman_runtime_run_on(struct astman_runtime *rt, int shard,
+                          ASTMAN_SHARD_CALLBACK func, void *data);
+/*******************************************************************************
+ * @fn int astman_runtime_shard_count(struct astman_runtime *rt)
+ ******************************************************************************/
+int astman_runtime_shard_count(struct astman_runtime *rt);
+/*******************************************************************************
+ * @fn int astman_runtime_shard_of(struct astman_runtime *rt, int session)
+ ******************************************************************************/
+int astman_runtime_shard_of(struct astman_runtime *rt, int session);
+/*******************************************************************************
+ * @fn int astman_runtime_current_shard(void)
+ * @return shard of the calling thread, -1 outside the shards
+ ******************************************************************************/
+int astman_runtime_current_shard(void);
+/*******************************************************************************
+ * @fn struct mansession *astman_runtime_session(struct astman_runtime *rt,
+ *                                               int session)
+ * @brief The session itself
+ * @warning From its shard thread only
+ ******************************************************************************/
+struct mansession *astman_runtime_session(struct astman_runtime *rt,
+                                          int session);
+/*******************************************************************************
+ * @fn void astman_runtime_stats(struct astman_runtime *rt, int shard,
+ *                               struct astman_shard_stats *st)
+ * @brief Counters of a shard, from any thread (approximate)
+ ******************************************************************************/
+void astman_runtime_stats(struct astman_runtime *rt, int shard,
+                          struct astman_shard_stats *st);
+#endif // ASTSHARD_H_INCLUDED
@@ -0,0 +1,80 @@
+#ifndef ASTSTART_H_INCLUDED
+#define ASTSTART_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file aststart.h
+ *  @brief Fast start: Login, filters and the initial snapshot actions are
+ *         written together right after connect instead of one round trip
+ *         each
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ *  @def    ASTMAN_FAST_START_TIMEOUT
+ *  @brief  Fast start deadline (ms) when astman_fast_start.timeout_ms is not
+ *          set
+ ******************************************************************************/
+#define ASTMAN_FAST_START_TIMEOUT   30000
+/*******************************************************************************
+ * @typedef (*ASTMAN_FAST_START_CALLBACK)
+ * @brief   A list event of a snapshot action, as it arrives. Valid during
+ *          the call only.
+ ******************************************************************************/
+typedef void (*ASTMAN_FAST_START_CALLBACK)(struct mansession *s,
+                                           const char *action,
+                                           struct message *m, void *data);
+/*******************************************************************************
+ * @struct  astman_fast_start
+ ******************************************************************************/
+struct astman_fast_start {
+    char *username;
+    char *secret;
+    char *events;               /**!< Login event mask, NULL for "on" */
+    char **filters;             /**!< Filter actions to add, NULL terminated
+                                     (or NULL) */
+    char **snapshot;            /**!< list actions (Status, QueueStatus,
+                                     SIPpeers...), NULL terminated (or NULL).
+                                     Their events also update the shared
+                                     state when it is published. */
+    int timeout_ms;             /**!< until ready, <= 0 for
+                                     ASTMAN_FAST_START_TIMEOUT */
+    ASTMAN_FAST_START_CALLBACK callback;  /**!< NULL for none */
+    void *data;
+    /* Filled by astman_fast_start() */
+    unsigned long long connect_ns;  /**!< connect() done */
+    unsigned long long login_ns;    /**!< Login answered */
+    unsigned long long ready_ns;    /**!< everything answered */
+    int failed;                     /**!< filter and snapshot actions that
+                                         failed or timed out */
+};
+/*******************************************************************************
+ * @fn int astman_fast_start(struct mansession *s, char *host, int port,
+ *                           struct astman_fast_start *fs)
+ * @brief Connect, then send Login, the filters and the snapshot actions in
+ *        one write and return once every one of them is answered. The
+ *        times are counted from the call.
+ * @return ASTMAN_SUCCESS when logged in (fs->failed tells whether the rest
+ *         went through), ASTMAN_FAILURE otherwise
+ ******************************************************************************/
+int astman_fast_start(struct mansession *s, char *host, int port,
+                      struct astman_fast_start *fs);
+#endif // ASTSTART_H_INCLUDED
@@ -0,0 +1,178 @@
+#ifndef ASTSTATE_H_INCLUDED
+#define ASTSTATE_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file aststate.h
+ *  @brief Channel and peer state in shared memory. One publisher process
+ *         keeps it up to date from its AMI events; reader processes map
+ *         the region read-only and copy records out of it, without a
+ *         socket, a lock or any parsing. Every record is a seqlock: a copy
+ *         is retried until it was not written meanwhile.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ * @struct  astman_state
+ * @brief   Opaque mapping of a state region (publisher or reader)
+ ******************************************************************************/
+struct astman_state;
+/*******************************************************************************
+ * @struct  astman_state_channel
+ * @brief   Channel record (fixed layout, strings truncated to fit)
+ ******************************************************************************/
+struct astman_state_channel {
+    char uniqueid[64];
+    char linkedid[64];
+    char channel[80];
+    char calleridnum[40];
+    char calleridname[80];
+    char context[80];
+    char exten[80];
+    int state;                  /**!< enum astman_channel_state */
+    int priority;
+    long long created;          /**!< CLOCK_REALTIME (us) */
+    long long updated;          /**!< CLOCK_REALTIME (us) */
+};
+/*******************************************************************************
+ * @struct  astman_state_peer
+ * @brief   Peer record, name is "<Channeltype>/<peer>" ("SIP/100")
+ ******************************************************************************/
+struct astman_state_peer {
+    char name[80];
+    char address[64];
+    int status;                 /**!< enum astman_peer_status */
+    int latency;                /**!< qualify time (ms), -1 if unknown */
+    long long updated;          /**!< CLOCK_REALTIME (us) */
+};
+/*******************************************************************************
+ * @struct  astman_state_info
+ ******************************************************************************/
+struct astman_state_info {
+    int max_channels;
+    int max_peers;
+    int channels;               /**!< records in use */
+    int peers;
+    int publisher;              /**!< pid */
+    unsigned long long events;  /**!< events applied */
+    long long updated;          /**!< last change (us), tells a dead publisher */
+};
+/*******************************************************************************
+ * @typedef (*ASTMAN_STATE_CHANNEL_CALLBACK)
+ * @brief   Return 0 to stop the walk
+ ******************************************************************************/
+typedef int (*ASTMAN_STATE_CHANNEL_CALLBACK)(const struct astman_state_channel *c,
+                                             void *data);
+/*******************************************************************************
+ * @typedef (*ASTMAN_STATE_PEER_CALLBACK)
+ ******************************************************************************/
+typedef int (*ASTMAN_STATE_PEER_CALLBACK)(const struct astman_state_peer *p,
+                                          void *data);
+/*******************************************************************************
+ * @fn struct astman_state *astman_state_create(const char *name,
+ *                                              int max_channels,
+ *                                              int max_peers)
+ * @brief Publisher: create (or reset) the shared memory region name
+ *        ("/astapi-state" for instance, see shm_open)
+ * @return the region, NULL on error
+ ******************************************************************************/
+struct astman_state *astman_state_create(const char *name, int max_channels,
+                                         int max_peers);
+/*******************************************************************************
+ * @fn int astman_state_attach(struct mansession *s, struct astman_state *st)
+ * @brief Publisher: apply every event of s before its handlers run (NULL
+ *        detaches)
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (st is a reader)
+ ******************************************************************************/
+int astman_state_attach(struct mansession *s, struct astman_state *st);
+/*******************************************************************************
+ * @fn int astman_state_seed(struct astman_state *st, struct mansession *s)
+ * @brief Publisher: load the current channels (Status) and SIP peers
+ *        (SIPpeers), then events keep them up to date
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_state_seed(struct astman_state *st, struct mansession *s);
+/*******************************************************************************
+ * @fn void astman_state_update(struct astman_state *st, struct message *m)
+ * @brief Publisher: apply an event (Newchannel, Newstate, NewCallerid,
+ *        Rename, Hangup, PeerStatus, PeerEntry, Status)
+ ******************************************************************************/
+void astman_state_update(struct astman_state *st, struct message *m);
+/*******************************************************************************
+ * @fn struct astman_state *astman_state_open(const char *name)
+ * @brief Reader: map a region read-only
+ * @return the region, NULL if there is none (or not a state region)
+ ******************************************************************************/
+struct astman_state *astman_state_open(const char *name);
+/*******************************************************************************
+ * @fn void astman_state_close(struct astman_state *st)
+ * @brief Unmap (the region stays for the other processes)
+ ******************************************************************************/
+void astman_state_close(struct astman_state *st);
+/*******************************************************************************
+ * @fn int astman_state_unlink(const char *name)
+ * @brief Remove the region, mappings already made stay valid
+ ******************************************************************************/
+int astman_state_unlink(const char *name);
+/*******************************************************************************
+ * @fn int astman_state_channel(struct astman_state *st, const char *uniqueid,
+ *                              struct astman_state_channel *c)
+ * @brief Consistent copy of a channel. A record still being written is
+ *        waited for, within a bound: a publisher that died in the middle of
+ *        a write does not hang the reader.
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (no such channel, or its record
+ *         could not be read)
+ ******************************************************************************/
+int astman_state_channel(struct astman_state *st, const char *uniqueid,
+                         struct astman_state_channel *c);
+/*******************************************************************************
+ * @fn int astman_state_peer(struct astman_state *st, const char *name,
+ *                           struct astman_state_peer *p)
+ * @brief See astman_state_channel()
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (no such peer, or its record
+ *         could not be read)
+ ******************************************************************************/
+int astman_state_peer(struct astman_state *st, const char *name,
+                      struct astman_state_peer *p);
+/*******************************************************************************
+ * @fn int astman_state_channels(struct astman_state *st,
+ *                               ASTMAN_STATE_CHANNEL_CALLBACK cb, void *data)
+ * @brief Call cb with a consistent copy of every channel. Each record is
+ *        consistent, the walk is not a snapshot of the whole table: a
+ *        record shifted back by a hangup meanwhile may be seen twice or
+ *        missed, a record that could not be read is skipped.
+ * @return channels walked
+ ******************************************************************************/
+int astman_state_channels(struct astman_state *st,
+                          ASTMAN_STATE_CHANNEL_CALLBACK cb, void *data);
+/*******************************************************************************
+ * @fn int astman_state_peers(struct astman_state *st,
+ *                            ASTMAN_STATE_PEER_CALLBACK cb, void *data)
+ * @return peers walked
+ ******************************************************************************/
+int astman_state_peers(struct astman_state *st, ASTMAN_STATE_PEER_CALLBACK cb,
+                       void *data);
+/*******************************************************************************
+ * @fn void astman_state_info(struct astman_state *st,
+ *                            struct astman_state_info *info)
+ ******************************************************************************/
+void astman_state_info(struct astman_state *st, struct astman_state_info *info);
+#endif // ASTSTATE_H_INCLUDED
@@ -0,0 +1,101 @@
+#ifndef ASTSUB_H_INCLUDED
+#define ASTSUB_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astsub.h
+ *  @brief Event subscriptions: exact names and glob patterns compiled into
+ *         one case-insensitive trie. A lookup walks the trie once along the
+ *         Event name and the result is cached per name, so dispatch cost
+ *         follows the name length, not the number of subscriptions.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+#include "astevent.h"
+/*******************************************************************************
+ * @struct  astman_subs
+ * @brief   Opaque subscription set
+ ******************************************************************************/
+struct astman_subs;
+/*******************************************************************************
+ * @fn int astman_subs_pattern(const char *event)
+ * @return 1 if event is a pattern: '*' matches any run of characters (a
+ *         trailing '*' is a prefix subscription), '?' one character
+ ******************************************************************************/
+int astman_subs_pattern(const char *event);
+/*******************************************************************************
+ * @fn struct astman_subs *astman_subs_new(void)
+ ******************************************************************************/
+struct astman_subs *astman_subs_new(void);
+/*******************************************************************************
+ * @fn void astman_subs_free(struct astman_subs *subs)
+ ******************************************************************************/
+void astman_subs_free(struct astman_subs *subs);
+/*******************************************************************************
+ * @fn int astman_subs_add(struct astman_subs *subs, const char *pattern,
+ *                         ASTMAN_EVENT_CALLBACK callback)
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (already subscribed, no memory)
+ ******************************************************************************/
+int astman_subs_add(struct astman_subs *subs, const char *pattern,
+                    ASTMAN_EVENT_CALLBACK callback);
+/*******************************************************************************
+ * @fn int astman_subs_remove(struct astman_subs *subs, const char *pattern)
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (not subscribed)
+ ******************************************************************************/
+int astman_subs_remove(struct astman_subs *subs, const char *pattern);
+/*******************************************************************************
+ * @fn int astman_subs_count(struct astman_subs *subs)
+ ******************************************************************************/
+int astman_subs_count(struct astman_subs *subs);
+/*******************************************************************************
+ * @fn ASTMAN_EVENT_CALLBACK astman_subs_match(struct astman_subs *subs,
+ *                                             const char *event)
+ * @brief Handler of an Event: an exact subscription first, then the pattern
+ *        with the most literal characters, the oldest one on a tie.
+ * @return the callback, NULL if nothing matches
+ ******************************************************************************/
+ASTMAN_EVENT_CALLBACK astman_subs_match(struct astman_subs *subs,
+                                        const char *event);
+/*******************************************************************************
+ * @fn ASTMAN_EVENT_CALLBACK astman_subs_match_id(struct astman_subs *subs,
+ *                                                int id, const char *event)
+ * @brief astman_subs_match() of a message whose Event is interned as id
+ *        (astman_message_event()), the outcome is kept by ID
+ ******************************************************************************/
+ASTMAN_EVENT_CALLBACK astman_subs_match_id(struct astman_subs *subs, int id,
+                                           const char *event);
+/*******************************************************************************
+ * @fn ASTMAN_EVENT_CALLBACK astman_subs_match_data(struct astman_subs *subs,
+ *                                                  int id, const char *event,
+ *                                                  void **data)
+ * @brief astman_subs_match_id(), with the data of the subscription matched
+ ******************************************************************************/
+ASTMAN_EVENT_CALLBACK astman_subs_match_data(struct astman_subs *subs, int id,
+                                             const char *event, void **data);
+/*******************************************************************************
+ * @fn int astman_subs_set_data(struct astman_subs *subs, const char *pattern,
+ *                              void *data)
+ * @brief Attach data to a subscription (dropped with it, not freed)
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (not subscribed)
+ ******************************************************************************/
+int astman_subs_set_data(struct astman_subs *subs, const char *pattern,
+                         void *data);
+#endif // ASTSUB_H_INCLUDED
@@ -0,0 +1,84 @@
+#ifndef ASTSWEEP_H_INCLUDED
+#define ASTSWEEP_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astsweep.h
+ *  @brief Bulk SIP peer sweep: SIPqualifypeer / SIPshowpeer over a peer
+ *         set, pipelined on one or more sessions with a bounded number of
+ *         requests in flight on each, results streamed as they arrive
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+#include "astasync.h"
+/*******************************************************************************
+ *  @def    ASTMAN_SWEEP_QUALIFY
+ *  @brief  Sweep operation: SIPqualifypeer
+ ******************************************************************************/
+#define ASTMAN_SWEEP_QUALIFY    0x01
+/*******************************************************************************
+ *  @def    ASTMAN_SWEEP_SHOW
+ *  @brief  Sweep operation: SIPshowpeer
+ ******************************************************************************/
+#define ASTMAN_SWEEP_SHOW       0x02
+/*******************************************************************************
+ *  @def    ASTMAN_SWEEP_WINDOW
+ *  @brief  Default requests in flight per session
+ ******************************************************************************/
+#define ASTMAN_SWEEP_WINDOW     32
+/*******************************************************************************
+ * @struct  astman_sweep_result
+ * @brief   One request of the sweep
+ ******************************************************************************/
+struct astman_sweep_result {
+    const char *peer;
+    int index;                  /**!< of the peer in the set */
+    int op;                     /**!< ASTMAN_SWEEP_QUALIFY or ASTMAN_SWEEP_SHOW */
+    int session;                /**!< index of the session that carried it */
+    int status;                 /**!< as astman_action_result */
+    struct message *response;   /**!< NULL if none arrived */
+};
+/*******************************************************************************
+ * @typedef (*ASTMAN_SWEEP_CALLBACK)
+ * @brief   A result, valid during the call only
+ ******************************************************************************/
+typedef void (*ASTMAN_SWEEP_CALLBACK)(struct astman_sweep_result *r,
+                                      void *data);
+/*******************************************************************************
+ * @fn int astman_sip_sweep(struct mansession **sessions, int nsessions,
+ *                          char **peers, int npeers, int ops, int window,
+ *                          int timeout_ms, ASTMAN_SWEEP_CALLBACK callback,
+ *                          void *data)
+ * @brief Run ops on every peer and return when each request is answered,
+ *        timed out or aborted. A session that has room takes the next
+ *        request, so a slow or lost one does not hold the sweep: what it
+ *        had in flight is reported ASTMAN_ACTION_ABORTED, the rest goes to
+ *        the others.
+ * @param sessions: connected and logged in, not used by another thread
+ * @param ops: ASTMAN_SWEEP_QUALIFY | ASTMAN_SWEEP_SHOW
+ * @param window: requests in flight per session, 0 for ASTMAN_SWEEP_WINDOW
+ * @param timeout_ms: per request, <= 0 for no deadline
+ * @return number of requests answered with success, -1 on bad arguments
+ ******************************************************************************/
+int astman_sip_sweep(struct mansession **sessions, int nsessions, char **peers,
+                     int npeers, int ops, int window, int timeout_ms,
+                     ASTMAN_SWEEP_CALLBACK callback, void *data);
+#endif // ASTSWEEP_H_INCLUDED
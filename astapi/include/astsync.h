@@ -0,0 +1,65 @@
+#ifndef ASTSYNC_H_INCLUDED
+#define ASTSYNC_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file astsync.h
+ *  @brief Snapshot plus delta synchronization: the live events arriving
+ *         while a list action (Status, QueueStatus...) dumps its entries
+ *         are held, then replayed once the snapshot is applied
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ * @struct  astman_sync
+ * @brief   Opaque, lives during astman_sync()
+ ******************************************************************************/
+struct astman_sync;
+/*******************************************************************************
+ * @typedef (*ASTMAN_SYNC_CALLBACK)
+ * @brief   An entry of the snapshot, valid during the call only
+ ******************************************************************************/
+typedef void (*ASTMAN_SYNC_CALLBACK)(struct mansession *s, struct message *m,
+                                     void *data);
+/*******************************************************************************
+ * @fn int astman_sync(struct mansession *s, char *action, char *params,
+ *                     int timeout_ms, ASTMAN_SYNC_CALLBACK callback,
+ *                     void *data)
+ * @brief Take a consistent snapshot: hold the live events, send the list
+ *        action, apply each entry (callback, then the shared state when
+ *        published) and finally dispatch the held events as usual, ordered
+ *        by Uniqueid and, for one channel, by arrival. Entries are told
+ *        apart from live events by their ActionID. The journal records the
+ *        live events as they arrive, only the state and the handlers wait.
+ * @param params: headers built with astman_add_param(), without ActionID
+ * @param timeout_ms: <= 0 for no deadline
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE (the held events are replayed
+ *         anyway)
+ ******************************************************************************/
+int astman_sync(struct mansession *s, char *action, char *params,
+                int timeout_ms, ASTMAN_SYNC_CALLBACK callback, void *data);
+/*******************************************************************************
+ * @fn int astman_sync_hold(struct astman_sync *sync, struct message *m)
+ * @brief Library side: keep a copy of a live event for the replay
+ * @return ASTMAN_SUCCESS, ASTMAN_FAILURE to dispatch it now (out of memory)
+ ******************************************************************************/
+int astman_sync_hold(struct astman_sync *sync, struct message *m);
+#endif // ASTSYNC_H_INCLUDED
@@ -0,0 +1,111 @@
+#ifndef ASTURING_H_INCLUDED
+#define ASTURING_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file asturing.h
+ *  @brief Minimal io_uring ring (raw system calls, no liburing): multishot
+ *         receive into a provided buffer ring, sends and connects queued and
+ *         submitted together with the wait. One ring per thread.
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include <sys/socket.h>
+/*******************************************************************************
+ * @struct  astman_uring
+ * @brief   Opaque ring
+ ******************************************************************************/
+struct astman_uring;
+/*******************************************************************************
+ * @struct  astman_uring_cqe
+ * @brief   A completion
+ ******************************************************************************/
+struct astman_uring_cqe {
+    unsigned long long user_data;
+    int res;                /**!< bytes or -errno */
+    const char *buf;        /**!< received data, NULL if none */
+    int bid;                /**!< buffer to give back, -1 if none */
+    int more;               /**!< the multishot request stays armed */
+};
+/*******************************************************************************
+ * @fn struct astman_uring *astman_uring_new(unsigned int entries,
+ *                                           unsigned int nbufs,
+ *                                           unsigned int bufsize)
+ * @param entries: submission queue size
+ * @param nbufs: receive buffers (power of two)
+ * @return the ring, NULL if the kernel (or the build) lacks io_uring,
+ *         provided buffer rings or extended wait arguments
+ ******************************************************************************/
+struct astman_uring *astman_uring_new(unsigned int entries, unsigned int nbufs,
+                                      unsigned int bufsize);
+/*******************************************************************************
+ * @fn void astman_uring_free(struct astman_uring *u)
+ ******************************************************************************/
+void astman_uring_free(struct astman_uring *u);
+/*******************************************************************************
+ * @fn int astman_uring_recv(struct astman_uring *u, int fd,
+ *                           unsigned long long user_data)
+ * @brief Arm a (multishot when supported) receive on fd
+ ******************************************************************************/
+int astman_uring_recv(struct astman_uring *u, int fd,
+                      unsigned long long user_data);
+/*******************************************************************************
+ * @fn int astman_uring_send(struct astman_uring *u, int fd, const void *buf,
+ *                           unsigned int len, unsigned long long user_data)
+ * @warning buf must stay valid until the completion
+ ******************************************************************************/
+int astman_uring_send(struct astman_uring *u, int fd, const void *buf,
+                      unsigned int len, unsigned long long user_data);
+/*******************************************************************************
+ * @fn int astman_uring_connect(struct astman_uring *u, int fd,
+ *                              const struct sockaddr *addr, socklen_t len,
+ *                              unsigned long long user_data)
+ * @warning addr must stay valid until the completion
+ ******************************************************************************/
+int astman_uring_connect(struct astman_uring *u, int fd,
+                         const struct sockaddr *addr, socklen_t len,
+                         unsigned long long user_data);
+/*******************************************************************************
+ * @fn int astman_uring_poll(struct astman_uring *u, int fd, unsigned int events,
+ *                           unsigned long long user_data)
+ * @brief Multishot poll (an eventfd for instance)
+ ******************************************************************************/
+int astman_uring_poll(struct astman_uring *u, int fd, unsigned int events,
+                      unsigned long long user_data);
+/*******************************************************************************
+ * @fn int astman_uring_wait(struct astman_uring *u, int timeout_ms,
+ *                           struct astman_uring_cqe *cqes, int max)
+ * @brief Submit everything queued and wait for completions, in one call
+ * @param timeout_ms: < 0 waits forever, 0 never blocks
+ * @return number of completions in cqes, -1 on error
+ ******************************************************************************/
+int astman_uring_wait(struct astman_uring *u, int timeout_ms,
+                      struct astman_uring_cqe *cqes, int max);
+/*******************************************************************************
+ * @fn void astman_uring_recycle(struct astman_uring *u, int bid)
+ * @brief Give a receive buffer back once its data is parsed
+ ******************************************************************************/
+void astman_uring_recycle(struct astman_uring *u, int bid);
+/*******************************************************************************
+ * @fn int astman_uring_multishot(struct astman_uring *u)
+ * @return 1 while multishot receives are in use
+ ******************************************************************************/
+int astman_uring_multishot(struct astman_uring *u);
+#endif // ASTURING_H_INCLUDED
@@ -0,0 +1,145 @@
+#ifndef UPDATE_H_INCLUDED
+#define UPDATE_H_INCLUDED
+
+/*******************************************************************************
+ * astapi - library for using Asterisk Manager API.
+ * Copyright (C) 2010 Baligh GUESMI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ ******************************************************************************/
+/*******************************************************************************
+ *  @file update.h
+ *  @brief UpdateConfig transactions
+ *  @author Baligh.GUESMI
+ *  @date 20100524
+ ******************************************************************************/
+#include "astman.h"
+/*******************************************************************************
+ *  @def    ASTMAN_UPDATE_PARAMS_IN_ACTION
+ *  @brief  Headers used by one edit (Action, Cat, Var, Value, Match, Line)
+ ******************************************************************************/
+#define ASTMAN_UPDATE_PARAMS_IN_ACTION  6
+/*******************************************************************************
+ *  @def    ASTMAN_UPDATE_ACTIONS_PER_REQUEST
+ *  @brief  Edits sent in one UpdateConfig request. Asterisk accepts at most
+ *          MAX_HEADERS headers per action, 5 are used by Action, ActionID,
+ *          SrcFilename, DstFilename and Reload.
+ ******************************************************************************/
+#define ASTMAN_UPDATE_ACTIONS_PER_REQUEST \
+    (((MAX_HEADERS) - 5) / (ASTMAN_UPDATE_PARAMS_IN_ACTION))
+/*******************************************************************************
+ *  @def    ASTMAN_UPDATE_TIMEOUT
+ *  @brief  Seconds to wait for each UpdateConfig response, the requests
+ *          still unanswered then count as failed
+ ******************************************************************************/
+#define ASTMAN_UPDATE_TIMEOUT   10
+/*******************************************************************************
+ * @struct  astman_update
+ * @brief   Opaque UpdateConfig transaction, one per caller
+ ******************************************************************************/
+struct astman_update;
+/*******************************************************************************
+ * @struct  astman_update_result
+ * @brief   Aggregated result of astman_update_execute()
+ ******************************************************************************/
+struct astman_update_result {
+  int requests;                     /**!< UpdateConfig requests sent */
+  int succeeded;                    /**!< requests answered with Success */
+  int failed;                       /**!< requests answered otherwise or lost */
+  int first_failed_action;          /**!< index of the first edit of the
+                                         first failed request, -1 if none */
+  char message[MAX_VALUE_LEN];      /**!< Message: of the first failure */
+};
+/*******************************************************************************
+ * @fn struct astman_update *astman_update_new(char *src_filename,
+ *                                             char *dst_filename,
+ *                                             int reload)
+ * @brief Start a new UpdateConfig transaction
+ * @return the transaction or NULL, free it with astman_update_free()
+ ******************************************************************************/
+struct astman_update *astman_update_new(char *src_filename,
+                                        char *dst_filename,
+                                        int reload);
+/*******************************************************************************
+ * @fn int astman_update_add_action(struct astman_update *u,
+ *                                  char *action,
+ *                                  char *cat,
+ *                                  char *var, char *val,
+ *                                  char *match,
+ *                                  char *line)
+ * @brief Append one edit (NewCat, RenameCat, DelCat, Update, Delete, Append...)
+ *        There is no limit on the number of edits.
+ * @return ASTMAN_SUCCESS / ASTMAN_FAILURE
+ ******************************************************************************/
+int astman_update_add_action(struct astman_update *u,
+                             char *action,
+                             char *cat,
+                             char *var, char *val,
+                             char *match,
+                             char *line);
+/*******************************************************************************
+ * @fn int astman_update_count(struct astman_update *u)
+ * @return Number of edits in the transaction
+ ******************************************************************************/
+int astman_update_count(struct astman_update *u);
+/*******************************************************************************
+ * @fn int astman_update_execute(struct mansession *s,
+ *                               struct astman_update *u,
+ *                               struct astman_update_result *result)
+ * @brief Send the edits split into ASTMAN_UPDATE_ACTIONS_PER_REQUEST sized
+ *        UpdateConfig requests. All requests but the last are written
+ *        before the first response is read; the first one reads
+ *        SrcFilename, the next ones continue from DstFilename. The last
+ *        one, which asks for Reload, is only sent once all the others
+ *        succeeded. The edits are consumed, the transaction can be reused.
+ * @warning A failed request does not roll back the previous ones, nor stop
+ *          the ones already written behind it.
+ * @return ASTMAN_SUCCESS if every request succeeded, ASTMAN_FAILURE otherwise
+ ******************************************************************************/
+int astman_update_execute(struct mansession *s, struct astman_update *u,
+                          struct astman_update_result *result);
+/*******************************************************************************
+ * @fn void astman_update_free(struct astman_update *u)
+ ******************************************************************************/
+void astman_update_free(struct astman_update *u);
+/*******************************************************************************
+ * @fn int astman_update_config_init(char *src_filename,
+ *                                   char *dst_filename,
+ *                                   int reload)
+ * @brief Legacy process wide transaction, see astman_update_new()
+ ******************************************************************************/
+int astman_update_config_init(char *src_filename,
+                              char *dst_filename,
+                              int reload);
+/*******************************************************************************
+ * @fn int astman_update_config_add_action(char *action,
+ *                                         char *cat,
+ *                                         char *var, char *val,
+ *                                         char *match,
+ *                                         char *line)
+ * @brief Legacy process wide transaction, see astman_update_add_action()
+ ******************************************************************************/
+int astman_update_config_add_action(char *action,
+                                    char *cat,
+                                    char *var, char *val,
+                                    char *match,
+                                    char *line);
+/*******************************************************************************
+ * @fn int astman_update_config_execute(struct mansession *s, struct message *m)
+ * @brief Legacy process wide transaction, see astman_update_execute()
+ *        m receives the last response.
+ ******************************************************************************/
+int astman_update_config_execute(struct mansession *s, struct message *m);
+#endif // UPDATE_H_INCLUDED